@@ -3,6 +3,7 @@
 #include <trap.h>
 #include <monitor.h>
 #include <kdebug.h>
+#include <ide.h>
 
 /* *
  * Simple command-line kernel monitor useful for controlling the
@@ -20,6 +21,7 @@ static struct command commands[] = {
     {"help", "Display this list of commands.", mon_help},
     {"kerninfo", "Display information about the kernel.", mon_kerninfo},
     {"backtrace", "Print backtrace of stack frame.", mon_backtrace},
+    {"iostat", "Display the latency of the disk I/Os.", mon_iostat},
 };
 
 #define NCOMMANDS (sizeof(commands)/sizeof(struct command))
@@ -126,3 +128,13 @@ mon_backtrace(int argc, char **argv, struct trapframe *tf) {
     return 0;
 }
 
+/* *
+ * mon_iostat - call ide_print_stats in kern/driver/ide.c to print
+ * the latency of the reads and writes of each disk.
+ * */
+int
+mon_iostat(int argc, char **argv, struct trapframe *tf) {
+    ide_print_stats();
+    return 0;
+}
+
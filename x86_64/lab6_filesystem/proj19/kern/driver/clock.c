@@ -2,10 +2,17 @@
 #include <trap.h>
 #include <stdio.h>
 #include <picirq.h>
+#include <lapic.h>
+#include <clock.h>
 
 /* *
  * Support for time-related hardware gadgets - the 8253 timer,
  * which generates interruptes on IRQ-0.
+ *
+ * The timer interrupts come from a clock event device: the 8253 at a fixed HZ, or the
+ * timer of the local APIC of each cpu, which interrupts once at the deadline set for it
+ * (see lapic.c). With the latter, the ticks are counted on the TSC, the busy cpus set
+ * their deadline to the next tick, and the idle ones to the first timer due (sched.c).
  * */
 
 #define IO_TIMER1           0x040               // 8253 Timer #1
@@ -20,26 +27,153 @@
 
 #define TIMER_MODE      (IO_TIMER1 + 3)         // timer mode port
 #define TIMER_SEL0      0x00                    // select counter 0
+#define TIMER_SEL2      0x80                    // select counter 2
+#define TIMER_INTTC     0x00                    // mode 0, intr on terminal cnt
 #define TIMER_RATEGEN   0x04                    // mode 2, rate generator
 #define TIMER_16BIT     0x30                    // r/w counter 16 bits, LSB first
 
+#define IO_PPI          0x061                   // gate and output of counter 2
+#define PPI_GATE2       0x01                    // counter 2 gate
+#define PPI_SPKR        0x02                    // counter 2 to speaker
+#define PPI_OUT2        0x20                    // counter 2 output
+
 volatile size_t ticks;
 
+#define CALIBRATE_TICKS     5                   // the 8253 ticks the TSC is counted over
+
+// the TSC cycles per second, calibrated against the 8253 by clock_init
+uint64_t tsc_freq;
+
+static uint64_t tick_cycles;                    // TSC cycles per tick
+static uint64_t tick_base;                      // the TSC at tick 0
+static uint64_t clock_last_ns;                  // the last time read, clock_ns never goes back
+
+static struct clock_event *clock_event;
+
+static void
+pit_init(void) {
+    // set 8253 timer-chip
+    outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
+    outb(IO_TIMER1, TIMER_DIV(HZ) % 256);
+    outb(IO_TIMER1, TIMER_DIV(HZ) / 256);
+    pic_enable(IRQ_TIMER);
+}
+
+// the 8253 interrupts the boot cpu once per tick, the fallback without a local APIC
+static struct clock_event pit_clock_event = {
+    .name = "8253",
+    .oneshot = 0,
+    .init = pit_init,
+    .set_next_event = NULL,
+};
+
 /* *
- * clock_init - initialize 8253 clock to interrupt 100 times per second,
- * and then enable IRQ_TIMER.
+ * clock_init - calibrate the TSC, and start the timer interrupts of the boot cpu: the
+ * timer of the local APIC in oneshot mode where there is one, the 8253 at HZ otherwise.
+ * The TSC is the clocksource of the kernel: clock_ns counts the nanoseconds from here.
  * */
 void
 clock_init(void) {
-    // set 8253 timer-chip
-    outb(TIMER_MODE, TIMER_SEL0 | TIMER_RATEGEN | TIMER_16BIT);
-    outb(IO_TIMER1, TIMER_DIV(100) % 256);
-    outb(IO_TIMER1, TIMER_DIV(100) / 256);
+    int i;
+    uint64_t start = rdtsc();
+    for (i = 0; i < CALIBRATE_TICKS; i ++) {
+        clock_wait_tick();
+    }
+    tick_cycles = (rdtsc() - start) / CALIBRATE_TICKS;
+    tsc_freq = tick_cycles * HZ;
+
+    if ((clock_event = lapic_clock_event()) == NULL) {
+        clock_event = &pit_clock_event;
+    }
 
     // initialize time counter 'ticks' to zero
     ticks = 0;
+    tick_base = rdtsc();
 
-    cprintf("++ setup timer interrupts\n");
-    pic_enable(IRQ_TIMER);
+    cprintf("++ setup timer interrupts: %s, tsc %llu kHz\n", clock_event->name, tsc_freq / 1000);
+    clock_init_ap();
+}
+
+// clock_init_ap - start the timer interrupts of this cpu, at the next tick
+void
+clock_init_ap(void) {
+    clock_event->init();
+    clock_set_next_event(clock_tick_deadline(ticks + 1));
+}
+
+// clock_interrupt - bring ticks up to date on a timer interrupt; with a oneshot device
+//                 - any cpu may have slept through ticks, so they are counted on the TSC
+void
+clock_interrupt(void) {
+    if (!clock_event->oneshot) {
+        ticks ++;
+        return;
+    }
+    size_t now = (rdtsc() - tick_base) / tick_cycles;
+    if ((long)(now - ticks) > 0) {
+        ticks = now;
+    }
+}
+
+bool
+clock_oneshot(void) {
+    return clock_event->oneshot;
+}
+
+// clock_tick_deadline - the TSC at which ticks reaches tick
+uint64_t
+clock_tick_deadline(size_t tick) {
+    return tick_base + tick * tick_cycles;
+}
+
+// clock_set_next_event - have the next timer interrupt of this cpu at the TSC deadline,
+//                      - or none if 0; ignored by a periodic device
+void
+clock_set_next_event(uint64_t deadline) {
+    if (clock_event->oneshot) {
+        clock_event->set_next_event(deadline);
+    }
+}
+
+// clock_ns2cycles - nanoseconds to TSC cycles
+uint64_t
+clock_ns2cycles(uint64_t ns) {
+    return ns / NSEC_PER_SEC * tsc_freq + ns % NSEC_PER_SEC * tsc_freq / NSEC_PER_SEC;
+}
+
+// clock_cycles2ns - TSC cycles to nanoseconds
+uint64_t
+clock_cycles2ns(uint64_t cycles) {
+    return cycles / tsc_freq * NSEC_PER_SEC + cycles % tsc_freq * NSEC_PER_SEC / tsc_freq;
+}
+
+// clock_ns - the monotonic time in nanoseconds since the clock started; the TSCs of the
+//          - cpus may be a little apart, so the time read is never less than the last one
+uint64_t
+clock_ns(void) {
+    if (tsc_freq == 0) {
+        return 0;
+    }
+    uint64_t now = rdtsc();
+    uint64_t ns = (now > tick_base) ? clock_cycles2ns(now - tick_base) : 0;
+    if (ns < clock_last_ns) {
+        return clock_last_ns;
+    }
+    return clock_last_ns = ns;
+}
+
+/* *
+ * clock_wait_tick - busy wait for one tick of the clock on counter 2 of the 8253,
+ * which is gated by port 0x61 and wired to no irq, so it works with interrupts off.
+ * */
+void
+clock_wait_tick(void) {
+    outb(IO_PPI, (inb(IO_PPI) & ~PPI_SPKR) | PPI_GATE2);
+    outb(TIMER_MODE, TIMER_SEL2 | TIMER_INTTC | TIMER_16BIT);
+    outb(IO_TIMER1 + 2, TIMER_DIV(HZ) % 256);
+    outb(IO_TIMER1 + 2, TIMER_DIV(HZ) / 256);
+    while (!(inb(IO_PPI) & PPI_OUT2)) {
+        /* do nothing */ ;
+    }
 }
 
@@ -2,10 +2,35 @@
 #define __KERN_DRIVER_CLOCK_H__
 
 #include <defs.h>
+#include <time.h>
+
+#define HZ                          100                 // ticks per second
+
+/* *
+ * struct clock_event - a device raising the timer interrupts of a cpu, either once per
+ * tick (periodic) or once at a deadline set for each interrupt (oneshot). The deadlines
+ * are in TSC cycles.
+ * */
+struct clock_event {
+    const char *name;
+    bool oneshot;                                   // interrupts at the deadlines set
+    void (*init)(void);                             // set up the device of this cpu
+    void (*set_next_event)(uint64_t deadline);      // interrupt at deadline, never if 0
+};
 
 extern volatile size_t ticks;
+extern uint64_t tsc_freq;
 
 void clock_init(void);
+void clock_init_ap(void);
+void clock_wait_tick(void);
+void clock_interrupt(void);
+bool clock_oneshot(void);
+uint64_t clock_tick_deadline(size_t tick);
+void clock_set_next_event(uint64_t deadline);
+uint64_t clock_ns2cycles(uint64_t ns);
+uint64_t clock_cycles2ns(uint64_t cycles);
+uint64_t clock_ns(void);
 
 #endif /* !__KERN_DRIVER_CLOCK_H__ */
 
@@ -7,6 +7,7 @@
 #include <x86.h>
 #include <sem.h>
 #include <assert.h>
+#include <clock.h>
 
 #define ISA_DATA                0x00
 #define ISA_ERROR               0x01
@@ -74,8 +75,14 @@ static struct ide_device {
     unsigned int sets;          // Commend Sets Supported
     unsigned int size;          // Size in Sectors
     unsigned char model[41];    // Model in String
+    uint64_t nr_io[2];          // # of reads and writes
+    uint64_t io_ns[2];          // the nanoseconds taken by the reads and writes
+    uint64_t max_io_ns[2];      // the longest read and write
 } ide_devices[MAX_IDE];
 
+#define IDE_READ                0
+#define IDE_WRITE               1
+
 static int
 ide_wait_ready(unsigned short iobase, bool check_error) {
     int r;
@@ -169,11 +176,43 @@ ide_device_size(unsigned short ideno) {
     return 0;
 }
 
+// ide_account - count an I/O of the device, from start until now
+static void
+ide_account(unsigned short ideno, int rw, uint64_t start) {
+    struct ide_device *ide = ide_devices + ideno;
+    uint64_t ns = clock_ns() - start;
+    ide->nr_io[rw] ++, ide->io_ns[rw] += ns;
+    if (ide->max_io_ns[rw] < ns) {
+        ide->max_io_ns[rw] = ns;
+    }
+}
+
+// ide_print_stats - the average and the longest latency of the reads and the writes of
+//                 - each device, waiting for the channel included
+void
+ide_print_stats(void) {
+    static const char *names[2] = {"reads", "writes"};
+    unsigned short ideno;
+    int rw;
+    for (ideno = 0; ideno < MAX_IDE; ideno ++) {
+        struct ide_device *ide = ide_devices + ideno;
+        if (!ide->valid) {
+            continue;
+        }
+        for (rw = IDE_READ; rw <= IDE_WRITE; rw ++) {
+            uint64_t nr = ide->nr_io[rw];
+            cprintf("ide %d: %llu %s, %llu us on average, %llu us at most.\n", ideno, nr, names[rw],
+                    (nr != 0) ? ide->io_ns[rw] / nr / 1000 : 0, ide->max_io_ns[rw] / 1000);
+        }
+    }
+}
+
 int
 ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs) {
     assert(nsecs <= MAX_NSECS && VALID_IDE(ideno));
     assert(secno < MAX_DISK_NSECS && secno + nsecs <= MAX_DISK_NSECS);
     unsigned short iobase = IO_BASE(ideno), ioctrl = IO_CTRL(ideno);
+    uint64_t start = clock_ns();
 
     lock_channel(ideno);
 
@@ -197,6 +236,7 @@ ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs) {
     }
 
 out:
+    ide_account(ideno, IDE_READ, start);
     unlock_channel(ideno);
     return ret;
 }
@@ -206,6 +246,7 @@ ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nse
     assert(nsecs <= MAX_NSECS && VALID_IDE(ideno));
     assert(secno < MAX_DISK_NSECS && secno + nsecs <= MAX_DISK_NSECS);
     unsigned short iobase = IO_BASE(ideno), ioctrl = IO_CTRL(ideno);
+    uint64_t start = clock_ns();
 
     lock_channel(ideno);
 
@@ -229,6 +270,7 @@ ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nse
     }
 
 out:
+    ide_account(ideno, IDE_WRITE, start);
     unlock_channel(ideno);
     return ret;
 }
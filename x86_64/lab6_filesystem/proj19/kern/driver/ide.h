@@ -9,6 +9,7 @@ size_t ide_device_size(unsigned short ideno);
 
 int ide_read_secs(unsigned short ideno, uint32_t secno, void *dst, size_t nsecs);
 int ide_write_secs(unsigned short ideno, uint32_t secno, const void *src, size_t nsecs);
+void ide_print_stats(void);
 
 #endif /* !__KERN_DRIVER_IDE_H__ */
 
@@ -0,0 +1,76 @@
+#include <defs.h>
+#include <stdio.h>
+#include <trap.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <mp.h>
+#include <ioapic.h>
+
+/* *
+ * The I/O APIC manages the hardware interrupts of an SMP system, it takes the place
+ * of the 8259A and routes each irq to the local APIC of a cpu.
+ * http://www.intel.com/design/chipsets/datashts/29056601.pdf
+ * */
+
+#define REG_ID                      0x00        // Register index: ID
+#define REG_VER                     0x01        // Register index: version
+#define REG_TABLE                   0x10        // Redirection table base
+
+// The redirection table starts at REG_TABLE and uses two registers to configure each
+// interrupt. The first (low) register in a pair contains configuration bits. The second
+// (high) register contains a bitmask telling which CPUs can serve that interrupt.
+#define INT_DISABLED                0x00010000  // Interrupt disabled
+#define INT_LEVEL                   0x00008000  // Level-triggered (vs edge-)
+#define INT_ACTIVELOW               0x00002000  // Active low (vs high)
+#define INT_LOGICAL                 0x00000800  // Destination is CPU id (vs APIC ID)
+
+// IO APIC MMIO structure: write reg, then read or write data.
+struct ioapic {
+    uint32_t reg;
+    uint32_t pad[3];
+    uint32_t data;
+};
+
+static volatile struct ioapic *ioapic;
+
+static uint32_t
+ioapic_read(int reg) {
+    ioapic->reg = reg;
+    return ioapic->data;
+}
+
+static void
+ioapic_write(int reg, uint32_t data) {
+    ioapic->reg = reg;
+    ioapic->data = data;
+}
+
+// ioapic_init - mark all the interrupts edge-triggered, active high, disabled,
+//             - and not routed to any cpu
+void
+ioapic_init(void) {
+    if (!ismp) {
+        return;
+    }
+
+    ioapic = ioremap(ioapic_pa, PGSIZE);
+    int i, id, maxintr;
+    maxintr = (ioapic_read(REG_VER) >> 16) & 0xFF;
+    id = ioapic_read(REG_ID) >> 24;
+    if (id != ioapicid) {
+        cprintf("ioapic_init: id isn't equal to ioapicid; not a MP\n");
+    }
+
+    for (i = 0; i <= maxintr; i ++) {
+        ioapic_write(REG_TABLE + 2 * i, INT_DISABLED | (IRQ_OFFSET + i));
+        ioapic_write(REG_TABLE + 2 * i + 1, 0);
+    }
+}
+
+// ioapic_enable - route irq to the cpu cpunum, edge-triggered and active high
+void
+ioapic_enable(int irq, int cpunum) {
+    ioapic_write(REG_TABLE + 2 * irq, IRQ_OFFSET + irq);
+    ioapic_write(REG_TABLE + 2 * irq + 1, cpus[cpunum].apicid << 24);
+}
+
@@ -0,0 +1,8 @@
+#ifndef __KERN_DRIVER_IOAPIC_H__
+#define __KERN_DRIVER_IOAPIC_H__
+
+void ioapic_init(void);
+void ioapic_enable(int irq, int cpunum);
+
+#endif /* !__KERN_DRIVER_IOAPIC_H__ */
+
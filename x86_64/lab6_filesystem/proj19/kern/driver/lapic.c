@@ -0,0 +1,241 @@
+#include <defs.h>
+#include <x86.h>
+#include <trap.h>
+#include <sync.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <clock.h>
+#include <lapic.h>
+
+/* *
+ * The local APIC manages the internal (non-I/O) interrupts of its cpu: the timer, the
+ * IPIs from the other cpus, and the irqs routed to it by the I/O APIC.
+ * */
+
+// local APIC registers, divided by 4 for use as uint32_t[] indices.
+#define LAPIC_ID                    (0x0020 / 4)    // ID
+#define LAPIC_VER                   (0x0030 / 4)    // Version
+#define LAPIC_TPR                   (0x0080 / 4)    // Task Priority
+#define LAPIC_EOI                   (0x00B0 / 4)    // EOI
+#define LAPIC_SVR                   (0x00F0 / 4)    // Spurious Interrupt Vector
+#define LAPIC_ENABLE                0x00000100      // Unit Enable
+#define LAPIC_ESR                   (0x0280 / 4)    // Error Status
+#define LAPIC_ICRLO                 (0x0300 / 4)    // Interrupt Command
+#define LAPIC_INIT                  0x00000500      // INIT/RESET
+#define LAPIC_STARTUP               0x00000600      // Startup IPI
+#define LAPIC_DELIVS                0x00001000      // Delivery status
+#define LAPIC_ASSERT                0x00004000      // Assert interrupt (vs deassert)
+#define LAPIC_LEVEL                 0x00008000      // Level triggered
+#define LAPIC_BCAST                 0x00080000      // Send to all APICs, including self.
+#define LAPIC_ICRHI                 (0x0310 / 4)    // Interrupt Command [63:32]
+#define LAPIC_TIMER                 (0x0320 / 4)    // Local Vector Table 0 (TIMER)
+#define LAPIC_X1                    0x0000000B      // divide counts by 1
+#define LAPIC_PERIODIC              0x00020000      // Periodic
+#define LAPIC_TSC_DEADLINE          0x00040000      // TSC-Deadline
+#define LAPIC_PCINT                 (0x0340 / 4)    // Performance Counter LVT
+#define LAPIC_LINT0                 (0x0350 / 4)    // Local Vector Table 1 (LINT0)
+#define LAPIC_LINT1                 (0x0360 / 4)    // Local Vector Table 2 (LINT1)
+#define LAPIC_ERROR                 (0x0370 / 4)    // Local Vector Table 3 (ERROR)
+#define LAPIC_MASKED                0x00010000      // Interrupt masked
+#define LAPIC_TICR                  (0x0380 / 4)    // Timer Initial Count
+#define LAPIC_TCCR                  (0x0390 / 4)    // Timer Current Count
+#define LAPIC_TDCR                  (0x03E0 / 4)    // Timer Divide Configuration
+
+#define CPUID_TSC_DEADLINE          (1 << 24)       // CPUID.01H:ECX, the timer has TSC-deadline mode
+
+#define CMOS_PORT                   0x70
+#define CMOS_RETURN                 0x71
+
+// the local APIC, mapped by mp_init; NULL if there is no MP table
+volatile uint32_t *lapic;
+
+// the count of the timer in one tick of the clock, divided by 1
+static uint32_t lapic_timer_count;
+
+static void
+lapicw(int index, uint32_t value) {
+    lapic[index] = value;
+    lapic[LAPIC_ID];                // wait for write to finish, by reading
+}
+
+// microdelay - spin for about us microseconds, an access to port 0x80 takes about 1us
+static void
+microdelay(int us) {
+    while (us -- > 0) {
+        inb(0x80);
+    }
+}
+
+// lapic_calibrate - count down the timer for one tick of the clock
+static uint32_t
+lapic_calibrate(void) {
+    lapicw(LAPIC_TDCR, LAPIC_X1);
+    lapicw(LAPIC_TIMER, LAPIC_MASKED);
+    lapicw(LAPIC_TICR, 0xFFFFFFFF);
+    clock_wait_tick();
+    uint32_t count = 0xFFFFFFFF - lapic[LAPIC_TCCR];
+    lapicw(LAPIC_TICR, 0);
+    return count;
+}
+
+// lapic_init - enable the local APIC of this cpu, the timer is calibrated against the
+//            - 8253 on the boot cpu, and is started by clock_init
+void
+lapic_init(void) {
+    if (lapic == NULL) {
+        return;
+    }
+
+    // enable local APIC; set spurious interrupt vector.
+    lapicw(LAPIC_SVR, LAPIC_ENABLE | (IRQ_OFFSET + IRQ_SPURIOUS));
+
+    if (mycpu() == cpus) {
+        lapic_timer_count = lapic_calibrate();
+    }
+
+    // disable logical interrupt lines, the irqs come through the I/O APIC
+    lapicw(LAPIC_LINT0, LAPIC_MASKED);
+    lapicw(LAPIC_LINT1, LAPIC_MASKED);
+
+    // disable performance counter overflow interrupts
+    // on machines that provide that interrupt entry.
+    if (((lapic[LAPIC_VER] >> 16) & 0xFF) >= 4) {
+        lapicw(LAPIC_PCINT, LAPIC_MASKED);
+    }
+
+    // map error interrupt to IRQ_ERROR.
+    lapicw(LAPIC_ERROR, IRQ_OFFSET + IRQ_ERROR);
+
+    // clear error status register (requires back-to-back writes).
+    lapicw(LAPIC_ESR, 0);
+    lapicw(LAPIC_ESR, 0);
+
+    // ack any outstanding interrupts.
+    lapicw(LAPIC_EOI, 0);
+
+    // send an Init Level De-Assert to synchronise arbitration ID's.
+    lapicw(LAPIC_ICRHI, 0);
+    lapicw(LAPIC_ICRLO, LAPIC_BCAST | LAPIC_INIT | LAPIC_LEVEL);
+    while (lapic[LAPIC_ICRLO] & LAPIC_DELIVS) {
+        /* do nothing */ ;
+    }
+
+    // enable interrupts on the APIC (but not on the processor).
+    lapicw(LAPIC_TPR, 0);
+}
+
+static void
+lapic_oneshot_init(void) {
+    lapicw(LAPIC_TDCR, LAPIC_X1);
+    lapicw(LAPIC_TIMER, IRQ_OFFSET + IRQ_TIMER);
+}
+
+// lapic_oneshot_set_next_event - count the timer down from the cycles left to deadline,
+//                              - at lapic_timer_count per tick; a deadline too far away
+//                              - gets an early interrupt, which sets the next one again
+static void
+lapic_oneshot_set_next_event(uint64_t deadline) {
+    uint64_t now = rdtsc(), tick_cycles = tsc_freq / HZ, cycles, count;
+    if (deadline == 0) {
+        lapicw(LAPIC_TICR, 0);
+        return;
+    }
+    cycles = (deadline > now) ? deadline - now : 0;
+    count = cycles / tick_cycles * lapic_timer_count + cycles % tick_cycles * lapic_timer_count / tick_cycles;
+    lapicw(LAPIC_TICR, (count == 0) ? 1 : ((count > 0xFFFFFFFF) ? 0xFFFFFFFF : count));
+}
+
+static struct clock_event lapic_oneshot_clock_event = {
+    .name = "lapic oneshot",
+    .oneshot = 1,
+    .init = lapic_oneshot_init,
+    .set_next_event = lapic_oneshot_set_next_event,
+};
+
+static void
+lapic_deadline_init(void) {
+    lapicw(LAPIC_TIMER, LAPIC_TSC_DEADLINE | (IRQ_OFFSET + IRQ_TIMER));
+}
+
+// lapic_deadline_set_next_event - the timer fires when the TSC reaches the deadline, a
+//                               - deadline of 0 disarms it
+static void
+lapic_deadline_set_next_event(uint64_t deadline) {
+    wrmsr(MSR_TSC_DEADLINE, deadline);
+}
+
+static struct clock_event lapic_deadline_clock_event = {
+    .name = "lapic tsc-deadline",
+    .oneshot = 1,
+    .init = lapic_deadline_init,
+    .set_next_event = lapic_deadline_set_next_event,
+};
+
+// lapic_clock_event - the timer of the local APIC as a clock event, in TSC-deadline mode
+//                   - where the cpu has it, NULL if there is no local APIC
+struct clock_event *
+lapic_clock_event(void) {
+    uint32_t ecx;
+    if (lapic == NULL || lapic_timer_count == 0) {
+        return NULL;
+    }
+    cpuid(1, NULL, NULL, &ecx, NULL);
+    if (ecx & CPUID_TSC_DEADLINE) {
+        return &lapic_deadline_clock_event;
+    }
+    return &lapic_oneshot_clock_event;
+}
+
+// lapic_eoi - acknowledge an interrupt delivered by the local APIC
+void
+lapic_eoi(void) {
+    if (lapic != NULL) {
+        lapicw(LAPIC_EOI, 0);
+    }
+}
+
+// lapic_startap - start the AP apicid running at the physical address addr, which
+//               - must be page aligned and below 1MB
+void
+lapic_startap(uint8_t apicid, uintptr_t addr) {
+    // "The BSP must initialize CMOS shutdown code to 0AH and the warm reset vector
+    // (DWORD based at 40:67) to point at the AP startup code prior to the [universal
+    // startup algorithm]."
+    outb(CMOS_PORT, 0xF);           // offset 0xF is shutdown code
+    outb(CMOS_RETURN, 0x0A);
+    uint16_t *wrv = KADDR((0x40 << 4) | 0x67);
+    wrv[0] = 0;
+    wrv[1] = addr >> 4;
+
+    // "Universal startup algorithm."
+    // send INIT (level-triggered) interrupt to reset other CPU.
+    lapicw(LAPIC_ICRHI, apicid << 24);
+    lapicw(LAPIC_ICRLO, LAPIC_INIT | LAPIC_LEVEL | LAPIC_ASSERT);
+    microdelay(200);
+    lapicw(LAPIC_ICRLO, LAPIC_INIT | LAPIC_LEVEL);
+    microdelay(10000);
+
+    // send startup IPI (twice!) to enter code.
+    int i;
+    for (i = 0; i < 2; i ++) {
+        lapicw(LAPIC_ICRHI, apicid << 24);
+        lapicw(LAPIC_ICRLO, LAPIC_STARTUP | (addr >> 12));
+        microdelay(200);
+    }
+}
+
+// lapic_send_ipi - send the interrupt vector to the cpu apicid
+void
+lapic_send_ipi(uint8_t apicid, int vector) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        lapicw(LAPIC_ICRHI, apicid << 24);
+        lapicw(LAPIC_ICRLO, LAPIC_ASSERT | vector);
+        while (lapic[LAPIC_ICRLO] & LAPIC_DELIVS) {
+            /* do nothing */ ;
+        }
+    }
+    local_intr_restore(intr_flag);
+}
+
@@ -0,0 +1,17 @@
+#ifndef __KERN_DRIVER_LAPIC_H__
+#define __KERN_DRIVER_LAPIC_H__
+
+#include <defs.h>
+
+extern volatile uint32_t *lapic;
+
+struct clock_event;
+
+void lapic_init(void);
+void lapic_eoi(void);
+void lapic_startap(uint8_t apicid, uintptr_t addr);
+void lapic_send_ipi(uint8_t apicid, int vector);
+struct clock_event *lapic_clock_event(void);
+
+#endif /* !__KERN_DRIVER_LAPIC_H__ */
+
@@ -0,0 +1,203 @@
+#include <defs.h>
+#include <x86.h>
+#include <string.h>
+#include <stdio.h>
+#include <memlayout.h>
+#include <pmm.h>
+#include <cpu.h>
+#include <lapic.h>
+#include <mp.h>
+
+/* *
+ * Multiprocessor support: the MP configuration table of the BIOS (Intel MultiProcessor
+ * Specification 1.4) lists the processors and the I/O APICs. The MP floating pointer
+ * structure is searched for in the first KB of the EBDA, the last KB of the base memory
+ * and the BIOS ROM (0xF0000 ~ 0xFFFFF).
+ * */
+
+struct mp {                         // floating pointer
+    uint8_t signature[4];           // "_MP_"
+    uint32_t physaddr;              // phys addr of MP config table
+    uint8_t length;                 // 1
+    uint8_t specrev;                // [14]
+    uint8_t checksum;               // all bytes must add up to 0
+    uint8_t type;                   // MP system config type
+    uint8_t imcrp;                  // IMCR present, the PIC is wired to the BSP through it
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct mpconf {                     // configuration table header
+    uint8_t signature[4];           // "PCMP"
+    uint16_t length;                // total table length
+    uint8_t version;                // [14]
+    uint8_t checksum;               // all bytes must add up to 0
+    uint8_t product[20];            // product id
+    uint32_t oemtable;              // OEM table pointer
+    uint16_t oemlength;             // OEM table length
+    uint16_t entry;                 // entry count
+    uint32_t lapicaddr;             // address of local APIC
+    uint16_t xlength;               // extended table length
+    uint8_t xchecksum;              // extended table checksum
+    uint8_t reserved;
+} __attribute__((packed));
+
+struct mpproc {                     // processor table entry
+    uint8_t type;                   // entry type (0)
+    uint8_t apicid;                 // local APIC id
+    uint8_t version;                // local APIC verison
+    uint8_t flags;                  // CPU flags
+    uint8_t signature[4];           // CPU signature
+    uint32_t feature;               // feature flags from CPUID instruction
+    uint8_t reserved[8];
+} __attribute__((packed));
+
+struct mpioapic {                   // I/O APIC table entry
+    uint8_t type;                   // entry type (2)
+    uint8_t apicno;                 // I/O APIC id
+    uint8_t version;                // I/O APIC version
+    uint8_t flags;                  // I/O APIC flags
+    uint32_t addr;                  // I/O APIC address
+} __attribute__((packed));
+
+// table entry types
+#define MPPROC                      0x00    // one per processor
+#define MPBUS                       0x01    // one per bus
+#define MPIOAPIC                    0x02    // one per I/O APIC
+#define MPIOINTR                    0x03    // one per bus interrupt source
+#define MPLINTR                     0x04    // one per system interrupt source
+
+// processor flags
+#define MPENABLED                   0x01    // the processor is usable
+#define MPBOOT                      0x02    // the processor is the BSP
+
+struct cpu cpus[NCPU];
+int ncpu = 1;
+
+bool ismp = 0;
+uint8_t ioapicid;
+uintptr_t ioapic_pa;
+
+static uint8_t
+sum(void *addr, size_t len) {
+    uint8_t *p = addr, s = 0;
+    size_t i;
+    for (i = 0; i < len; i ++) {
+        s += p[i];
+    }
+    return s;
+}
+
+// mp_search1 - look for an MP floating pointer structure in [pa, pa + len)
+static struct mp *
+mp_search1(uintptr_t pa, size_t len) {
+    struct mp *mp = KADDR(pa), *end = KADDR(pa + len);
+    for (; mp < end; mp ++) {
+        if (memcmp(mp->signature, "_MP_", 4) == 0 && sum(mp, sizeof(struct mp)) == 0) {
+            return mp;
+        }
+    }
+    return NULL;
+}
+
+// mp_search - look for the MP floating pointer structure in the EBDA, the last KB of
+//           - the base memory and the BIOS ROM, in that order
+static struct mp *
+mp_search(void) {
+    uint8_t *bda = KADDR(0x400);
+    uintptr_t pa;
+    struct mp *mp;
+    if ((pa = (*(uint16_t *)(bda + 0x0E)) << 4) != 0) {
+        if ((mp = mp_search1(pa, 1024)) != NULL) {
+            return mp;
+        }
+    }
+    else {
+        pa = (*(uint16_t *)(bda + 0x13)) * 1024;
+        if ((mp = mp_search1(pa - 1024, 1024)) != NULL) {
+            return mp;
+        }
+    }
+    return mp_search1(0xF0000, 0x10000);
+}
+
+// mp_config - find and check the MP configuration table, the default configurations
+//           - (physaddr == 0) are not supported
+static struct mpconf *
+mp_config(struct mp **pmp) {
+    struct mp *mp;
+    struct mpconf *conf;
+    if ((mp = mp_search()) == NULL || mp->physaddr == 0) {
+        return NULL;
+    }
+    conf = KADDR(mp->physaddr);
+    if (memcmp(conf->signature, "PCMP", 4) != 0) {
+        return NULL;
+    }
+    if ((conf->version != 1 && conf->version != 4) || sum(conf, conf->length) != 0) {
+        return NULL;
+    }
+    *pmp = mp;
+    return conf;
+}
+
+// mp_init - find the cpus and the I/O APIC, the BSP is kept in cpus[0]
+void
+mp_init(void) {
+    struct mp *mp;
+    struct mpconf *conf;
+    if ((conf = mp_config(&mp)) == NULL) {
+        cprintf("mp: no MP table, 1 cpu.\n");
+        return;
+    }
+
+    ismp = 1;
+    lapic = ioremap(conf->lapicaddr, PGSIZE);
+
+    uint8_t *p = (uint8_t *)(conf + 1), *end = (uint8_t *)conf + conf->length;
+    while (p < end) {
+        struct mpproc *proc;
+        struct mpioapic *ioapic;
+        switch (*p) {
+        case MPPROC:
+            proc = (struct mpproc *)p;
+            if (proc->flags & MPENABLED) {
+                struct cpu *cpu = NULL;
+                if (proc->flags & MPBOOT) {
+                    cpu = cpus;
+                }
+                else if (ncpu < NCPU) {
+                    cpu = cpus + ncpu, cpu->id = ncpu ++;
+                }
+                if (cpu != NULL) {
+                    cpu->apicid = proc->apicid;
+                }
+            }
+            p += sizeof(struct mpproc);
+            continue;
+        case MPIOAPIC:
+            ioapic = (struct mpioapic *)p;
+            ioapicid = ioapic->apicno;
+            ioapic_pa = ioapic->addr;
+            p += sizeof(struct mpioapic);
+            continue;
+        case MPBUS:
+        case MPIOINTR:
+        case MPLINTR:
+            p += 8;
+            continue;
+        default:
+            cprintf("mp: unknown config type %x, 1 cpu.\n", *p);
+            ismp = 0, ncpu = 1;
+            lapic = NULL;
+            return;
+        }
+    }
+
+    if (mp->imcrp) {
+        // the IMCR routes the 8259A to the BSP, select the APICs instead
+        outb(0x22, 0x70);
+        outb(0x23, inb(0x23) | 1);
+    }
+    cprintf("mp: %d cpus, ioapic %d.\n", ncpu, ioapicid);
+}
+
@@ -0,0 +1,13 @@
+#ifndef __KERN_DRIVER_MP_H__
+#define __KERN_DRIVER_MP_H__
+
+#include <defs.h>
+
+extern bool ismp;
+extern uint8_t ioapicid;
+extern uintptr_t ioapic_pa;
+
+void mp_init(void);
+
+#endif /* !__KERN_DRIVER_MP_H__ */
+
@@ -1,6 +1,8 @@
 #include <defs.h>
 #include <x86.h>
 #include <picirq.h>
+#include <mp.h>
+#include <ioapic.h>
 
 // I/O Addresses of the two programmable interrupt controllers
 #define IO_PIC1             0x20    // Master (IRQs 0-7)
@@ -16,15 +18,20 @@ static bool did_init = 0;
 static void
 pic_setmask(uint16_t mask) {
     irq_mask = mask;
-    if (did_init) {
+    if (did_init && !ismp) {
         outb(IO_PIC1 + 1, mask);
         outb(IO_PIC2 + 1, mask >> 8);
     }
 }
 
+// pic_enable - enable irq; with an I/O APIC the 8259A stays masked, and the irq is
+//            - routed to the boot cpu by the I/O APIC instead
 void
 pic_enable(unsigned int irq) {
     pic_setmask(irq_mask & ~(1 << irq));
+    if (did_init && ismp) {
+        ioapic_enable(irq, 0);
+    }
 }
 
 /* pic_init - initialize the 8259A interrupt controllers */
@@ -79,7 +86,15 @@ pic_init(void) {
     outb(IO_PIC2, 0x68);    // OCW3
     outb(IO_PIC2, 0x0a);    // OCW3
 
-    if (irq_mask != 0xFFFF) {
+    if (ismp) {
+        unsigned int irq;
+        for (irq = 0; irq < 16; irq ++) {
+            if (irq != IRQ_SLAVE && !(irq_mask & (1 << irq))) {
+                ioapic_enable(irq, 0);
+            }
+        }
+    }
+    else if (irq_mask != 0xFFFF) {
         pic_setmask(irq_mask);
     }
 }
@@ -245,6 +245,29 @@ file_write(int fd, void *base, size_t len, size_t *copied_store) {
     return ret;
 }
 
+// file_pread - read at pos, the position of the file stays where it is
+int
+file_pread(int fd, void *base, size_t len, off_t pos, size_t *copied_store) {
+    int ret;
+    struct file *file;
+    *copied_store = 0;
+    if ((ret = fd2file(fd, &file)) != 0) {
+        return ret;
+    }
+    if (!file->readable) {
+        return -E_INVAL;
+    }
+    filemap_acquire(file);
+
+    if ((ret = vop_tryseek(file->node, pos)) == 0) {
+        struct iobuf __iob, *iob = iobuf_init(&__iob, base, len, pos);
+        ret = vop_read(file->node, iob);
+        *copied_store = iobuf_used(iob);
+    }
+    filemap_release(file);
+    return ret;
+}
+
 int
 file_seek(int fd, off_t pos, int whence) {
     struct stat __stat, *stat = &__stat;
@@ -1,6 +1,6 @@
 #include <defs.h>
 #include <slab.h>
-#include <sem.h>
+#include <mutex.h>
 #include <vfs.h>
 #include <dev.h>
 #include <file.h>
@@ -24,12 +24,12 @@ fs_cleanup(void) {
 
 void
 lock_fs(struct fs_struct *fs_struct) {
-    down(&(fs_struct->fs_sem));
+    mutex_lock(&(fs_struct->fs_lock));
 }
 
 void
 unlock_fs(struct fs_struct *fs_struct) {
-    up(&(fs_struct->fs_sem));
+    mutex_unlock(&(fs_struct->fs_lock));
 }
 
 struct fs_struct *
@@ -40,7 +40,7 @@ fs_create(void) {
         fs_struct->pwd = NULL;
         fs_struct->filemap = (void *)(fs_struct + 1);
         atomic_set(&(fs_struct->fs_count), 0);
-        sem_init(&(fs_struct->fs_sem), 1);
+        mutex_init(&(fs_struct->fs_lock));
         filemap_init(fs_struct->filemap);
     }
     return fs_struct;
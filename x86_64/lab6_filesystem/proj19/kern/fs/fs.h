@@ -3,7 +3,7 @@
 
 #include <defs.h>
 #include <mmu.h>
-#include <sem.h>
+#include <mutex.h>
 #include <atomic.h>
 
 #define SECTSIZE            512
@@ -22,7 +22,7 @@ struct fs_struct {
     struct inode *pwd;
     struct file *filemap;
     atomic_t fs_count;
-    semaphore_t fs_sem;
+    mutex_t fs_lock;
 };
 
 #define FS_STRUCT_BUFSIZE                       (2 * PGSIZE - sizeof(struct fs_struct))
@@ -5,6 +5,7 @@
 #include <vfs.h>
 #include <inode.h>
 #include <pipe.h>
+#include <pipe_state.h>
 #include <error.h>
 #include <assert.h>
 
@@ -57,6 +58,8 @@ pipe_fs_init(struct fs *fs) {
 
 void
 pipe_init(void) {
+    pipe_state_init();
+
     struct fs *fs;
     if ((fs = alloc_fs(pipe)) == NULL) {
         panic("pipe: create pipe_fs failed.\n");
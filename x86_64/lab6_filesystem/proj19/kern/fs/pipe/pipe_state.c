@@ -25,11 +25,20 @@ struct pipe_state {
 
 #define PIPE_BUFSIZE                            (PGSIZE - sizeof(struct pipe_state))
 
+static kmem_cache_t *pipe_state_cachep;
+
+void
+pipe_state_init(void) {
+    if ((pipe_state_cachep = kmem_cache_create("pipe_state", sizeof(struct pipe_state) + PIPE_BUFSIZE, 0, NULL)) == NULL) {
+        panic("pipe: cannot create pipe_state cache.\n");
+    }
+}
+
 struct pipe_state *
 pipe_state_create(void) {
     static_assert((int)PIPE_BUFSIZE > 128);
     struct pipe_state *state;
-    if ((state = kmalloc(sizeof(struct pipe_state) + PIPE_BUFSIZE)) != NULL) {
+    if ((state = kmem_cache_alloc(pipe_state_cachep)) != NULL) {
         state->p_rpos = state->p_wpos = 0;
         state->buf = (uint8_t *)(state + 1);
         state->isclosed = 0;
@@ -106,7 +115,7 @@ pipe_state_release(struct pipe_state *state) {
     if (-- state->ref_count == 0) {
         assert(wait_queue_empty(&(state->reader_queue)));
         assert(wait_queue_empty(&(state->writer_queue)));
-        kfree(state);
+        kmem_cache_free(pipe_state_cachep, state);
     }
 }
 
@@ -3,6 +3,7 @@
 
 struct pipe_state;
 
+void pipe_state_init(void);
 struct pipe_state *pipe_state_create(void);
 void pipe_state_acquire(struct pipe_state *state);
 void pipe_state_release(struct pipe_state *state);
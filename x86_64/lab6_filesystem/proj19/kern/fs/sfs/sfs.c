@@ -5,6 +5,8 @@
 
 void
 sfs_init(void) {
+    sfs_inode_init();
+
     int ret;
     if ((ret = sfs_mount("disk0")) != 0) {
         panic("failed: sfs: sfs_mount: %e.\n", ret);
@@ -5,6 +5,7 @@
 #include <mmu.h>
 #include <list.h>
 #include <sem.h>
+#include <mutex.h>
 #include <atomic.h>
 #include <unistd.h>
 
@@ -75,7 +76,7 @@ struct sfs_inode {
     uint32_t flags;                                 /* inode flags */
     bool dirty;                                     /* true if inode modified */
     int reclaim_count;                              /* kill inode if it hits zero */
-    semaphore_t sem;                                /* semaphore for din */
+    mutex_t lock;                                   /* mutex for din */
     list_entry_t inode_link;                        /* entry for linked-list in sfs_fs */
     list_entry_t hash_link;                         /* entry for hash linked-list in sfs_fs */
 };
@@ -96,9 +97,9 @@ struct sfs_fs {
     struct bitmap *freemap;                         /* blocks in use are mared 0 */
     bool super_dirty;                               /* true if super/freemap modified */
     void *sfs_buffer;                               /* buffer for non-block aligned io */
-    semaphore_t fs_sem;                             /* semaphore for fs */
-    semaphore_t io_sem;                             /* semaphore for io */
-    semaphore_t mutex_sem;                          /* semaphore for link/unlink and rename */
+    mutex_t fs_lock;                                /* mutex for fs */
+    mutex_t io_lock;                                /* mutex for io */
+    mutex_t link_lock;                              /* mutex for link/unlink and rename */
     list_entry_t inode_list;                        /* inode linked-list */
     list_entry_t *hash_list;                        /* inode hash linked-list */
 };
@@ -135,6 +136,7 @@ int sfs_sync_super(struct sfs_fs *sfs);
 int sfs_sync_freemap(struct sfs_fs *sfs);
 int sfs_clear_block(struct sfs_fs *sfs, uint32_t blkno, uint32_t nblks);
 
+void sfs_inode_init(void);
 int sfs_load_inode(struct sfs_fs *sfs, struct inode **node_store, uint32_t ino);
 
 #endif /* !__KERN_FS_SFS_SFS_H__ */
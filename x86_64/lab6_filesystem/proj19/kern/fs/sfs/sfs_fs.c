@@ -260,9 +260,9 @@ sfs_do_mount(struct device *dev, struct fs **fs_store) {
 
     /* and other fields */
     sfs->super_dirty = 0;
-    sem_init(&(sfs->fs_sem), 1);
-    sem_init(&(sfs->io_sem), 1);
-    sem_init(&(sfs->mutex_sem), 1);
+    mutex_init(&(sfs->fs_lock));
+    mutex_init(&(sfs->io_lock));
+    mutex_init(&(sfs->link_lock));
     list_init(&(sfs->inode_list));
     cprintf("sfs: mount: '%s' (%d/%d/%d)\n", sfs->super.info,
             blocks - unused_blocks, unused_blocks, blocks);
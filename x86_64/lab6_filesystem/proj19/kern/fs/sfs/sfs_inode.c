@@ -16,21 +16,31 @@
 static const struct inode_ops sfs_node_dirops;
 static const struct inode_ops sfs_node_fileops;
 
+static kmem_cache_t *sfs_din_cachep, *sfs_entry_cachep;
+
+void
+sfs_inode_init(void) {
+    if ((sfs_din_cachep = kmem_cache_create("sfs_disk_inode", sizeof(struct sfs_disk_inode), 0, NULL)) == NULL ||
+        (sfs_entry_cachep = kmem_cache_create("sfs_disk_entry", sizeof(struct sfs_disk_entry), 0, NULL)) == NULL) {
+        panic("sfs: cannot create inode caches.\n");
+    }
+}
+
 static inline int
 trylock_sin(struct sfs_inode *sin) {
     if (!SFSInodeRemoved(sin)) {
-        down(&(sin->sem));
+        mutex_lock(&(sin->lock));
         if (!SFSInodeRemoved(sin)) {
             return 0;
         }
-        up(&(sin->sem));
+        mutex_unlock(&(sin->lock));
     }
     return -E_NOENT;
 }
 
 static inline void
 unlock_sin(struct sfs_inode *sin) {
-    up(&(sin->sem));
+    mutex_unlock(&(sin->lock));
 }
 
 static const struct inode_ops *
@@ -95,7 +105,7 @@ sfs_create_inode(struct sfs_fs *sfs, struct sfs_disk_inode *din, uint32_t ino, s
         vop_init(node, sfs_get_ops(din->type), info2fs(sfs, sfs));
         struct sfs_inode *sin = vop_info(node, sfs_inode);
         sin->din = din, sin->ino = ino, sin->dirty = 0, sin->flags = 0, sin->reclaim_count = 1;
-        sem_init(&(sin->sem), 1);
+        mutex_init(&(sin->lock));
         *node_store = node;
         return 0;
     }
@@ -129,7 +139,7 @@ sfs_load_inode(struct sfs_fs *sfs, struct inode **node_store, uint32_t ino) {
 
     int ret = -E_NO_MEM;
     struct sfs_disk_inode *din;
-    if ((din = kmalloc(sizeof(struct sfs_disk_inode))) == NULL) {
+    if ((din = kmem_cache_alloc(sfs_din_cachep)) == NULL) {
         goto failed_unlock;
     }
 
@@ -150,7 +160,7 @@ out_unlock:
     return 0;
 
 failed_cleanup_din:
-    kfree(din);
+    kmem_cache_free(sfs_din_cachep, din);
 failed_unlock:
     unlock_sfs_fs(sfs);
     return ret;
@@ -362,7 +372,7 @@ static int
 sfs_dirent_write_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, int slot, uint32_t ino, const char *name) {
     assert(sin->din->type == SFS_TYPE_DIR && (slot >= 0 && slot <= sin->din->blocks));
     struct sfs_disk_entry *entry;
-    if ((entry = kmalloc(sizeof(struct sfs_disk_entry))) == NULL) {
+    if ((entry = kmem_cache_alloc(sfs_entry_cachep)) == NULL) {
         return -E_NO_MEM;
     }
     memset(entry, 0, sizeof(struct sfs_disk_entry));
@@ -378,7 +388,7 @@ sfs_dirent_write_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, int slot, uin
     assert(sfs_block_inuse(sfs, ino));
     ret = sfs_wbuf(sfs, entry, sizeof(struct sfs_disk_entry), ino, 0);
 out:
-    kfree(entry);
+    kmem_cache_free(sfs_entry_cachep, entry);
     return ret;
 }
 
@@ -431,7 +441,7 @@ static int
 sfs_dirent_search_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, const char *name, uint32_t *ino_store, int *slot, int *empty_slot) {
     assert(strlen(name) <= SFS_MAX_FNAME_LEN);
     struct sfs_disk_entry *entry;
-    if ((entry = kmalloc(sizeof(struct sfs_disk_entry))) == NULL) {
+    if ((entry = kmem_cache_alloc(sfs_entry_cachep)) == NULL) {
         return -E_NO_MEM;
     }
 
@@ -455,7 +465,7 @@ sfs_dirent_search_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, const char *
 #undef set_pvalue
     ret = -E_NOENT;
 out:
-    kfree(entry);
+    kmem_cache_free(sfs_entry_cachep, entry);
     return ret;
 }
 
@@ -476,7 +486,7 @@ sfs_dirent_findino_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, uint32_t in
 static int
 sfs_dirent_create_inode(struct sfs_fs *sfs, uint16_t type, struct inode **node_store) {
     struct sfs_disk_inode *din;
-    if ((din = kmalloc(sizeof(struct sfs_disk_inode))) == NULL) {
+    if ((din = kmem_cache_alloc(sfs_din_cachep)) == NULL) {
         return -E_NO_MEM;
     }
     memset(din, 0, sizeof(struct sfs_disk_inode));
@@ -502,7 +512,7 @@ sfs_dirent_create_inode(struct sfs_fs *sfs, uint16_t type, struct inode **node_s
 failed_cleanup_ino:
     sfs_block_free(sfs, ino);
 failed_cleanup_din:
-    kfree(din);
+    kmem_cache_free(sfs_din_cachep, din);
     return ret;
 }
 
@@ -900,7 +910,7 @@ sfs_rename(struct inode *node, const char *name, struct inode *new_node, const c
 static int
 sfs_namefile(struct inode *node, struct iobuf *iob) {
     struct sfs_disk_entry *entry;
-    if (iob->io_resid <= 2 || (entry = kmalloc(sizeof(struct sfs_disk_entry))) == NULL) {
+    if (iob->io_resid <= 2 || (entry = kmem_cache_alloc(sfs_entry_cachep)) == NULL) {
         return -E_NO_MEM;
     }
 
@@ -945,14 +955,14 @@ sfs_namefile(struct inode *node, struct iobuf *iob) {
     ptr = memmove(iob->io_base + 1, ptr, alen);
     ptr[-1] = '/', ptr[alen] = '\0';
     iobuf_skip(iob, alen);
-    kfree(entry);
+    kmem_cache_free(sfs_entry_cachep, entry);
     return 0;
 
 failed_nomem:
     ret = -E_NO_MEM;
 failed:
     vop_ref_dec(node);
-    kfree(entry);
+    kmem_cache_free(sfs_entry_cachep, entry);
     return ret;
 }
 
@@ -976,7 +986,7 @@ sfs_getdirentry_sub_nolock(struct sfs_fs *sfs, struct sfs_inode *sin, int slot,
 static int
 sfs_getdirentry(struct inode *node, struct iobuf *iob) {
     struct sfs_disk_entry *entry;
-    if ((entry = kmalloc(sizeof(struct sfs_disk_entry))) == NULL) {
+    if ((entry = kmem_cache_alloc(sfs_entry_cachep)) == NULL) {
         return -E_NO_MEM;
     }
 
@@ -985,13 +995,13 @@ sfs_getdirentry(struct inode *node, struct iobuf *iob) {
 
     off_t offset = iob->io_offset;
     if (offset < 0 || offset % sfs_dentry_size != 0) {
-        kfree(entry);
+        kmem_cache_free(sfs_entry_cachep, entry);
         return -E_INVAL;
     }
 
     int ret, slot = offset / sfs_dentry_size;
     if (slot >= sin->din->dirinfo.slots + 2) {
-        kfree(entry);
+        kmem_cache_free(sfs_entry_cachep, entry);
         return -E_NOENT;
     }
     switch (slot) {
@@ -1013,7 +1023,7 @@ sfs_getdirentry(struct inode *node, struct iobuf *iob) {
     }
     ret = iobuf_move(iob, entry->name, sfs_dentry_size, 1, NULL);
 out:
-    kfree(entry);
+    kmem_cache_free(sfs_entry_cachep, entry);
     return ret;
 }
 
@@ -1060,7 +1070,7 @@ sfs_reclaim(struct inode *node) {
             sfs_block_free(sfs, ent);
         }
     }
-    kfree(sin->din);
+    kmem_cache_free(sfs_din_cachep, sin->din);
     vop_kill(node);
     return 0;
 
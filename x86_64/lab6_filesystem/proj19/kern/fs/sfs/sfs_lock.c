@@ -1,34 +1,34 @@
 #include <defs.h>
-#include <sem.h>
+#include <mutex.h>
 #include <sfs.h>
 
 void
 lock_sfs_fs(struct sfs_fs *sfs) {
-    down(&(sfs->fs_sem));
+    mutex_lock(&(sfs->fs_lock));
 }
 
 void
 lock_sfs_io(struct sfs_fs *sfs) {
-    down(&(sfs->io_sem));
+    mutex_lock(&(sfs->io_lock));
 }
 
 void
 lock_sfs_mutex(struct sfs_fs *sfs) {
-    down(&(sfs->mutex_sem));
+    mutex_lock(&(sfs->link_lock));
 }
 
 void
 unlock_sfs_fs(struct sfs_fs *sfs) {
-    up(&(sfs->fs_sem));
+    mutex_unlock(&(sfs->fs_lock));
 }
 
 void
 unlock_sfs_io(struct sfs_fs *sfs) {
-    up(&(sfs->io_sem));
+    mutex_unlock(&(sfs->io_lock));
 }
 
 void
 unlock_sfs_mutex(struct sfs_fs *sfs) {
-    up(&(sfs->mutex_sem));
+    mutex_unlock(&(sfs->link_lock));
 }
 
@@ -53,8 +53,9 @@ sysfile_close(int fd) {
     return file_close(fd);
 }
 
-int
-sysfile_read(int fd, void *base, size_t len) {
+// __sysfile_read - read from the position of the file, or at *posp if posp is not NULL
+static int
+__sysfile_read(int fd, void *base, size_t len, off_t *posp) {
     struct mm_struct *mm = current->mm;
     if (len == 0) {
         return 0;
@@ -73,7 +74,13 @@ sysfile_read(int fd, void *base, size_t len) {
         if ((alen = IOBUF_SIZE) > len) {
             alen = len;
         }
-        ret = file_read(fd, buffer, alen, &alen);
+        if (posp == NULL) {
+            ret = file_read(fd, buffer, alen, &alen);
+        }
+        else {
+            ret = file_pread(fd, buffer, alen, *posp, &alen);
+            *posp += alen;
+        }
         if (alen != 0) {
             lock_mm(mm);
             {
@@ -100,6 +107,16 @@ out:
     return ret;
 }
 
+int
+sysfile_read(int fd, void *base, size_t len) {
+    return __sysfile_read(fd, base, len, NULL);
+}
+
+int
+sysfile_pread(int fd, void *base, size_t len, off_t pos) {
+    return __sysfile_read(fd, base, len, &pos);
+}
+
 int
 sysfile_write(int fd, void *base, size_t len) {
     struct mm_struct *mm = current->mm;
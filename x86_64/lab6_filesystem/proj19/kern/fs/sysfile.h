@@ -10,6 +10,7 @@ int sysfile_open(const char *path, uint32_t open_flags);
 int sysfile_close(int fd);
 int sysfile_read(int fd, void *base, size_t len);
 int sysfile_write(int fd, void *base, size_t len);
+int sysfile_pread(int fd, void *base, size_t len, off_t pos);
 int sysfile_seek(int fd, off_t pos, int whence);
 int sysfile_fstat(int fd, struct stat *stat);
 int sysfile_fsync(int fd);
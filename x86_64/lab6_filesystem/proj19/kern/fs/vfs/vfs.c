@@ -23,6 +23,7 @@ __alloc_fs(int type) {
 
 void
 vfs_init(void) {
+    inode_cache_init();
     sem_init(&bootfs_sem, 1);
     vfs_devlist_init();
 }
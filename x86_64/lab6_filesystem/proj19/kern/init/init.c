@@ -14,6 +14,15 @@
 #include <swap.h>
 #include <proc.h>
 #include <sched.h>
+#include <cpu.h>
+#include <mp.h>
+#include <lapic.h>
+#include <ioapic.h>
+#include <spinlock.h>
+#include <x86.h>
+#include <assert.h>
+
+static void boot_aps(void);
 
 int __noreturn
 kern_init(void) {
@@ -28,7 +37,11 @@ kern_init(void) {
     print_kerninfo();
 
     pmm_init();                 // init physical memory management
+    lock_kernel();              // the boot cpu runs in the kernel
 
+    mp_init();                  // find the cpus and the I/O APIC
+    lapic_init();               // init the local APIC of the boot cpu
+    ioapic_init();              // init the I/O APIC
     pic_init();                 // init interrupt controller
     idt_init();                 // init interrupt descriptor table
 
@@ -39,11 +52,74 @@ kern_init(void) {
 
     ide_init();                 // init ide devices
     swap_init();                // init swap
+    thp_init();                 // init transparent huge page
+    fault_around_init();        // init fault-around
     fs_init();                  // init fs
 
     clock_init();               // init clock interrupt
     intr_enable();              // enable irq interrupt
 
+    boot_aps();                 // start the other cpus
+
     cpu_idle();                 // run idle process
 }
 
+// mp_main - an AP comes here from mpentry.S, on the kernel stack of its idle proc
+static void __noreturn
+mp_main(struct cpu *cpu) {
+    pmm_init_ap(cpu, cpu->idle->kstack + KSTACKSIZE);
+    idt_init_ap();
+    lapic_init();
+    clock_init_ap();
+    cpu->started = 1;
+
+    lock_kernel();
+    cprintf("cpu%d: started.\n", cpu->id);
+    cpu_idle();
+}
+
+// boot_aps - start the APs one by one; the trampoline runs on a copy of boot_pgdir
+//          - which maps the low memory at 0 too, and is freed when the APs are up
+static void
+boot_aps(void) {
+    extern char mpentry_start[], mpentry_end[];
+    extern uintptr_t mpentry_stack[], mpentry_cpu[], mpentry_main[];
+    extern uint32_t mpentry_cr3[];
+
+    cpus[0].started = 1;
+    if (ncpu == 1) {
+        return;
+    }
+
+    uint8_t *code = KADDR(MPENTRY_PADDR);
+    memmove(code, mpentry_start, mpentry_end - mpentry_start);
+#define MPBOOTVAR(var)              ((void *)(code + ((char *)(var) - mpentry_start)))
+
+    struct Page *page;
+    if ((page = alloc_page()) == NULL) {
+        panic("boot_aps: no memory for the trampoline page table.\n");
+    }
+    pgd_t *pgdir = page2kva(page);
+    memcpy(pgdir, boot_pgdir, PGSIZE);
+    pgdir[0] = pgdir[PGX(KERNBASE)];
+    assert(page2pa(page) < 0x100000000ULL);
+    *(uint32_t *)MPBOOTVAR(mpentry_cr3) = page2pa(page);
+    *(uintptr_t *)MPBOOTVAR(mpentry_main) = (uintptr_t)mp_main;
+
+    struct cpu *cpu;
+    for (cpu = cpus + 1; cpu < cpus + ncpu; cpu ++) {
+        if (proc_init_ap(cpu) != 0) {
+            panic("boot_aps: cannot create the idle proc of cpu%d.\n", cpu->id);
+        }
+        *(uintptr_t *)MPBOOTVAR(mpentry_stack) = cpu->idle->kstack + KSTACKSIZE;
+        *(uintptr_t *)MPBOOTVAR(mpentry_cpu) = (uintptr_t)cpu;
+        lapic_startap(cpu->apicid, MPENTRY_PADDR);
+        while (!cpu->started) {
+            cpu_relax();
+        }
+    }
+#undef MPBOOTVAR
+
+    free_page(page);
+}
+
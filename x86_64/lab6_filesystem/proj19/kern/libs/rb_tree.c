@@ -19,15 +19,20 @@ rb_tree_empty(rb_tree *tree) {
 }
 
 /* *
- * rb_tree_create - creates a new red-black tree, the 'compare' function
- * is required and returns 'NULL' if failed.
+ * rb_tree_create_augmented - creates a new red-black tree, the 'compare'
+ * function is required and returns 'NULL' if failed.
  *
  * Note that, root->left should always point to the node that is the root
  * of the tree. And nil points to a 'NULL' node which should always be
  * black and may have arbitrary children and parent node.
+ *
+ * If 'augment' is given, it is called on every node whose subtree has
+ * changed, the children first, so that each node may keep a summary of
+ * its subtree (e.g. the largest gap between the vmas in it).
  * */
 rb_tree *
-rb_tree_create(int (*compare)(rb_node *node1, rb_node *node2)) {
+rb_tree_create_augmented(int (*compare)(rb_node *node1, rb_node *node2),
+                         void (*augment)(rb_tree *tree, rb_node *node)) {
     assert(compare != NULL);
 
     rb_tree *tree;
@@ -38,6 +43,7 @@ rb_tree_create(int (*compare)(rb_node *node1, rb_node *node2)) {
     }
 
     tree->compare = compare;
+    tree->augment = augment;
 
     if ((nil = rb_node_create()) == NULL) {
         goto bad_node_cleanup_tree;
@@ -64,6 +70,27 @@ bad_tree:
     return NULL;
 }
 
+/* rb_tree_create - creates a new red-black tree without augmentation */
+rb_tree *
+rb_tree_create(int (*compare)(rb_node *node1, rb_node *node2)) {
+    return rb_tree_create_augmented(compare, NULL);
+}
+
+/* *
+ * rb_augment_propagate - recomputes the augmented data of @node and all
+ * its ancestors, it must be called when the data of @node itself changes.
+ * */
+void
+rb_augment_propagate(rb_tree *tree, rb_node *node) {
+    if (tree->augment != NULL) {
+        rb_node *nil = tree->nil, *root = tree->root;
+        while (node != nil && node != root) {
+            tree->augment(tree, node);
+            node = node->parent;
+        }
+    }
+}
+
 /* *
  * FUNC_ROTATE - rotates as described in "Introduction to Algorithm".
  *
@@ -94,6 +121,10 @@ func_name(rb_tree *tree, rb_node *x) {                          \
     }                                                           \
     y->_left = x;                                               \
     x->parent = y;                                              \
+    if (tree->augment != NULL) {                                \
+        tree->augment(tree, x);                                 \
+        tree->augment(tree, y);                                 \
+    }                                                           \
     assert(!(nil->red));                                        \
 }
 
@@ -133,6 +164,7 @@ rb_insert_binary(rb_tree *tree, rb_node *node) {
 void
 rb_insert(rb_tree *tree, rb_node *node) {
     rb_insert_binary(tree, node);
+    rb_augment_propagate(tree, node);
     node->red = 1;
 
     rb_node *x = node, *y;
@@ -322,6 +354,9 @@ rb_delete(rb_tree *tree, rb_node *node) {
         z->left->parent = z->right->parent = y;
         *y = *z;
     }
+    // the subtrees from the place y is spliced out up to the root have changed,
+    // y itself is on the path if it has taken the place of z
+    rb_augment_propagate(tree, x->parent);
     if (need_fixup) {
         rb_delete_fixup(tree, x);
     }
@@ -413,12 +448,41 @@ check_safe_kmalloc(size_t size) {
 
 struct check_data {
     long data;
+    long max;                   // the max data in the subtree, kept by check_augment
     rb_node rb_link;
 };
 
 #define rbn2data(node)              \
     (to_struct(node, struct check_data, rb_link))
 
+static void
+check_augment(rb_tree *tree, rb_node *node) {
+    long max = rbn2data(node)->data;
+    if (node->left != tree->nil && rbn2data(node->left)->max > max) {
+        max = rbn2data(node->left)->max;
+    }
+    if (node->right != tree->nil && rbn2data(node->right)->max > max) {
+        max = rbn2data(node->right)->max;
+    }
+    rbn2data(node)->max = max;
+}
+
+static long
+check_augment_tree(rb_tree *tree, rb_node *node) {
+    if (node == tree->nil) {
+        return -1;
+    }
+    long max = rbn2data(node)->data, left, right;
+    if ((left = check_augment_tree(tree, node->left)) > max) {
+        max = left;
+    }
+    if ((right = check_augment_tree(tree, node->right)) > max) {
+        max = right;
+    }
+    assert(rbn2data(node)->max == max);
+    return max;
+}
+
 static inline int
 check_compare1(rb_node *node1, rb_node *node2) {
     return rbn2data(node1)->data - rbn2data(node2)->data;
@@ -431,7 +495,7 @@ check_compare2(rb_node *node, void *key) {
 
 void
 check_rb_tree(void) {
-    rb_tree *tree = rb_tree_create(check_compare1);
+    rb_tree *tree = rb_tree_create_augmented(check_compare1, check_augment);
     assert(tree != NULL);
 
     rb_node *nil = tree->nil, *root = tree->root;
@@ -474,6 +538,7 @@ check_rb_tree(void) {
     for (i = 0; i < total; i ++) {
         rb_insert(tree, &(all[i]->rb_link));
         check_tree(tree, root->left);
+        check_augment_tree(tree, root->left);
     }
 
     rb_node *node;
@@ -487,6 +552,7 @@ check_rb_tree(void) {
         assert(node != NULL && rbn2data(node)->data == i);
         rb_delete(tree, node);
         check_tree(tree, root->left);
+        check_augment_tree(tree, root->left);
     }
 
     assert(!nil->red && root->left == nil);
@@ -500,6 +566,7 @@ check_rb_tree(void) {
         all[i]->data = max;
         rb_insert(tree, &(all[i]->rb_link));
         check_tree(tree, root->left);
+        check_augment_tree(tree, root->left);
     }
 
     for (i = 0; i < max; i ++) {
@@ -507,6 +574,7 @@ check_rb_tree(void) {
         assert(node != NULL && rbn2data(node)->data == max);
         rb_delete(tree, node);
         check_tree(tree, root->left);
+        check_augment_tree(tree, root->left);
     }
 
     assert(rb_tree_empty(tree));
@@ -514,6 +582,7 @@ check_rb_tree(void) {
     for (i = 0; i < total; i ++) {
         rb_insert(tree, &(all[i]->rb_link));
         check_tree(tree, root->left);
+        check_augment_tree(tree, root->left);
     }
 
     rb_tree_destroy(tree);
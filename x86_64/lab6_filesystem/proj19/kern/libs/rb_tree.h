@@ -12,10 +12,16 @@ typedef struct rb_node {
 typedef struct rb_tree {
     // compare function should return -1 if *node1 < *node2, 1 if *node1 > *node2, and 0 otherwise
     int (*compare)(rb_node *node1, rb_node *node2);
+    // augment function (optional) recomputes the data kept in a node for its subtree,
+    // from the node itself and its children
+    void (*augment)(struct rb_tree *tree, rb_node *node);
     struct rb_node *nil, *root;
 } rb_tree;
 
 rb_tree *rb_tree_create(int (*compare)(rb_node *node1, rb_node *node2));
+rb_tree *rb_tree_create_augmented(int (*compare)(rb_node *node1, rb_node *node2),
+                                  void (*augment)(rb_tree *tree, rb_node *node));
+void rb_augment_propagate(rb_tree *tree, rb_node *node);
 void rb_tree_destroy(rb_tree *tree);
 void rb_insert(rb_tree *tree, rb_node *node);
 void rb_delete(rb_tree *tree, rb_node *node);
@@ -1,7 +1,10 @@
 #include <pmm.h>
 #include <list.h>
+#include <x86.h>
+#include <stdio.h>
 #include <string.h>
 #include <buddy_pmm.h>
+#include <slab.h>
 
 /* The buddy memory allocation technique is a memory allocation algorithm that divides memory into partitions 
    to try to satisfy a memory request as suitably as possible. This system makes use of splitting memory into halves
@@ -23,54 +26,150 @@
    companion buddies if they resulted from the split of the same direct parent block. 
 */
 
-// {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024}
-// from 2^0 ~ 2^10
+/* The allocator keeps a bitmap of the orders whose free list is not empty, so an allocation finds the smallest 
+   large-enough free block with one find-first-set instead of walking the orders. Each zone also keeps one bitmap per 
+   order (as Linux 2.4 does): bit (idx >> (order + 1)) is the XOR of the free states of the two buddies of that order, 
+   it's toggled whenever one of them enters or leaves a free list. When a block is freed, a set bit means its buddy is 
+   free, so coalescing never needs to look at the Page descriptors of the buddy.
+   
+   The index of a page is counted from the 2^MAX_ORDER aligned page before the zone, so every block of 2^order pages 
+   is also naturally aligned in physical memory.
+*/
+
+// {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, ...}
+// from 2^0 ~ 2^MAX_ORDER, MAX_ORDER could be changed at compile time (-DMAX_ORDER=X)
+#ifndef MAX_ORDER
 #define MAX_ORDER 10
+#endif
+
 static free_area_t free_area[MAX_ORDER + 1];
 
 //x from 0 ~ MAX_ORDER
 #define free_list(x) (free_area[x].free_list)
 #define nr_free(x) (free_area[x].nr_free)
 
+// bit x is set if free_list(x) is not empty
+static uint64_t free_orders;
+
 #define MAX_ZONE_NUM 10
 struct Zone {
-    struct Page *mem_base;
+    struct Page *mem_base;              // the page of idx 0, aligned to 2^MAX_ORDER pages
+    size_t nr_free;                     // # of free pages in this zone
+    uint64_t *free_map[MAX_ORDER];      // the buddy bitmaps of order 0 ~ MAX_ORDER-1
 } zones[MAX_ZONE_NUM] = {{NULL}};
 
+static int nr_zones = 0;
+
 //buddy_init - init the free_list(0 ~ MAX_ORDER) & reset nr_free(0 ~ MAX_ORDER)
 static void
 buddy_init(void) {
+    static_assert(MAX_ORDER >= KMALLOC_MAX_ORDER && MAX_ORDER < 64);
     int i;
     for (i = 0; i <= MAX_ORDER; i ++) {
         list_init(&free_list(i));
         nr_free(i) = 0;
     }
+    free_orders = 0;
+}
+
+//page2idx - get the related index number idx of continuous page block which this page belongs to 
+static inline ppn_t
+page2idx(struct Page *page) {
+    return page - zones[page->zone_num].mem_base;
+}
+
+//idx2page - get the related page according to the index number idx of continuous page block 
+static inline struct Page *
+idx2page(int zone_num, ppn_t idx) {
+    return zones[zone_num].mem_base + idx;
+}
+
+//free_map_change - toggle the bit of buddy bitmap for the block (page, order)
+static inline void
+free_map_change(struct Page *page, size_t order) {
+    if (order < MAX_ORDER) {
+        change_bit(page2idx(page) >> (order + 1), zones[page->zone_num].free_map[order]);
+    }
 }
 
-//buddy_init_memmap - build free_list for Page base follow  n continuous pages.
+//free_map_buddy - is the buddy of block (page, order) free?
+static inline bool
+free_map_buddy(struct Page *page, size_t order) {
+    return test_bit(page2idx(page) >> (order + 1), zones[page->zone_num].free_map[order]);
+}
+
+//free_area_add - add a free block of 2^order pages to free_list(order)
+static inline void
+free_area_add(struct Page *page, size_t order) {
+    page->property = order;
+    SetPageProperty(page);
+    list_add(&free_list(order), &(page->page_link));
+    nr_free(order) ++;
+    free_orders |= ((uint64_t)1 << order);
+    zones[page->zone_num].nr_free += (1 << order);
+    free_map_change(page, order);
+}
+
+//free_area_del - delete a free block of 2^order pages from free_list(order)
+static inline void
+free_area_del(struct Page *page, size_t order) {
+    list_del(&(page->page_link));
+    ClearPageProperty(page);
+    if (-- nr_free(order) == 0) {
+        free_orders &= ~((uint64_t)1 << order);
+    }
+    zones[page->zone_num].nr_free -= (1 << order);
+    free_map_change(page, order);
+}
+
+//buddy_init_memmap - build free_list for Page base follow  n continuous pages,
+//                  - the buddy bitmaps of the zone are placed in its first pages.
 static void
 buddy_init_memmap(struct Page *base, size_t n) {
-    static int zone_num = 0;
-    assert(n > 0 && zone_num < MAX_ZONE_NUM);
+    assert(n > 0 && nr_zones < MAX_ZONE_NUM);
+    ppn_t begin = ROUNDDOWN(page2ppn(base), 1 << MAX_ORDER);
+    ppn_t end = ROUNDUP(page2ppn(base) + n, 1 << MAX_ORDER);
+
+    size_t order, map_size[MAX_ORDER], map_pages = 0;
+    for (order = 0; order < MAX_ORDER; order ++) {
+        map_size[order] = ROUNDUP((end - begin) >> (order + 1), 64) / 8;
+        map_pages += map_size[order];
+    }
+    map_pages = ROUNDUP(map_pages, PGSIZE) / PGSIZE;
+    if (n <= map_pages) {
+        return ;
+    }
+
+    int zone_num = nr_zones ++;
+    struct Zone *zone = zones + zone_num;
+    zone->mem_base = pages + begin, zone->nr_free = 0;
+
+    uint8_t *map = page2kva(base);
+    memset(map, 0, map_pages * PGSIZE);
+    for (order = 0; order < MAX_ORDER; order ++) {
+        zone->free_map[order] = (uint64_t *)map;
+        map += map_size[order];
+    }
+
     struct Page *p = base;
     for (; p != base + n; p ++) {
         assert(PageReserved(p));
-        p->flags = p->property = 0;
         p->zone_num = zone_num;
+        if (p < base + map_pages) {
+            continue;
+        }
+        p->flags = p->property = 0;
         set_page_ref(p, 0);
     }
-    p = zones[zone_num ++].mem_base = base;
-    size_t order = MAX_ORDER, order_size = (1 << order);
-    while (n != 0) {
-        while (n >= order_size) {
-            p->property = order;
-            SetPageProperty(p);
-            list_add(&free_list(order), &(p->page_link));
-            n -= order_size, p += order_size;
-            nr_free(order) ++;
+
+    ppn_t idx = page2idx(base + map_pages), last = page2idx(base + n);
+    while (idx < last) {
+        order = MAX_ORDER;
+        while ((idx & ((1 << order) - 1)) != 0 || idx + (1 << order) > last) {
+            order --;
         }
-        order --;
-        order_size >>= 1;
+        free_area_add(idx2page(zone_num, idx), order);
+        idx += (1 << order);
     }
 }
 
@@ -91,28 +190,20 @@ getorder(size_t n) {
 static inline struct Page *
 buddy_alloc_pages_sub(size_t order) {
     assert(order <= MAX_ORDER);
-    size_t cur_order;
-    for (cur_order = order; cur_order <= MAX_ORDER; cur_order ++) {
-        if (!list_empty(&free_list(cur_order))) {
-            list_entry_t *le = list_next(&free_list(cur_order));
-            struct Page *page = le2page(le, page_link);
-            nr_free(cur_order) --;
-            list_del(le);
-            size_t size = 1 << cur_order;
-            while (cur_order > order) {
-                cur_order --;
-                size >>= 1;
-                struct Page *buddy = page + size;
-                buddy->property = cur_order;
-                SetPageProperty(buddy);
-                nr_free(cur_order) ++;
-                list_add(&free_list(cur_order), &(buddy->page_link));
-            }
-            ClearPageProperty(page);
-            return page;
-        }
+    uint64_t orders = free_orders & ~(((uint64_t)1 << order) - 1);
+    if (orders == 0) {
+        return NULL;
+    }
+    size_t cur_order = bsfq(orders);
+    struct Page *page = le2page(list_next(&free_list(cur_order)), page_link);
+    free_area_del(page, cur_order);
+    size_t size = 1 << cur_order;
+    while (cur_order > order) {
+        cur_order --;
+        size >>= 1;
+        free_area_add(page + size, cur_order);
     }
-    return NULL;
+    return page;
 }
 
 //buddy_alloc_pages - call buddy_alloc_pages_sub to alloc 2^order>=n pages
@@ -127,35 +218,11 @@ buddy_alloc_pages(size_t n) {
     return page;
 }
 
-//page_is_buddy - Does this page belong to the No. zone_num Zone & this page
-//              -  be in the continuous page block whose size is 2^order pages?
-static inline bool
-page_is_buddy(struct Page *page, size_t order, int zone_num) {
-    if (page2ppn(page) < npage) {
-        if (page->zone_num == zone_num) {
-            return !PageReserved(page) && PageProperty(page) && page->property == order;
-        }
-    }
-    return 0;
-}
-
-//page2idx - get the related index number idx of continuous page block which this page belongs to 
-static inline ppn_t
-page2idx(struct Page *page) {
-    return page - zones[page->zone_num].mem_base;
-}
-
-//idx2page - get the related page according to the index number idx of continuous page block 
-static inline struct Page *
-idx2page(int zone_num, ppn_t idx) {
-    return zones[zone_num].mem_base + idx;
-}
-
-//buddy_free_pages_sub - the actual free implimentation, should consider how to 
-//                     - merge the adjacent buddy block
+//buddy_free_pages_sub - the actual free implimentation, the buddy bitmaps tell
+//                     - whether the adjacent buddy block could be merged
 static void
 buddy_free_pages_sub(struct Page *base, size_t order) {
-    ppn_t buddy_idx, page_idx = page2idx(base);
+    ppn_t page_idx = page2idx(base);
     assert((page_idx & ((1 << order) - 1)) == 0);
     struct Page *p = base;
     for (; p != base + (1 << order); p ++) {
@@ -164,23 +231,16 @@ buddy_free_pages_sub(struct Page *base, size_t order) {
         set_page_ref(p, 0);
     }
     int zone_num = base->zone_num;
-    while (order < MAX_ORDER) {
-        buddy_idx = page_idx ^ (1 << order);
-        struct Page *buddy = idx2page(zone_num, buddy_idx);
-        if (!page_is_buddy(buddy, order, zone_num)) {
-            break;
-        }
-        nr_free(order) --;
-        list_del(&(buddy->page_link));
-        ClearPageProperty(buddy);
-        page_idx &= buddy_idx;
+    struct Page *page = base;
+    while (order < MAX_ORDER && free_map_buddy(page, order)) {
+        struct Page *buddy = idx2page(zone_num, page_idx ^ (1 << order));
+        assert(PageProperty(buddy) && buddy->property == order);
+        free_area_del(buddy, order);
+        page_idx &= ~(1 << order);
+        page = idx2page(zone_num, page_idx);
         order ++;
     }
-    struct Page *page = idx2page(zone_num, page_idx);
-    page->property = order;
-    SetPageProperty(page);
-    nr_free(order) ++;
-    list_add(&free_list(order), &(page->page_link));
+    free_area_add(page, order);
 }
 
 //buddy_free_pages - call buddy_free_pages_sub to free n continuous page block
@@ -214,16 +274,48 @@ buddy_free_pages(struct Page *base, size_t n) {
     }
 }
 
-//buddy_nr_free_pages - get the nr: the number of free pages
+//buddy_nr_free_pages - get the nr: the number of free pages of all zones
 static size_t
 buddy_nr_free_pages(void) {
-    size_t ret = 0, order = 0;
-    for (; order <= MAX_ORDER; order ++) {
-        ret += nr_free(order) * (1 << order);
+    size_t ret = 0;
+    int i;
+    for (i = 0; i < nr_zones; i ++) {
+        ret += zones[i].nr_free;
     }
     return ret;
 }
 
+#define BENCH_BLOCKS                    64
+#define BENCH_ROUNDS                    16
+
+//buddy_bench - measure the throughput of alloc/free of each order, allocate as many
+//            - as BENCH_BLOCKS blocks and free them again in every round.
+static void
+buddy_bench(void) {
+    static struct Page *blocks[BENCH_BLOCKS];
+    cprintf("buddy_bench: cycles per alloc/free, %d rounds of %d blocks\n", BENCH_ROUNDS, BENCH_BLOCKS);
+    size_t order;
+    for (order = 0; order <= MAX_ORDER; order ++) {
+        uint64_t cycles = 0, ops = 0;
+        int round, i, n;
+        for (round = 0; round < BENCH_ROUNDS; round ++) {
+            uint64_t start = rdtsc();
+            for (n = 0; n < BENCH_BLOCKS; n ++) {
+                if ((blocks[n] = buddy_alloc_pages_sub(order)) == NULL) {
+                    break;
+                }
+            }
+            for (i = 0; i < n; i ++) {
+                buddy_free_pages_sub(blocks[i], order);
+            }
+            cycles += rdtsc() - start, ops += n * 2;
+        }
+        if (ops != 0) {
+            cprintf("  order %2d: %6d ops, %6d cycles/op\n", order, (int)ops, (int)(cycles / ops));
+        }
+    }
+}
+
 //buddy_check - check the correctness of buddy system
 static void
 buddy_check(void) {
@@ -236,6 +328,7 @@ buddy_check(void) {
             assert(PageProperty(p) && p->property == i);
             count ++, total += (1 << i);
         }
+        assert(list_empty(list) == !(free_orders & ((uint64_t)1 << i)));
     }
     assert(total == nr_free_pages());
 
@@ -247,6 +340,8 @@ buddy_check(void) {
 
     list_entry_t free_lists_store[MAX_ORDER + 1];
     unsigned int nr_free_store[MAX_ORDER + 1];
+    size_t zone_nr_free_store[MAX_ZONE_NUM];
+    uint64_t free_orders_store = free_orders;
 
     for (i = 0; i <= MAX_ORDER; i ++) {
         free_lists_store[i] = free_list(i);
@@ -255,6 +350,11 @@ buddy_check(void) {
         nr_free_store[i] = nr_free(i);
         nr_free(i) = 0;
     }
+    for (i = 0; i < nr_zones; i ++) {
+        zone_nr_free_store[i] = zones[i].nr_free;
+        zones[i].nr_free = 0;
+    }
+    free_orders = 0;
 
     assert(nr_free_pages() == 0);
     assert(alloc_page() == NULL);
@@ -292,6 +392,10 @@ buddy_check(void) {
         free_list(i) = free_lists_store[i];
         nr_free(i) = nr_free_store[i];
     }
+    for (i = 0; i < nr_zones; i ++) {
+        zones[i].nr_free = zone_nr_free_store[i];
+    }
+    free_orders = free_orders_store;
 
     free_pages(p0, 8);
     free_pages(buddy, 8);
@@ -308,6 +412,8 @@ buddy_check(void) {
     }
     assert(count == 0);
     assert(total == 0);
+
+    buddy_bench();
 }
 
 //the buddy system pmm
@@ -3,19 +3,24 @@
 
 /* This file contains the definitions for memory management in our OS. */
 
-/* global segment number */
+/* *
+ * global segment number; SYSCALL loads %cs and %ss with GD_KTEXT and GD_KTEXT + 8,
+ * SYSRET with GD_UDATA + 8 and GD_UDATA, so the kernel data follows the kernel text
+ * and the user text the user data. The TSS takes two descriptors.
+ * */
 #define SEG_KTEXT   1
 #define SEG_KDATA   2
-#define SEG_UTEXT   3
-#define SEG_UDATA   4
+#define SEG_UDATA   3
+#define SEG_UTEXT   4
 #define SEG_TSS     5
+#define NSEGS       7                       // # of descriptors in a gdt
 
 /* global descrptor numbers */
-#define GD_KTEXT    ((SEG_KTEXT) << 4)      // kernel text
-#define GD_KDATA    ((SEG_KDATA) << 4)      // kernel data
-#define GD_UTEXT    ((SEG_UTEXT) << 4)      // user text
-#define GD_UDATA    ((SEG_UDATA) << 4)      // user data
-#define GD_TSS      ((SEG_TSS) << 4)        // task segment selector
+#define GD_KTEXT    ((SEG_KTEXT) << 3)      // kernel text
+#define GD_KDATA    ((SEG_KDATA) << 3)      // kernel data
+#define GD_UDATA    ((SEG_UDATA) << 3)      // user data
+#define GD_UTEXT    ((SEG_UTEXT) << 3)      // user text
+#define GD_TSS      ((SEG_TSS) << 3)        // task segment selector
 
 #define DPL_KERNEL  (0)
 #define DPL_USER    (3)
@@ -43,7 +48,11 @@
  *                            |                                 |
  *     KERNBASE ------------> +---------------------------------+ 0xFFFF800000000000
  *                            |        Invalid Memory (*)       | --/--
- *     USERTOP -------------> +---------------------------------+ 0x0000100000000000
+ *     UKMAPTOP ------------> +---------------------------------+ 0x0000100000005000
+ *                            |       Uring Pages (Kern, RW)    | RW/RW URINGSIZE
+ *     URING ---------------> +---------------------------------+ 0x0000100000001000
+ *                            |        VVAR Page (Kern, RW)     | RW/R- PGSIZE
+ *     USERTOP, UVVAR ------> +---------------------------------+ 0x0000100000000000
  *                            |           User stack            |
  *                            +---------------------------------+
  *                            |                                 |
@@ -80,11 +89,19 @@
 #define KSTACKPAGE          4                           // # of pages in kernel stack
 #define KSTACKSIZE          (KSTACKPAGE * PGSIZE)       // sizeof kernel stack
 
+#define MPENTRY_PADDR       0x7000                      // where the APs start, in real mode
+
 #define USERTOP             0x0000100000000000
 #define USTACKTOP           USERTOP
 #define USTACKPAGE          4096                        // # of pages in user stack
 #define USTACKSIZE          (USTACKPAGE * PGSIZE)       // sizeof user stack
 
+/* the pages the kernel maps above USERTOP for the user, outside of the vmas */
+#define UVVAR               USERTOP                     // the vvar page, read only to the user
+#define URING               (UVVAR + PGSIZE)            // the pages of the uring
+#define URINGSIZE           (4 * PGSIZE)
+#define UKMAPTOP            (URING + URINGSIZE)
+
 #define USERBASE            0x0000000001000000
 #define UTEXT               0x0000000010000000          // where user programs generally begin
 #define USTAB               USERBASE                    // the location of the user STABS data structure
@@ -92,6 +109,9 @@
 #define USER_ACCESS(start, end)                     \
     (USERBASE <= (start) && (start) < (end) && (end) <= USERTOP)
 
+#define UKMAP_ACCESS(start, end)                    \
+    (USERTOP <= (start) && (start) < (end) && (end) <= UKMAPTOP)
+
 #define KERN_ACCESS(start, end)                     \
     (KERNBASE <= (start) && (start) < (end) && (end) <= KERNTOP)
 
@@ -133,7 +153,8 @@ struct Page {
     int zone_num;                   // used in buddy system, the No. of zone which the page belongs to
     list_entry_t page_link;         // free list link
     swap_entry_t index;             // stores a swapped-out page identifier
-    list_entry_t swap_link;         // swap hash link
+    list_entry_t swap_link;         // swap lru link
+    unsigned int lru_gen;           // the generation of swap lru which the page belongs to
 };
 
 /* Flags describing the status of a page frame */
@@ -141,8 +162,7 @@ struct Page {
 #define PG_property                 1       // the member 'property' is valid
 #define PG_slab                     2       // page frame is included in a slab
 #define PG_dirty                    3       // the page has been modified
-#define PG_swap                     4       // the page is in the active or inactive page list (and swap hash table)
-#define PG_active                   5       // the page is in the active page list
+#define PG_swap                     4       // the page is in one generation of swap lru (and swap hash table)
 
 #define SetPageReserved(page)       set_bit(PG_reserved, &((page)->flags))
 #define ClearPageReserved(page)     clear_bit(PG_reserved, &((page)->flags))
@@ -159,9 +179,6 @@ struct Page {
 #define SetPageSwap(page)           set_bit(PG_swap, &((page)->flags))
 #define ClearPageSwap(page)         clear_bit(PG_swap, &((page)->flags))
 #define PageSwap(page)              test_bit(PG_swap, &((page)->flags))
-#define SetPageActive(page)         set_bit(PG_active, &((page)->flags))
-#define ClearPageActive(page)       clear_bit(PG_active, &((page)->flags))
-#define PageActive(page)            test_bit(PG_active, &((page)->flags))
 
 // convert list entry to page
 #define le2page(le, member)                 \
@@ -49,17 +49,15 @@
 #ifdef __ASSEMBLER__
 
 #define SEG_NULL()                              \
-    .quad 0x0, 0x0
+    .quad 0x0
 
 #define SEG_CODE(type)                          \
     .word 0x0, 0x0;                             \
-    .byte 0x0, (0x90 | (type)), 0x20, 0x0;      \
-    .word 0x0, 0x0, 0x0, 0x0
+    .byte 0x0, (0x90 | (type)), 0x20, 0x0
 
 #define SEG_DATA(type)                          \
     .word 0x0, 0x0;                             \
-    .byte 0x0, (0x90 | (type)), 0x0, 0x0;       \
-    .word 0x0, 0x0, 0x0, 0x0
+    .byte 0x0, (0x90 | (type)), 0x0, 0x0
 
 #else /* not __ASSEMBLER__ */
 
@@ -134,26 +132,31 @@ struct segdesc {
     unsigned int sd_db : 1;         // 0 = 16-bit segment, 1 = 32-bit segment
     unsigned int sd_g : 1;          // granularity: limit scaled by 4K when set
     unsigned int sd_base_31_24 : 8; // [24 ~ 31] bits of segment base address
-    unsigned int sd_base_63_32 : 32;// [32 ~ 63] bits of segment base address
-    unsigned int sd_rsv : 32;       // reserved
 };
 
 #define SEG_NULL                                            \
-    (struct segdesc) {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
+    (struct segdesc) {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}
 
 #define SEG(type, dpl)                                      \
     (struct segdesc) {                                      \
         0, 0, 0, type, 1, dpl, 1,                           \
-        0, 0, 1, 0, 1, 0, 0, 0                              \
+        0, 0, 1, 0, 1, 0                                    \
     }
 
+// a system segment takes two descriptors, SEGTSS_HI is the second with the
+// [32 ~ 63] bits of the base
 #define SEGTSS(type, base, lim, dpl)                        \
     (struct segdesc) {                                      \
         (lim) & 0xffff, (base) & 0xffff,                    \
         ((base) >> 16) & 0xff, type, 0, dpl, 1,             \
         ((lim) >> 16) & 0xf, 0, 0, 0, 0,                    \
-        ((base) >> 24) & 0xff,                              \
-        ((base) >> 32) & 0xffffffff, 0                      \
+        ((base) >> 24) & 0xff                               \
+    }
+
+#define SEGTSS_HI(base)                                     \
+    (struct segdesc) {                                      \
+        ((base) >> 32) & 0xffff, ((base) >> 48) & 0xffff,   \
+        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0                     \
     }
 
 /* task state segment format (as described by the x86_64 architecture book) */
@@ -243,6 +246,7 @@ struct taskstate {
 #define PTE_A           0x020                           // Accessed
 #define PTE_D           0x040                           // Dirty
 #define PTE_PS          0x080                           // Page Size
+#define PTE_G           0x100                           // Global
 #define PTE_MBZ         0x180                           // Bits must be zero
 #define PTE_AVAIL       0xE00                           // Available for software use
                                                         // The PTE_AVAIL bits aren't used by the kernel or interpreted by the
@@ -264,6 +268,7 @@ struct taskstate {
 #define CR0_CD          0x40000000                      // Cache Disable
 #define CR0_PG          0x80000000                      // Paging
 
+#define CR4_PCIDE       0x00020000                      // Process-Context Identifiers Enable
 #define CR4_PCE         0x00000100                      // Performance counter enable
 #define CR4_PGE         0x00000080                      // Page Global Enable
 #define CR4_MCE         0x00000040                      // Machine Check Enable
@@ -274,4 +279,19 @@ struct taskstate {
 #define CR4_PVI         0x00000002                      // Protected-Mode Virtual Interrupts
 #define CR4_VME         0x00000001                      // V86 Mode Extensions
 
+#define CR3_PCID_MASK   0xFFF                           // PCID of the loaded page directory (CR4_PCIDE)
+#define CR3_NOFLUSH     0x8000000000000000              // Keep the TLB entries of the PCID being loaded
+
+/* Model specific registers */
+#define MSR_EFER            0xC0000080                  // Extended Feature Enable Register
+#define MSR_STAR            0xC0000081                  // SYSCALL/SYSRET segment selectors
+#define MSR_LSTAR           0xC0000082                  // SYSCALL target %rip in 64-bit mode
+#define MSR_SFMASK          0xC0000084                  // %rflags bits cleared by SYSCALL
+#define MSR_GS_BASE         0xC0000101                  // Base of %gs
+#define MSR_KERNEL_GS_BASE  0xC0000102                  // Base of %gs swapped in by swapgs
+#define MSR_TSC_DEADLINE    0x000006E0                  // TSC deadline of the local APIC timer
+
+#define EFER_SCE        0x00000001                      // SYSCALL Enable
+#define EFER_LME        0x00000100                      // Long Mode Enable
+
 #endif /* !__KERN_MM_MMU_H__ */
@@ -10,6 +10,9 @@
 #include <slab.h>
 #include <swap.h>
 #include <error.h>
+#include <cpu.h>
+#include <lapic.h>
+#include <trap.h>
 
 /* *
  * Task State Segment:
@@ -30,8 +33,10 @@
  * contains the new RSP value for CPL = 0. When an interrupt happens in protected
  * mode, the x86-64 CPU will look in the TSS for SS0 and RSP0 and load their value
  * into SS and RSP respectively.
+ *
+ * Each cpu has a TSS of its own in struct cpu (and a GDT to hold its descriptor),
+ * as the RSP0 is the kernel stack of the proc running on the cpu.
  * */
-static struct taskstate ts = {0};
 
 // virtual address of physicall page array
 struct Page *pages;
@@ -43,13 +48,41 @@ pgd_t *boot_pgdir = NULL;
 // physical address of boot-time page directory
 uintptr_t boot_cr3;
 
+// the shared zero page, mapped read-only by the read faults on untouched anonymous memory
+struct Page *zero_page;
+
 // physical memory management
 const struct pmm_manager *pmm_manager;
 
-pte_t * const vpt = (pte_t *)VPT;
-pmd_t * const vmd = (pmd_t *)PGADDR(PGX(VPT), PGX(VPT), 0, 0, 0);
-pud_t * const vud = (pud_t *)PGADDR(PGX(VPT), PGX(VPT), PGX(VPT), 0, 0);
-pgd_t * const vgd = (pgd_t *)PGADDR(PGX(VPT), PGX(VPT), PGX(VPT), PGX(VPT), 0);
+/* *
+ * Per-CPU page cache:
+ *
+ * Most of the allocations in ucore are single pages (page tables, user pages, small
+ * slabs), so order-0 requests are served from a short per-CPU list in front of the
+ * pmm_manager. Pages freed recently are still hot in the CPU cache, they are put at
+ * the head of the list and handed out first; pages refilled from the pmm_manager are
+ * cold and put at the tail, and the list is drained from the tail. The list is
+ * refilled and drained in batches, so the pmm_manager is only entered once for every
+ * 'batch' pages instead of on every alloc_page/free_page.
+ *
+ * Each cpu has a list of its own, indexed by its id, so the pages it frees are handed
+ * back to it while they are in its cache. A cpu only touches its own list, except
+ * drain_all_pages and nr_free_pages, which go over all of them under the kernel lock.
+ * */
+struct per_cpu_pages {
+    list_entry_t list;              // the cached pages, hot pages at head & cold pages at tail
+    size_t count;                   // # of pages in list
+    size_t high;                    // high watermark, drain a batch if count exceeds it
+    size_t batch;                   // # of pages refilled or drained in one go
+};
+
+#define PCP_HIGH                    96
+#define PCP_BATCH                   16
+
+static struct per_cpu_pages pcps[NCPU];
+static bool pcp_enabled = 0;
+
+#define this_pcp()                  (pcps + mycpu()->id)
 
 /* *
  * Global Descriptor Table:
@@ -58,27 +91,30 @@ pgd_t * const vgd = (pgd_t *)PGADDR(PGX(VPT), PGX(VPT), PGX(VPT), PGX(VPT), 0);
  * the %ss register, the CPL must equal the DPL. Thus, we must duplicate the
  * segments for the user and the kernel. Defined as follows:
  *   - 0x0 :  unused (always faults -- for trapping NULL far pointers)
- *   - 0x10:  kernel code segment
- *   - 0x20:  kernel data segment
- *   - 0x30:  user code segment
- *   - 0x40:  user data segment
- *   - 0x50:  defined for tss, initialized in gdt_init
+ *   - 0x08:  kernel code segment
+ *   - 0x10:  kernel data segment
+ *   - 0x18:  user data segment
+ *   - 0x20:  user code segment
+ *   - 0x28:  defined for tss (two descriptors), initialized in gdt_init
+ * in the order SYSCALL and SYSRET expect, see memlayout.h.
+ * gdt is the template of the GDT of each cpu.
  * */
-static struct segdesc gdt[] = {
+static struct segdesc gdt[NSEGS] = {
     SEG_NULL,
     [SEG_KTEXT] = SEG(STA_X | STA_R, DPL_KERNEL),
     [SEG_KDATA] = SEG(STA_W, DPL_KERNEL),
-    [SEG_UTEXT] = SEG(STA_X | STA_R, DPL_USER),
     [SEG_UDATA] = SEG(STA_W, DPL_USER),
+    [SEG_UTEXT] = SEG(STA_X | STA_R, DPL_USER),
     [SEG_TSS]   = SEG_NULL,
-};
-
-static struct pseudodesc gdt_pd = {
-    sizeof(gdt) - 1, (uintptr_t)gdt
+    [SEG_TSS + 1] = SEG_NULL,
 };
 
 static void check_alloc_page(void);
 static void check_boot_pgdir(void);
+static void pcid_init(void);
+static void tlb_invalidate_all(pgd_t *pgdir);
+static void tlb_shootdown(pgd_t *pgdir, const uintptr_t *addrs, size_t n);
+static void local_tlb_invalidate(pgd_t *pgdir, uintptr_t la);
 
 /* *
  * lgdt - load the global descriptor table register and reset the
@@ -111,21 +147,29 @@ lgdt(struct pseudodesc *pd) {
  * */
 void
 load_rsp0(uintptr_t rsp0) {
-    ts.ts_rsp0 = rsp0;
+    mycpu()->ts.ts_rsp0 = mycpu()->rsp0 = rsp0;
 }
 
-/* gdt_init - initialize the default GDT and TSS */
+/* gdt_init - initialize the GDT and TSS of cpu, and point the %gs base at cpu */
 static void
-gdt_init(void) {
-    // set boot kernel stack and default SS0
-    load_rsp0((uintptr_t)bootstacktop);
+gdt_init(struct cpu *cpu, uintptr_t rsp0) {
+    // set kernel stack and default SS0
+    cpu->ts.ts_rsp0 = cpu->rsp0 = rsp0;
 
     // initialize the TSS filed of the gdt
-    gdt[SEG_TSS] = SEGTSS(STS_T32A, (uintptr_t)&ts, sizeof(ts), DPL_KERNEL);
+    memcpy(cpu->gdt, gdt, sizeof(gdt));
+    cpu->gdt[SEG_TSS] = SEGTSS(STS_T32A, (uintptr_t)&(cpu->ts), sizeof(cpu->ts), DPL_KERNEL);
+    cpu->gdt[SEG_TSS + 1] = SEGTSS_HI((uintptr_t)&(cpu->ts));
 
-    // reload all segment registers
+    // reload all segment registers, which clears the %gs base
+    struct pseudodesc gdt_pd = {sizeof(cpu->gdt) - 1, (uintptr_t)cpu->gdt};
     lgdt(&gdt_pd);
 
+    // the kernel finds the struct cpu at %gs:0, the user %gs base is 0
+    cpu->self = cpu;
+    wrmsr(MSR_GS_BASE, (uintptr_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+
     // load the TSS
     ltr(GD_TSS);
 }
@@ -144,7 +188,97 @@ init_memmap(struct Page *base, size_t n) {
     pmm_manager->init_memmap(base, n);
 }
 
-//alloc_pages - call pmm->alloc_pages to allocate a continuous n*PAGESIZE memory 
+//pcp_init - initialize the per-CPU page caches, they are enabled once pmm_manager is
+//           checked and mycpu() works
+static void
+pcp_init(void) {
+    int i;
+    for (i = 0; i < NCPU; i ++) {
+        struct per_cpu_pages *pcp = pcps + i;
+        list_init(&(pcp->list));
+        pcp->count = 0;
+        pcp->high = PCP_HIGH, pcp->batch = PCP_BATCH;
+    }
+    pcp_enabled = 1;
+}
+
+//pcp_drain - give back at most n cold pages at the tail of pcp to pmm_manager
+// return value: the number of pages given back
+static size_t
+pcp_drain(struct per_cpu_pages *pcp, size_t n) {
+    size_t ret = 0;
+    list_entry_t *list = &(pcp->list), *le;
+    while (ret < n && (le = list_prev(list)) != list) {
+        list_del(le);
+        pmm_manager->free_pages(le2page(le, page_link), 1);
+        pcp->count --, ret ++;
+    }
+    return ret;
+}
+
+//pcp_refill - refill a batch of cold pages from pmm_manager to the tail of pcp
+static void
+pcp_refill(struct per_cpu_pages *pcp) {
+    size_t i;
+    for (i = 0; i < pcp->batch; i ++) {
+        struct Page *page;
+        if ((page = pmm_manager->alloc_pages(1)) == NULL) {
+            break;
+        }
+        list_add_before(&(pcp->list), &(page->page_link));
+        pcp->count ++;
+    }
+}
+
+//pcp_alloc_page - allocate the hottest page in pcp, refill pcp first if it is empty
+static struct Page *
+pcp_alloc_page(struct per_cpu_pages *pcp) {
+    if (pcp->count == 0) {
+        pcp_refill(pcp);
+        if (pcp->count == 0) {
+            return NULL;
+        }
+    }
+    list_entry_t *le = list_next(&(pcp->list));
+    list_del(le);
+    pcp->count --;
+    return le2page(le, page_link);
+}
+
+//pcp_free_page - put the page at the head of pcp as a hot page, drain a batch of
+//                cold pages if pcp grows above the high watermark
+static void
+pcp_free_page(struct per_cpu_pages *pcp, struct Page *page) {
+    assert(!PageReserved(page) && !PageProperty(page));
+    page->flags = 0;
+    set_page_ref(page, 0);
+    list_add(&(pcp->list), &(page->page_link));
+    if (++ pcp->count > pcp->high) {
+        pcp_drain(pcp, pcp->batch);
+    }
+}
+
+//drain_all_pages - give back all pages in the page caches of all cpus to pmm_manager, so
+//                  that they can be merged again. it's called when an allocation fails and
+//                  by kswapd; the other cpus are kept out of their lists by the kernel lock.
+// return value: the number of pages given back
+size_t
+drain_all_pages(void) {
+    size_t ret = 0;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        int i;
+        for (i = 0; i < NCPU; i ++) {
+            ret += pcp_drain(pcps + i, pcps[i].count);
+        }
+    }
+    local_intr_restore(intr_flag);
+    return ret;
+}
+
+//alloc_pages - call pmm->alloc_pages to allocate a continuous n*PAGESIZE memory,
+//            - a single page is allocated from the per-CPU page cache
 struct Page *
 alloc_pages(size_t n) {
     bool intr_flag;
@@ -152,28 +286,63 @@ alloc_pages(size_t n) {
 try_again:
     local_intr_save(intr_flag);
     {
-        page = pmm_manager->alloc_pages(n);
+        if (n == 1 && pcp_enabled) {
+            page = pcp_alloc_page(this_pcp());
+        }
+        else {
+            page = pmm_manager->alloc_pages(n);
+        }
     }
     local_intr_restore(intr_flag);
+    if (page == NULL && drain_all_pages() != 0) {
+        goto try_again;
+    }
     if (page == NULL && try_free_pages(n)) {
         goto try_again;
     }
     return page;
 }
 
-//free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory 
+//free_pages - call pmm->free_pages to free a continuous n*PAGESIZE memory,
+//           - a single page is freed to the per-CPU page cache
 void
 free_pages(struct Page *base, size_t n) {
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        pmm_manager->free_pages(base, n);
+        if (n == 1 && pcp_enabled) {
+            pcp_free_page(this_pcp(), base);
+        }
+        else {
+            pmm_manager->free_pages(base, n);
+        }
+    }
+    local_intr_restore(intr_flag);
+}
+
+//free_page_list - free the blocks of n pages linked by page_link in list, in one go
+static void
+free_page_list(list_entry_t *list, size_t n) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        list_entry_t *le;
+        while ((le = list_next(list)) != list) {
+            struct Page *page = le2page(le, page_link);
+            list_del(le);
+            if (n == 1 && pcp_enabled) {
+                pcp_free_page(this_pcp(), page);
+            }
+            else {
+                pmm_manager->free_pages(page, n);
+            }
+        }
     }
     local_intr_restore(intr_flag);
 }
 
 //nr_free_pages - call pmm->nr_free_pages to get the size (nr*PAGESIZE) 
-//of current free memory
+//of current free memory, the pages in the per-CPU page cache are free too
 size_t
 nr_free_pages(void) {
     size_t ret;
@@ -181,6 +350,10 @@ nr_free_pages(void) {
     local_intr_save(intr_flag);
     {
         ret = pmm_manager->nr_free_pages();
+        int i;
+        for (i = 0; i < NCPU; i ++) {
+            ret += pcps[i].count;
+        }
     }
     local_intr_restore(intr_flag);
     return ret;
@@ -239,19 +412,63 @@ page_init(void) {
     }
 }
 
+#define CPUID_EXT_PDPE1GB           (1 << 26)       // 1GB pages, cpuid 0x80000001 edx
+
+// has_pdpe1gb - whether the cpu supports 1GB pages
+static bool
+has_pdpe1gb(void) {
+    uint32_t eax, edx;
+    cpuid(0x80000000, &eax, NULL, NULL, NULL);
+    if (eax < 0x80000001) {
+        return 0;
+    }
+    cpuid(0x80000001, NULL, NULL, NULL, &edx);
+    return (edx & CPUID_EXT_PDPE1GB) != 0;
+}
+
+//boot_map_segment - map [la, la + size) to [pa, pa + size) in pgdir, a 1GB page (pud entry)
+//                 - or a 2MB page (pmd entry) is used if both la and pa are aligned to it,
+//                 - and 4KB pages are used for the rest
 static void
 boot_map_segment(pgd_t *pgdir, uintptr_t la, size_t size, uintptr_t pa, uint32_t perm) {
     assert(PGOFF(la) == PGOFF(pa));
     size_t n = ROUNDUP(size + PGOFF(la), PGSIZE) / PGSIZE;
     la = ROUNDDOWN(la, PGSIZE);
     pa = ROUNDDOWN(pa, PGSIZE);
-    for (; n > 0; n --, la += PGSIZE, pa += PGSIZE) {
-        pte_t *ptep = get_pte(pgdir, la, 1);
-        assert(ptep != NULL);
-        *ptep = pa | PTE_P | perm;
+    bool pdpe1gb = has_pdpe1gb();
+    while (n > 0) {
+        if (pdpe1gb && n >= PMSIZE / PGSIZE && la % PMSIZE == 0 && pa % PMSIZE == 0) {
+            pud_t *pudp = get_pud(pgdir, la, 1);
+            assert(pudp != NULL && !(*pudp & PTE_P));
+            *pudp = pa | PTE_PS | PTE_P | perm;
+            n -= PMSIZE / PGSIZE, la += PMSIZE, pa += PMSIZE;
+        }
+        else if (n >= PTSIZE / PGSIZE && la % PTSIZE == 0 && pa % PTSIZE == 0) {
+            pmd_t *pmdp = get_pmd(pgdir, la, 1);
+            assert(pmdp != NULL && !(*pmdp & PTE_P));
+            *pmdp = pa | PTE_PS | PTE_P | perm;
+            n -= PTSIZE / PGSIZE, la += PTSIZE, pa += PTSIZE;
+        }
+        else {
+            pte_t *ptep = get_pte(pgdir, la, 1);
+            assert(ptep != NULL);
+            *ptep = pa | PTE_P | perm;
+            n --, la += PGSIZE, pa += PGSIZE;
+        }
     }
 }
 
+// ioremap - map the device memory [pa, pa + size) uncached at KERNBASE + pa, where it
+//         - would be if it were physical memory, and return the address
+void *
+ioremap(uintptr_t pa, size_t size) {
+    uintptr_t la = KERNBASE + pa;
+    if (pa + size > npage * PGSIZE) {
+        boot_map_segment(boot_pgdir, la, size, pa, PTE_W | PTE_G | PTE_PCD | PTE_PWT);
+    }
+    return (void *)la;
+}
+
 //boot_alloc_page - allocate one page using pmm->alloc_pages(1) 
 // return value: the kernel virtual address of this allocated page
 //note: this function is used to get the memory for PDT(Page Directory Table)&PT(Page Table)
@@ -264,6 +481,15 @@ boot_alloc_page(void) {
     return page2kva(p);
 }
 
+// cr0_init - set CR0 for the kernel: paging, write protect, and the FPU
+static void
+cr0_init(void) {
+    uint64_t cr0 = rcr0();
+    cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_TS | CR0_EM | CR0_MP;
+    cr0 &= ~(CR0_TS | CR0_EM);
+    lcr0(cr0);
+}
+
 //pmm_init - setup a pmm to manage physical memory, build PDT&PT to setup paging mechanism 
 //         - check the correctness of pmm & paging mechanism, print PDT&PT
 void
@@ -284,6 +510,7 @@ pmm_init(void) {
 
     // create boot_pgdir, an initial page directory(Page Directory Table, PDT)
     boot_pgdir = boot_alloc_page();
+    pgdir_init(boot_pgdir);
     memset(boot_pgdir, 0, PGSIZE);
     boot_cr3 = PADDR(boot_pgdir);
 
@@ -293,23 +520,32 @@ pmm_init(void) {
     // to form a virtual page table at virtual address VPT
     boot_pgdir[PGX(VPT)] = PADDR(boot_pgdir) | PTE_P | PTE_W;
 
-    // map all physical memory at KERNBASE
-    boot_map_segment(boot_pgdir, KERNBASE, npage * PGSIZE, 0, PTE_W);
+    // map all physical memory at KERNBASE with large pages, the mappings are
+    // global (shared by all page tables), so they survive the reload of CR3
+    boot_map_segment(boot_pgdir, KERNBASE, npage * PGSIZE, 0, PTE_W | PTE_G);
 
     lcr3(boot_cr3);
+    lcr4(rcr4() | CR4_PGE);
+    cr0_init();
 
-    // set CR0
-    uint64_t cr0 = rcr0();
-    cr0 |= CR0_PE | CR0_PG | CR0_AM | CR0_WP | CR0_NE | CR0_TS | CR0_EM | CR0_MP;
-    cr0 &= ~(CR0_TS | CR0_EM);
-    lcr0(cr0);
+    gdt_init(cpus, (uintptr_t)bootstacktop);
+    mycpu()->pgdir = boot_pgdir;
 
-    gdt_init();
+    // put the per-CPU page caches in front of pmm, they are found by mycpu()
+    pcp_init();
 
     check_boot_pgdir();
 
+    // tag the TLB entries with the address space, if the cpu supports it
+    pcid_init();
+
     print_pgdir();
 
+    // the zero page holds a reference of its own, so it is never freed by unmapping
+    zero_page = kva2page(boot_alloc_page());
+    memset(page2kva(zero_page), 0, PGSIZE);
+    set_page_ref(zero_page, 1);
+
     slab_init();
 }
 
@@ -343,6 +579,7 @@ get_pmd(pgd_t *pgdir, uintptr_t la, bool create) {
     if ((pudp = get_pud(pgdir, la, create)) == NULL) {
         return NULL;
     }
+    assert(!(*pudp & PTE_PS));
     if (!(*pudp & PTE_P)) {
         struct Page *page;
         if (!create || (page = alloc_page()) == NULL) {
@@ -362,6 +599,7 @@ get_pte(pgd_t *pgdir, uintptr_t la, bool create) {
     if ((pmdp = get_pmd(pgdir, la, create)) == NULL) {
         return NULL;
     }
+    assert(!(*pmdp & PTE_PS));
     if (!(*pmdp & PTE_P)) {
         struct Page *page;
         if (!create || (page = alloc_page()) == NULL) {
@@ -387,13 +625,56 @@ get_page(pgd_t *pgdir, uintptr_t la, pte_t **ptep_store) {
     return NULL;
 }
 
+// tlb_gather_mmu - start gathering the TLB entries and the pages dropped from pgdir
+void
+tlb_gather_mmu(struct mmu_gather *tlb, pgd_t *pgdir) {
+    tlb->pgdir = pgdir;
+    tlb->flush_all = 0, tlb->nr_addrs = 0;
+    list_init(&(tlb->pages));
+    list_init(&(tlb->huge_pages));
+}
+
+// tlb_flush_entry - record the entry of la to be flushed, the whole pgdir is flushed
+//                 - instead once there are too many of them
+void
+tlb_flush_entry(struct mmu_gather *tlb, uintptr_t la) {
+    if (!tlb->flush_all) {
+        if (tlb->nr_addrs == TLB_FLUSH_ALL_THRESHOLD) {
+            tlb->flush_all = 1;
+        }
+        else {
+            tlb->addrs[tlb->nr_addrs ++] = la;
+        }
+    }
+}
+
+// tlb_finish_mmu - flush the gathered entries, then free the gathered pages
+void
+tlb_finish_mmu(struct mmu_gather *tlb) {
+    if (tlb->flush_all) {
+        tlb_invalidate_all(tlb->pgdir);
+    }
+    else if (tlb->nr_addrs != 0) {
+        tlb_shootdown(tlb->pgdir, tlb->addrs, tlb->nr_addrs);
+        size_t i;
+        for (i = 0; i < tlb->nr_addrs; i ++) {
+            local_tlb_invalidate(tlb->pgdir, tlb->addrs[i]);
+        }
+    }
+    tlb->flush_all = 0, tlb->nr_addrs = 0;
+    free_page_list(&(tlb->pages), 1);
+    free_page_list(&(tlb->huge_pages), NPGENTRY);
+}
+
+// zap_pte - clear the entry *ptep of la, the flush of the entry and the free of
+//         - the page are left to tlb
 static inline void
-page_remove_pte(pgd_t *pgdir, uintptr_t la, pte_t *ptep) {
+zap_pte(struct mmu_gather *tlb, uintptr_t la, pte_t *ptep) {
     if (*ptep & PTE_P) {
         struct Page *page = pte2page(*ptep);
         if (!PageSwap(page)) {
             if (page_ref_dec(page) == 0) {
-                free_page(page);
+                list_add(&(tlb->pages), &(page->page_link));
             }
         }
         else {
@@ -403,7 +684,7 @@ page_remove_pte(pgd_t *pgdir, uintptr_t la, pte_t *ptep) {
             page_ref_dec(page);
         }
         *ptep = 0;
-        tlb_invalidate(pgdir, la);
+        tlb_flush_entry(tlb, la);
     }
     else if (*ptep != 0) {
         swap_remove_entry(*ptep);
@@ -411,6 +692,14 @@ page_remove_pte(pgd_t *pgdir, uintptr_t la, pte_t *ptep) {
     }
 }
 
+static inline void
+page_remove_pte(pgd_t *pgdir, uintptr_t la, pte_t *ptep) {
+    struct mmu_gather tlb;
+    tlb_gather_mmu(&tlb, pgdir);
+    zap_pte(&tlb, la, ptep);
+    tlb_finish_mmu(&tlb);
+}
+
 void
 page_remove(pgd_t *pgdir, uintptr_t la) {
     pte_t *ptep = get_pte(pgdir, la, 0);
@@ -440,13 +729,221 @@ out:
     return 0;
 }
 
-// invalidate a TLB entry, but only if the page tables being
-// edited are the ones currently in use by the processor.
+/* *
+ * Process-context identifiers:
+ *
+ * Without PCID every load of CR3 flushes all the non-global TLB entries, so a task
+ * switching back and forth between two processes refills its TLB on every switch.
+ * With CR4_PCIDE the TLB entries are tagged with the 12-bit PCID in CR3, and CR3 is
+ * loaded with CR3_NOFLUSH to keep the entries of the incoming address space.
+ *
+ * Each address space gets an asid = (generation | pcid) from a generation based
+ * allocator. PCIDs are handed out in order; when they run out, the generation is
+ * bumped and the whole TLB is flushed once, which invalidates the asids of all the
+ * address spaces at a time, they get new PCIDs the next time they are loaded. A PCID
+ * is never reused inside a generation, so no flush is needed when a new one is got.
+ * PCID 0 is kept for boot_pgdir and the bare lcr3 in the checks.
+ *
+ * A pgdir page is never swapped, so the asid is kept in the 'index' field of its
+ * page descriptor, which is what the tlb_invalidate(pgdir, la) callers have in hand.
+ * The TLB entries of a pgdir that is not in use are shot down with INVPCID, or by
+ * dropping its asid if the cpu lacks INVPCID.
+ *
+ * With several cpus, the pcids are shared by all of them, and each TLB keeps its own
+ * entries. A new generation asks every cpu to flush all its pcids the next time it
+ * loads a pgdir (asid_flush_all). The TLB entries of a pgdir are shot down on the other
+ * cpus too: the cpus running on pgdir get an IPI and flush them at once, the sender
+ * waits for them; the others mark the pcid of pgdir stale (asid_stale), and flush it
+ * when they load pgdir again. All of these are done with the kernel lock held.
+ * */
+
+#define CPUID_PCID                  (1 << 17)       // process-context identifiers, cpuid 1 ecx
+#define CPUID_INVPCID               (1 << 10)       // invpcid instruction, cpuid 7 ebx
+
+#define INVPCID_ADDR                0               // one address of one pcid
+#define INVPCID_SINGLE              1               // all the non-global entries of one pcid
+#define INVPCID_ALL_NONGLOBAL       3               // all the non-global entries of all pcids
+
+#define pgdir_asid(pgdir)           (kva2page(pgdir)->index)
+
+// the number of huge pages mapped in user space of a pgdir, kept in the 'property'
+// field of its page descriptor, which the buddy system only uses for free blocks
+#define pgdir_nr_huge(pgdir)        (kva2page(pgdir)->property)
+
+static bool pcid_enabled = 0, invpcid_enabled = 0;
+static uint64_t asid_generation = NR_ASID;
+static uint64_t next_asid = 1;
+
+// pgdir_loaded - whether pgdir is in use by the processor
+static inline bool
+pgdir_loaded(pgd_t *pgdir) {
+    return (rcr3() & ~CR3_PCID_MASK) == PADDR(pgdir);
+}
+
+// flush_tlb_all - flush the TLB entries of all pcids, toggling CR4_PGE flushes
+//               - the global entries as well
+static void
+flush_tlb_all(void) {
+    if (invpcid_enabled) {
+        invpcid(INVPCID_ALL_NONGLOBAL, 0, 0);
+    }
+    else {
+        uintptr_t cr4 = rcr4();
+        lcr4(cr4 & ~CR4_PGE);
+        lcr4(cr4);
+    }
+}
+
+// asid_alloc - get a pcid of the current generation, start a new generation
+//            - and flush the TLB if the pcids are used up
+static uint64_t
+asid_alloc(void) {
+    if (next_asid == NR_ASID) {
+        asid_generation += NR_ASID, next_asid = 1;
+        int i;
+        for (i = 0; i < ncpu; i ++) {
+            cpus[i].asid_flush_all = 1;
+        }
+    }
+    return asid_generation | (next_asid ++);
+}
+
+// pgdir_init - a new pgdir has no asid, it gets one when it is loaded, and maps no
+//            - huge pages
 void
-tlb_invalidate(pgd_t *pgdir, uintptr_t la) {
-    if (rcr3() == PADDR(pgdir)) {
+pgdir_init(pgd_t *pgdir) {
+    pgdir_asid(pgdir) = 0;
+    pgdir_nr_huge(pgdir) = 0;
+}
+
+// load_pgdir - load pgdir into CR3, the TLB entries of pgdir are kept across
+//            - the switch if its asid is still in the current generation
+void
+load_pgdir(pgd_t *pgdir) {
+    struct cpu *cpu = mycpu();
+    uintptr_t cr3 = PADDR(pgdir);
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        if (pcid_enabled) {
+            bool noflush = 1;
+            if (pgdir != boot_pgdir) {
+                if ((pgdir_asid(pgdir) & ~CR3_PCID_MASK) != asid_generation) {
+                    pgdir_asid(pgdir) = asid_alloc();
+                }
+                cr3 |= (pgdir_asid(pgdir) & CR3_PCID_MASK);
+            }
+            if (cpu->asid_flush_all) {
+                flush_tlb_all();
+                memset(cpu->asid_stale, 0, sizeof(cpu->asid_stale));
+                cpu->asid_flush_all = 0;
+            }
+            else if (test_and_clear_bit(cr3 & CR3_PCID_MASK, cpu->asid_stale)) {
+                noflush = 0;
+            }
+            if (noflush) {
+                cr3 |= CR3_NOFLUSH;
+            }
+        }
+        cpu->pgdir = pgdir;
+        lcr3(cr3);
+    }
+    local_intr_restore(intr_flag);
+}
+
+// tlb_shootdown - flush the TLB entries of pgdir at the n addresses addrs (all the
+//               - entries if n == 0) on the other cpus
+static void
+tlb_shootdown(pgd_t *pgdir, const uintptr_t *addrs, size_t n) {
+    if (ncpu == 1 || pgdir == boot_pgdir) {
+        return;
+    }
+    assert(kernel_locked());
+    struct cpu *self = mycpu(), *cpu;
+    uint64_t asid = pgdir_asid(pgdir);
+    for (cpu = cpus; cpu < cpus + ncpu; cpu ++) {
+        if (cpu == self || !cpu->started) {
+            continue;
+        }
+        if (cpu->pgdir == pgdir) {
+            cpu->tlb_flush_addrs = addrs, cpu->tlb_flush_nr = n;
+            cpu->tlb_flush = 1;
+            lapic_send_ipi(cpu->apicid, IRQ_OFFSET + IRQ_TLB);
+        }
+        else if (pcid_enabled && (asid & ~CR3_PCID_MASK) == asid_generation) {
+            set_bit(asid & CR3_PCID_MASK, cpu->asid_stale);
+        }
+    }
+    for (cpu = cpus; cpu < cpus + ncpu; cpu ++) {
+        while (cpu->tlb_flush) {
+            cpu_relax();
+        }
+    }
+}
+
+// tlb_shootdown_ack - flush the TLB entries asked for by tlb_shootdown, on the page table
+//                   - in use, which cannot change while the sender waits
+void
+tlb_shootdown_ack(void) {
+    struct cpu *cpu = mycpu();
+    if (cpu->tlb_flush) {
+        if (cpu->tlb_flush_nr == 0) {
+            lcr3(rcr3());
+        }
+        else {
+            size_t i;
+            for (i = 0; i < cpu->tlb_flush_nr; i ++) {
+                invlpg((void *)cpu->tlb_flush_addrs[i]);
+            }
+        }
+        cpu->tlb_flush = 0;
+    }
+}
+
+// local_tlb_invalidate - invalidate the TLB entry of la in pgdir on this cpu
+static void
+local_tlb_invalidate(pgd_t *pgdir, uintptr_t la) {
+    if (pgdir_loaded(pgdir)) {
         invlpg((void *)la);
     }
+    else if (pcid_enabled && pgdir != boot_pgdir) {
+        if ((pgdir_asid(pgdir) & ~CR3_PCID_MASK) == asid_generation) {
+            if (invpcid_enabled) {
+                invpcid(INVPCID_ADDR, pgdir_asid(pgdir) & CR3_PCID_MASK, la);
+            }
+            else {
+                pgdir_asid(pgdir) = 0;
+            }
+        }
+    }
+}
+
+// invalidate a TLB entry. The page tables in use by the processor are handled by
+// invlpg; with PCID the other page tables may have entries cached under their own
+// pcid as well, they are invalidated by INVPCID or by dropping the asid.
+void
+tlb_invalidate(pgd_t *pgdir, uintptr_t la) {
+    tlb_shootdown(pgdir, &la, 1);
+    local_tlb_invalidate(pgdir, la);
+}
+
+// invalidate all the non-global TLB entries of pgdir.
+static void
+tlb_invalidate_all(pgd_t *pgdir) {
+    tlb_shootdown(pgdir, NULL, 0);
+    if (pgdir_loaded(pgdir)) {
+        lcr3(rcr3());
+    }
+    else if (pcid_enabled && pgdir != boot_pgdir) {
+        if ((pgdir_asid(pgdir) & ~CR3_PCID_MASK) == asid_generation) {
+            if (invpcid_enabled) {
+                invpcid(INVPCID_SINGLE, pgdir_asid(pgdir) & CR3_PCID_MASK, 0);
+            }
+            else {
+                pgdir_asid(pgdir) = 0;
+            }
+        }
+    }
 }
 
 struct Page *
@@ -461,168 +958,309 @@ pgdir_alloc_page(pgd_t *pgdir, uintptr_t la, uint32_t perm) {
     return page;
 }
 
-static void
-unmap_range_pte(pgd_t *pgdir, pte_t *pte, uintptr_t base, uintptr_t start, uintptr_t end) {
-    assert(start >= 0 && start < end && end <= PTSIZE);
-    assert(start % PGSIZE == 0 && end % PGSIZE == 0);
-    do {
-        pte_t *ptep = &pte[PTX(start)];
-        if (*ptep != 0) {
-            page_remove_pte(pgdir, base + start, ptep);
+// pgdir_alloc_huge_page - allocate a 2MB aligned block and map it at la with a
+//                       - single pmd entry; fail if the pmd is already in use
+struct Page *
+pgdir_alloc_huge_page(pgd_t *pgdir, uintptr_t la, uint32_t perm) {
+    assert(la % PTSIZE == 0);
+    pmd_t *pmdp = get_pmd(pgdir, la, 1);
+    if (pmdp == NULL || *pmdp != 0) {
+        return NULL;
+    }
+    struct Page *page = alloc_pages(NPGENTRY);
+    if (page != NULL) {
+        if (page2pa(page) % PTSIZE != 0) {
+            free_pages(page, NPGENTRY);
+            return NULL;
         }
-        start += PGSIZE;
-    } while (start != 0 && start < end);
+        memset(page2kva(page), 0, PTSIZE);
+        set_page_ref(page, 1);
+        *pmdp = page2pa(page) | PTE_PS | PTE_P | perm;
+        pgdir_nr_huge(pgdir) ++;
+    }
+    return page;
 }
 
-static void
-unmap_range_pmd(pgd_t *pgdir, pmd_t *pmd, uintptr_t base, uintptr_t start, uintptr_t end) {
-    assert(start >= 0 && start < end && end <= PMSIZE);
-    size_t off, size;
-    uintptr_t la = ROUNDDOWN(start, PTSIZE);
-    do {
-        off = start - la, size = PTSIZE - off;
-        if (size > end - start) {
-            size = end - start;
+// split_huge_pmd - replace the huge page mapping la (if any) with a page table
+//                - of 512 small ptes pointing at the same physical pages
+int
+split_huge_pmd(pgd_t *pgdir, uintptr_t la) {
+    pmd_t *pmdp = get_pmd(pgdir, la, 0);
+    if (pmdp == NULL || !(*pmdp & PTE_PS)) {
+        return 0;
+    }
+    struct Page *ptpage;
+    if ((ptpage = alloc_page()) == NULL) {
+        return -E_NO_MEM;
+    }
+    set_page_ref(ptpage, 1);
+
+    pte_t *pte = page2kva(ptpage);
+    struct Page *page = pa2page(PMD_ADDR(*pmdp));
+    uint32_t perm = (*pmdp & (PTE_USER | PTE_SWAP));
+    int i;
+    for (i = 0; i < NPGENTRY; i ++) {
+        set_page_ref(page + i, 1);
+        pte[i] = page2pa(page + i) | PTE_P | perm;
+    }
+    *pmdp = page2pa(ptpage) | PTE_U | PTE_W | PTE_P;
+    pgdir_nr_huge(pgdir) --;
+    tlb_invalidate(pgdir, ROUNDDOWN(la, PTSIZE));
+    return 0;
+}
+
+// unshare_pgtable - give pgdir a private copy of the page table it shares with others after
+//                 - fork at la (if any); the pages in it become copy-on-write between the sharers.
+//                 - a shared page table is mapped by read-only pmds, and page_ref counts its sharers
+int
+unshare_pgtable(pgd_t *pgdir, uintptr_t la) {
+    pmd_t *pmdp = get_pmd(pgdir, la, 0);
+    if (pmdp == NULL || !(*pmdp & PTE_P) || (*pmdp & (PTE_PS | PTE_W))) {
+        return 0;
+    }
+    struct Page *ptpage = pmd2page(*pmdp);
+    if (page_ref(ptpage) > 1) {
+        struct Page *npage;
+        if ((npage = alloc_page()) == NULL) {
+            return -E_NO_MEM;
         }
-        pmd_t *pmdp = &pmd[PMX(la)];
-        if (*pmdp & PTE_P) {
-            unmap_range_pte(pgdir, KADDR(PMD_ADDR(*pmdp)), base + la, off, off + size);
+        set_page_ref(npage, 1);
+
+        pte_t *pte = page2kva(ptpage), *npte = page2kva(npage);
+        int i;
+        for (i = 0; i < NPGENTRY; i ++) {
+            if (pte[i] & PTE_P) {
+                pte[i] &= ~PTE_W;
+                page_ref_inc(pte2page(pte[i]));
+            }
+            else if (pte[i] != 0) {
+                swap_duplicate(pte[i]);
+            }
+            npte[i] = pte[i];
         }
-        start += size, la += PTSIZE;
-    } while (start != 0 && start < end);
+        page_ref_dec(ptpage);
+        ptpage = npage;
+    }
+    *pmdp = page2pa(ptpage) | PTE_U | PTE_W | PTE_P;
+    tlb_invalidate_all(pgdir);
+    return 0;
 }
 
-static void
-unmap_range_pud(pgd_t *pgdir, pud_t *pud, uintptr_t base, uintptr_t start, uintptr_t end) {
-    assert(start >= 0 && start < end && end <= PUSIZE);
-    size_t off, size;
-    uintptr_t la = ROUNDDOWN(start, PMSIZE);
-    do {
-        off = start - la, size = PMSIZE - off;
-        if (size > end - start) {
-            size = end - start;
+static const int walk_shift[] = {PGXSHIFT, PUXSHIFT, PMXSHIFT, PTXSHIFT};
+
+// walk_range - walk [lo, hi] (hi is inclusive) of the table at level, lo is page aligned
+static int
+walk_range(struct pgwalk *walk, uintptr_t *table, int level, uintptr_t lo, uintptr_t hi) {
+    int ret;
+    if (level == WALK_PTE) {
+        pte_t *ptep = &table[PTX(lo)], *last = &table[PTX(hi)];
+        for (; ptep <= last; ptep ++, lo += PGSIZE) {
+            if (*ptep != 0 && (ret = walk->pte(ptep, lo, walk)) != 0) {
+                return ret;
+            }
+        }
+        return 0;
+    }
+    uintptr_t size = (1LLU << walk_shift[level]);
+    while (1) {
+        uintptr_t *entryp = &table[(lo >> walk_shift[level]) & 0x1FF];
+        uintptr_t top = ROUNDDOWN(lo, size) + (size - 1);
+        if (top > hi) {
+            top = hi;
+        }
+        if (*entryp & PTE_P) {
+            if (walk->entry != NULL && (ret = walk->entry(entryp, level, lo, top + 1, walk)) != 0) {
+                if (ret != WALK_SKIP) {
+                    return ret;
+                }
+                goto next;
+            }
+            if ((*entryp & PTE_P) && !(*entryp & PTE_PS)) {
+                if (level + 1 != WALK_PTE || walk->pte != NULL) {
+                    if ((ret = walk_range(walk, KADDR(PTE_ADDR(*entryp)), level + 1, lo, top)) != 0) {
+                        return ret;
+                    }
+                }
+                if (walk->exit != NULL && (ret = walk->exit(entryp, level, lo, top + 1, walk)) != 0) {
+                    return ret;
+                }
+            }
+        }
+    next:
+        if (top == hi) {
+            break;
         }
-        pud_t *pudp = &pud[PUX(la)];
-        if (*pudp & PTE_P) {
-            unmap_range_pmd(pgdir, KADDR(PUD_ADDR(*pudp)), base + la, off, off + size);
+        lo = top + 1;
+        // keep lo canonical when crossing the hole in the middle of the address space
+        if (lo & (1LLU << 47)) {
+            lo |= ~((1LLU << 48) - 1);
         }
-        start += size, la += PMSIZE;
-    } while (start != 0 && start < end);
+    }
+    return 0;
 }
 
-static void
-unmap_range_pgd(pgd_t *pgd, uintptr_t start, uintptr_t end) {
-    size_t off, size;
-    uintptr_t la = ROUNDDOWN(start, PUSIZE);
-    do {
-        off = start - la, size = PUSIZE - off;
-        if (size > end - start) {
-            size = end - start;
+// walk_page_range - walk the entries of walk->pgdir in [start, end), see struct pgwalk,
+//                 - end of 0 stands for the top of the address space
+int
+walk_page_range(struct pgwalk *walk, uintptr_t start, uintptr_t end) {
+    assert(start % PGSIZE == 0 && end % PGSIZE == 0 && start != end);
+    return walk_range(walk, walk->pgdir, WALK_PGD, start, end - 1);
+}
+
+// nr_huge_pages - the number of huge page mappings in user space of pgdir
+size_t
+nr_huge_pages(pgd_t *pgdir) {
+    return pgdir_nr_huge(pgdir);
+}
+
+static inline void
+zap_pmd(struct mmu_gather *tlb, uintptr_t la, pmd_t *pmdp) {
+    struct Page *page = pa2page(PMD_ADDR(*pmdp));
+    if (page_ref_dec(page) == 0) {
+        list_add(&(tlb->huge_pages), &(page->page_link));
+    }
+    *pmdp = 0;
+    pgdir_nr_huge(tlb->pgdir) --;
+    tlb_flush_entry(tlb, la);
+}
+
+static int
+unmap_entry(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    struct mmu_gather *tlb = walk->data;
+    if (level == WALK_PMD) {
+        if (*entryp & PTE_PS) {
+            assert(la % PTSIZE == 0 && end - la == PTSIZE);
+            zap_pmd(tlb, la, entryp);
+            return WALK_SKIP;
         }
-        pgd_t *pgdp = &pgd[PGX(la)];
-        if (*pgdp & PTE_P) {
-            unmap_range_pud(pgd, KADDR(PGD_ADDR(*pgdp)), la, off, off + size);
+        if (page_ref(pmd2page(*entryp)) > 1) {
+            assert(la % PTSIZE == 0 && end - la == PTSIZE);
+            page_ref_dec(pmd2page(*entryp)), *entryp = 0;
+            tlb->flush_all = 1;
+            return WALK_SKIP;
         }
-        start += size, la += PUSIZE;
-    } while (start != 0 && start < end);
+    }
+    return 0;
+}
+
+static int
+unmap_pte(pte_t *ptep, uintptr_t la, struct pgwalk *walk) {
+    zap_pte(walk->data, la, ptep);
+    return 0;
 }
 
 void
-unmap_range(pgd_t *pgdir, uintptr_t start, uintptr_t end) {
+unmap_range(struct mmu_gather *tlb, uintptr_t start, uintptr_t end) {
     assert(start % PGSIZE == 0 && end % PGSIZE == 0);
-    assert(USER_ACCESS(start, end));
-    unmap_range_pgd(pgdir, start, end);
+    assert(USER_ACCESS(start, end) || UKMAP_ACCESS(start, end));
+    struct pgwalk walk = {tlb->pgdir, unmap_entry, unmap_pte, NULL, tlb};
+    walk_page_range(&walk, start, end);
 }
 
-static void
-exit_range_pmd(pmd_t *pmd) {
-    uintptr_t la = 0;
-    do {
-        pmd_t *pmdp = &pmd[PMX(la)];
-        if (*pmdp & PTE_P) {
-            free_page(pmd2page(*pmdp)), *pmdp = 0;
-        }
-        la += PTSIZE;
-    } while (la != PMSIZE);
+// tlb_remove_table - a page table is dropped, it may be cached by the paging-structure
+//                  - caches, so the whole pgdir is flushed before it is freed
+static inline void
+tlb_remove_table(struct mmu_gather *tlb, struct Page *page) {
+    list_add(&(tlb->pages), &(page->page_link));
+    tlb->flush_all = 1;
 }
 
-static void
-exit_range_pud(pud_t *pud) {
-    uintptr_t la = 0;
-    do {
-        pud_t *pudp = &pud[PUX(la)];
-        if (*pudp & PTE_P) {
-            exit_range_pmd(KADDR(PUD_ADDR(*pudp)));
-            free_page(pud2page(*pudp)), *pudp = 0;
-        }
-        la += PMSIZE;
-    } while (la != PUSIZE);
+static int
+exit_entry(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    assert(!(*entryp & PTE_PS));
+    return 0;
 }
 
-static void
-exit_range_pgd(pgd_t *pgd, uintptr_t start, uintptr_t end) {
-    start = ROUNDDOWN(start, PUSIZE);
-    do {
-        pgd_t *pgdp = &pgd[PGX(start)];
-        if (*pgdp & PTE_P) {
-            exit_range_pud(KADDR(PGD_ADDR(*pgdp)));
-            free_page(pgd2page(*pgdp)), *pgdp = 0;
-        }
-        start += PUSIZE;
-    } while (start != 0 && start < end);
+static int
+exit_table(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    tlb_remove_table(walk->data, pa2page(PTE_ADDR(*entryp))), *entryp = 0;
+    return 0;
 }
 
+// exit_range - free the page tables of the pgd entries covering [start, end)
 void
-exit_range(pgd_t *pgdir, uintptr_t start, uintptr_t end) {
+exit_range(struct mmu_gather *tlb, uintptr_t start, uintptr_t end) {
     assert(start % PGSIZE == 0 && end % PGSIZE == 0);
-    assert(USER_ACCESS(start, end));
-    exit_range_pgd(pgdir, start, end);
+    assert(USER_ACCESS(start, end) || UKMAP_ACCESS(start, end));
+    struct pgwalk walk = {tlb->pgdir, exit_entry, NULL, exit_table, tlb};
+    walk_page_range(&walk, ROUNDDOWN(start, PUSIZE), ROUNDUP(end, PUSIZE));
+}
+
+struct copy_walk {
+    pgd_t *to;
+    bool share;
+    struct mmu_gather tlb;          // the COW downgrades of from
+    uintptr_t nbase;                // the linear address of the leaf table npte of to
+    pte_t *npte;
+};
+
+static int
+copy_entry(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    struct copy_walk *cw = walk->data;
+    if (level != WALK_PMD) {
+        return 0;
+    }
+    if ((*entryp & PTE_PS) && split_huge_pmd(walk->pgdir, la) != 0) {
+        return -E_NO_MEM;
+    }
+    if (!cw->share && la % PTSIZE == 0 && end - la == PTSIZE) {
+        pmd_t *npmdp;
+        if ((npmdp = get_pmd(cw->to, la, 1)) == NULL) {
+            return -E_NO_MEM;
+        }
+        assert(*npmdp == 0);
+        page_ref_inc(pmd2page(*entryp));
+        *entryp &= ~PTE_W, *npmdp = *entryp;
+        cw->tlb.flush_all = 1;
+        return WALK_SKIP;
+    }
+    return unshare_pgtable(walk->pgdir, la);
 }
 
+static int
+copy_pte(pte_t *ptep, uintptr_t la, struct pgwalk *walk) {
+    struct copy_walk *cw = walk->data;
+    if (cw->npte == NULL || cw->nbase != ROUNDDOWN(la, PTSIZE)) {
+        cw->nbase = ROUNDDOWN(la, PTSIZE);
+        if ((cw->npte = get_pte(cw->to, cw->nbase, 1)) == NULL) {
+            return -E_NO_MEM;
+        }
+    }
+    pte_t *nptep = &(cw->npte[PTX(la)]);
+    assert(*nptep == 0);
+    if (*ptep & PTE_P) {
+        uint32_t perm = (*ptep & PTE_USER);
+        struct Page *page = pte2page(*ptep);
+        if (!cw->share && (*ptep & PTE_W)) {
+            perm &= ~PTE_W;
+            *ptep &= ~PTE_W;
+            tlb_flush_entry(&(cw->tlb), la);
+        }
+        page_ref_inc(page);
+        *nptep = page2pa(page) | PTE_P | perm;
+    }
+    else {
+        swap_entry_t entry = *ptep;
+        swap_duplicate(entry);
+        *nptep = entry;
+    }
+    return 0;
+}
+
+// copy_range - copy the mappings of [start, end) from one page table to a new one. a private
+//            - range covering a whole page table shares the table itself (see unshare_pgtable),
+//            - so fork costs O(page tables) instead of O(pages)
 int
 copy_range(pgd_t *to, pgd_t *from, uintptr_t start, uintptr_t end, bool share) {
     assert(start % PGSIZE == 0 && end % PGSIZE == 0);
     assert(USER_ACCESS(start, end));
 
-    do { 
-        pte_t *ptep = get_pte(from, start, 0), *nptep;
-        if (ptep == NULL) {
-            if (get_pud(from, start, 0) == NULL) {
-                start = ROUNDDOWN(start + PUSIZE, PUSIZE);
-            }
-            else if (get_pmd(from, start, 0) == NULL) {
-                start = ROUNDDOWN(start + PMSIZE, PMSIZE);
-            }
-            else {
-                start = ROUNDDOWN(start + PTSIZE, PTSIZE);
-            }
-            continue ;
-        }
-        if (*ptep != 0) {
-            if ((nptep = get_pte(to, start, 1)) == NULL) {
-                return -E_NO_MEM;
-            }
-            int ret;
-            assert(*ptep != 0 && *nptep == 0);
-            if (*ptep & PTE_P) {
-                uint32_t perm = (*ptep & PTE_USER);
-                struct Page *page = pte2page(*ptep);
-                if (!share && (*ptep & PTE_W)) {
-                    perm &= ~PTE_W;
-                    page_insert(from, page, start, perm | (*ptep & PTE_SWAP));
-                }
-                ret = page_insert(to, page, start, perm);
-                assert(ret == 0);
-            }
-            else {
-                swap_entry_t entry = *ptep;
-                swap_duplicate(entry);
-                *nptep = entry;
-            }
-        }
-        start += PGSIZE;
-    } while (start != 0 && start < end);
-    return 0;
+    struct copy_walk cw = {to, share};
+    struct pgwalk walk = {from, copy_entry, copy_pte, NULL, &cw};
+    tlb_gather_mmu(&(cw.tlb), from);
+    int ret = walk_page_range(&walk, start, end);
+    tlb_finish_mmu(&(cw.tlb));
+    return ret;
 }
 
 static void
@@ -633,12 +1271,30 @@ check_alloc_page(void) {
 
 static void
 check_boot_pgdir(void) {
-    pte_t *ptep;
-    int i;
-    for (i = 0; i < npage; i += PGSIZE) {
-        assert((ptep = get_pte(boot_pgdir, (uintptr_t)KADDR(i), 0)) != NULL);
-        assert(PTE_ADDR(*ptep) == i);
+    uintptr_t pa, size;
+    for (pa = 0; pa < npage * PGSIZE; pa += size) {
+        uintptr_t la = (uintptr_t)KADDR(pa), entry;
+        pud_t *pudp = get_pud(boot_pgdir, la, 0);
+        assert(pudp != NULL && (*pudp & PTE_P));
+        if (*pudp & PTE_PS) {
+            entry = *pudp, size = PMSIZE;
+        }
+        else {
+            pmd_t *pmdp = get_pmd(boot_pgdir, la, 0);
+            assert(pmdp != NULL && (*pmdp & PTE_P));
+            if (*pmdp & PTE_PS) {
+                entry = *pmdp, size = PTSIZE;
+            }
+            else {
+                pte_t *ptep = get_pte(boot_pgdir, la, 0);
+                assert(ptep != NULL && (*ptep & PTE_P));
+                entry = *ptep, size = PGSIZE;
+            }
+        }
+        assert(PTE_ADDR(entry) == pa && (entry & PTE_G) && !(entry & PTE_U));
     }
+    assert(rcr4() & CR4_PGE);
+
     size_t nr_free_pages_saved = nr_free_pages();
 
     assert(PUD_ADDR(boot_pgdir[PGX(VPT)]) == PADDR(boot_pgdir));
@@ -668,6 +1324,100 @@ check_boot_pgdir(void) {
     cprintf("check_boot_pgdir() succeeded!\n");
 }
 
+// check_pcid - check that the TLB entries of a pgdir not in use are invalidated,
+//            - and that a new generation hands out new pcids
+static void
+check_pcid(void) {
+    size_t nr_free_pages_saved = nr_free_pages();
+
+    struct Page *p0, *p1, *pp;
+    assert((pp = alloc_page()) != NULL);
+    pgd_t *pgdir = page2kva(pp);
+    memcpy(pgdir, boot_pgdir, PGSIZE);
+    pgdir[PGX(VPT)] = PADDR(pgdir) | PTE_P | PTE_W;
+    pgdir_init(pgdir);
+
+    assert((p0 = alloc_page()) != NULL && (p1 = alloc_page()) != NULL);
+    *(int *)page2kva(p0) = 0, *(int *)page2kva(p1) = 1;
+
+    // read 0x100 through a volatile pointer, so every load is really done through
+    // the current pgdir and gcc doesn't treat the constant address as an empty object
+    int *volatile ptr = (int *)0x100;
+
+    assert(page_insert(pgdir, p0, 0x100, PTE_W) == 0);
+    load_pgdir(pgdir);
+    assert(*ptr == 0);
+    if (pcid_enabled) {
+        assert((rcr3() & CR3_PCID_MASK) == (pgdir_asid(pgdir) & CR3_PCID_MASK));
+        assert((rcr3() & CR3_PCID_MASK) != 0);
+    }
+    load_pgdir(boot_pgdir);
+
+    // the entry of 0x100 may be cached under the pcid of pgdir
+    assert(page_insert(pgdir, p1, 0x100, PTE_W) == 0);
+    load_pgdir(pgdir);
+    assert(*ptr == 1);
+    load_pgdir(boot_pgdir);
+
+    if (pcid_enabled) {
+        uint64_t generation = asid_generation;
+        next_asid = NR_ASID;
+        load_pgdir(pgdir);
+        assert(asid_generation == generation + NR_ASID);
+        assert(pgdir_asid(pgdir) == (asid_generation | 1));
+        assert(*ptr == 1);
+        load_pgdir(boot_pgdir);
+    }
+
+    page_remove(pgdir, 0x100);
+    free_page(pa2page(PMD_ADDR(*get_pmd(pgdir, 0x100, 0))));
+    free_page(pa2page(PUD_ADDR(*get_pud(pgdir, 0x100, 0))));
+    free_page(pa2page(PGD_ADDR(*get_pgd(pgdir, 0x100, 0))));
+    free_page(pp);
+
+    assert(nr_free_pages() == nr_free_pages_saved);
+
+    cprintf("check_pcid() succeeded!\n");
+}
+
+// pcid_init - enable PCID (and INVPCID) if the cpu has them, otherwise every
+//           - load_pgdir flushes the TLB as before
+static void
+pcid_init(void) {
+    uint32_t eax, ebx, ecx;
+    cpuid(1, NULL, NULL, &ecx, NULL);
+    if (ecx & CPUID_PCID) {
+        cpuid(0, &eax, NULL, NULL, NULL);
+        if (eax >= 7) {
+            cpuid(7, NULL, &ebx, NULL, NULL);
+            invpcid_enabled = ((ebx & CPUID_INVPCID) != 0);
+        }
+        // CR3 must hold pcid 0 when CR4_PCIDE is set
+        assert((rcr3() & CR3_PCID_MASK) == 0);
+        lcr4(rcr4() | CR4_PCIDE);
+        pcid_enabled = 1;
+    }
+    cprintf("pcid: %s, invpcid: %s\n", pcid_enabled ? "on" : "off", invpcid_enabled ? "on" : "off");
+
+    check_pcid();
+}
+
+// pmm_init_ap - set up the gdt of an AP and its paging like that of the boot cpu; the
+//             - AP comes here on the page table and the gdt of the trampoline, which
+//             - are in the low memory, so the gdt is switched first
+void
+pmm_init_ap(struct cpu *cpu, uintptr_t rsp0) {
+    gdt_init(cpu, rsp0);
+
+    lcr3(boot_cr3);
+    lcr4(rcr4() | CR4_PGE);
+    cr0_init();
+    mycpu()->pgdir = boot_pgdir;
+    if (pcid_enabled) {
+        lcr4(rcr4() | CR4_PCIDE);
+    }
+}
+
 //perm2str - use string 'u,r,w,-' to present the permission
 static const char *
 perm2str(int perm) {
@@ -679,72 +1429,79 @@ perm2str(int perm) {
     return str;
 }
 
-//get_pgtable_items - In [left, right] range of PDT or PT, find a continuous linear addr space
-//                  - (left_store*X_SIZE~right_store*X_SIZE) for PDT or PT
-//                  - X_SIZE=PTSIZE=4M, if PDT; X_SIZE=PGSIZE=4K, if PT
-// paramemters:
-//  left:        no use ???
-//  right:       the high side of table's range
-//  start:       the low side of table's range
-//  table:       the beginning addr of table
-//  left_store:  the pointer of the high side of table's next range
-//  right_store: the pointer of the low side of table's next range
-// return value: 0 - not a invalid item range, perm - a valid item range with perm permission 
+static const char *pgdir_level_fmt[] = {
+    "PGD          (%09x)",
+    " |-PUD       (%09x)",
+    " |--|-PMD    (%09x)",
+    " |--|--|-PTE (%09x)",
+};
+
+// print_walk - a run of present entries with the same perm at level, being printed
+struct print_walk {
+    int level;
+    uintptr_t start, end;
+    int perm;
+};
+
+static void print_pgdir_sub(pgd_t *pgdir, int level, uintptr_t start, uintptr_t end);
+
+// print_run - print the run of entries, then the entries of their subtrees
+static void
+print_run(pgd_t *pgdir, struct print_walk *pw) {
+    if (pw->start != pw->end) {
+        cprintf(pgdir_level_fmt[pw->level], (pw->end - pw->start) >> walk_shift[pw->level]);
+        cprintf(" %016llx-%016llx %016llx %s\n", pw->start, pw->end, pw->end - pw->start, perm2str(pw->perm));
+        if (pw->level != WALK_PTE && !(pw->perm & PTE_PS)) {
+            print_pgdir_sub(pgdir, pw->level + 1, pw->start, pw->end);
+        }
+    }
+}
+
+// print_entry - extend the current run with the entry of la, or print the run and start a new one
+static void
+print_entry(struct pgwalk *walk, uintptr_t entry, uintptr_t la, uintptr_t end) {
+    struct print_walk *pw = walk->data;
+    int perm = (entry & (PTE_USER | PTE_PS));
+    if (pw->end != la || pw->perm != perm) {
+        print_run(walk->pgdir, pw);
+        pw->start = la, pw->perm = perm;
+    }
+    pw->end = end;
+}
+
 static int
-get_pgtable_items(size_t left, size_t right, size_t start, uintptr_t *table, size_t *left_store, size_t *right_store) {
-    if (start >= right) {
+print_upper_entry(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    struct print_walk *pw = walk->data;
+    if (level < pw->level) {
         return 0;
     }
-    while (start < right && !(table[start] & PTE_P)) {
-        start ++;
-    }
-    if (start < right) {
-        if (left_store != NULL) {
-            *left_store = start;
-        }
-        int perm = (table[start ++] & PTE_USER);
-        while (start < right && (table[start] & PTE_USER) == perm) {
-            start ++;
-        }
-        if (right_store != NULL) {
-            *right_store = start;
-        }
-        return perm;
+    print_entry(walk, *entryp, la, end);
+    return WALK_SKIP;
+}
+
+static int
+print_pte(pte_t *ptep, uintptr_t la, struct pgwalk *walk) {
+    if (*ptep & PTE_P) {
+        print_entry(walk, *ptep, la, la + PGSIZE);
     }
     return 0;
 }
 
+// print_pgdir_sub - print the runs of present entries at level in [start, end)
 static void
-print_pgdir_sub(int deep, size_t left, size_t right, char *s1[], size_t s2[], uintptr_t *s3[]) {
-    if (deep > 0) {
-        uint32_t perm;
-        size_t l, r = left;
-        while ((perm = get_pgtable_items(left, right, r, s3[0], &l, &r)) != 0) {
-            cprintf(s1[0], r - l);
-            size_t lb = l * s2[0], rb = r * s2[0];
-            if ((lb >> 32) & 0x8000) {
-                lb |= (0xFFFFLLU << 48);
-                rb |= (0xFFFFLLU << 48);
-            }
-            cprintf(" %016llx-%016llx %016llx %s\n", lb, rb, rb - lb, perm2str(perm));
-            print_pgdir_sub(deep - 1, l * NPGENTRY, r * NPGENTRY, s1 + 1, s2 + 1, s3 + 1);
-        }
-    }
+print_pgdir_sub(pgd_t *pgdir, int level, uintptr_t start, uintptr_t end) {
+    struct print_walk pw = {level, start, start, 0};
+    struct pgwalk walk = {pgdir, print_upper_entry, (level == WALK_PTE) ? print_pte : NULL, NULL, &pw};
+    walk_page_range(&walk, start, end);
+    print_run(pgdir, &pw);
 }
 
-//print_pgdir - print the PDT&PT
+//print_pgdir - print the page table in use
 void
 print_pgdir(void) {
-    char *s1[] = {
-        "PGD          (%09x)",
-        " |-PUD       (%09x)",
-        " |--|-PMD    (%09x)",
-        " |--|--|-PTE (%09x)",
-    };
-    size_t s2[] = {PUSIZE, PMSIZE, PTSIZE, PGSIZE};
-    uintptr_t *s3[] = {vgd, vud, vmd, vpt};
+    pgd_t *pgdir = KADDR(PTE_ADDR(rcr3()));
     cprintf("-------------------- BEGIN --------------------\n");
-    print_pgdir_sub(sizeof(s1) / sizeof(s1[0]), 0, NPGENTRY, s1, s2, s3);
+    print_pgdir_sub(pgdir, WALK_PGD, 0, 0);
     cprintf("--------------------- END ---------------------\n");
 }
 
@@ -25,12 +25,18 @@ struct pmm_manager {
 extern const struct pmm_manager *pmm_manager;
 extern pgd_t *boot_pgdir;
 extern uintptr_t boot_cr3;
+extern struct Page *zero_page;
+
+struct cpu;
 
 void pmm_init(void);
+void pmm_init_ap(struct cpu *cpu, uintptr_t rsp0);
+void *ioremap(uintptr_t pa, size_t size);
 
 struct Page *alloc_pages(size_t n);
 void free_pages(struct Page *base, size_t n);
 size_t nr_free_pages(void);
+size_t drain_all_pages(void);
 
 #define alloc_page() alloc_pages(1)
 #define free_page(page) free_pages(page, 1)
@@ -43,11 +49,72 @@ struct Page *get_page(pgd_t *pgdir, uintptr_t la, pte_t **ptep_store);
 void page_remove(pgd_t *pgdir, uintptr_t la);
 int page_insert(pgd_t *pgdir, struct Page *page, uintptr_t la, uint32_t perm);
 
+/* *
+ * mmu_gather collects the TLB entries and the pages dropped while unmapping a range.
+ * The entries are flushed once at the end, one by one with invlpg, or by a reload of
+ * CR3 if there are more than TLB_FLUSH_ALL_THRESHOLD of them; the pages are freed in
+ * one batch after the flush, so no cpu can reach a freed page through a stale entry.
+ * */
+#define TLB_FLUSH_ALL_THRESHOLD     32
+
+struct mmu_gather {
+    pgd_t *pgdir;                                   // the page table being unmapped
+    bool flush_all;                                 // flush all the entries of pgdir
+    size_t nr_addrs;                                // # of entries in addrs
+    uintptr_t addrs[TLB_FLUSH_ALL_THRESHOLD];       // the entries to flush one by one
+    list_entry_t pages;                             // the pages to free, linked by page_link
+    list_entry_t huge_pages;                        // the huge pages to free
+};
+
+/* *
+ * pgwalk describes a walk of the page table pgdir over a range of linear addresses.
+ * The walk descends each level once and runs through the leaf tables linearly, the
+ * subtrees of the non-present entries are skipped. The levels are WALK_PGD, WALK_PUD,
+ * WALK_PMD and WALK_PTE; [la, end) passed to the callbacks is the part of the range
+ * covered by the entry.
+ *  entry: called on each present entry of the upper levels before its subtree is
+ *         walked, the entry is read again after the call. A huge entry (PTE_PS) has
+ *         no subtree. Return WALK_SKIP to skip the subtree.
+ *  pte:   called on each non-zero entry of the leaf tables, the leaf tables are not
+ *         walked at all if it is NULL.
+ *  exit:  called on each upper level entry after its subtree is walked.
+ * A callback returns 0 to go on; any other value (except WALK_SKIP from entry) stops
+ * the walk, and walk_page_range returns it.
+ * */
+#define WALK_PGD                    0
+#define WALK_PUD                    1
+#define WALK_PMD                    2
+#define WALK_PTE                    3
+
+#define WALK_SKIP                   1
+#define WALK_STOP                   2
+
+struct pgwalk {
+    pgd_t *pgdir;
+    int (*entry)(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk);
+    int (*pte)(pte_t *ptep, uintptr_t la, struct pgwalk *walk);
+    int (*exit)(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk);
+    void *data;
+};
+
+int walk_page_range(struct pgwalk *walk, uintptr_t start, uintptr_t end);
+
+void tlb_gather_mmu(struct mmu_gather *tlb, pgd_t *pgdir);
+void tlb_flush_entry(struct mmu_gather *tlb, uintptr_t la);
+void tlb_finish_mmu(struct mmu_gather *tlb);
+
 void load_rsp0(uintptr_t rsp0);
 void tlb_invalidate(pgd_t *pgdir, uintptr_t la);
+void pgdir_init(pgd_t *pgdir);
+void load_pgdir(pgd_t *pgdir);
+void tlb_shootdown_ack(void);
 struct Page *pgdir_alloc_page(pgd_t *pgdir, uintptr_t la, uint32_t perm);
-void unmap_range(pgd_t *pgdir, uintptr_t start, uintptr_t end);
-void exit_range(pgd_t *pgdir, uintptr_t start, uintptr_t end);
+struct Page *pgdir_alloc_huge_page(pgd_t *pgdir, uintptr_t la, uint32_t perm);
+int split_huge_pmd(pgd_t *pgdir, uintptr_t la);
+int unshare_pgtable(pgd_t *pgdir, uintptr_t la);
+size_t nr_huge_pages(pgd_t *pgdir);
+void unmap_range(struct mmu_gather *tlb, uintptr_t start, uintptr_t end);
+void exit_range(struct mmu_gather *tlb, uintptr_t start, uintptr_t end);
 int copy_range(pgd_t *to, pgd_t *from, uintptr_t start, uintptr_t end, bool share);
 
 void print_pgdir(void);
@@ -7,6 +7,7 @@
 #include <pmm.h>
 #include <stdio.h>
 #include <rb_tree.h>
+#include <cpu.h>
 
 /* The slab allocator used in ucore is based on an algorithm first introduced by 
    Jeff Bonwick for the SunOS operating system. The paper can be download from 
@@ -59,6 +60,29 @@
      kmem_slab_destroy(kmem_cache_t *cachep, slab_t *slabp)
      kmalloc(size_t size): used by outside functions need dynamicly get memory
      kfree(void *objp): used by outside functions need dynamicly release memory
+
+   Object caches:
+   Besides the slab_cache array for kmalloc, kmem_cache_create builds a cache for objs
+   with an exact size and alignment, so that a hot kernel structure is not rounded up to
+   the next power of 2 and does not share the cache lines with unrelated objs. An optional
+   ctor is called once for each obj when its slab is created, the objs must be freed in
+   the constructed state. The unused area of a slab is used to colour the slabs: each new
+   slab shifts its objs by colour_off bytes more than the previous one (and wraps around),
+   so the objs at the same index in different slabs don't map to the same cache lines.
+   All the caches (include slab_cache) are chained in cache_list.
+
+   Magazine layer:
+   On top of the slabs, each kmem_cache caches free objs in magazines, as described in
+   Bonwick & Adams, "Magazines and Vmem" (USENIX 2001). A magazine is an array of at most
+   MAGAZINE_SIZE obj pointers. Every cpu has a loaded and a previous magazine per cache,
+   found by mycpu()->id, the previous one is always full or empty. kmem_cache_alloc pops an obj from the loaded
+   magazine and kmem_cache_free pushes it back, so the hottest obj is reused first and
+   neither the slab lists nor the bufctl chains are touched. When the loaded magazine runs
+   empty (or full), it's exchanged with the previous one, or with a full (or empty)
+   magazine from the depot of the cache. Only if the depot can't help, the obj goes to the
+   slab layer. The objs cached in magazines are still allocated from the view of the slab
+   layer, slab_reap gives all of them back (from the magazines of every cpu) and frees
+   the magazines.
 */
   
 #define BUFCTL_END      0xFFFFFFFFL // the signature of the last bufctl
@@ -78,10 +102,27 @@ typedef struct slab_s {
 #define le2slab(le, member)                 \
     to_struct((le), slab_t, member)
 
-typedef struct kmem_cache_s kmem_cache_t;
+#define MAGAZINE_SIZE           16
+
+typedef struct magazine_s {
+    list_entry_t mag_link;      // the list entry linked to depot
+    size_t rounds;              // the number of objs in magazine
+    void *objs[MAGAZINE_SIZE];  // the cached objs, objs[rounds - 1] is the hottest one
+} magazine_t;
+
+// get the magazine address according to the link element (see list.h)
+#define le2mag(le, member)                  \
+    to_struct((le), magazine_t, member)
 
+// the per-cpu magazines of a kmem_cache
+struct kmem_cpu_cache {
+    magazine_t *loaded;         // the magazine in use
+    magazine_t *previous;       // the magazine used before, it's full or empty
+};
 
 struct kmem_cache_s {
+    const char *name;            // the name of cache
+    list_entry_t cache_link;     // the list entry linked to cache_list
     list_entry_t slabs_full;     // list for fully allocated slabs
     list_entry_t slabs_notfull;  // list for not-fully allocated slabs
 
@@ -94,39 +135,75 @@ struct kmem_cache_s {
     size_t page_order;
 
     kmem_cache_t *slab_cachep;
+
+    void (*ctor)(void *objp);    // the constructor of obj, may be NULL
+
+    size_t colour;               // number of colours of slab
+    size_t colour_off;           // the offset of one colour
+    size_t colour_next;          // the colour of the next slab
+
+    struct kmem_cpu_cache cpu_cache[NCPU];  // magazines of each cpu
+    list_entry_t depot_full;            // depot for full magazines
+    list_entry_t depot_empty;           // depot for empty magazines
 };
 
+// get the kmem_cache address according to the link element (see list.h)
+#define le2cache(le, member)                \
+    to_struct((le), kmem_cache_t, member)
+
 #define MIN_SIZE_ORDER          5           // 32
 #define MAX_SIZE_ORDER          17          // 128k
 #define SLAB_CACHE_NUM          (MAX_SIZE_ORDER - MIN_SIZE_ORDER + 1)
 
+#define SLAB_DEFAULT_ALIGN      sizeof(long)
+#define CACHE_LINE_SIZE         64
+
 static kmem_cache_t slab_cache[SLAB_CACHE_NUM];
 
-static void init_kmem_cache(kmem_cache_t *cachep, size_t objsize, size_t align);
+// the kmem_cache_t structures created by kmem_cache_create are allocated from cache_cache
+static kmem_cache_t cache_cache;
+static list_entry_t cache_list;
+
+// the magazines are allocated from magazine_cache, which has no magazine layer itself
+static kmem_cache_t magazine_cache;
+static bool magazine_enabled = 0;
+
+static void init_kmem_cache(kmem_cache_t *cachep, const char *name, size_t objsize, size_t align, void (*ctor)(void *));
 static void check_slab(void);
+static void check_magazine(void);
+static void check_kmem_cache(void);
 
-//slab_init - call init_kmem_cache function to reset the slab_cache array
+//slab_init - call init_kmem_cache function to reset the slab_cache array,
+//          - the magazine layer is enabled after the slab layer is checked
 void
 slab_init(void) {
     size_t i;
     //the align bit for obj in slab. 2^n could be better for performance
     size_t align = 16;
+    list_init(&cache_list);
     for (i = 0; i < SLAB_CACHE_NUM; i ++) {
-        init_kmem_cache(slab_cache + i, 1 << (i + MIN_SIZE_ORDER), align);
+        init_kmem_cache(slab_cache + i, "kmalloc", 1 << (i + MIN_SIZE_ORDER), align, NULL);
+        list_add_before(&cache_list, &(slab_cache[i].cache_link));
     }
+    init_kmem_cache(&magazine_cache, "magazine", sizeof(magazine_t), align, NULL);
+    init_kmem_cache(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), align, NULL);
     check_slab();
+
+    magazine_enabled = 1;
+    check_magazine();
+    check_kmem_cache();
 }
 
 //slab_allocated - summary the total size of allocated objs
 size_t
 slab_allocated(void) {
     size_t total = 0;
-    int i;
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        for (i = 0; i < SLAB_CACHE_NUM; i ++) {
-            kmem_cache_t *cachep = slab_cache + i;
+        list_entry_t *cache_le = &cache_list;
+        while ((cache_le = list_next(cache_le)) != &cache_list) {
+            kmem_cache_t *cachep = le2cache(cache_le, cache_link);
             list_entry_t *list, *le;
             list = le = &(cachep->slabs_full);
             while ((le = list_next(le)) != list) {
@@ -224,10 +301,19 @@ getorder(size_t n) {
 
 // init_kmem_cache - initial a slab_cache cachep according to the obj with the size = objsize
 static void
-init_kmem_cache(kmem_cache_t *cachep, size_t objsize, size_t align) {
+init_kmem_cache(kmem_cache_t *cachep, const char *name, size_t objsize, size_t align, void (*ctor)(void *)) {
+    cachep->name = name;
+    cachep->ctor = ctor;
     list_init(&(cachep->slabs_full));
     list_init(&(cachep->slabs_notfull));
 
+    int cid;
+    for (cid = 0; cid < NCPU; cid ++) {
+        cachep->cpu_cache[cid].loaded = cachep->cpu_cache[cid].previous = NULL;
+    }
+    list_init(&(cachep->depot_full));
+    list_init(&(cachep->depot_empty));
+
     objsize = ROUNDUP(objsize, align);
     cachep->objsize = objsize;
     cachep->off_slab = (objsize >= (PGSIZE >> 3));
@@ -241,6 +327,7 @@ init_kmem_cache(kmem_cache_t *cachep, size_t objsize, size_t align) {
 
     if (cachep->off_slab && left_over >= mgmt_size) {
         cachep->off_slab = 0;
+        left_over -= mgmt_size;
     }
 
     if (cachep->off_slab) {
@@ -250,9 +337,13 @@ init_kmem_cache(kmem_cache_t *cachep, size_t objsize, size_t align) {
     else {
         cachep->offset = mgmt_size;
     }
+
+    cachep->colour_off = (align > CACHE_LINE_SIZE) ? align : CACHE_LINE_SIZE;
+    cachep->colour = left_over / cachep->colour_off;
+    cachep->colour_next = 0;
 }
 
-static void *kmem_cache_alloc(kmem_cache_t *cachep);
+static void *kmem_cache_alloc_slab(kmem_cache_t *cachep);
 
 #define slab_bufctl(slabp)              \
     ((kmem_bufctl_t*)(((slab_t *)(slabp)) + 1))
@@ -264,16 +355,26 @@ kmem_cache_slabmgmt(kmem_cache_t *cachep, struct Page *page) {
     void *objp = page2kva(page);
     slab_t *slabp;
     if (cachep->off_slab) {
-        if ((slabp = kmem_cache_alloc(cachep->slab_cachep)) == NULL) {
+        if ((slabp = kmem_cache_alloc_slab(cachep->slab_cachep)) == NULL) {
             return NULL;
         }
     }
     else {
         slabp = page2kva(page);
     }
+    size_t colour;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        colour = cachep->colour_next;
+        if (++ cachep->colour_next >= cachep->colour) {
+            cachep->colour_next = 0;
+        }
+    }
+    local_intr_restore(intr_flag);
     slabp->inuse = 0;
-    slabp->offset = cachep->offset;
-    slabp->s_mem = objp + cachep->offset;
+    slabp->offset = cachep->offset + colour * cachep->colour_off;
+    slabp->s_mem = objp + slabp->offset;
     return slabp;
 }
 
@@ -322,6 +423,12 @@ kmem_cache_grow(kmem_cache_t *cachep) {
     slab_bufctl(slabp)[cachep->num - 1] = BUFCTL_END;
     slabp->free = 0;
 
+    if (cachep->ctor != NULL) {
+        for (i = 0; i < cachep->num; i ++) {
+            cachep->ctor(slabp->s_mem + i * cachep->objsize);
+        }
+    }
+
     bool intr_flag;
     local_intr_save(intr_flag);
     {
@@ -350,10 +457,10 @@ kmem_cache_alloc_one(kmem_cache_t *cachep, slab_t *slabp) {
     return objp;
 }
 
-// kmem_cache_alloc - call kmem_cache_alloc_one function to allocate a obj
-//                  - if no free obj, try to allocate a slab
+// kmem_cache_alloc_slab - call kmem_cache_alloc_one function to allocate a obj
+//                       - if no free obj, try to allocate a slab (if grow is set)
 static void *
-kmem_cache_alloc(kmem_cache_t *cachep) {
+__kmem_cache_alloc_slab(kmem_cache_t *cachep, bool grow) {
     void *objp;
     bool intr_flag;
 
@@ -370,12 +477,97 @@ try_again:
 alloc_new_slab:
     local_intr_restore(intr_flag);
 
-    if (kmem_cache_grow(cachep)) {
+    if (grow && kmem_cache_grow(cachep)) {
         goto try_again;
     }
     return NULL;
 }
 
+static void *
+kmem_cache_alloc_slab(kmem_cache_t *cachep) {
+    return __kmem_cache_alloc_slab(cachep, 1);
+}
+
+// depot_get - get a magazine from the depot list, return NULL if the list is empty
+static inline magazine_t *
+depot_get(list_entry_t *list) {
+    list_entry_t *le = list_next(list);
+    if (le == list) {
+        return NULL;
+    }
+    list_del(le);
+    return le2mag(le, mag_link);
+}
+
+// depot_put - put a magazine into the depot list
+static inline void
+depot_put(list_entry_t *list, magazine_t *mag) {
+    list_add(list, &(mag->mag_link));
+}
+
+// magazine_alloc - allocate an empty magazine, never allocate new pages for magazine_cache
+//                - unless grow is set, because kmem_cache_free should not sleep
+static magazine_t *
+magazine_alloc(bool grow) {
+    magazine_t *mag;
+    if ((mag = __kmem_cache_alloc_slab(&magazine_cache, grow)) != NULL) {
+        mag->rounds = 0;
+    }
+    return mag;
+}
+
+static void kmem_cache_free_slab(kmem_cache_t *cachep, void *obj);
+
+// kmem_cache_alloc - allocate an obj from the loaded magazine, exchange the loaded magazine
+//                  - with the previous one or a full one in depot if it's empty
+//                  - if there is no obj in the magazines, call kmem_cache_alloc_slab
+void *
+kmem_cache_alloc(kmem_cache_t *cachep) {
+    if (!magazine_enabled) {
+        return kmem_cache_alloc_slab(cachep);
+    }
+
+    void *objp = NULL;
+    bool intr_flag, need_empty = 0;
+    local_intr_save(intr_flag);
+    {
+        struct kmem_cpu_cache *cc = cachep->cpu_cache + mycpu()->id;
+        if (cc->loaded == NULL || cc->loaded->rounds == 0) {
+            magazine_t *mag;
+            if (cc->previous != NULL && cc->previous->rounds != 0) {
+                mag = cc->previous, cc->previous = cc->loaded, cc->loaded = mag;
+            }
+            else if ((mag = depot_get(&(cachep->depot_full))) != NULL) {
+                if (cc->previous != NULL) {
+                    depot_put(&(cachep->depot_empty), cc->previous);
+                }
+                cc->previous = cc->loaded, cc->loaded = mag;
+            }
+        }
+        if (cc->loaded != NULL && cc->loaded->rounds != 0) {
+            objp = cc->loaded->objs[-- cc->loaded->rounds];
+        }
+        else {
+            need_empty = list_empty(&(cachep->depot_empty));
+        }
+    }
+    local_intr_restore(intr_flag);
+
+    if (objp == NULL) {
+        // magazine miss: prepare an empty magazine for the following kmem_cache_free
+        magazine_t *mag;
+        if (need_empty && (mag = magazine_alloc(1)) != NULL) {
+            local_intr_save(intr_flag);
+            {
+                depot_put(&(cachep->depot_empty), mag);
+            }
+            local_intr_restore(intr_flag);
+        }
+        objp = kmem_cache_alloc_slab(cachep);
+    }
+    return objp;
+}
+
 // kmalloc - simple interface used by outside functions 
 //         - to allocate a free memory using kmem_cache_alloc function
 void *
@@ -388,8 +580,6 @@ kmalloc(size_t size) {
     return kmem_cache_alloc(slab_cache + (order - MIN_SIZE_ORDER));
 }
 
-static void kmem_cache_free(kmem_cache_t *cachep, void *obj);
-
 // kmem_slab_destroy - call free_pages & kmem_cache_free to free a slab 
 static void
 kmem_slab_destroy(kmem_cache_t *cachep, slab_t *slabp) {
@@ -406,7 +596,7 @@ kmem_slab_destroy(kmem_cache_t *cachep, slab_t *slabp) {
     free_pages(page, 1 << cachep->page_order);
 
     if (cachep->off_slab) {
-        kmem_cache_free(cachep->slab_cachep, slabp);
+        kmem_cache_free_slab(cachep->slab_cachep, slabp);
     }
 }
 
@@ -437,9 +627,9 @@ kmem_cache_free_one(kmem_cache_t *cachep, slab_t *slabp, void *objp) {
 #define GET_PAGE_SLAB(page)                                 \
     (slab_t *)((page)->page_link.prev)
 
-// kmem_cache_free - call kmem_cache_free_one function to free an obj 
+// kmem_cache_free_slab - call kmem_cache_free_one function to free an obj 
 static void
-kmem_cache_free(kmem_cache_t *cachep, void *objp) {
+kmem_cache_free_slab(kmem_cache_t *cachep, void *objp) {
     bool intr_flag;
     struct Page *page = kva2page(objp);
 
@@ -453,12 +643,168 @@ kmem_cache_free(kmem_cache_t *cachep, void *objp) {
     local_intr_restore(intr_flag);
 }
 
+// kmem_cache_free - push the obj into the loaded magazine, exchange the loaded magazine
+//                 - with the previous one or an empty one in depot if it's full
+//                 - if there is no room in the magazines, call kmem_cache_free_slab
+void
+kmem_cache_free(kmem_cache_t *cachep, void *objp) {
+    if (!magazine_enabled) {
+        kmem_cache_free_slab(cachep, objp);
+        return ;
+    }
+
+    if (!PageSlab(kva2page(objp))) {
+        panic("not a slab page %08x\n", objp);
+    }
+
+    magazine_t *empty = NULL;
+    bool intr_flag;
+
+try_again:
+    local_intr_save(intr_flag);
+    {
+        struct kmem_cpu_cache *cc = cachep->cpu_cache + mycpu()->id;
+        if (cc->loaded == NULL || cc->loaded->rounds == MAGAZINE_SIZE) {
+            magazine_t *mag;
+            if (cc->previous != NULL && cc->previous->rounds == 0) {
+                mag = cc->previous, cc->previous = cc->loaded, cc->loaded = mag;
+            }
+            else if ((mag = empty) != NULL || (mag = depot_get(&(cachep->depot_empty))) != NULL) {
+                if (mag == empty) {
+                    empty = NULL;
+                }
+                if (cc->previous != NULL) {
+                    depot_put(&(cachep->depot_full), cc->previous);
+                }
+                cc->previous = cc->loaded, cc->loaded = mag;
+            }
+        }
+        if (cc->loaded != NULL && cc->loaded->rounds != MAGAZINE_SIZE) {
+            cc->loaded->objs[cc->loaded->rounds ++] = objp;
+            objp = NULL;
+        }
+        if (empty != NULL) {
+            depot_put(&(cachep->depot_empty), empty);
+            empty = NULL;
+        }
+    }
+    local_intr_restore(intr_flag);
+
+    if (objp != NULL) {
+        if ((empty = magazine_alloc(0)) != NULL) {
+            goto try_again;
+        }
+        kmem_cache_free_slab(cachep, objp);
+    }
+}
+
 // kfree - simple interface used by ooutside functions to free an obj
+//       - the cache of obj is found by its page, so any obj from slab could be freed
 void
 kfree(void *objp) {
     kmem_cache_free(GET_PAGE_CACHE(kva2page(objp)), objp);
 }
 
+// magazine_destroy - give all objs in magazine back to the slab layer, then free the magazine
+static void
+magazine_destroy(kmem_cache_t *cachep, magazine_t *mag) {
+    while (mag->rounds > 0) {
+        kmem_cache_free_slab(cachep, mag->objs[-- mag->rounds]);
+    }
+    kmem_cache_free_slab(&magazine_cache, mag);
+}
+
+// kmem_cache_reap - detach all magazines of cachep (both the cpus' and the depot's), and
+//                 - destroy them, so that the free slabs can be returned to pmm. the
+//                 - magazines of other cpus are safe to take under the kernel lock
+static void
+kmem_cache_reap(kmem_cache_t *cachep) {
+    list_entry_t list;
+    list_init(&list);
+
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        int i;
+        for (i = 0; i < NCPU; i ++) {
+            struct kmem_cpu_cache *cc = cachep->cpu_cache + i;
+            if (cc->loaded != NULL) {
+                depot_put(&list, cc->loaded);
+            }
+            if (cc->previous != NULL) {
+                depot_put(&list, cc->previous);
+            }
+            cc->loaded = cc->previous = NULL;
+        }
+        magazine_t *mag;
+        while ((mag = depot_get(&(cachep->depot_full))) != NULL) {
+            depot_put(&list, mag);
+        }
+        while ((mag = depot_get(&(cachep->depot_empty))) != NULL) {
+            depot_put(&list, mag);
+        }
+    }
+    local_intr_restore(intr_flag);
+
+    magazine_t *mag;
+    while ((mag = depot_get(&list)) != NULL) {
+        magazine_destroy(cachep, mag);
+    }
+}
+
+// slab_reap - reap the magazines of all slab_caches, called by kswapd when memory is short
+void
+slab_reap(void) {
+    list_entry_t *le = &cache_list;
+    while ((le = list_next(le)) != &cache_list) {
+        kmem_cache_reap(le2cache(le, cache_link));
+    }
+}
+
+// kmem_cache_create - create a cache for objs with the size, the objs are aligned to align
+//                   - (0 for default), and ctor (may be NULL) is called for each new obj
+kmem_cache_t *
+kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *)) {
+    if (align == 0) {
+        align = SLAB_DEFAULT_ALIGN;
+    }
+    if (size == 0 || size > (1 << MAX_SIZE_ORDER) || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+
+    kmem_cache_t *cachep;
+    if ((cachep = kmem_cache_alloc_slab(&cache_cache)) != NULL) {
+        init_kmem_cache(cachep, name, size, align, ctor);
+
+        bool intr_flag;
+        local_intr_save(intr_flag);
+        {
+            list_add_before(&cache_list, &(cachep->cache_link));
+        }
+        local_intr_restore(intr_flag);
+    }
+    return cachep;
+}
+
+// kmem_cache_destroy - destroy a cache created by kmem_cache_create, all objs must be freed
+void
+kmem_cache_destroy(kmem_cache_t *cachep) {
+    assert(!(slab_cache <= cachep && cachep < slab_cache + SLAB_CACHE_NUM));
+    kmem_cache_reap(cachep);
+
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        if (!list_empty(&(cachep->slabs_full)) || !list_empty(&(cachep->slabs_notfull))) {
+            panic("kmem_cache_destroy: cache %s is still in use.\n", cachep->name);
+        }
+        list_del(&(cachep->cache_link));
+    }
+    local_intr_restore(intr_flag);
+
+    kmem_cache_free_slab(&cache_cache, cachep);
+}
+
 static inline void
 check_slab_empty(void) {
     int i;
@@ -626,3 +972,175 @@ check_pass:
     cprintf("check_slab() succeeded!\n");
 }
 
+#ifdef DEBUG_SLAB_BENCH
+
+/* *
+ * slab_bench - time kmalloc/kfree with and without the magazine layer. The cycles depend
+ * on the host, so they are only printed, and the bench is built in with
+ * make "DEFS+=-DDEBUG_SLAB_BENCH".
+ * */
+
+#define SLAB_BENCH_BATCH        MAGAZINE_SIZE
+#define SLAB_BENCH_ROUNDS       64
+
+// slab_bench_run - allocate and free a batch of objs with size for many rounds, return cycles
+static uint64_t
+slab_bench_run(size_t size) {
+    void *objs[SLAB_BENCH_BATCH];
+    int i, j;
+    uint64_t start = rdtsc();
+    for (i = 0; i < SLAB_BENCH_ROUNDS; i ++) {
+        for (j = 0; j < SLAB_BENCH_BATCH; j ++) {
+            assert((objs[j] = kmalloc(size)) != NULL);
+        }
+        for (j = SLAB_BENCH_BATCH - 1; j >= 0; j --) {
+            kfree(objs[j]);
+        }
+    }
+    return rdtsc() - start;
+}
+
+// slab_bench - compare the slab layer with the magazine layer for 32B ~ 4KB objs,
+//            - print the cycles of one kmalloc/kfree pair
+static void
+slab_bench(void) {
+    size_t order, ops = SLAB_BENCH_ROUNDS * SLAB_BENCH_BATCH;
+    cprintf("slab_bench: cycles per kmalloc/kfree pair (batch %d)\n", SLAB_BENCH_BATCH);
+    for (order = MIN_SIZE_ORDER; order <= 12; order ++) {
+        size_t size = (1 << order);
+        uint64_t slab_cycles, mag_cycles;
+
+        magazine_enabled = 0;
+        slab_bench_run(size);
+        slab_cycles = slab_bench_run(size);
+
+        magazine_enabled = 1;
+        slab_bench_run(size);
+        mag_cycles = slab_bench_run(size);
+
+        kmem_cache_reap(slab_cache + (order - MIN_SIZE_ORDER));
+        cprintf("  %4d B: slab %5d, magazine %5d\n", (int)size, (int)(slab_cycles / ops), (int)(mag_cycles / ops));
+    }
+}
+
+#endif /* DEBUG_SLAB_BENCH */
+
+static void
+check_magazine(void) {
+    int i;
+    void *objs[MAGAZINE_SIZE * 3];
+
+    slab_reap();
+    size_t nr_free_pages_store = nr_free_pages();
+    size_t slab_allocated_store = slab_allocated();
+
+    kmem_cache_t *cachep = slab_cache;
+    struct kmem_cpu_cache *cc = cachep->cpu_cache + mycpu()->id;
+    assert(cc->loaded == NULL && cc->previous == NULL);
+    assert(list_empty(&(cachep->depot_full)) && list_empty(&(cachep->depot_empty)));
+
+    // the first miss provisions an empty magazine into depot
+    assert((objs[0] = kmalloc(16)) != NULL);
+    assert(!list_empty(&(cachep->depot_empty)));
+
+    // the freed obj goes into the loaded magazine and is reused first
+    kfree(objs[0]);
+    assert(cc->loaded != NULL && cc->loaded->rounds == 1);
+    assert(list_empty(&(cachep->depot_empty)));
+    assert(kmalloc(16) == objs[0]);
+    assert(cc->loaded->rounds == 0);
+
+    for (i = 1; i < MAGAZINE_SIZE * 3; i ++) {
+        assert((objs[i] = kmalloc(16)) != NULL);
+    }
+    for (i = 0; i < MAGAZINE_SIZE * 3; i ++) {
+        kfree(objs[i]);
+    }
+
+    // the previous magazine is either full or empty
+    assert(cc->loaded != NULL && cc->loaded->rounds > 0);
+    assert(cc->previous == NULL || cc->previous->rounds == 0 || cc->previous->rounds == MAGAZINE_SIZE);
+
+    // objs come back in LIFO order
+    for (i = MAGAZINE_SIZE * 3 - 1; i >= 0; i --) {
+        assert(kmalloc(16) == objs[i]);
+    }
+    assert(cc->loaded->rounds == 0 && !list_empty(&(cachep->depot_empty)));
+    for (i = 0; i < MAGAZINE_SIZE * 3; i ++) {
+        kfree(objs[i]);
+    }
+
+    assert(slab_allocated() > slab_allocated_store);
+    slab_reap();
+    assert(cc->loaded == NULL && cc->previous == NULL);
+    assert(list_empty(&(cachep->depot_full)) && list_empty(&(cachep->depot_empty)));
+    assert(list_empty(&(magazine_cache.slabs_full)) && list_empty(&(magazine_cache.slabs_notfull)));
+
+    assert(nr_free_pages_store == nr_free_pages());
+    assert(slab_allocated_store == slab_allocated());
+
+    cprintf("check_magazine() succeeded!\n");
+
+#ifdef DEBUG_SLAB_BENCH
+    slab_bench();
+#endif
+}
+
+#define CHECK_CACHE_OBJSIZE     232
+#define CHECK_CACHE_NUM         32
+#define CHECK_CACHE_MAGIC       0x5AB1E
+
+static void
+check_kmem_cache_ctor(void *objp) {
+    *(int *)objp = CHECK_CACHE_MAGIC;
+}
+
+static void
+check_kmem_cache(void) {
+    int i;
+
+    slab_reap();
+    size_t nr_free_pages_store = nr_free_pages();
+    size_t slab_allocated_store = slab_allocated();
+
+    assert(kmem_cache_create("bad", 0, 0, NULL) == NULL);
+    assert(kmem_cache_create("bad", 32, 24, NULL) == NULL);
+
+    kmem_cache_t *cachep;
+    assert((cachep = kmem_cache_create("check", CHECK_CACHE_OBJSIZE, 0, check_kmem_cache_ctor)) != NULL);
+    assert(cachep->objsize == CHECK_CACHE_OBJSIZE && !cachep->off_slab);
+    assert(cachep->colour > 1 && cachep->colour_off == CACHE_LINE_SIZE);
+
+    // objs have the exact size, and all of them are constructed
+    void *objs[CHECK_CACHE_NUM];
+    size_t total = cachep->num + 1;
+    assert(total <= CHECK_CACHE_NUM);
+    for (i = 0; i < total; i ++) {
+        assert((objs[i] = kmem_cache_alloc(cachep)) != NULL);
+        assert(((uintptr_t)objs[i] % SLAB_DEFAULT_ALIGN) == 0);
+        assert(*(int *)objs[i] == CHECK_CACHE_MAGIC);
+    }
+    assert(objs[1] == objs[0] + CHECK_CACHE_OBJSIZE);
+    assert(slab_allocated() == slab_allocated_store + CHECK_CACHE_OBJSIZE * total);
+
+    // the second slab has a different colour
+    slab_t *slabp0 = GET_PAGE_SLAB(kva2page(objs[0]));
+    slab_t *slabp1 = GET_PAGE_SLAB(kva2page(objs[total - 1]));
+    assert(slabp0 != slabp1 && slabp0->s_mem == objs[0] && slabp1->s_mem == objs[total - 1]);
+    assert(slabp1->offset == slabp0->offset + cachep->colour_off);
+
+    // the freed obj is still constructed when it's allocated again
+    kmem_cache_free(cachep, objs[0]);
+    assert(kmem_cache_alloc(cachep) == objs[0] && *(int *)objs[0] == CHECK_CACHE_MAGIC);
+
+    for (i = 0; i < total; i ++) {
+        kmem_cache_free(cachep, objs[i]);
+    }
+    kmem_cache_destroy(cachep);
+
+    slab_reap();
+    assert(nr_free_pages_store == nr_free_pages());
+    assert(slab_allocated_store == slab_allocated());
+
+    cprintf("check_kmem_cache() succeeded!\n");
+}
@@ -5,12 +5,20 @@
 
 #define KMALLOC_MAX_ORDER       10
 
+typedef struct kmem_cache_s kmem_cache_t;
+
 void slab_init(void);
 
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, void (*ctor)(void *));
+void kmem_cache_destroy(kmem_cache_t *cachep);
+void *kmem_cache_alloc(kmem_cache_t *cachep);
+void kmem_cache_free(kmem_cache_t *cachep, void *objp);
+
 void *kmalloc(size_t n);
 void kfree(void *objp);
 
 size_t slab_allocated(void);
+void slab_reap(void);
 
 #endif /* !__KERN_MM_SLAB_H__ */
 
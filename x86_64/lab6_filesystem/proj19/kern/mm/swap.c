@@ -39,15 +39,17 @@ Software Design Rule:
 
 Page Replacement algorithm:
 ----------------------------
-(an simplified Linux page replacement algorithm)
-  ucore implements a simple modified version of LRU, called the two-list strategy. Instead of maintaining one list, 
-the LRU list, ucore keeps two lists: the active list and the inactive list. Pages on the active list are considered “hot” 
-and are not available to evict. Pages on the inactive list are available to evict. Pages are placed on the active list 
-when ucore need more free pages or when they are accessed while already residing on the inactive list. Both lists are 
-maintained in a pseudo-LRU manner: Items are added to the tail and removed from the head, as with a queue. If there are no 
-enough free page to alloc, the page items from the active list are moved back to the inactive list, making them available 
-to evict. The two-list strategy solves the only-used-once failure in a classic LRU and also enables simpler, pseudo-LRU 
-semantics to perform well.This two-list approach is also known as LRU/2; it can be generalized to n-lists, called LRU/n. 
+(an simplified Linux multi-generational LRU)
+  ucore keeps the swap pages in a small ring of generations instead of the classic active/inactive lists. Each 
+generation is a list tagged by a sequence number, min_seq is the oldest one and max_seq is the youngest one, and there are 
+always MIN_NR_GENS..MAX_NR_GENS generations alive. Pages whose accessed bit is found set in the page table are promoted to 
+the youngest generation, cold pages enter the oldest one and only the oldest generation is evicted. Aging opens a new 
+youngest generation (or folds the oldest one into its successor when the ring is full), so a page has to survive several 
+aging rounds without being accessed before it is considered for eviction again.
+  When a page is evicted, a shadow entry (the value of an eviction clock) is left in the swap slot. When the page faults 
+back in, the refault distance (the number of evictions in between) is compared with the number of pages in the lru: a small 
+distance means the page was thrashing, so it is placed in the youngest generation, where it is protected from being 
+unmapped until it ages; otherwise it enters the oldest generation like any other cold page.
 
 Implementation:
 ----------------------------
@@ -62,15 +64,15 @@ to process this exception:
   
   If there are no free page frame, then ucore will find&replace some used page frame to swap out to swap space. The key function of 
 swap implementation is in kswapd_main(swap.c::proj11::lab3), and the steps are shown below:
-  0 ucore first builds two page list (active_list & inactive_list) for active page(hot accessed) frames and inactive page frames
-    (not accessed in currently past). ucore wants to evict inactive page frames to produce more free page frames.
+  0 ucore first builds the generations of swap lru (lru_gens) for swap page frames, the youngest generation holds the hot
+    page frames and ucore wants to evict the page frames in the oldest generation to produce more free page frames.
   1 try_free_pages(swap.c) will calculate pressure(swap.c) to estimate the number(pressure<<5) of needed page frames in ucore currently, 
      then call kswapd kernel thread.
   2 kswapd kernel thread (wake up by try_free_pages OR timer(sched.[ch]::proj10.4::lab3)) will call kswapd_main to evict N=pressure<<5 
     page frames.
-    2.1 call swap_out_mm to try to evict N page frames in inactive page list from each process's mm struct.
-    2.2 call page_launder & refill_inactive_scan to try to change some active page frames to inactive page frames and
-    swap out some inactive swap page frame to swap space(disk).
+    2.1 call swap_out_mm to try to unmap N page frames from each process's mm struct, accessed page frames are promoted.
+    2.2 call page_launder & lru_gen_age to swap out page frames of the oldest generation to swap space(disk) and
+    age the generations.
 */
 
 // the max offset of swap entry
@@ -82,14 +84,22 @@ typedef struct {
     size_t nr_pages;
 } swap_list_t;
 
-// there are two swap list: active_list & inactive_list
-// active page list. Items in active_list may move to inactive_list.
-static swap_list_t active_list;
-// inactive page list, will be evicted if ucore need more free page frames
-static swap_list_t inactive_list;
+#define MAX_NR_GENS                     4
+#define MIN_NR_GENS                     2
 
-#define nr_active_pages                 (active_list.nr_pages)
-#define nr_inactive_pages               (inactive_list.nr_pages)
+// the generations of swap lru, indexed by (seq % MAX_NR_GENS)
+static swap_list_t lru_gens[MAX_NR_GENS];
+// the sequence number of the oldest & the youngest generation
+static size_t min_seq, max_seq;
+// the number of pages in all generations
+static size_t nr_lru_pages;
+
+#define lru_gen_from_seq(seq)           ((seq) % MAX_NR_GENS)
+#define lru_gen_list(seq)               (lru_gens + lru_gen_from_seq(seq))
+#define nr_lru_gens                     (max_seq - min_seq + 1)
+#define nr_oldest_pages                 (lru_gen_list(min_seq)->nr_pages)
+#define PageOldest(page)                ((page)->lru_gen == lru_gen_from_seq(min_seq))
+#define PageYoungest(page)              ((page)->lru_gen == lru_gen_from_seq(max_seq))
 
 // the array element is used to record the offset of swap entry
 // the value of array element is the reference number of swap out page
@@ -97,6 +107,11 @@ static swap_list_t inactive_list;
 // the index of array element is the offset of swap space(disk)
 static unsigned short *mem_map;
 
+// the shadow entry of an evicted page: the value of eviction clock when the page frame of
+// swap entry (offset) was evicted, 0 means no shadow entry.
+static unsigned short *shadow_map;
+static unsigned short eviction_clock;
+
 #define SWAP_UNUSED                     0xFFFF
 #define MAX_SWAP_REF                    0xFFFE
 
@@ -125,41 +140,91 @@ swap_list_init(swap_list_t *list) {
     list->nr_pages = 0;
 }
 
-// swap_active_list_add - add the page to active_list
+// lru_gen_add - add the page to the tail of generation seq
 static inline void
-swap_active_list_add(struct Page *page) {
-    assert(PageSwap(page));
-    SetPageActive(page);
-    swap_list_t *list = &active_list;
-    list->nr_pages ++;
+lru_gen_add(struct Page *page, size_t seq) {
+    assert(PageSwap(page) && min_seq <= seq && seq <= max_seq);
+    swap_list_t *list = lru_gen_list(seq);
+    page->lru_gen = lru_gen_from_seq(seq);
+    list->nr_pages ++, nr_lru_pages ++;
     list_add_before(&(list->swap_list), &(page->swap_link));
 }
 
-// swap_inactive_list_add - add the page to inactive_list
+// lru_gen_del - delete page from its generation
 static inline void
-swap_inactive_list_add(struct Page *page) {
+lru_gen_del(struct Page *page) {
     assert(PageSwap(page));
-    ClearPageActive(page);
-    swap_list_t *list = &inactive_list;
-    list->nr_pages ++;
-    list_add_before(&(list->swap_list), &(page->swap_link));
+    lru_gens[page->lru_gen].nr_pages --, nr_lru_pages --;
+    list_del(&(page->swap_link));
 }
 
-// swap_list_del - delete page from the swap list
+// lru_gen_move - move page to the tail of generation seq
 static inline void
-swap_list_del(struct Page *page) {
-    assert(PageSwap(page));
-    (PageActive(page) ? &active_list : &inactive_list)->nr_pages --;
-    list_del(&(page->swap_link));
+lru_gen_move(struct Page *page, size_t seq) {
+    lru_gen_del(page);
+    lru_gen_add(page, seq);
+}
+
+// lru_gen_age - retire the empty old generations and open a new youngest generation,
+//             - the oldest generation is folded into the next one if there is no room.
+static void
+lru_gen_age(void) {
+    while (nr_lru_gens > MIN_NR_GENS && list_empty(&(lru_gen_list(min_seq)->swap_list))) {
+        min_seq ++;
+    }
+    if (nr_lru_gens == MAX_NR_GENS) {
+        list_entry_t *list = &(lru_gen_list(min_seq)->swap_list), *le;
+        while ((le = list_prev(list)) != list) {
+            struct Page *page = le2page(le, swap_link);
+            lru_gen_del(page);
+            page->lru_gen = lru_gen_from_seq(min_seq + 1);
+            lru_gen_list(min_seq + 1)->nr_pages ++, nr_lru_pages ++;
+            list_add_after(&(lru_gen_list(min_seq + 1)->swap_list), &(page->swap_link));
+        }
+        min_seq ++;
+    }
+    max_seq ++;
+}
+
+// workingset_eviction - leave a shadow entry in the swap entry of an evicted page
+static void
+workingset_eviction(swap_entry_t entry) {
+    size_t offset = swap_offset(entry);
+    if (mem_map[offset] != SWAP_UNUSED) {
+        if (++ eviction_clock == 0) {
+            eviction_clock ++;
+        }
+        shadow_map[offset] = eviction_clock;
+    }
+}
+
+// workingset_refault - check the shadow entry of a refault page and return the generation it
+//                    - should be added to: if the refault distance is not larger than the number
+//                    - of pages in lru, the page is still in the working set and it is activated.
+static size_t
+workingset_refault(swap_entry_t entry) {
+    size_t offset = swap_offset(entry);
+    unsigned short shadow = shadow_map[offset];
+    shadow_map[offset] = 0;
+    if (shadow != 0) {
+        unsigned short distance = eviction_clock - shadow;
+        if (distance <= nr_lru_pages) {
+            return max_seq;
+        }
+    }
+    return min_seq;
 }
 
-// swap_init - init swap fs, two swap lists, alloc memory & init for swap_entry record array mem_map
-//           - init the hash list.
+// swap_init - init swap fs, lru generations, alloc memory & init for swap_entry record array mem_map
+//           - and shadow_map, init the hash list.
 void
 swap_init(void) {
     swapfs_init();
-    swap_list_init(&active_list);
-    swap_list_init(&inactive_list);
+    int i;
+    for (i = 0; i < MAX_NR_GENS; i ++) {
+        swap_list_init(lru_gens + i);
+    }
+    min_seq = 0, max_seq = MIN_NR_GENS - 1, nr_lru_pages = 0;
 
     if (!(1024 <= max_swap_offset && max_swap_offset < MAX_SWAP_OFFSET_LIMIT)) {
         panic("bad max_swap_offset %08x.\n", max_swap_offset);
@@ -167,13 +232,15 @@ swap_init(void) {
 
     mem_map = kmalloc(sizeof(short) * max_swap_offset);
     assert(mem_map != NULL);
+    shadow_map = kmalloc(sizeof(short) * max_swap_offset);
+    assert(shadow_map != NULL);
 
     size_t offset;
     for (offset = 0; offset < max_swap_offset; offset ++) {
         mem_map[offset] = SWAP_UNUSED;
+        shadow_map[offset] = 0;
     }
 
-    int i;
     for (i = 0; i < HASH_LIST_SIZE; i ++) {
         list_init(hash_list + i);
     }
@@ -313,7 +380,7 @@ try_alloc_swap_entry(void) {
         entry = (zero << 8);
         struct Page *page = swap_hash_find(entry);
         assert(page != NULL && PageSwap(page));
-        swap_list_del(page);
+        lru_gen_del(page);
         if (page_ref(page) == 0) {
             swap_free_page(page);
         }
@@ -323,6 +390,10 @@ try_alloc_swap_entry(void) {
         mem_map[zero] = SWAP_UNUSED;
     }
 
+    if (entry != 0) {
+        shadow_map[swap_offset(entry)] = 0;
+    }
+
     static unsigned int failed_counter = 0;
     if (entry == 0 && ((++ failed_counter) % 0x1000) == 0) {
         warn("swap: try_alloc_swap_entry: failed too many times.\n");
@@ -330,7 +401,7 @@ try_alloc_swap_entry(void) {
     return entry;
 }
 
-// swap_remove_entry - call swap_list_del to remove page from swap hash list,
+// swap_remove_entry - call lru_gen_del to remove page from swap lru,
 //                   - and call swap_free_page to generate a free page 
 void
 swap_remove_entry(swap_entry_t entry) {
@@ -342,7 +413,7 @@ swap_remove_entry(swap_entry_t entry) {
             if (page_ref(page) != 0) {
                 return ;
             }
-            swap_list_del(page);
+            lru_gen_del(page);
             swap_free_page(page);
         }
         mem_map[offset] = SWAP_UNUSED;
@@ -369,7 +440,8 @@ swap_duplicate(swap_entry_t entry) {
 }
 
 // swap_in_page - swap in a content of a page frame from swap space to memory
-//              - set the PG_swap flag in this page and add this page to swap active list
+//              - set the PG_swap flag in this page and add this page to swap lru, the generation
+//              - is decided by the refault distance
 int
 swap_in_page(swap_entry_t entry, struct Page **pagep) {
     if (pagep == NULL) {
@@ -404,7 +476,7 @@ swap_in_page(swap_entry_t entry, struct Page **pagep) {
         goto failed_unlock;
     }
     swap_page_add(page, entry);
-    swap_active_list_add(page);
+    lru_gen_add(page, workingset_refault(entry));
 
 found_unlock:
     up(&swap_in_sem);
@@ -417,8 +489,17 @@ failed_unlock:
     return ret;
 }
 
+// swap_lookup_page - find the page of entry in swap cache, without reading the swap space
+struct Page *
+swap_lookup_page(swap_entry_t entry) {
+    // entry is read from a pte, so it's in use and that pte is counted
+    size_t offset = swap_offset(entry);
+    assert(mem_map[offset] > 0 && mem_map[offset] <= MAX_SWAP_REF);
+    return swap_hash_find(entry);
+}
+
 // swap_copy_entry - copy a content of swap out page frame to a new page
-//                 - set this new page PG_swap flag and add to swap active list
+//                 - set this new page PG_swap flag and add to the oldest generation of swap lru
 int
 swap_copy_entry(swap_entry_t entry, swap_entry_t *store) {
     if (store == NULL) {
@@ -438,7 +519,7 @@ swap_copy_entry(swap_entry_t entry, swap_entry_t *store) {
     if (!swap_page_add(newpage, 0)) {
         goto failed_free_page;
     }
-    swap_active_list_add(newpage);
+    lru_gen_add(newpage, min_seq);
     memcpy(page2kva(newpage), page2kva(page), PGSIZE);
     *store = newpage->index;
     ret = 0;
@@ -463,23 +544,23 @@ try_free_swap_entry(swap_entry_t entry) {
     return 0;
 }
 
-// page_launder - try to move page to swap_active_list OR swap_inactive_list, 
-//              - and call swap_fs_write to swap out pages in swap_inactive_list
+// page_launder - scan the oldest generation, move the mapped pages to the next generation,
+//              - and call swap_fs_write to swap out the others
 static int
 page_launder(void) {
-    size_t maxscan = nr_inactive_pages, free_count = 0;
-    list_entry_t *list = &(inactive_list.swap_list), *le = list_next(list);
+    size_t maxscan = nr_oldest_pages, free_count = 0;
+    list_entry_t *list = &(lru_gen_list(min_seq)->swap_list), *le = list_next(list);
     while (maxscan -- > 0 && le != list) {
         struct Page *page = le2page(le, swap_link);
         le = list_next(le);
-        if (!(PageSwap(page) && !PageActive(page))) {
-            panic("inactive: wrong swap list.\n");
+        if (!(PageSwap(page) && PageOldest(page)) || page == zero_page) {
+            panic("lru_gen: wrong swap list.\n");
         }
-        swap_list_del(page);
         if (page_ref(page) != 0) {
-            swap_active_list_add(page);
+            lru_gen_move(page, min_seq + 1);
             continue ;
         }
+        lru_gen_del(page);
         swap_entry_t entry = page->index;
         if (!try_free_swap_entry(entry)) {
             if (PageDirty(page)) {
@@ -490,15 +571,16 @@ page_launder(void) {
                 }
                 mem_map[swap_offset(entry)] --;
                 if (page_ref(page) != 0) {
-                    swap_active_list_add(page);
+                    lru_gen_add(page, min_seq + 1);
                     continue ;
                 }
                 if (PageDirty(page)) {
-                    swap_inactive_list_add(page);
+                    lru_gen_add(page, min_seq);
                     continue ;
                 }
                 try_free_swap_entry(entry);
             }
+            workingset_eviction(entry);
         }
         free_count ++;
         swap_free_page(page);
@@ -506,84 +588,100 @@ page_launder(void) {
     return free_count;
 }
 
-// refill_inactive_scan - try to move page in swap_active_list into swap_inactive_list
-static void
-refill_inactive_scan(void) {
-    size_t maxscan = nr_active_pages;
-    list_entry_t *list = &(active_list.swap_list), *le = list_next(list);
-    while (maxscan -- > 0 && le != list) {
-        struct Page *page = le2page(le, swap_link);
-        le = list_next(le);
-        if (!(PageSwap(page) && PageActive(page))) {
-            panic("active: wrong swap list.\n");
+struct swap_walk {
+    struct mm_struct *mm;
+    struct vma_struct *vma;
+    struct mmu_gather tlb;
+    size_t require, free_count;
+};
+
+static int
+swap_out_entry(uintptr_t *entryp, int level, uintptr_t la, uintptr_t end, struct pgwalk *walk) {
+    struct swap_walk *sw = walk->data;
+    if (level == WALK_PMD && (*entryp & PTE_PS)) {
+        if (*entryp & PTE_A) {
+            *entryp &= ~PTE_A;
+            tlb_flush_entry(&(sw->tlb), ROUNDDOWN(la, PTSIZE));
+            return WALK_SKIP;
         }
-        if (page_ref(page) == 0) {
-            swap_list_del(page);
-            swap_inactive_list_add(page);
+        if (split_huge_pmd(walk->pgdir, la) != 0) {
+            return -E_NO_MEM;
         }
     }
+    // a page table fork shares is seen by every sharer, and their TLBs are not flushed
+    // here; its pages are swapped once a write gives each sharer a copy (unshare_pgtable)
+    if (level == WALK_PMD && !(*entryp & PTE_W) && page_ref(pmd2page(*entryp)) > 1) {
+        return WALK_SKIP;
+    }
+    return 0;
 }
 
-// swap_out_vma - try unmap pte & move pages into swap active list.
 static int
-swap_out_vma(struct mm_struct *mm, struct vma_struct *vma, uintptr_t addr, size_t require) {
-    if (require == 0 || !(addr >= vma->vm_start && addr < vma->vm_end)) {
+swap_out_pte(pte_t *ptep, uintptr_t addr, struct pgwalk *walk) {
+    struct swap_walk *sw = walk->data;
+    if (!(*ptep & PTE_P)) {
         return 0;
     }
-    uintptr_t end;
-    size_t free_count = 0;
-    addr = ROUNDDOWN(addr, PGSIZE), end = ROUNDUP(vma->vm_end, PGSIZE);
-    while (addr < end && require != 0) {
-        pte_t *ptep = get_pte(mm->pgdir, addr, 0);
-        if (ptep == NULL) {
-            if (get_pud(mm->pgdir, addr, 0) == NULL) {
-                addr = ROUNDDOWN(addr + PUSIZE, PUSIZE);
-            }
-            else if (get_pmd(mm->pgdir, addr, 0) == NULL) {
-                addr = ROUNDDOWN(addr + PMSIZE, PMSIZE);
-            }
-            else {
-                addr = ROUNDDOWN(addr + PTSIZE, PTSIZE);
-            }
-            continue ;
+    struct Page *page = pte2page(*ptep);
+    assert(!PageReserved(page));
+    if (page == zero_page) {
+        return 0;
+    }
+    if (*ptep & PTE_A) {
+        *ptep &= ~PTE_A;
+        tlb_flush_entry(&(sw->tlb), addr);
+        if (PageSwap(page)) {
+            lru_gen_move(page, max_seq);
         }
-        if (*ptep & PTE_P) {
-            struct Page *page = pte2page(*ptep);
-            assert(!PageReserved(page));
-            if (*ptep & PTE_A) {
-                *ptep &= ~PTE_A;
-                tlb_invalidate(mm->pgdir, addr);
-                goto try_next_entry;
-            }
-            if (!PageSwap(page)) {
-                if (!swap_page_add(page, 0)) {
-                    goto try_next_entry;
-                }
-                swap_active_list_add(page);
-            }
-            else if (*ptep & PTE_D) {
-                SetPageDirty(page);
-            }
-            swap_entry_t entry = page->index;
-            swap_duplicate(entry);
-            page_ref_dec(page);
-            *ptep = entry;
-            tlb_invalidate(mm->pgdir, addr);
-            mm->swap_address = addr + PGSIZE;
-            free_count ++, require --;
-            if ((vma->vm_flags & VM_SHARE) && page_ref(page) == 1) {
-                uintptr_t shmem_addr = addr - vma->vm_start + vma->shmem_off;
-                pte_t *sh_ptep = shmem_get_entry(vma->shmem, shmem_addr, 0);
-                assert(sh_ptep != NULL && *sh_ptep != 0);
-                if (*sh_ptep & PTE_P) {
-                    shmem_insert_entry(vma->shmem, shmem_addr, entry);
-                }
-            }
+        return 0;
+    }
+    if (!PageSwap(page)) {
+        if (!swap_page_add(page, 0)) {
+            return 0;
         }
-    try_next_entry:
-        addr += PGSIZE;
+        lru_gen_add(page, min_seq);
     }
-    return free_count;
+    else if (PageYoungest(page)) {
+        return 0;
+    }
+    else if (*ptep & PTE_D) {
+        SetPageDirty(page);
+    }
+    swap_entry_t entry = page->index;
+    swap_duplicate(entry);
+    page_ref_dec(page);
+    *ptep = entry;
+    tlb_flush_entry(&(sw->tlb), addr);
+    sw->mm->swap_address = addr + PGSIZE;
+    sw->free_count ++, sw->require --;
+    struct vma_struct *vma = sw->vma;
+    if ((vma->vm_flags & VM_SHARE) && page_ref(page) == 1) {
+        uintptr_t shmem_addr = addr - vma->vm_start + vma->shmem_off;
+        pte_t *sh_ptep = shmem_get_entry(vma->shmem, shmem_addr, 0);
+        assert(sh_ptep != NULL && *sh_ptep != 0);
+        if (*sh_ptep & PTE_P) {
+            shmem_insert_entry(vma->shmem, shmem_addr, entry);
+        }
+    }
+    return (sw->require == 0) ? WALK_STOP : 0;
+}
+
+// swap_out_vma - try unmap pte & move pages into swap lru.
+//              - the accessed pages are promoted to the youngest generation, and the pages
+//              - in the youngest generation are not unmapped until they get older.
+//              - an accessed huge page is aged as a whole, a cold one is split first.
+static int
+swap_out_vma(struct mm_struct *mm, struct vma_struct *vma, uintptr_t addr, size_t require) {
+    if (require == 0 || !(addr >= vma->vm_start && addr < vma->vm_end)) {
+        return 0;
+    }
+    struct swap_walk sw = {mm, vma};
+    sw.require = require;
+    struct pgwalk walk = {mm->pgdir, swap_out_entry, swap_out_pte, NULL, &sw};
+    tlb_gather_mmu(&(sw.tlb), mm->pgdir);
+    walk_page_range(&walk, ROUNDDOWN(addr, PGSIZE), ROUNDUP(vma->vm_end, PGSIZE));
+    tlb_finish_mmu(&(sw.tlb));
+    return sw.free_count;
 }
 
 // swap_out_mm - call swap_out_vma to try to unmap a set of vma ('require' NUM pages).
@@ -631,6 +729,8 @@ kswapd_main(void *arg) {
     int guard = 0;
     while (1) {
         if (pressure > 0) {
+            slab_reap();
+            drain_all_pages();
             int needs = (pressure << 5), rounds = 16;
             list_entry_t *list = &proc_mm_list;
             assert(!list_empty(list));
@@ -643,7 +743,7 @@ kswapd_main(void *arg) {
             }
         }
         pressure -= page_launder();
-        refill_inactive_scan();
+        lru_gen_age();
         if (pressure > 0) {
             if ((++ guard) >= 1000) {
                 guard = 0;
@@ -660,6 +760,7 @@ kswapd_main(void *arg) {
 // check_swap - check the correctness of swap & page replacement algorithm
 static void
 check_swap(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -702,10 +803,10 @@ check_swap(void) {
     mem_map[1] = 1;
     assert(try_alloc_swap_entry() == 0);
 
-    // set rp1, Swap, Active, add to hash_list, active_list
+    // set rp1, Swap, add to hash_list, the youngest generation
 
     swap_page_add(rp1, entry);
-    swap_active_list_add(rp1);
+    lru_gen_add(rp1, max_seq);
     assert(PageSwap(rp1));
 
     mem_map[1] = 0;
@@ -721,39 +822,39 @@ check_swap(void) {
     assert(mem_map[1] == 1);
 
     swap_page_add(rp1, entry);
-    swap_inactive_list_add(rp1);
+    lru_gen_add(rp1, min_seq);
     swap_remove_entry(entry);
     assert(PageSwap(rp1));
     assert(rp1->index == entry && mem_map[1] == 0);
 
-    // check page_launder, move page from inactive_list to active_list
+    // check page_launder, move mapped page from the oldest generation to the next one
 
     assert(page_ref(rp1) == 1);
-    assert(nr_active_pages == 0 && nr_inactive_pages == 1);
-    assert(list_next(&(inactive_list.swap_list)) == &(rp1->swap_link));
+    assert(nr_lru_pages == 1 && nr_oldest_pages == 1);
+    assert(list_next(&(lru_gen_list(min_seq)->swap_list)) == &(rp1->swap_link));
 
     page_launder();
-    assert(nr_active_pages == 1 && nr_inactive_pages == 0);
-    assert(PageSwap(rp1) && PageActive(rp1));
+    assert(nr_lru_pages == 1 && nr_oldest_pages == 0);
+    assert(PageSwap(rp1) && rp1->lru_gen == lru_gen_from_seq(min_seq + 1));
 
     entry = try_alloc_swap_entry();
     assert(swap_offset(entry) == 1);
-    assert(!PageSwap(rp1) && nr_active_pages == 0);
-    assert(list_empty(&(active_list.swap_list)));
+    assert(!PageSwap(rp1) && nr_lru_pages == 0);
+    assert(list_empty(&(lru_gen_list(min_seq + 1)->swap_list)));
 
-    // set rp1 inactive again
+    // set rp1 in the oldest generation again
 
     assert(page_ref(rp1) == 1);
     swap_page_add(rp1, 0);
     assert(PageSwap(rp1) && swap_offset(rp1->index) == 1);
-    swap_inactive_list_add(rp1);
+    lru_gen_add(rp1, min_seq);
     mem_map[1] = 1;
-    assert(nr_inactive_pages == 1);
+    assert(nr_oldest_pages == 1);
     page_ref_dec(rp1);
 
     size_t count = nr_free_pages();
     swap_remove_entry(entry);
-    assert(nr_inactive_pages == 0 && nr_free_pages() == count + 1);
+    assert(nr_lru_pages == 0 && nr_free_pages() == count + 1);
 
     // check swap_out_mm
 
@@ -768,23 +869,25 @@ check_swap(void) {
 
     ret = swap_out_mm(mm, 10);
     assert(ret == 0 && *ptep0 == entry && mem_map[1] == 1);
-    assert(PageDirty(rp0) && PageActive(rp0) && page_ref(rp0) == 0);
-    assert(nr_active_pages == 1 && list_next(&(active_list.swap_list)) == &(rp0->swap_link));
+    assert(PageDirty(rp0) && PageOldest(rp0) && page_ref(rp0) == 0);
+    assert(nr_lru_pages == 1 && list_next(&(lru_gen_list(min_seq)->swap_list)) == &(rp0->swap_link));
 
-    // check refill_inactive_scan()
+    // check lru_gen_age()
 
-    refill_inactive_scan();
-    assert(!PageActive(rp0) && page_ref(rp0) == 0);
-    assert(nr_inactive_pages == 1 && list_next(&(inactive_list.swap_list)) == &(rp0->swap_link));
+    size_t seq = max_seq;
+    lru_gen_age();
+    assert(max_seq == seq + 1 && nr_lru_gens <= MAX_NR_GENS);
+    assert(PageOldest(rp0) && page_ref(rp0) == 0);
+    assert(nr_oldest_pages == 1 && list_next(&(lru_gen_list(min_seq)->swap_list)) == &(rp0->swap_link));
 
     page_ref_inc(rp0);
     page_launder();
-    assert(PageActive(rp0) && page_ref(rp0) == 1);
-    assert(nr_active_pages == 1 && list_next(&(active_list.swap_list)) == &(rp0->swap_link));
+    assert(!PageOldest(rp0) && page_ref(rp0) == 1);
+    assert(nr_oldest_pages == 0 && list_next(&(lru_gen_list(min_seq + 1)->swap_list)) == &(rp0->swap_link));
 
     page_ref_dec(rp0);
-    refill_inactive_scan();
-    assert(!PageActive(rp0));
+    lru_gen_age();
+    assert(PageOldest(rp0) && !PageYoungest(rp0));
 
     // save data in rp0
 
@@ -794,8 +897,8 @@ check_swap(void) {
     }
 
     page_launder();
-    assert(nr_inactive_pages == 0 && list_empty(&(inactive_list.swap_list)));
-    assert(mem_map[1] == 1);
+    assert(nr_lru_pages == 0 && list_empty(&(lru_gen_list(min_seq)->swap_list)));
+    assert(mem_map[1] == 1 && shadow_map[1] != 0);
 
     rp1 = alloc_page();
     assert(rp1 != NULL);
@@ -806,17 +909,17 @@ check_swap(void) {
         assert(((char *)page2kva(rp1))[i] == (char)i);
     }
 
-    // page fault now
+    // page fault now, refault distance is 0, so the page is activated
 
     *(char *)0 = 0xEF;
 
     rp0 = pte2page(*ptep0);
-    assert(page_ref(rp0) == 1);
-    assert(PageSwap(rp0) && PageActive(rp0));
+    assert(page_ref(rp0) == 1 && shadow_map[1] == 0);
+    assert(PageSwap(rp0) && PageYoungest(rp0));
 
     entry = try_alloc_swap_entry();
     assert(swap_offset(entry) == 1 && mem_map[1] == SWAP_UNUSED);
-    assert(!PageSwap(rp0) && nr_active_pages == 0 && nr_inactive_pages == 0);
+    assert(!PageSwap(rp0) && nr_lru_pages == 0);
 
     // clear accessed flag
 
@@ -834,7 +937,7 @@ check_swap(void) {
     assert(*ptep0 == entry && page_ref(rp0) == 0 && mem_map[1] == 1);
 
     count = nr_free_pages();
-    refill_inactive_scan();
+    lru_gen_age();
     page_launder();
     assert(count + 1 == nr_free_pages());
 
@@ -863,13 +966,14 @@ check_swap(void) {
 
     rp0 = pte2page(*ptep0);
     rp1 = pte2page(*ptep1);
-    assert(!PageSwap(rp0) && PageSwap(rp1) && PageActive(rp1));
+    assert(!PageSwap(rp0) && PageSwap(rp1) && PageYoungest(rp1));
 
     entry = try_alloc_swap_entry();
     assert(!PageSwap(rp0) && !PageSwap(rp1));
     assert(swap_offset(entry) == 1 && mem_map[1] == SWAP_UNUSED);
-    assert(list_empty(&(active_list.swap_list)));
-    assert(list_empty(&(inactive_list.swap_list)));
+    for (i = 0; i < MAX_NR_GENS; i ++) {
+        assert(list_empty(&(lru_gens[i].swap_list)));
+    }
 
     page_insert(pgdir, rp0, PGSIZE, perm | PTE_A);
 
@@ -886,7 +990,7 @@ check_swap(void) {
     assert(ret == 2);
     assert(mem_map[1] == 2 && page_ref(rp0) == 0);
 
-    refill_inactive_scan();
+    lru_gen_age();
     page_launder();
     assert(mem_map[1] == 2 && swap_hash_find(entry) == NULL);
 
@@ -919,12 +1023,14 @@ check_swap(void) {
 
     // free memory
 
-    swap_list_del(rp0), swap_list_del(rp1);
+    lru_gen_del(rp0), lru_gen_del(rp1);
     swap_page_del(rp0), swap_page_del(rp1);
 
     assert(page_ref(rp0) == 1 && page_ref(rp1) == 1);
-    assert(nr_active_pages == 0 && list_empty(&(active_list.swap_list)));
-    assert(nr_inactive_pages == 0 && list_empty(&(inactive_list.swap_list)));
+    assert(nr_lru_pages == 0);
+    for (i = 0; i < MAX_NR_GENS; i ++) {
+        assert(lru_gens[i].nr_pages == 0 && list_empty(&(lru_gens[i].swap_list)));
+    }
 
     for (i = 0; i < HASH_LIST_SIZE; i ++) {
         assert(list_empty(hash_list + i));
@@ -942,11 +1048,13 @@ check_swap(void) {
     mm_destroy(mm);
     check_mm_struct = NULL;
 
-    assert(nr_active_pages == 0 && nr_inactive_pages == 0);
+    assert(nr_lru_pages == 0);
     for (offset = 0; offset < max_swap_offset; offset ++) {
         mem_map[offset] = SWAP_UNUSED;
+        shadow_map[offset] = 0;
     }
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
@@ -955,6 +1063,7 @@ check_swap(void) {
 
 static void
 check_mm_swap(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -1017,6 +1126,7 @@ check_mm_swap(void) {
 
     mm_destroy(mm0);
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
@@ -1179,6 +1289,17 @@ check_mm_swap(void) {
     ret = dup_mmap(mm1, mm0);
     assert(ret == 0);
 
+    // the page table is shared by mm0 and mm1 now, swapping mm1 out leaves it alone
+
+    ret = 0;
+    ret += swap_out_mm(mm1, 10);
+    ret += swap_out_mm(mm1, 10);
+    assert(ret == 0);
+    for (i = 4, addr1 = addr0 + 4 * PGSIZE; i < 8; i ++, addr1 += PGSIZE) {
+        ptep = get_pte(mm0->pgdir, addr1, 0);
+        assert(ptep != NULL && (*ptep & PTE_P));
+    }
+
     // switch to mm1
 
     check_mm_struct = mm1;
@@ -1190,6 +1311,13 @@ check_mm_swap(void) {
         *(char *)addr1 = (char)0x88;
     }
 
+    // mm1 has a page table of its own now, swap its pages out
+
+    ret = 0;
+    ret += swap_out_mm(mm1, 10);
+    ret += swap_out_mm(mm1, 10);
+    assert(ret != 0);
+
     // switch to mm0
 
     check_mm_struct = mm0;
@@ -1200,6 +1328,16 @@ check_mm_swap(void) {
         assert(*(char *)addr1 == (char)(i * i));
     }
 
+    // switch to mm1, and swap its pages back in
+
+    check_mm_struct = mm1;
+    lcr3(PADDR(mm1->pgdir));
+
+    addr1 = addr0;
+    for (i = 0; i < 8; i ++, addr1 += PGSIZE) {
+        assert(*(char *)addr1 == (char)0x88);
+    }
+
     // switch to boot_cr3
 
     check_mm_struct = NULL;
@@ -1217,12 +1355,13 @@ check_mm_swap(void) {
 
     cprintf("check_mm_swap: step4, dup_mmap ok.\n");
 
-    refill_inactive_scan();
+    lru_gen_age();
     page_launder();
     for (i = 0; i < max_swap_offset; i ++) {
         assert(mem_map[i] == SWAP_UNUSED);
     }
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
@@ -1231,6 +1370,7 @@ check_mm_swap(void) {
 
 static void
 check_mm_shm_swap(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -1306,10 +1446,10 @@ check_mm_shm_swap(void) {
     // check swap
 
     ret = swap_out_mm(mm0, 8) + swap_out_mm(mm0, 8);
-    assert(ret == 8 && nr_active_pages == 4 && nr_inactive_pages == 0);
+    assert(ret == 8 && nr_lru_pages == 4 && nr_oldest_pages == 4);
 
-    refill_inactive_scan();
-    assert(nr_active_pages == 0 && nr_inactive_pages == 4);
+    lru_gen_age();
+    assert(nr_lru_pages == 4 && nr_oldest_pages == 4);
 
     // write & read again
 
@@ -1387,12 +1527,13 @@ check_mm_shm_swap(void) {
     free_page(kva2page(mm0->pgdir));
     mm_destroy(mm0);
 
-    refill_inactive_scan();
+    lru_gen_age();
     page_launder();
     for (i = 0; i < max_swap_offset; i ++) {
         assert(mem_map[i] == SWAP_UNUSED);
     }
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
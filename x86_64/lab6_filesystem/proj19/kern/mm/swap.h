@@ -35,6 +35,7 @@ void swap_remove_entry(swap_entry_t entry);
 int swap_page_count(struct Page *page);
 void swap_duplicate(swap_entry_t entry);
 int swap_in_page(swap_entry_t entry, struct Page **pagep);
+struct Page *swap_lookup_page(swap_entry_t entry);
 int swap_copy_entry(swap_entry_t entry, swap_entry_t *store);
 
 int __noreturn kswapd_main(void *arg);
@@ -11,6 +11,7 @@
 #include <shmem.h>
 #include <proc.h>
 #include <sem.h>
+#include <stdlib.h>
 
 /* 
   vmm design include two parts: mm_struct (mm) & vma_struct (vma)
@@ -34,21 +35,38 @@
      inline struct vma_struct * find_vma_rb(rb_tree *tree, uintptr_t addr) 
      inline void insert_vma_rb(rb_tree *tree, struct vma_struct *vma, ....
      inline int vma_compare(rb_node *node1, rb_node *node2)
+     void vma_gap_augment(rb_tree *tree, rb_node *node)
+     struct vma_struct * vmacache_find(struct mm_struct *mm, uintptr_t addr)
+---------------
+  The rb tree is augmented with the largest free gap below the vmas (between a vma and
+  the one before it) in each subtree, so get_unmapped_area finds a hole in O(log n).
+  Each thread keeps the last few vmas it has found in a small cache in front of find_vma,
+  a thread's cache is valid as long as no vma has been removed from its mm since it
+  was filled (mm->vmacache_seqnum).
 ---------------
    check correctness functions
      void check_vmm(void);
      void check_vma_struct(void);
      void check_pgfault(void);
+     void check_zero_page(void);
+     void check_thp(void);
+     void check_fault_around(void);
 */
 
 static void check_vmm(void);
 static void check_vma_struct(void);
 static void check_pgfault(void);
+static void check_zero_page(void);
+static void check_thp(void);
+static void check_fault_around(void);
+
+static bool thp_enabled = 0;
+static size_t fault_around_pages = 1;
 
 void
 lock_mm(struct mm_struct *mm) {
     if (mm != NULL) {
-        down(&(mm->mm_sem));
+        mutex_lock(&(mm->mm_lock));
         if (current != NULL) {
             mm->locked_by = current->pid;
         }
@@ -58,7 +76,7 @@ lock_mm(struct mm_struct *mm) {
 void
 unlock_mm(struct mm_struct *mm) {
     if (mm != NULL) {
-        up(&(mm->mm_sem));
+        mutex_unlock(&(mm->mm_lock));
         mm->locked_by = 0;
     }
 }
@@ -66,7 +84,7 @@ unlock_mm(struct mm_struct *mm) {
 bool
 try_lock_mm(struct mm_struct *mm) {
     if (mm != NULL) {
-        if (!try_down(&(mm->mm_sem))) {
+        if (!mutex_trylock(&(mm->mm_lock))) {
             return 0;
         }
         if (current != NULL) {
@@ -76,22 +94,27 @@ try_lock_mm(struct mm_struct *mm) {
     return 1;
 }
 
+static kmem_cache_t *mm_cachep, *vma_cachep;
+
 // mm_create -  alloc a mm_struct & initialize it.
 struct mm_struct *
 mm_create(void) {
-    struct mm_struct *mm = kmalloc(sizeof(struct mm_struct));
+    struct mm_struct *mm = kmem_cache_alloc(mm_cachep);
     if (mm != NULL) {
         list_init(&(mm->mmap_list));
         mm->mmap_tree = NULL;
-        mm->mmap_cache = NULL;
+        mm->vmacache_seqnum = 0;
         mm->pgdir = NULL;
         mm->map_count = 0;
         mm->swap_address = 0;
+        mm->nr_faults = 0;
         set_mm_count(mm, 0);
         mm->locked_by = 0;
         mm->brk_start = mm->brk = 0;
         list_init(&(mm->proc_mm_link));
-        sem_init(&(mm->mm_sem), 1);
+        mutex_init(&(mm->mm_lock));
+        mm->vvar = NULL;
+        mm->uring = NULL;
     }
     return mm;
 }
@@ -99,11 +122,12 @@ mm_create(void) {
 // vma_create - alloc a vma_struct & initialize it. (addr range: vm_start~vm_end)
 struct vma_struct *
 vma_create(uintptr_t vm_start, uintptr_t vm_end, uint32_t vm_flags) {
-    struct vma_struct *vma = kmalloc(sizeof(struct vma_struct));
+    struct vma_struct *vma = kmem_cache_alloc(vma_cachep);
     if (vma != NULL) {
         vma->vm_start = vm_start;
         vma->vm_end = vm_end;
         vma->vm_flags = vm_flags;
+        vma->rb_subtree_gap = 0;
         vma->shmem = NULL;
         vma->shmem_off = 0;
     }
@@ -118,7 +142,7 @@ vma_destroy(struct vma_struct *vma) {
             shmem_destroy(vma->shmem);
         }
     }
-    kfree(vma);
+    kmem_cache_free(vma_cachep, vma);
 }
 
 // find_vma_rb - find a vma  (vma->vm_start <= addr <= vma_vm_end) in rb tree
@@ -142,33 +166,79 @@ find_vma_rb(rb_tree *tree, uintptr_t addr) {
     return vma;
 }
 
-// find_vma - find a vma  (vma->vm_start <= addr <= vma_vm_end)
+#define VMACACHE_HASH(addr)         (((addr) >> PGSHIFT) & (VMACACHE_SIZE - 1))
+
+// vmacache_flush - forget the vmas cached by proc, when proc moves to another mm
+void
+vmacache_flush(struct proc_struct *proc) {
+    memset(proc->vmacache, 0, sizeof(proc->vmacache));
+    proc->vmacache_seqnum = 0;
+}
+
+// vmacache_valid - the cache of current can be used on mm only if it's current's own mm,
+//                - and no vma has been removed from mm since the cache was filled
+static inline bool
+vmacache_valid(struct mm_struct *mm) {
+    if (current == NULL || current->mm != mm) {
+        return 0;
+    }
+    if (current->vmacache_seqnum != mm->vmacache_seqnum) {
+        memset(current->vmacache, 0, sizeof(current->vmacache));
+        current->vmacache_seqnum = mm->vmacache_seqnum;
+    }
+    return 1;
+}
+
+// vmacache_find - find the vma containing addr in the cache of current
+static inline struct vma_struct *
+vmacache_find(struct mm_struct *mm, uintptr_t addr) {
+    if (vmacache_valid(mm)) {
+        int i;
+        for (i = 0; i < VMACACHE_SIZE; i ++) {
+            struct vma_struct *vma = current->vmacache[i];
+            if (vma != NULL && vma->vm_start <= addr && vma->vm_end > addr) {
+                return vma;
+            }
+        }
+    }
+    return NULL;
+}
+
+static inline void
+vmacache_update(struct mm_struct *mm, uintptr_t addr, struct vma_struct *vma) {
+    if (vmacache_valid(mm)) {
+        current->vmacache[VMACACHE_HASH(addr)] = vma;
+    }
+}
+
+// find_vma - find the first vma with addr < vma->vm_end, which contains addr
+//          - if vma->vm_start <= addr
 struct vma_struct *
 find_vma(struct mm_struct *mm, uintptr_t addr) {
     struct vma_struct *vma = NULL;
     if (mm != NULL) {
-        vma = mm->mmap_cache;
-        if (!(vma != NULL && vma->vm_start <= addr && vma->vm_end > addr)) {
-            if (mm->mmap_tree != NULL) {
-                vma = find_vma_rb(mm->mmap_tree, addr);
-            }
-            else {
-                bool found = 0;
-                list_entry_t *list = &(mm->mmap_list), *le = list;
-                while ((le = list_next(le)) != list) {
-                    vma = le2vma(le, list_link);
-                    if (addr < vma->vm_end) {
-                        found = 1;
-                        break;
-                    }
-                }
-                if (!found) {
-                    vma = NULL;
+        if ((vma = vmacache_find(mm, addr)) != NULL) {
+            return vma;
+        }
+        if (mm->mmap_tree != NULL) {
+            vma = find_vma_rb(mm->mmap_tree, addr);
+        }
+        else {
+            bool found = 0;
+            list_entry_t *list = &(mm->mmap_list), *le = list;
+            while ((le = list_next(le)) != list) {
+                vma = le2vma(le, list_link);
+                if (addr < vma->vm_end) {
+                    found = 1;
+                    break;
                 }
             }
+            if (!found) {
+                vma = NULL;
+            }
         }
-        if (vma != NULL) {
-            mm->mmap_cache = vma;
+        if (vma != NULL && vma->vm_start <= addr) {
+            vmacache_update(mm, addr, vma);
         }
     }
     return vma;
@@ -200,17 +270,47 @@ check_vma_overlap(struct vma_struct *prev, struct vma_struct *next) {
     assert(next->vm_start < next->vm_end);
 }
 
-// insert_vma_rb - insert vma in rb tree according vma->start_addr
+// vma_gap - the free gap between vma and the vma before it (or USERBASE)
+static inline uintptr_t
+vma_gap(struct vma_struct *vma) {
+    list_entry_t *le = list_prev(&(vma->list_link));
+    uintptr_t prev_end = USERBASE;
+    if (le != &(vma->vm_mm->mmap_list)) {
+        prev_end = le2vma(le, list_link)->vm_end;
+    }
+    return (vma->vm_start > prev_end) ? vma->vm_start - prev_end : 0;
+}
+
+// vma_gap_augment - rb_subtree_gap of a node is the largest of its own gap and the
+//                 - rb_subtree_gap of its children
+static void
+vma_gap_augment(rb_tree *tree, rb_node *node) {
+    uintptr_t gap = vma_gap(rbn2vma(node, rb_link));
+    rb_node *child;
+    if ((child = rb_node_left(tree, node)) != NULL && rbn2vma(child, rb_link)->rb_subtree_gap > gap) {
+        gap = rbn2vma(child, rb_link)->rb_subtree_gap;
+    }
+    if ((child = rb_node_right(tree, node)) != NULL && rbn2vma(child, rb_link)->rb_subtree_gap > gap) {
+        gap = rbn2vma(child, rb_link)->rb_subtree_gap;
+    }
+    rbn2vma(node, rb_link)->rb_subtree_gap = gap;
+}
+
+// vma_gap_update_next - the end of vma has moved, or a vma has been put in or taken out
+//                     - before le, so the gap of the vma at le changes
 static inline void
-insert_vma_rb(rb_tree *tree, struct vma_struct *vma, struct vma_struct **vma_prevp) {
-    rb_node *node = &(vma->rb_link), *prev;
-    rb_insert(tree, node);
-    if (vma_prevp != NULL) {
-        prev = rb_node_prev(tree, node);
-        *vma_prevp = (prev != NULL) ? rbn2vma(prev, rb_link) : NULL;
+vma_gap_update_next(struct mm_struct *mm, list_entry_t *le) {
+    if (mm->mmap_tree != NULL && le != &(mm->mmap_list)) {
+        rb_augment_propagate(mm->mmap_tree, &(le2vma(le, list_link)->rb_link));
     }
 }
 
+// insert_vma_rb - insert vma in rb tree according vma->start_addr, vma must be in the list
+static inline void
+insert_vma_rb(rb_tree *tree, struct vma_struct *vma) {
+    rb_insert(tree, &(vma->rb_link));
+}
+
 // insert_vma_struct -insert vma in mm's rb tree link & list link
 void
 insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
@@ -218,11 +318,8 @@ insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
     list_entry_t *list = &(mm->mmap_list);
     list_entry_t *le_prev = list, *le_next;
     if (mm->mmap_tree != NULL) {
-        struct vma_struct *mmap_prev;
-        insert_vma_rb(mm->mmap_tree, vma, &mmap_prev);
-        if (mmap_prev != NULL) {
-            le_prev = &(mmap_prev->list_link);
-        }
+        struct vma_struct *mmap_next = find_vma_rb(mm->mmap_tree, vma->vm_start);
+        le_prev = list_prev((mmap_next != NULL) ? &(mmap_next->list_link) : list);
     }
     else {
         list_entry_t *le = list;
@@ -247,17 +344,21 @@ insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
 
     vma->vm_mm = mm;
     list_add_after(le_prev, &(vma->list_link));
+    if (mm->mmap_tree != NULL) {
+        insert_vma_rb(mm->mmap_tree, vma);
+        vma_gap_update_next(mm, le_next);
+    }
 
     mm->map_count ++;
     if (mm->mmap_tree == NULL && mm->map_count >= RB_MIN_MAP_COUNT) {
 
         /* try to build red-black tree now, but may fail. */
-        mm->mmap_tree = rb_tree_create(vma_compare);
+        mm->mmap_tree = rb_tree_create_augmented(vma_compare, vma_gap_augment);
 
         if (mm->mmap_tree != NULL) {
             list_entry_t *list = &(mm->mmap_list), *le = list;
             while ((le = list_next(le)) != list) {
-                insert_vma_rb(mm->mmap_tree, le2vma(le, list_link), NULL);
+                insert_vma_rb(mm->mmap_tree, le2vma(le, list_link));
             }
         }
     }
@@ -267,13 +368,13 @@ insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
 static int
 remove_vma_struct(struct mm_struct *mm, struct vma_struct *vma) {
     assert(mm == vma->vm_mm);
+    list_entry_t *le_next = list_next(&(vma->list_link));
+    list_del(&(vma->list_link));
     if (mm->mmap_tree != NULL) {
         rb_delete(mm->mmap_tree, &(vma->rb_link));
+        vma_gap_update_next(mm, le_next);
     }
-    list_del(&(vma->list_link));
-    if (vma == mm->mmap_cache) {
-        mm->mmap_cache = NULL;
-    }
+    mm->vmacache_seqnum ++;
     mm->map_count --;
     return 0;
 }
@@ -290,13 +391,17 @@ mm_destroy(struct mm_struct *mm) {
         list_del(le);
         vma_destroy(le2vma(le, list_link));
     }
-    kfree(mm);
+    kmem_cache_free(mm_cachep, mm);
 }
 
 // vmm_init - initialize virtual memory management
-//          - now just call check_vmm to check correctness of vmm
+//          - create the caches for mm_struct and vma_struct, then check correctness of vmm
 void
 vmm_init(void) {
+    if ((mm_cachep = kmem_cache_create("mm_struct", sizeof(struct mm_struct), 0, NULL)) == NULL ||
+        (vma_cachep = kmem_cache_create("vma_struct", sizeof(struct vma_struct), 0, NULL)) == NULL) {
+        panic("vmm_init: cannot create caches.\n");
+    }
     check_vmm();
 }
 
@@ -363,6 +468,16 @@ vma_resize(struct vma_struct *vma, uintptr_t start, uintptr_t end) {
     vma->vm_start = start, vma->vm_end = end;
 }
 
+static int
+unshare_pmd_boundary(struct mm_struct *mm, uintptr_t la) {
+    if (la % PTSIZE != 0) {
+        if (split_huge_pmd(mm->pgdir, la) != 0 || unshare_pgtable(mm->pgdir, la) != 0) {
+            return -E_NO_MEM;
+        }
+    }
+    return 0;
+}
+
 int
 mm_unmap(struct mm_struct *mm, uintptr_t addr, size_t len) {
     uintptr_t start = ROUNDDOWN(addr, PGSIZE), end = ROUNDUP(addr + len, PGSIZE);
@@ -377,6 +492,15 @@ mm_unmap(struct mm_struct *mm, uintptr_t addr, size_t len) {
         return 0;
     }
 
+    // the huge pages and the page tables shared by fork crossing the boundaries of the range
+    // are split and unshared before any vma changes
+    if (unshare_pmd_boundary(mm, start) != 0 || unshare_pmd_boundary(mm, end) != 0) {
+        return -E_NO_MEM;
+    }
+
+    struct mmu_gather tlb;
+    tlb_gather_mmu(&tlb, mm->pgdir);
+
     if (vma->vm_start < start && end < vma->vm_end) {
         struct vma_struct *nvma;
         if ((nvma = vma_create(vma->vm_start, start, vma->vm_flags)) == NULL) {
@@ -384,7 +508,8 @@ mm_unmap(struct mm_struct *mm, uintptr_t addr, size_t len) {
         }
         vma_resize(vma, end, vma->vm_end);
         insert_vma_struct(mm, nvma);
-        unmap_range(mm->pgdir, start, end);
+        unmap_range(&tlb, start, end);
+        tlb_finish_mmu(&tlb);
         return 0;
     }
 
@@ -421,8 +546,9 @@ mm_unmap(struct mm_struct *mm, uintptr_t addr, size_t len) {
                 vma_destroy(vma);
             }
         }
-        unmap_range(mm->pgdir, un_start, un_end);
+        unmap_range(&tlb, un_start, un_end);
     }
+    tlb_finish_mmu(&tlb);
     return 0;
 }
 
@@ -456,23 +582,26 @@ dup_mmap(struct mm_struct *to, struct mm_struct *from) {
 void
 exit_mmap(struct mm_struct *mm) {
     assert(mm != NULL && mm_count(mm) == 0);
-    pgd_t *pgdir = mm->pgdir;
+    struct mmu_gather tlb;
+    tlb_gather_mmu(&tlb, mm->pgdir);
     list_entry_t *list = &(mm->mmap_list), *le = list;
     while ((le = list_next(le)) != list) {
         struct vma_struct *vma = le2vma(le, list_link);
-        unmap_range(pgdir, vma->vm_start, vma->vm_end);
+        unmap_range(&tlb, vma->vm_start, vma->vm_end);
     }
+    unmap_range(&tlb, USERTOP, UKMAPTOP);
     while ((le = list_next(le)) != list) {
         struct vma_struct *vma = le2vma(le, list_link);
-        exit_range(pgdir, vma->vm_start, vma->vm_end);
+        exit_range(&tlb, vma->vm_start, vma->vm_end);
     }
+    exit_range(&tlb, USERTOP, UKMAPTOP);
+    mm->vvar = NULL;
+    tlb_finish_mmu(&tlb);
 }
 
-uintptr_t
-get_unmapped_area(struct mm_struct *mm, size_t len) {
-    if (len == 0 || len > USERTOP) {
-        return 0;
-    }
+// unmapped_area_list - find the highest hole of len bytes, walking down the vma list
+static uintptr_t
+unmapped_area_list(struct mm_struct *mm, size_t len) {
     uintptr_t start = USERTOP - len;
     list_entry_t *list = &(mm->mmap_list), *le = list;
     while ((le = list_prev(le)) != list) {
@@ -490,6 +619,43 @@ get_unmapped_area(struct mm_struct *mm, size_t len) {
     return (start >= USERBASE) ? start : 0;
 }
 
+// unmapped_area_tree - find the highest hole of len bytes, going down the rb tree into
+//                    - the rightmost subtree whose rb_subtree_gap is large enough
+static uintptr_t
+unmapped_area_tree(struct mm_struct *mm, size_t len) {
+    uintptr_t start = USERTOP - len;
+    list_entry_t *list = &(mm->mmap_list), *le = list_prev(list);
+    if (le == list || le2vma(le, list_link)->vm_end <= start) {
+        return (start >= USERBASE) ? start : 0;
+    }
+    rb_tree *tree = mm->mmap_tree;
+    rb_node *node = rb_node_root(tree), *right;
+    while (node != NULL && rbn2vma(node, rb_link)->rb_subtree_gap >= len) {
+        struct vma_struct *vma = rbn2vma(node, rb_link);
+        if ((right = rb_node_right(tree, node)) != NULL && rbn2vma(right, rb_link)->rb_subtree_gap >= len) {
+            node = right;
+        }
+        else if (vma_gap(vma) >= len) {
+            return vma->vm_start - len;
+        }
+        else {
+            node = rb_node_left(tree, node);
+        }
+    }
+    return 0;
+}
+
+uintptr_t
+get_unmapped_area(struct mm_struct *mm, size_t len) {
+    if (len == 0 || len > USERTOP) {
+        return 0;
+    }
+    if (mm->mmap_tree != NULL) {
+        return unmapped_area_tree(mm, len);
+    }
+    return unmapped_area_list(mm, len);
+}
+
 int
 mm_brk(struct mm_struct *mm, uintptr_t addr, size_t len) {
     uintptr_t start = ROUNDDOWN(addr, PGSIZE), end = ROUNDUP(addr + len, PGSIZE);
@@ -505,6 +671,7 @@ mm_brk(struct mm_struct *mm, uintptr_t addr, size_t len) {
     struct vma_struct *vma = find_vma(mm, start - 1);
     if (vma != NULL && vma->vm_end == start && vma->vm_flags == vm_flags) {
         vma->vm_end = end;
+        vma_gap_update_next(mm, list_next(&(vma->list_link)));
         return 0;
     }
     if ((vma = vma_create(start, end, vm_flags)) == NULL) {
@@ -585,12 +752,15 @@ copy_string(struct mm_struct *mm, char *dst, const char *src, size_t maxn) {
 // check_vmm - check correctness of vmm
 static void
 check_vmm(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
     check_vma_struct();
     check_pgfault();
+    check_zero_page();
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
@@ -599,6 +769,7 @@ check_vmm(void) {
 
 static void
 check_vma_struct(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -641,6 +812,32 @@ check_vma_struct(void) {
 
     mm_destroy(mm);
 
+    // vmas of 1 or 2 pages with random gaps below USERTOP, the holes found by the gaps
+    // in the rb tree must be the ones found by walking the list
+    assert((mm = mm_create()) != NULL);
+    uintptr_t end = USERTOP;
+    for (i = 0; i < step2; i ++) {
+        uintptr_t start = end - (rand() % 2 + 1) * PGSIZE;
+        struct vma_struct *vma = vma_create(start, end, 0);
+        assert(vma != NULL);
+        insert_vma_struct(mm, vma);
+        end = start - (rand() % 16) * PGSIZE;
+    }
+    assert(mm->mmap_tree != NULL);
+    for (i = 0; i < step2; i ++) {
+        size_t len = (rand() % 20 + 1) * PGSIZE;
+        assert(unmapped_area_tree(mm, len) == unmapped_area_list(mm, len));
+        if (i % 3 == 0) {
+            struct vma_struct *vma = find_vma(mm, end + (rand() % (USERTOP - end)));
+            if (vma != NULL) {
+                remove_vma_struct(mm, vma);
+                vma_destroy(vma);
+            }
+        }
+    }
+    mm_destroy(mm);
+
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
@@ -652,6 +849,7 @@ struct mm_struct *check_mm_struct;
 // check_pgfault - check correctness of pgfault handler
 static void
 check_pgfault(void) {
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -690,12 +888,264 @@ check_pgfault(void) {
     mm_destroy(mm);
     check_mm_struct = NULL;
 
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
 
     cprintf("check_pgfault() succeeded!\n");
 }
 
+// check_zero_page - check that read faults share the zero page, and the first write copies it
+static void
+check_zero_page(void) {
+    slab_reap();
+    size_t nr_free_pages_store = nr_free_pages();
+    size_t slab_allocated_store = slab_allocated();
+
+    check_mm_struct = mm_create();
+    assert(check_mm_struct != NULL);
+
+    struct mm_struct *mm = check_mm_struct;
+    pgd_t *pgdir = mm->pgdir = boot_pgdir;
+    assert(pgdir[0] == 0);
+
+    uintptr_t base = USERBASE;
+    struct vma_struct *vma = vma_create(base, base + PGSIZE * 2, VM_READ | VM_WRITE);
+    assert(vma != NULL);
+
+    insert_vma_struct(mm, vma);
+
+    int ref = page_ref(zero_page);
+    assert(*(char *)(base + 0x100) == 0 && *(char *)(base + PGSIZE + 0x100) == 0);
+    pte_t *ptep0 = get_pte(pgdir, base, 0), *ptep1 = get_pte(pgdir, base + PGSIZE, 0);
+    assert(ptep0 != NULL && ptep1 != NULL && page_ref(zero_page) == ref + 2);
+    assert(pte2page(*ptep0) == zero_page && !(*ptep0 & PTE_W));
+    assert(pte2page(*ptep1) == zero_page && !(*ptep1 & PTE_W));
+
+    *(char *)(base + 0x100) = 0x1;
+    assert(pte2page(*ptep0) != zero_page && (*ptep0 & PTE_W) && page_ref(zero_page) == ref + 1);
+    assert(*(char *)(base + 0x101) == 0 && *(char *)(base + PGSIZE + 0x100) == 0);
+    assert(*(char *)(page2kva(zero_page) + 0x100) == 0);
+
+    exit_mmap(mm);
+    assert(pgdir[0] == 0 && page_ref(zero_page) == ref);
+
+    mm->pgdir = NULL;
+    mm_destroy(mm);
+    check_mm_struct = NULL;
+
+    slab_reap();
+    assert(nr_free_pages_store == nr_free_pages());
+    assert(slab_allocated_store == slab_allocated());
+
+    cprintf("check_zero_page() succeeded!\n");
+}
+
+// check_thp - check the huge page fault, and the splits for fork and partial munmap,
+//           - the fork also shares the split page table until the first write
+static void
+check_thp(void) {
+    slab_reap();
+    size_t nr_free_pages_store = nr_free_pages();
+    size_t slab_allocated_store = slab_allocated();
+
+    check_mm_struct = mm_create();
+    assert(check_mm_struct != NULL);
+
+    struct mm_struct *mm = check_mm_struct;
+    pgd_t *pgdir = mm->pgdir = boot_pgdir;
+    assert(pgdir[0] == 0);
+
+    uintptr_t base = USERBASE, addr;
+    struct vma_struct *vma = vma_create(base, base + PTSIZE * 2, VM_READ | VM_WRITE);
+    assert(vma != NULL);
+
+    insert_vma_struct(mm, vma);
+
+    *(char *)(base + 0x100) = 0x1;
+    pmd_t *pmdp = get_pmd(pgdir, base, 0);
+    assert(pmdp != NULL && (*pmdp & PTE_PS) && nr_huge_pages(pgdir) == 1);
+
+    struct Page *page = pa2page(PMD_ADDR(*pmdp));
+    assert(page_ref(page) == 1);
+    for (addr = base; addr < base + PTSIZE; addr += PGSIZE) {
+        *(uintptr_t *)(addr + 0x100) = addr;
+    }
+
+    struct Page *pgdir_page = alloc_page();
+    assert(pgdir_page != NULL);
+    pgd_t *npgdir = page2kva(pgdir_page);
+    memset(npgdir, 0, PGSIZE);
+    pgdir_init(npgdir);
+
+    assert(copy_range(npgdir, pgdir, base, base + PTSIZE, 0) == 0);
+    assert(!(*pmdp & PTE_PS) && nr_huge_pages(pgdir) == 0 && nr_huge_pages(npgdir) == 0);
+
+    pmd_t *npmdp = get_pmd(npgdir, base, 0);
+    assert(npmdp != NULL && *npmdp == *pmdp && !(*pmdp & PTE_W) && page_ref(pmd2page(*pmdp)) == 2);
+
+    *(uintptr_t *)(base + 0x100) = 0;
+    assert((*pmdp & PTE_W) && PMD_ADDR(*pmdp) != PMD_ADDR(*npmdp) && page_ref(pmd2page(*npmdp)) == 1);
+    for (addr = base; addr < base + PTSIZE; addr += PGSIZE) {
+        struct Page *p = page + (addr - base) / PGSIZE;
+        pte_t *nptep = get_pte(npgdir, addr, 0);
+        assert(nptep != NULL && pte2page(*nptep) == p && !(*nptep & PTE_W));
+        assert(*(uintptr_t *)(page2kva(p) + 0x100) == addr);
+        if (addr != base) {
+            assert(page_ref(p) == 2 && *(uintptr_t *)(addr + 0x100) == addr);
+        }
+    }
+    assert(page_ref(page) == 1 && *(uintptr_t *)(base + 0x100) == 0);
+
+    struct mmu_gather tlb;
+    tlb_gather_mmu(&tlb, npgdir);
+    unmap_range(&tlb, base, base + PTSIZE);
+    exit_range(&tlb, base, base + PTSIZE);
+    tlb_finish_mmu(&tlb);
+    free_page(pgdir_page);
+
+    *(char *)(base + PTSIZE + 0x100) = 0x2;
+    assert(nr_huge_pages(pgdir) == 1);
+    assert(mm_unmap(mm, base + PTSIZE + PGSIZE, PGSIZE) == 0);
+    assert(nr_huge_pages(pgdir) == 0 && get_page(pgdir, base + PTSIZE + PGSIZE, NULL) == NULL);
+    assert(get_page(pgdir, base + PTSIZE, NULL) != NULL && *(char *)(base + PTSIZE + 0x100) == 0x2);
+
+    exit_mmap(mm);
+    assert(pgdir[0] == 0);
+
+    mm->pgdir = NULL;
+    mm_destroy(mm);
+    check_mm_struct = NULL;
+
+    slab_reap();
+    assert(nr_free_pages_store == nr_free_pages());
+    assert(slab_allocated_store == slab_allocated());
+
+    cprintf("check_thp() succeeded!\n");
+}
+
+// thp_init - let the anonymous vmas fault in huge pages, then check the huge page paths
+void
+thp_init(void) {
+    thp_enabled = 1;
+    check_thp();
+}
+
+// check_fault_around - check that sequential touches trap once per window instead of once per page
+static void
+check_fault_around(void) {
+    slab_reap();
+    size_t nr_free_pages_store = nr_free_pages();
+    size_t slab_allocated_store = slab_allocated();
+
+    check_mm_struct = mm_create();
+    assert(check_mm_struct != NULL);
+
+    struct mm_struct *mm = check_mm_struct;
+    pgd_t *pgdir = mm->pgdir = boot_pgdir;
+    assert(pgdir[0] == 0);
+
+    size_t n = FAULT_AROUND_PAGES * 4, i;
+    uintptr_t base = USERBASE;
+    struct vma_struct *vma = vma_create(base, base + n * PGSIZE, VM_READ | VM_WRITE);
+    assert(vma != NULL);
+
+    insert_vma_struct(mm, vma);
+
+    size_t window = fault_around_pages, before, after;
+    fault_around_pages = 1;
+    for (i = 0; i < n / 2; i ++) {
+        *(char *)(base + i * PGSIZE + 0x100) = i;
+    }
+    before = mm->nr_faults;
+    assert(before == n / 2);
+
+    fault_around_pages = FAULT_AROUND_PAGES;
+    for (i = n / 2; i < n; i ++) {
+        *(char *)(base + i * PGSIZE + 0x100) = i;
+    }
+    after = mm->nr_faults - before;
+    assert(after == n / 2 / FAULT_AROUND_PAGES);
+    for (i = 0; i < n; i ++) {
+        assert(*(char *)(base + i * PGSIZE + 0x100) == (char)i);
+    }
+    fault_around_pages = window;
+
+    cprintf("fault-around: %d pages, %d faults before, %d faults after.\n", n / 2, before, after);
+
+    exit_mmap(mm);
+    assert(pgdir[0] == 0);
+
+    mm->pgdir = NULL;
+    mm_destroy(mm);
+    check_mm_struct = NULL;
+
+    slab_reap();
+    assert(nr_free_pages_store == nr_free_pages());
+    assert(slab_allocated_store == slab_allocated());
+
+    cprintf("check_fault_around() succeeded!\n");
+}
+
+// fault_around_init - populate FAULT_AROUND_PAGES pages per page fault from now on
+void
+fault_around_init(void) {
+    check_fault_around();
+    fault_around_pages = FAULT_AROUND_PAGES;
+}
+
+// do_fault_around - populate the empty and swap cached ptes around addr, in the same page table
+//                 - and under the same mm lock, so sequential touches do not trap once per page
+//                 - a read fault fills the empty anonymous ptes with the zero page
+static void
+do_fault_around(struct mm_struct *mm, struct vma_struct *vma, uintptr_t addr, uint32_t perm, bool write) {
+    size_t size = fault_around_pages * PGSIZE;
+    if (size <= PGSIZE) {
+        return ;
+    }
+    assert(PTSIZE % size == 0);
+
+    uintptr_t start = ROUNDDOWN(addr, size), end = start + size, vm_start = vma->vm_start;
+    if (vma->vm_flags & VM_STACK) {
+        vm_start += PGSIZE;
+    }
+    if (start < vm_start) {
+        start = vm_start;
+    }
+    if (end > vma->vm_end) {
+        end = vma->vm_end;
+    }
+
+    bool cow = ((vma->vm_flags & (VM_SHARE | VM_WRITE)) == VM_WRITE);
+    pte_t *pte = get_pte(mm->pgdir, addr, 0) - PTX(addr);
+    for (; start < end; start += PGSIZE) {
+        pte_t *ptep = &pte[PTX(start)];
+        if (start == addr || (*ptep & PTE_P)) {
+            continue ;
+        }
+        if (*ptep != 0) {
+            struct Page *page = swap_lookup_page(*ptep);
+            if (page != NULL) {
+                page_insert(mm->pgdir, page, start, cow ? (perm & ~PTE_W) : perm);
+            }
+        }
+        else if (vma->vm_flags & VM_SHARE) {
+            lock_shmem(vma->shmem);
+            pte_t *sh_ptep = shmem_get_entry(vma->shmem, start - vma->vm_start + vma->shmem_off, 0);
+            if (sh_ptep != NULL && (*sh_ptep & PTE_P)) {
+                page_insert(mm->pgdir, pa2page(*sh_ptep), start, perm);
+            }
+            unlock_shmem(vma->shmem);
+        }
+        else if (!write && cow) {
+            page_insert(mm->pgdir, zero_page, start, perm & ~PTE_W);
+        }
+        else if (pgdir_alloc_page(mm->pgdir, start, perm) == NULL) {
+            break;
+        }
+    }
+}
+
 int
 do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr) {
     if (mm == NULL) {
@@ -713,6 +1163,7 @@ do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr) {
             lock_mm(mm);
         }
     }
+    mm->nr_faults ++;
 
     int ret = -E_INVAL;
     struct vma_struct *vma = find_vma(mm, addr);
@@ -750,12 +1201,33 @@ do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr) {
     ret = -E_NO_MEM;
     pte_t *ptep;
 
+    if (thp_enabled && (error_code & 2) && !(vma->vm_flags & (VM_SHARE | VM_STACK))) {
+        uintptr_t start = ROUNDDOWN(addr, PTSIZE);
+        if (vma->vm_start <= start && start + PTSIZE <= vma->vm_end) {
+            if (pgdir_alloc_huge_page(mm->pgdir, start, perm) != NULL) {
+                ret = 0;
+                goto failed;
+            }
+        }
+    }
+    if (split_huge_pmd(mm->pgdir, addr) != 0 || unshare_pgtable(mm->pgdir, addr) != 0) {
+        goto failed;
+    }
     if ((ptep = get_pte(mm->pgdir, addr, 1)) == NULL) {
         goto failed;
     }
+    if ((*ptep & PTE_P) && (*ptep & PTE_W)) {
+        // only the pmd was read-only, the page table is no longer shared
+        ret = 0;
+        goto failed;
+    }
+    bool around = !(*ptep & PTE_P);
     if (*ptep == 0) {
         if (!(vma->vm_flags & VM_SHARE)) {
-            if (pgdir_alloc_page(mm->pgdir, addr, perm) == NULL) {
+            if (!(error_code & 2) && (perm & PTE_W)) {
+                page_insert(mm->pgdir, zero_page, addr, perm & ~PTE_W);
+            }
+            else if (pgdir_alloc_page(mm->pgdir, addr, perm) == NULL) {
                 goto failed;
             }
         }
@@ -806,7 +1278,12 @@ do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr) {
                 if (newpage == NULL) {
                     goto failed;
                 }
-                memcpy(page2kva(newpage), page2kva(page), PGSIZE);
+                if (page == zero_page) {
+                    memset(page2kva(newpage), 0, PGSIZE);
+                }
+                else {
+                    memcpy(page2kva(newpage), page2kva(page), PGSIZE);
+                }
                 page = newpage, newpage = NULL;
             }
         }
@@ -815,6 +1292,9 @@ do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr) {
             free_page(newpage);
         }
     }
+    if (around) {
+        do_fault_around(mm, vma, addr, perm, error_code & 2);
+    }
     ret = 0;
 
 failed:
@@ -9,9 +9,12 @@
 #include <shmem.h>
 #include <atomic.h>
 #include <sem.h>
+#include <mutex.h>
 
 //pre define
 struct mm_struct;
+struct vvar;
+struct uring_ctx;
 
 // the virtual continuous memory area(vma)
 struct vma_struct {
@@ -20,6 +23,7 @@ struct vma_struct {
     uintptr_t vm_end;        // end addr of vma
     uint32_t vm_flags;       // flags of vma
     rb_node rb_link;         // redblack link which sorted by start addr of vma
+    uintptr_t rb_subtree_gap;// the largest free gap below a vma in its rb subtree
     list_entry_t list_link;  // linear list link which sorted by start addr of vma
     struct shmem_struct *shmem;
     size_t shmem_off;
@@ -37,18 +41,23 @@ struct vma_struct {
 #define VM_STACK                0x00000008
 #define VM_SHARE                0x00000010
 
+#define FAULT_AROUND_PAGES      16      // the number of pages populated around a page fault
+
 struct mm_struct {
     list_entry_t mmap_list;
     rb_tree *mmap_tree;
-    struct vma_struct *mmap_cache;
+    uint64_t vmacache_seqnum;       // bumped when a vma is removed, invalidates the vmacache of threads
     pgd_t *pgdir;
     int map_count;
     uintptr_t swap_address;
+    size_t nr_faults;
     atomic_t mm_count;
     int locked_by;
     uintptr_t brk_start, brk;
     list_entry_t proc_mm_link;
-    semaphore_t mm_sem;
+    mutex_t mm_lock;
+    struct vvar *vvar;              // the vvar page mapped at UVVAR, see vvar.c
+    struct uring_ctx *uring;        // the ring mapped at URING, see uring.c
 };
 
 void lock_mm(struct mm_struct *mm);
@@ -65,10 +74,15 @@ struct vma_struct *find_vma_intersection(struct mm_struct *mm, uintptr_t start,
 struct vma_struct *vma_create(uintptr_t vm_start, uintptr_t vm_end, uint32_t vm_flags);
 void insert_vma_struct(struct mm_struct *mm, struct vma_struct *vma);
 
+struct proc_struct;
+void vmacache_flush(struct proc_struct *proc);
+
 struct mm_struct *mm_create(void);
 void mm_destroy(struct mm_struct *mm);
 
 void vmm_init(void);
+void thp_init(void);
+void fault_around_init(void);
 int mm_map(struct mm_struct *mm, uintptr_t addr, size_t len, uint32_t vm_flags,
         struct vma_struct **vma_store);
 int mm_map_shmem(struct mm_struct *mm, uintptr_t addr, uint32_t vm_flags,
@@ -79,6 +93,9 @@ void exit_mmap(struct mm_struct *mm);
 uintptr_t get_unmapped_area(struct mm_struct *mm, size_t len);
 int mm_brk(struct mm_struct *mm, uintptr_t addr, size_t len);
 
+int vvar_map(struct mm_struct *mm);
+void vvar_update(struct proc_struct *proc);
+
 int do_pgfault(struct mm_struct *mm, uint64_t error_code, uintptr_t addr);
 bool user_mem_check(struct mm_struct *mm, uintptr_t start, size_t len, bool write);
 
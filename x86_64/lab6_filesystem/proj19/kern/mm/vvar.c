@@ -0,0 +1,55 @@
+#include <defs.h>
+#include <vvar.h>
+#include <vmm.h>
+#include <pmm.h>
+#include <proc.h>
+#include <clock.h>
+#include <x86.h>
+#include <string.h>
+#include <error.h>
+#include <assert.h>
+
+/* *
+ * The vvar page of an mm is mapped at UVVAR outside of the vmas, so no munmap, fork
+ * or swap ever touches it; exit_mmap takes it down with the page tables of the mm.
+ * A fork gets a new page of its own, the threads sharing an mm share it as well.
+ * */
+
+// vvar_map - alloc the vvar page of mm and map it at UVVAR, read only to the user
+int
+vvar_map(struct mm_struct *mm) {
+    static_assert(UVVAR == VVAR_ADDR && sizeof(struct vvar) <= PGSIZE);
+    assert(mm->vvar == NULL);
+    struct Page *page;
+    if ((page = pgdir_alloc_page(mm->pgdir, UVVAR, PTE_U)) == NULL) {
+        return -E_NO_MEM;
+    }
+    struct vvar *vvar = page2kva(page);
+    memset(vvar, 0, PGSIZE);
+    vvar->tsc_base = clock_tick_deadline(0);
+    vvar->tsc_freq = tsc_freq;
+    mm->vvar = vvar;
+    return 0;
+}
+
+// vvar_update - write the state of proc into the vvar page of its mm; called with the
+//             - kernel lock held on the way back to user mode, so there is one writer
+void
+vvar_update(struct proc_struct *proc) {
+    struct mm_struct *mm = proc->mm;
+    struct vvar *vvar;
+    if (mm == NULL || (vvar = mm->vvar) == NULL) {
+        return ;
+    }
+    vvar->seq ++;
+    barrier();
+    vvar->pid = (mm_count(mm) == 1) ? proc->pid : 0;
+    vvar->ticks = ticks;
+    vvar->cpu = proc->cpu;
+    vvar->runs = proc->runs;
+    vvar->runtime = proc->runtime;
+    vvar->exec_start = proc->exec_start;
+    barrier();
+    vvar->seq ++;
+}
+
@@ -0,0 +1,67 @@
+#ifndef __KERN_PROCESS_CPU_H__
+#define __KERN_PROCESS_CPU_H__
+
+#include <mmu.h>
+#include <memlayout.h>
+
+#define NCPU                        8           // the maximum number of cpus
+
+// the offsets of rsp0 and user_rsp in struct cpu, for trapentry.S
+#define CPU_RSP0                    0x08
+#define CPU_USER_RSP                0x10
+
+#ifndef __ASSEMBLER__
+
+#include <defs.h>
+
+#define NR_ASID                     (CR3_PCID_MASK + 1)
+
+struct proc_struct;
+struct run_queue;
+struct rb_tree;
+
+/* *
+ * struct cpu - the per-cpu state. The %gs base of the kernel points at the struct
+ * cpu of the processor, and the first field points at the struct itself, so mycpu()
+ * is one load from %gs:0. The base is swapped with swapgs on the way into and out of
+ * user mode, see trapentry.S, which also uses rsp0 and user_rsp at CPU_RSP0 and
+ * CPU_USER_RSP.
+ * */
+struct cpu {
+    struct cpu *self;                           // this struct, read from %gs:0
+    uintptr_t rsp0;                             // the kernel stack of current, as in ts
+    uintptr_t user_rsp;                         // the user %rsp, saved by syscall_entry
+    int id;                                     // index in cpus[]
+    uint8_t apicid;                             // local APIC id
+    volatile bool started;                      // the cpu has come up
+    struct proc_struct *proc;                   // the proc running on this cpu
+    struct proc_struct *idle;                   // the idle proc of this cpu
+    struct run_queue *rq;                       // the run queue of the fair class of this cpu
+    struct run_queue *rt_rq;                    // the run queue of the real-time class of this cpu
+    pgd_t *pgdir;                               // the page table loaded into CR3
+    struct rb_tree *hrtimers;                   // the hrtimers of this cpu by expiry
+    size_t last_tick;                           // the tick proc_tick was last run for
+    bool tick_stopped;                          // idle, the next interrupt is the first timer due
+    volatile bool tlb_flush;                    // a TLB shootdown waits for this cpu
+    const uintptr_t *tlb_flush_addrs;           // the addresses to flush, all if tlb_flush_nr == 0
+    size_t tlb_flush_nr;                        // # of addresses in tlb_flush_addrs
+    bool asid_flush_all;                        // the asid generation is new, flush all pcids
+    uint32_t asid_stale[NR_ASID / 32];          // the pcids to flush before they are loaded again
+    struct taskstate ts;                        // used by x86 to find the stack for interrupt
+    struct segdesc gdt[NSEGS];                  // the gdt of this cpu, with its own tss
+};
+
+extern struct cpu cpus[NCPU];
+extern int ncpu;
+
+static inline struct cpu *
+mycpu(void) {
+    struct cpu *cpu;
+    asm volatile ("movq %%gs:0, %0" : "=r" (cpu));
+    return cpu;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !__KERN_PROCESS_CPU_H__ */
+
@@ -19,6 +19,10 @@
 #include <sysfile.h>
 #include <swap.h>
 #include <mbox.h>
+#include <uring.h>
+#include <mutex.h>
+#include <spawn.h>
+#include <clock.h>
 
 /* ------------- process/thread mechanism design&implementation -------------
 (an simplified Linux process/thread mechanism )
@@ -78,12 +82,8 @@ list_entry_t proc_mm_list;
 // has list for process set based on pid
 static list_entry_t hash_list[HASH_LIST_SIZE];
 
-// idle proc
-struct proc_struct *idleproc = NULL;
 // init proc
 struct proc_struct *initproc = NULL;
-// current proc
-struct proc_struct *current = NULL;
 // swap daemon proc
 struct proc_struct *kswapd = NULL;
 
@@ -96,10 +96,12 @@ void switch_to(struct context *from, struct context *to);
 static int __do_exit(void);
 static int __do_kill(struct proc_struct *proc, int error_code); 
 
+static kmem_cache_t *proc_cachep;
+
 // alloc_proc - create a proc struct and init fields
 static struct proc_struct *
 alloc_proc(void) {
-    struct proc_struct *proc = kmalloc(sizeof(struct proc_struct));
+    struct proc_struct *proc = kmem_cache_alloc(proc_cachep);
     if (proc != NULL) {
         proc->state = PROC_UNINIT;
         proc->pid = -1;
@@ -117,11 +119,23 @@ alloc_proc(void) {
         proc->cptr = proc->optr = proc->yptr = NULL;
         list_init(&(proc->thread_group));
         proc->rq = NULL;
+        proc->cpu = -1;
         list_init(&(proc->run_link));
         proc->time_slice = 0;
+        proc->policy = SCHED_NORMAL;
+        proc->rt_priority = 0;
+        proc->nice = 0;
+        proc->vruntime = 0;
+        proc->slice_ticks = 0;
+        list_init(&(proc->pi_mutexes));
+        proc->pi_blocked_on = NULL;
+        memset(&(proc->pi), 0, sizeof(sched_pi_t));
+        proc->runtime = 0;
+        proc->exec_start = rdtsc();
         proc->sem_queue = NULL;
         event_box_init(&(proc->event_box));
         proc->fs_struct = NULL;
+        vmacache_flush(proc);
     }
     return proc;
 }
@@ -213,9 +227,12 @@ proc_run(struct proc_struct *proc) {
         struct proc_struct *prev = current, *next = proc;
         local_intr_save(intr_flag);
         {
+            uint64_t now = rdtsc();
+            prev->runtime += now - prev->exec_start;
+            next->exec_start = now;
             current = proc;
             load_rsp0(next->kstack + KSTACKSIZE);
-            lcr3(next->cr3);
+            load_pgdir(KADDR(next->cr3));
             switch_to(&(prev->context), &(next->context));
         }
         local_intr_restore(intr_flag);
@@ -227,6 +244,10 @@ proc_run(struct proc_struct *proc) {
 //       after switch_to, the current proc will execute here.
 static void
 forkret(void) {
+    if (!trap_in_kernel(current->tf)) {
+        vvar_update(current);
+        unlock_kernel();
+    }
     forkrets(current->tf);
 }
 
@@ -300,6 +321,7 @@ setup_pgdir(struct mm_struct *mm) {
     pgd_t *pgdir = page2kva(page);
     memcpy(pgdir, boot_pgdir, PGSIZE);
     pgdir[PGX(VPT)] = PADDR(pgdir) | PTE_P | PTE_W;
+    pgdir_init(pgdir);
     mm->pgdir = pgdir;
     return 0;
 }
@@ -358,7 +380,7 @@ copy_mm(uint32_t clone_flags, struct proc_struct *proc) {
     }
     unlock_mm(oldmm);
 
-    if (ret != 0) {
+    if (ret != 0 || (ret = vvar_map(mm)) != 0) {
         goto bad_dup_cleanup_mmap;
     }
 
@@ -489,6 +511,42 @@ put_fs(struct proc_struct *proc) {
     }
 }
 
+// exit_mm - drop current's reference of its mm, free the mm if current is the last user,
+//         - and release the parent sleeping in vfork
+static void
+exit_mm(void) {
+    struct mm_struct *mm = current->mm;
+    if (mm != NULL) {
+        load_pgdir(boot_pgdir);
+        if (mm_count_dec(mm) == 0) {
+            exit_mmap(mm);
+            uring_destroy(mm);
+            put_pgdir(mm);
+            bool intr_flag;
+            local_intr_save(intr_flag);
+            {
+                list_del(&(mm->proc_mm_link));
+            }
+            local_intr_restore(intr_flag);
+            mm_destroy(mm);
+        }
+        current->mm = NULL;
+        vmacache_flush(current);
+        current->cr3 = boot_cr3;
+    }
+    if (current->flags & PF_VFORK) {
+        bool intr_flag;
+        local_intr_save(intr_flag);
+        {
+            current->flags &= ~PF_VFORK;
+            if (current->parent->wait_state == WT_VFORK) {
+                wakeup_proc(current->parent);
+            }
+        }
+        local_intr_restore(intr_flag);
+    }
+}
+
 // may_killed - check if current thread should be killed, should be called before go back to user space
 void
 may_killed(void) {
@@ -503,6 +561,7 @@ may_killed(void) {
 //    2. call setup_kstack to allocate a kernel stack for child process
 //    3. call copy_mm to dup OR share mm according clone_flag
 //    4. call wakup_proc to make the new child process RUNNABLE 
+//    5. if CLONE_VFORK, sleep until the child execs or exits, it runs on our mm and user stack
 int
 do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
     int ret = -E_NO_FREE_PROC;
@@ -522,6 +581,9 @@ do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
     assert(current->wait_state == 0);
 
     assert(current->time_slice >= 0);
+    proc->policy = current->policy;
+    proc->rt_priority = current->rt_priority;
+    proc->nice = current->nice;
     proc->time_slice = current->time_slice / 2;
     current->time_slice -= proc->time_slice;
 
@@ -548,12 +610,26 @@ do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf) {
         if (clone_flags & CLONE_THREAD) {
             list_add_before(&(current->thread_group), &(proc->thread_group));
         }
+        if (clone_flags & CLONE_VFORK) {
+            proc->flags |= PF_VFORK;
+        }
     }
     local_intr_restore(intr_flag);
 
     wakeup_proc(proc);
 
     ret = proc->pid;
+    if (clone_flags & CLONE_VFORK) {
+        local_intr_save(intr_flag);
+        while (proc->flags & PF_VFORK) {
+            current->state = PROC_SLEEPING;
+            current->wait_state = WT_VFORK;
+            local_intr_restore(intr_flag);
+            schedule();
+            local_intr_save(intr_flag);
+        }
+        local_intr_restore(intr_flag);
+    }
 fork_out:
     return ret;
 
@@ -564,7 +640,7 @@ bad_fork_cleanup_sem:
 bad_fork_cleanup_kstack:
     put_kstack(proc);
 bad_fork_cleanup_proc:
-    kfree(proc);
+    kmem_cache_free(proc_cachep, proc);
     goto fork_out;
 }
 
@@ -581,22 +657,7 @@ __do_exit(void) {
         panic("initproc exit.\n");
     }
 
-    struct mm_struct *mm = current->mm;
-    if (mm != NULL) {
-        lcr3(boot_cr3);
-        if (mm_count_dec(mm) == 0) {
-            exit_mmap(mm);
-            put_pgdir(mm);
-            bool intr_flag;
-            local_intr_save(intr_flag);
-            {
-                list_del(&(mm->proc_mm_link));
-            }
-            local_intr_restore(intr_flag);
-            mm_destroy(mm);
-        }
-        current->mm = NULL;
-    }
+    exit_mm();
     put_fs(current);
     put_sem_queue(current);
     current->state = PROC_ZOMBIE;
@@ -796,6 +857,9 @@ load_icode(int fd, int argc, char **kargv) {
     if ((ret = mm_map(mm, USTACKTOP - USTACKSIZE, USTACKSIZE, vm_flags, NULL)) != 0) {
         goto bad_cleanup_mmap;
     }
+    if ((ret = vvar_map(mm)) != 0) {
+        goto bad_cleanup_mmap;
+    }
 
     bool intr_flag;
     local_intr_save(intr_flag);
@@ -805,8 +869,9 @@ load_icode(int fd, int argc, char **kargv) {
     local_intr_restore(intr_flag);
     mm_count_inc(mm);
     current->mm = mm;
+    vmacache_flush(current);
     current->cr3 = PADDR(mm->pgdir);
-    lcr3(PADDR(mm->pgdir));
+    load_pgdir(mm->pgdir);
 
     uintptr_t stacktop = USTACKTOP - argc * PGSIZE;
     char **uargv = (char **)(stacktop - argc * sizeof(char *));
@@ -872,6 +937,8 @@ failed_cleanup:
     return ret;
 }
 
+static int __do_execve(const char *path, const char *local_name, int argc, char **kargv);
+
 int
 do_execve(const char *name, int argc, const char **argv) {
     static_assert(EXEC_MAX_ARG_LEN >= FS_MAX_FPATH_LEN);
@@ -905,30 +972,23 @@ do_execve(const char *name, int argc, const char **argv) {
     path = argv[0];
     unlock_mm(mm);
 
-    fs_closeall(current->fs_struct);
-
     /* sysfile_open will check the first argument path, thus we have to use a user-space pointer, and argv[0] may be incorrect */
 
-    int fd;
+    return __do_execve(path, local_name, argc, kargv);
+}
+
+// __do_execve - replace the image of current with the program at path, the kargv are consumed
+//             - on success; on failure current exits
+static int
+__do_execve(const char *path, const char *local_name, int argc, char **kargv) {
+    fs_closeall(current->fs_struct);
+
+    int fd, ret;
     if ((ret = fd = sysfile_open(path, O_RDONLY)) < 0) {
         goto execve_exit;
     }
 
-    if (mm != NULL) {
-        lcr3(boot_cr3);
-        if (mm_count_dec(mm) == 0) {
-            exit_mmap(mm);
-            put_pgdir(mm);
-            bool intr_flag;
-            local_intr_save(intr_flag);
-            {
-                list_del(&(mm->proc_mm_link));
-            }
-            local_intr_restore(intr_flag);
-            mm_destroy(mm);
-        }
-        current->mm = NULL;
-    }
+    exit_mm();
     put_sem_queue(current);
 
     ret = -E_NO_MEM;
@@ -951,10 +1011,152 @@ execve_exit:
     panic("already exit: %e.\n", ret);
 }
 
+// the arguments of SYS_spawn copied into kernel by the parent, and consumed by the child
+struct spawn_args {
+    char name[PROC_NAME_LEN + 1];
+    int argc;
+    char *kargv[EXEC_MAX_ARG_NUM];
+    int nactions;
+    struct spawn_action actions[SPAWN_MAX_ACTIONS];
+};
+
+static void
+put_spawn_args(struct spawn_args *args) {
+    int i;
+    for (i = 0; i < args->nactions; i ++) {
+        if (args->actions[i].type == SPAWN_OPEN && args->actions[i].path != NULL) {
+            kfree((void *)(args->actions[i].path));
+        }
+    }
+    kfree(args);
+}
+
+// spawn_file_actions - apply the file actions of SYS_spawn to the files of current
+static int
+spawn_file_actions(int nactions, struct spawn_action *actions) {
+    int i, ret = 0;
+    for (i = 0; i < nactions && ret >= 0; i ++) {
+        struct spawn_action *act = actions + i;
+        switch (act->type) {
+        case SPAWN_OPEN:
+            sysfile_close(act->fd);
+            if ((ret = sysfile_open(act->path, act->open_flags)) >= 0 && ret != act->fd) {
+                int fd = ret;
+                ret = sysfile_dup(fd, act->fd);
+                sysfile_close(fd);
+            }
+            break;
+        case SPAWN_DUP2:
+            if (act->fd != act->newfd) {
+                sysfile_close(act->newfd);
+                ret = sysfile_dup(act->fd, act->newfd);
+            }
+            break;
+        case SPAWN_CLOSE:
+            ret = sysfile_close(act->fd);
+            break;
+        default:
+            ret = -E_INVAL;
+        }
+    }
+    return (ret < 0) ? ret : 0;
+}
+
+// spawn_main - the child of SYS_spawn: drop the mm borrowed by kernel_thread, apply the file
+//            - actions, then load the new image and go to user mode without an address space copy
+static int
+spawn_main(void *arg) {
+    struct spawn_args *args = (struct spawn_args *)arg;
+    char local_name[PROC_NAME_LEN + 1], *kargv[EXEC_MAX_ARG_NUM];
+    int argc = args->argc, ret;
+
+    exit_mm();
+    if (args->name[0] == '\0') {
+        snprintf(local_name, sizeof(local_name), "<null> %d", current->pid);
+    }
+    else {
+        memcpy(local_name, args->name, sizeof(local_name));
+    }
+    memcpy(kargv, args->kargv, sizeof(char *) * argc);
+
+    ret = spawn_file_actions(args->nactions, args->actions);
+    put_spawn_args(args);
+    if (ret != 0) {
+        put_kargv(argc, kargv);
+        return ret;
+    }
+
+    __do_execve(kargv[0], local_name, argc, kargv);
+    unlock_kernel();
+    forkrets(current->tf);
+    panic("spawn_main: forkrets returned.\n");
+}
+
+// do_spawn - create a child running the program argv[0] after the file actions, like
+//          - vfork + exec, but the parent never shares or copies its address space
+int
+do_spawn(const char *name, int argc, const char **argv, const struct spawn_action *actions, int nactions) {
+    struct mm_struct *mm = current->mm;
+    if (mm == NULL) {
+        panic("kernel thread call sys_spawn!!.\n");
+    }
+    if (!(argc >= 1 && argc <= EXEC_MAX_ARG_NUM) || !(nactions >= 0 && nactions <= SPAWN_MAX_ACTIONS)) {
+        return -E_INVAL;
+    }
+
+    struct spawn_args *args;
+    if ((args = kmalloc(sizeof(struct spawn_args))) == NULL) {
+        return -E_NO_MEM;
+    }
+    memset(args, 0, sizeof(struct spawn_args));
+
+    int i, ret = -E_INVAL;
+
+    lock_mm(mm);
+    if (name != NULL && !copy_string(mm, args->name, name, sizeof(args->name))) {
+        goto failed_unlock;
+    }
+    // a spawn with no actions may pass NULL, and an empty range never passes user_mem_check
+    if (nactions > 0 && !copy_from_user(mm, args->actions, actions, sizeof(struct spawn_action) * nactions, 0)) {
+        goto failed_unlock;
+    }
+    for (i = 0; i < nactions; i ++) {
+        if (args->actions[i].type == SPAWN_OPEN) {
+            const char *path = args->actions[i].path;
+            char *buffer;
+            if ((args->actions[i].path = buffer = kmalloc(FS_MAX_FPATH_LEN + 1)) == NULL) {
+                ret = -E_NO_MEM;
+                goto failed_unlock;
+            }
+            args->nactions = i + 1;
+            if (!copy_string(mm, buffer, path, FS_MAX_FPATH_LEN + 1)) {
+                goto failed_unlock;
+            }
+        }
+    }
+    args->nactions = nactions;
+    if ((ret = copy_kargv(mm, argc, args->kargv, argv)) != 0) {
+        goto failed_unlock;
+    }
+    args->argc = argc;
+    unlock_mm(mm);
+
+    if ((ret = kernel_thread(spawn_main, args, 0)) < 0) {
+        put_kargv(argc, args->kargv);
+        put_spawn_args(args);
+    }
+    return ret;
+
+failed_unlock:
+    unlock_mm(mm);
+    put_spawn_args(args);
+    return ret;
+}
+
 // do_yield - ask the scheduler to reschedule
 int
 do_yield(void) {
-    current->need_resched = 1;
+    sched_yield();
     return 0;
 }
 
@@ -1023,7 +1225,7 @@ found:
     }
     local_intr_restore(intr_flag);
     put_kstack(proc);
-    kfree(proc);
+    kmem_cache_free(proc_cachep, proc);
 
     int ret = 0;
     if (code_store != NULL) {
@@ -1062,6 +1264,50 @@ do_kill(int pid, int error_code) {
     return -E_INVAL;
 }
 
+// do_setpriority - set the nice value of process pid (0 for current), clamped to
+//                - [NICE_MIN, NICE_MAX]
+int
+do_setpriority(int pid, int nice) {
+    struct proc_struct *proc = current;
+    if (pid != 0 && (proc = find_proc(pid)) == NULL) {
+        return -E_INVAL;
+    }
+    if (nice < NICE_MIN) {
+        nice = NICE_MIN;
+    }
+    if (nice > NICE_MAX) {
+        nice = NICE_MAX;
+    }
+    sched_set_nice(proc, nice);
+    return 0;
+}
+
+// do_sched_setscheduler - set the scheduling policy of process pid (0 for current); the
+//                       - real-time policies take a priority below MAX_RT_PRIO, and
+//                       - SCHED_NORMAL takes 0
+int
+do_sched_setscheduler(int pid, int policy, int rt_priority) {
+    struct proc_struct *proc = current;
+    if (pid != 0 && (proc = find_proc(pid)) == NULL) {
+        return -E_INVAL;
+    }
+    if (policy == SCHED_NORMAL) {
+        if (rt_priority != 0) {
+            return -E_INVAL;
+        }
+    }
+    else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (rt_priority < 0 || rt_priority >= MAX_RT_PRIO) {
+            return -E_INVAL;
+        }
+    }
+    else {
+        return -E_INVAL;
+    }
+    sched_set_scheduler(proc, policy, rt_priority);
+    return 0;
+}
+
 // do_brk - adjust(increase/decrease) the size of process heap, align with page size
 // NOTE: will change the process vma
 int
@@ -1131,6 +1377,74 @@ do_sleep(unsigned int time) {
     return 0;
 }
 
+// do_nanosleep - like do_sleep, on an hrtimer expiring "ns" nanoseconds from now
+int
+do_nanosleep(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    hrtimer_t __timer, *timer = hrtimer_init(&__timer, current, rdtsc() + clock_ns2cycles(ns));
+    current->state = PROC_SLEEPING;
+    current->wait_state = WT_TIMER;
+    add_hrtimer(timer);
+    local_intr_restore(intr_flag);
+
+    schedule();
+
+    del_hrtimer(timer);
+    return 0;
+}
+
+// proc_runtime - the TSC cycles run by proc, with those of the run it is in now
+static uint64_t
+proc_runtime(struct proc_struct *proc) {
+    uint64_t runtime = proc->runtime;
+    if (proc->cpu >= 0 && cpus[proc->cpu].proc == proc) {
+        runtime += rdtsc() - proc->exec_start;
+    }
+    return runtime;
+}
+
+// do_clock_gettime - read the clock clock_id into the timespec ts of the user
+int
+do_clock_gettime(int clock_id, struct timespec *ts) {
+    struct mm_struct *mm = current->mm;
+    uint64_t ns;
+    switch (clock_id) {
+    case CLOCK_MONOTONIC:
+        ns = clock_ns();
+        break;
+    case CLOCK_THREAD_CPUTIME_ID:
+        ns = clock_cycles2ns(proc_runtime(current));
+        break;
+    case CLOCK_PROCESS_CPUTIME_ID: {
+            list_entry_t *list = &(current->thread_group), *le = list;
+            uint64_t runtime = proc_runtime(current);
+            while ((le = list_next(le)) != list) {
+                runtime += proc_runtime(le2proc(le, thread_group));
+            }
+            ns = clock_cycles2ns(runtime);
+        }
+        break;
+    default:
+        return -E_INVAL;
+    }
+
+    struct timespec __local_ts, *local_ts = &__local_ts;
+    local_ts->tv_sec = ns / NSEC_PER_SEC;
+    local_ts->tv_nsec = ns % NSEC_PER_SEC;
+
+    int ret;
+    lock_mm(mm);
+    {
+        ret = (copy_to_user(mm, ts, local_ts, sizeof(struct timespec))) ? 0 : -E_INVAL;
+    }
+    unlock_mm(mm);
+    return ret;
+}
+
 // do_mmap - add a vma with addr, len and flags(VM_READ/M_WRITE/VM_STACK)
 int
 do_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags) {
@@ -1293,11 +1607,14 @@ init_main(void *arg) {
     kswapd = find_proc(pid);
     set_proc_name(kswapd, "kswapd");
 
+    check_mutex();
+
     int ret;
     if ((ret = vfs_set_bootfs("disk0:")) != 0) {
         panic("set boot fs failed: %e.\n", ret);
     }
 
+    slab_reap();
     size_t nr_free_pages_store = nr_free_pages();
     size_t slab_allocated_store = slab_allocated();
 
@@ -1332,6 +1649,7 @@ init_main(void *arg) {
     assert(initproc->cptr == kswapd && initproc->yptr == NULL && initproc->optr == NULL);
     assert(kswapd->cptr == NULL && kswapd->yptr == NULL && kswapd->optr == NULL);
     assert(nr_process == 3);
+    slab_reap();
     assert(nr_free_pages_store == nr_free_pages());
     assert(slab_allocated_store == slab_allocated());
     cprintf("init check memory pass.\n");
@@ -1350,6 +1668,10 @@ proc_init(void) {
         list_init(hash_list + i);
     }
 
+    if ((proc_cachep = kmem_cache_create("proc_struct", sizeof(struct proc_struct), 0, NULL)) == NULL) {
+        panic("cannot create proc_struct cache.\n");
+    }
+
     if ((idleproc = alloc_proc()) == NULL) {
         panic("cannot alloc idleproc.\n");
     }
@@ -1380,13 +1702,46 @@ proc_init(void) {
     assert(initproc != NULL && initproc->pid == 1);
 }
 
+// proc_init_ap - set up the idle proc of an AP, the AP comes up on its kernel stack;
+//              - the idle procs of the APs are not counted in nr_process
+int
+proc_init_ap(struct cpu *cpu) {
+    struct proc_struct *idle;
+    if ((idle = alloc_proc()) == NULL) {
+        return -E_NO_MEM;
+    }
+    if (setup_kstack(idle) != 0) {
+        kmem_cache_free(proc_cachep, idle);
+        return -E_NO_MEM;
+    }
+    idle->pid = 0;
+    idle->state = PROC_RUNNABLE;
+    idle->need_resched = 1;
+    set_proc_name(idle, "idle");
+    cpu->idle = cpu->proc = idle;
+    return 0;
+}
+
 // cpu_idle - at the end of kern_init, the first kernel thread idleproc will do below works
 void
 cpu_idle(void) {
+    intr_disable();
     while (1) {
         if (current->need_resched) {
+            if (mycpu()->tick_stopped) {
+                timer_program(0);
+            }
             schedule();
         }
+        else {
+            // tickless: sleep until the first timer due, a wakeup from another cpu
+            // comes with an IPI; sti;hlt in one go
+            timer_program(1);
+            unlock_kernel();
+            safe_halt();
+            intr_disable();
+            lock_kernel();
+        }
     }
 }
 
@@ -8,6 +8,9 @@
 #include <unistd.h>
 #include <sem.h>
 #include <event.h>
+#include <cpu.h>
+#include <rb_tree.h>
+#include <sched.h>
 
 // process's state in his life cycle
 enum proc_state {
@@ -43,8 +46,13 @@ struct context {
 extern list_entry_t proc_list;
 extern list_entry_t proc_mm_list;
 
+#define VMACACHE_SIZE               4
+
 struct inode;
 struct fs_struct;
+struct vma_struct;
+struct timespec;
+struct mutex;
 
 struct proc_struct {
     enum proc_state state;                      // Process state
@@ -66,36 +74,85 @@ struct proc_struct {
     struct proc_struct *cptr, *yptr, *optr;     // Process's children, yonger sibling, Old sibling
     list_entry_t thread_group;                  // the threads list including this proc which share resource (mem/file/sem...)
     struct run_queue *rq;                       // running queue contains Process
+    int cpu;                                    // the cpu whose run queue the proc was put on last
     list_entry_t run_link;                      // the entry linked in run queue
     int time_slice;                             // time slice for occupying the CPU
+    int policy;                                 // SCHED_NORMAL, SCHED_FIFO or SCHED_RR
+    int rt_priority;                            // the priority of SCHED_FIFO and SCHED_RR, higher runs first
+    int nice;                                   // the nice value, NICE_MIN ~ NICE_MAX, weights the proc in CFS
+    uint64_t vruntime;                          // CFS: the runtime weighted by nice, see sched_CFS.c
+    int slice_ticks;                            // CFS: the ticks run since the proc was picked
+    rb_node run_node;                           // CFS: the node in the tree of the run queue
+    list_entry_t pi_mutexes;                    // the mutexes held, see mutex.c
+    struct mutex *pi_blocked_on;                // the mutex the proc sleeps on, NULL if none
+    sched_pi_t pi;                              // the attributes inherited through pi_mutexes
+    uint64_t runtime;                           // the TSC cycles run, up to exec_start if running
+    uint64_t exec_start;                        // the TSC when the proc was last switched to
     sem_queue_t *sem_queue;                     // the user semaphore queue which process waits
     event_t event_box;                          // the event which process waits   
-    struct fs_struct *fs_struct;                // the file related info(pwd, files_count, files_array, fs_semaphore) of process
+    struct fs_struct *fs_struct;                // the file related info(pwd, files_count, files_array, fs_lock) of process
+    uint64_t vmacache_seqnum;                   // the vmacache_seqnum of mm when vmacache was filled
+    struct vma_struct *vmacache[VMACACHE_SIZE]; // the vmas of mm found recently, indexed by page number
 };
 
+#define NICE_MIN                    (-20)           // the highest priority
+#define NICE_MAX                    19              // the lowest priority
+
 #define PF_EXITING                  0x00000001      // getting shutdown
+#define PF_VFORK                    0x00000002      // the parent sleeps in vfork until this exec or exit
 
 //the wait state
 #define WT_CHILD                    (0x00000001 | WT_INTERRUPTED)  // wait child process
 #define WT_TIMER                    (0x00000002 | WT_INTERRUPTED)  // wait timer
 #define WT_KSWAPD                    0x00000003                    // wait kswapd to free page
 #define WT_KBD                      (0x00000004 | WT_INTERRUPTED)  // wait the input of keyboard
+#define WT_VFORK                     0x00000005                    // wait the vfork child to exec or exit
 #define WT_KSEM                      0x00000100                    // wait kernel semaphore
 #define WT_USEM                     (0x00000101 | WT_INTERRUPTED)  // wait user semaphore
+#define WT_KMUTEX                    0x00000102                    // wait kernel mutex
 #define WT_EVENT_SEND               (0x00000110 | WT_INTERRUPTED)  // wait the sending event
 #define WT_EVENT_RECV               (0x00000111 | WT_INTERRUPTED)  // wait the recving event 
 #define WT_MBOX_SEND                (0x00000120 | WT_INTERRUPTED)  // wait the sending mbox
 #define WT_MBOX_RECV                (0x00000121 | WT_INTERRUPTED)  // wait the recving mbox
 #define WT_PIPE                     (0x00000200 | WT_INTERRUPTED)  // wait the pipe
+#define WT_URING                    (0x00000300 | WT_INTERRUPTED)  // wait the uring
 #define WT_INTERRUPTED               0x80000000                    // the wait state could be interrupted
 
 #define le2proc(le, member)         \
     to_struct((le), struct proc_struct, member)
 
-extern struct proc_struct *idleproc, *initproc, *current;
+// proc_pi_rt - proc inherits a real-time priority above its own
+static inline bool
+proc_pi_rt(struct proc_struct *proc) {
+    return proc->pi.boosted && proc->pi.policy != SCHED_NORMAL &&
+        (proc->policy == SCHED_NORMAL || proc->pi.rt_priority > proc->rt_priority);
+}
+
+// proc_policy, proc_rt_priority, proc_nice - the attributes proc is scheduled by: its
+//              - own, or those it inherits through a mutex where they are higher
+static inline int
+proc_policy(struct proc_struct *proc) {
+    return proc_pi_rt(proc) ? proc->pi.policy : proc->policy;
+}
+
+static inline int
+proc_rt_priority(struct proc_struct *proc) {
+    return proc_pi_rt(proc) ? proc->pi.rt_priority : proc->rt_priority;
+}
+
+static inline int
+proc_nice(struct proc_struct *proc) {
+    return (proc->pi.boosted && proc->pi.nice < proc->nice) ? proc->pi.nice : proc->nice;
+}
+
+#define current                     (mycpu()->proc)
+#define idleproc                    (mycpu()->idle)
+
+extern struct proc_struct *initproc;
 extern struct proc_struct *kswapd;
 
 void proc_init(void);
+int proc_init_ap(struct cpu *cpu);
 void proc_run(struct proc_struct *proc);
 int kernel_thread(int (*fn)(void *), void *arg, uint32_t clone_flags);
 
@@ -109,11 +166,17 @@ int do_fork(uint32_t clone_flags, uintptr_t stack, struct trapframe *tf);
 int do_exit(int error_code);
 int do_exit_thread(int error_code);
 int do_execve(const char *name, int argc, const char **argv);
+struct spawn_action;
+int do_spawn(const char *name, int argc, const char **argv, const struct spawn_action *actions, int nactions);
 int do_yield(void);
 int do_wait(int pid, int *code_store);
 int do_kill(int pid, int error_code);
 int do_brk(uintptr_t *brk_store);
 int do_sleep(unsigned int time);
+int do_nanosleep(uint64_t ns);
+int do_clock_gettime(int clock_id, struct timespec *ts);
+int do_setpriority(int pid, int nice);
+int do_sched_setscheduler(int pid, int policy, int rt_priority);
 int do_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
 int do_munmap(uintptr_t addr, size_t len);
 int do_shmem(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
@@ -5,60 +5,265 @@
 #include <stdio.h>
 #include <assert.h>
 #include <sched_MLFQ.h>
+#include <sched_CFS.h>
+#include <sched_RT.h>
+#include <unistd.h>
+#include <cpu.h>
+#include <trap.h>
+#include <lapic.h>
+#include <clock.h>
+#include <mutex.h>
+#include <string.h>
 
-static list_entry_t timer_list;
+// the scheduler class, 'make SCHED=CFS' builds the kernel with CFS_sched_class
+#ifndef SCHED_CLASS
+#define SCHED_CLASS                 MLFQ_sched_class
+#endif
+
+/* *
+ * The timers are kept in a hierarchical timing wheel (Varghese & Lauck, as in Linux):
+ * tv1 has a slot for each of the next TVR_SIZE ticks, and each level of tvn a slot for
+ * TVN_SIZE times the span of the level below. A timer goes in the slot of the lowest
+ * level that spans its expiry, so adding and deleting are O(1); each tick runs the slot
+ * of tv1 that is due, and when tv1 wraps the next slot of tvn[0] is cascaded down into
+ * it, and so on up the levels. timer->expires holds the absolute tick in the wheel.
+ * */
+#define TVN_BITS                    6
+#define TVR_BITS                    8
+#define TVN_SIZE                    (1 << TVN_BITS)
+#define TVR_SIZE                    (1 << TVR_BITS)
+#define TVN_MASK                    (TVN_SIZE - 1)
+#define TVR_MASK                    (TVR_SIZE - 1)
+#define TVN_LEVELS                  4       // TVR_BITS + TVN_LEVELS * TVN_BITS == 32
+
+#define TVN_INDEX(expires, n)       (((expires) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+static list_entry_t tv1[TVR_SIZE];
+static list_entry_t tvn[TVN_LEVELS][TVN_SIZE];
+static unsigned int timer_jiffies;          // the next tick the wheel runs, ticks + 1 after a run
 
 static struct sched_class *sched_class;
 
-static struct run_queue *rq;
+#define NR_SCHED_CLASS              2
+
+// the stacked classes from the highest to the lowest: a class is picked from only if the
+// classes above it have nothing to run, and a proc of a higher class waking up preempts
+static struct sched_class *sched_classes[NR_SCHED_CLASS];
+
+static inline struct sched_class *
+proc_sched_class(struct proc_struct *proc) {
+    return (proc_policy(proc) == SCHED_NORMAL) ? sched_class : &RT_sched_class;
+}
+
+// class_rq - the run queue of class on cpu; the rq_lock of the fair run queue covers
+//          - all the run queues of the cpu
+static inline struct run_queue *
+class_rq(struct cpu *cpu, struct sched_class *class) {
+    return (class == &RT_sched_class) ? cpu->rt_rq : cpu->rq;
+}
 
+// sched_class_enqueue - put proc into the run queue of its class on cpu, placing it
+//                     - first if it is waking up
 static inline void
-sched_class_enqueue(struct proc_struct *proc) {
-    if (proc != idleproc) {
-        sched_class->enqueue(rq, proc);
+sched_class_enqueue(struct cpu *cpu, struct proc_struct *proc, bool wakeup) {
+    if (proc != cpu->idle) {
+        struct sched_class *class = proc_sched_class(proc);
+        struct run_queue *rq = class_rq(cpu, class);
+        spin_lock(&(cpu->rq->rq_lock));
+        if (wakeup && class->proc_wakeup != NULL) {
+            class->proc_wakeup(rq, proc);
+        }
+        proc->cpu = cpu->id;
+        class->enqueue(rq, proc);
+        spin_unlock(&(cpu->rq->rq_lock));
     }
 }
 
 static inline void
-sched_class_dequeue(struct proc_struct *proc) {
-    sched_class->dequeue(rq, proc);
+sched_class_dequeue(struct cpu *cpu, struct proc_struct *proc) {
+    struct sched_class *class = proc_sched_class(proc);
+    spin_lock(&(cpu->rq->rq_lock));
+    class->dequeue(class_rq(cpu, class), proc);
+    spin_unlock(&(cpu->rq->rq_lock));
 }
 
+// sched_class_pick_next - pick the next proc of the highest class with one on cpu, and
+//                       - dequeue it
 static inline struct proc_struct *
-sched_class_pick_next(void) {
-    return sched_class->pick_next(rq);
+sched_class_pick_next(struct cpu *cpu) {
+    struct proc_struct *next = NULL;
+    int i;
+    spin_lock(&(cpu->rq->rq_lock));
+    for (i = 0; next == NULL && i < NR_SCHED_CLASS; i ++) {
+        struct sched_class *class = sched_classes[i];
+        struct run_queue *rq = class_rq(cpu, class);
+        if ((next = class->pick_next(rq)) != NULL) {
+            class->dequeue(rq, next);
+        }
+    }
+    spin_unlock(&(cpu->rq->rq_lock));
+    return next;
 }
 
 static void
 sched_class_proc_tick(struct proc_struct *proc) {
     if (proc != idleproc) {
-        sched_class->proc_tick(rq, proc);
+        struct sched_class *class = proc_sched_class(proc);
+        class->proc_tick(class_rq(mycpu(), class), proc);
     }
     else {
         proc->need_resched = 1;
     }
 }
 
-static struct run_queue __rq[4];
+#define MLFQ_LEVELS                 4
+#define LOAD_BALANCE_BATCH          8
+
+static struct run_queue __rq[NCPU][MLFQ_LEVELS];
+static struct run_queue __rt_rq[NCPU];
+
+static int
+hrtimer_compare(rb_node *node1, rb_node *node2) {
+    hrtimer_t *timer1 = rbn2hrtimer(node1), *timer2 = rbn2hrtimer(node2);
+    if (timer1->expires != timer2->expires) {
+        return (timer1->expires < timer2->expires) ? -1 : 1;
+    }
+    return (timer1 < timer2) ? -1 : ((timer1 > timer2) ? 1 : 0);
+}
 
 void
 sched_init(void) {
-    list_init(&timer_list);
+    int i, j;
+    for (i = 0; i < TVR_SIZE; i ++) {
+        list_init(tv1 + i);
+    }
+    for (i = 0; i < TVN_LEVELS; i ++) {
+        for (j = 0; j < TVN_SIZE; j ++) {
+            list_init(tvn[i] + j);
+        }
+    }
+    timer_jiffies = ticks + 1;
 
-    rq = __rq;
-    list_init(&(rq->rq_link));
-    rq->max_time_slice = 8;
+    sched_class = &SCHED_CLASS;
+    sched_classes[0] = &RT_sched_class;
+    sched_classes[1] = sched_class;
 
-    int i;
-    for (i = 1; i < sizeof(__rq) / sizeof(__rq[0]); i ++) {
-        list_add_before(&(rq->rq_link), &(__rq[i].rq_link));
-        __rq[i].max_time_slice = rq->max_time_slice * (1 << i);
+    for (i = 0; i < ncpu; i ++) {
+        if ((cpus[i].hrtimers = rb_tree_create(hrtimer_compare)) == NULL) {
+            panic("no memory for the hrtimers.\n");
+        }
+    }
+
+    for (i = 0; i < ncpu; i ++) {
+        struct run_queue *rq = __rq[i];
+        list_init(&(rq->rq_link));
+        rq->max_time_slice = 8;
+        for (j = 1; j < MLFQ_LEVELS; j ++) {
+            list_add_before(&(rq->rq_link), &(__rq[i][j].rq_link));
+            __rq[i][j].max_time_slice = rq->max_time_slice * (1 << j);
+        }
+        spinlock_init(&(rq->rq_lock));
+        sched_class->init(rq);
+        cpus[i].rq = rq;
+
+        list_init(&(__rt_rq[i].rq_link));
+        RT_sched_class.init(__rt_rq + i);
+        cpus[i].rt_rq = __rt_rq + i;
     }
 
-    sched_class = &MLFQ_sched_class;
-    sched_class->init(rq);
+    cprintf("sched class: %s over %s\n", RT_sched_class.name, sched_class->name);
+}
 
-    cprintf("sched class: %s\n", sched_class->name);
+// cpu_load - the number of procs queued on cpu, over all the classes and levels
+static int
+cpu_load(struct cpu *cpu) {
+    int load = cpu->rt_rq->proc_num;
+    list_entry_t *list = &(cpu->rq->rq_link), *le = list;
+    do {
+        load += le2rq(le, rq_link)->proc_num;
+        le = list_next(le);
+    } while (le != list);
+    return load;
+}
+
+// cpu_is_idle - the cpu runs its idle proc and has nothing queued
+static inline bool
+cpu_is_idle(struct cpu *cpu) {
+    return cpu->started && cpu->proc == cpu->idle && cpu_load(cpu) == 0;
+}
+
+// select_cpu - choose the cpu to queue a woken proc on: the cpu it ran on last, unless
+//            - that one is busy and another cpu is idle
+static struct cpu *
+select_cpu(struct proc_struct *proc) {
+    struct cpu *cpu = (proc->cpu >= 0) ? cpus + proc->cpu : mycpu();
+    if (!cpu_is_idle(cpu)) {
+        int i;
+        for (i = 1; i < ncpu; i ++) {
+            struct cpu *idle = cpus + (cpu->id + i) % ncpu;
+            if (cpu_is_idle(idle)) {
+                return idle;
+            }
+        }
+    }
+    return cpu;
+}
+
+// proc_preempts - proc goes before the proc running on cpu: any proc goes before the
+//               - idle proc, and a real-time proc before a fair one or a real-time one of
+//               - a lower priority
+static bool
+proc_preempts(struct cpu *cpu, struct proc_struct *proc) {
+    struct proc_struct *curr = cpu->proc;
+    if (curr == cpu->idle) {
+        return 1;
+    }
+    if (proc_policy(proc) == SCHED_NORMAL) {
+        return 0;
+    }
+    return proc_policy(curr) == SCHED_NORMAL || proc_rt_priority(curr) < proc_rt_priority(proc);
+}
+
+// resched_cpu - make the proc running on cpu go through schedule(), at once
+static void
+resched_cpu(struct cpu *cpu) {
+    cpu->proc->need_resched = 1;
+    if (cpu != mycpu()) {
+        lapic_send_ipi(cpu->apicid, IRQ_OFFSET + IRQ_RESCHED);
+    }
+}
+
+// load_balance - called by a cpu finding its run queues empty: steal half of the procs
+//              - queued on the busiest cpu, from the highest class first; return the
+//              - number of procs stolen
+static int
+load_balance(struct cpu *self) {
+    struct cpu *cpu, *busiest = NULL;
+    int load, max_load = 0;
+    for (cpu = cpus; cpu < cpus + ncpu; cpu ++) {
+        if (cpu != self && cpu->started && (load = cpu_load(cpu)) > max_load) {
+            busiest = cpu, max_load = load;
+        }
+    }
+    if (busiest == NULL) {
+        return 0;
+    }
+
+    struct proc_struct *procs_moved[LOAD_BALANCE_BATCH];
+    int i, n = 0, max = (max_load + 1) / 2;
+    if (max > LOAD_BALANCE_BATCH) {
+        max = LOAD_BALANCE_BATCH;
+    }
+    spin_lock(&(busiest->rq->rq_lock));
+    for (i = 0; n < max && i < NR_SCHED_CLASS; i ++) {
+        struct sched_class *class = sched_classes[i];
+        n += class->get_proc(class_rq(busiest, class), procs_moved + n, max - n);
+    }
+    spin_unlock(&(busiest->rq->rq_lock));
+    for (i = 0; i < n; i ++) {
+        sched_class_enqueue(self, procs_moved[i], 0);
+    }
+    return n;
 }
 
 void
@@ -71,7 +276,11 @@ wakeup_proc(struct proc_struct *proc) {
             proc->state = PROC_RUNNABLE;
             proc->wait_state = 0;
             if (proc != current) {
-                sched_class_enqueue(proc);
+                struct cpu *cpu = select_cpu(proc);
+                sched_class_enqueue(cpu, proc, 1);
+                if (proc_preempts(cpu, proc)) {
+                    resched_cpu(cpu);
+                }
             }
         }
         else {
@@ -87,12 +296,13 @@ schedule(void) {
     struct proc_struct *next;
     local_intr_save(intr_flag);
     {
+        struct cpu *cpu = mycpu();
         current->need_resched = 0;
         if (current->state == PROC_RUNNABLE) {
-            sched_class_enqueue(current);
+            sched_class_enqueue(cpu, current, 0);
         }
-        if ((next = sched_class_pick_next()) != NULL) {
-            sched_class_dequeue(next);
+        if ((next = sched_class_pick_next(cpu)) == NULL && load_balance(cpu) != 0) {
+            next = sched_class_pick_next(cpu);
         }
         if (next == NULL) {
             next = idleproc;
@@ -105,6 +315,146 @@ schedule(void) {
     local_intr_restore(intr_flag);
 }
 
+// sched_yield - current gives up the cpu, behind the procs of its priority
+void
+sched_yield(void) {
+    struct sched_class *class = proc_sched_class(current);
+    if (class->proc_yield != NULL) {
+        class->proc_yield(class_rq(mycpu(), class), current);
+    }
+    current->need_resched = 1;
+}
+
+// sched_setattr - change the scheduling parameters of proc, own and inherited: a queued
+//               - proc is put back into the run queue of its class, as if waking up if
+//               - the class changes, and the cpu it runs or waits on reschedules if it
+//               - may go first now
+static void
+sched_setattr(struct proc_struct *proc, int policy, int rt_priority, int nice, const sched_pi_t *pi) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        struct cpu *cpu = (proc->cpu >= 0) ? cpus + proc->cpu : NULL;
+        bool queued = (cpu != NULL && proc->state == PROC_RUNNABLE && cpu->proc != proc);
+        bool normal = (proc_policy(proc) == SCHED_NORMAL);
+        if (queued) {
+            sched_class_dequeue(cpu, proc);
+        }
+        proc->policy = policy, proc->rt_priority = rt_priority, proc->nice = nice;
+        proc->pi = *pi;
+        if (queued) {
+            sched_class_enqueue(cpu, proc, normal != (proc_policy(proc) == SCHED_NORMAL));
+            if (proc_preempts(cpu, proc)) {
+                resched_cpu(cpu);
+            }
+        }
+        else if (cpu != NULL && cpu->proc == proc) {
+            resched_cpu(cpu);
+        }
+    }
+    local_intr_restore(intr_flag);
+}
+
+// sched_set_nice, sched_set_scheduler - set the own parameters of proc, and pass them
+//              - on to the owners of the mutex it sleeps on
+void
+sched_set_nice(struct proc_struct *proc, int nice) {
+    sched_setattr(proc, proc->policy, proc->rt_priority, nice, &(proc->pi));
+    mutex_adjust_pi(proc);
+}
+
+void
+sched_set_scheduler(struct proc_struct *proc, int policy, int rt_priority) {
+    sched_setattr(proc, policy, rt_priority, proc->nice, &(proc->pi));
+    mutex_adjust_pi(proc);
+}
+
+// sched_set_pi - let proc inherit the parameters donor is scheduled by, or give up those
+//              - it inherited if donor is NULL
+void
+sched_set_pi(struct proc_struct *proc, struct proc_struct *donor) {
+    sched_pi_t pi;
+    memset(&pi, 0, sizeof(sched_pi_t));
+    if (donor != NULL) {
+        pi.boosted = 1;
+        pi.policy = proc_policy(donor);
+        pi.rt_priority = proc_rt_priority(donor);
+        pi.nice = proc_nice(donor);
+        pi.prio = (sched_class->proc_prio != NULL) ? sched_class->proc_prio(donor) : 0;
+    }
+    if (memcmp(&pi, &(proc->pi), sizeof(sched_pi_t)) != 0) {
+        sched_setattr(proc, proc->policy, proc->rt_priority, proc->nice, &pi);
+    }
+}
+
+// sched_prio_before - proc1 goes before proc2 by the parameters they are scheduled by: a
+//                   - real-time proc before a fair one, the real-time procs by priority,
+//                   - the fair ones by the rank their class gives them
+bool
+sched_prio_before(struct proc_struct *proc1, struct proc_struct *proc2) {
+    bool rt1 = (proc_policy(proc1) != SCHED_NORMAL), rt2 = (proc_policy(proc2) != SCHED_NORMAL);
+    if (rt1 != rt2) {
+        return rt1;
+    }
+    if (rt1) {
+        return proc_rt_priority(proc1) > proc_rt_priority(proc2);
+    }
+    if (sched_class->proc_prio != NULL) {
+        return sched_class->proc_prio(proc1) > sched_class->proc_prio(proc2);
+    }
+    return 0;
+}
+
+static void
+timer_wakeup(struct proc_struct *proc) {
+    if (proc->wait_state != 0) {
+        assert(proc->wait_state & WT_INTERRUPTED);
+    }
+    else {
+        warn("process %d's wait_state == 0.\n", proc->pid);
+    }
+    wakeup_proc(proc);
+}
+
+// timer_vec - the list of the slots of a level the timer goes in, by its expiry; the
+//           - timers expired already go in the slot run next
+static list_entry_t *
+timer_vec(timer_t *timer) {
+    unsigned int expires = timer->expires, idx = expires - timer_jiffies;
+    if (idx < TVR_SIZE) {
+        return tv1 + (expires & TVR_MASK);
+    }
+    if ((int)idx < 0) {
+        return tv1 + (timer_jiffies & TVR_MASK);
+    }
+    int n;
+    for (n = 0; n < TVN_LEVELS - 1; n ++) {
+        if (idx < (1U << (TVR_BITS + (n + 1) * TVN_BITS))) {
+            break;
+        }
+    }
+    return tvn[n] + TVN_INDEX(expires, n);
+}
+
+// cascade - move the timers of slot index of level n down to the levels below, return
+//         - the index so that the next level is cascaded when it wraps to 0
+static int
+cascade(int n, int index) {
+    list_entry_t list, *head = tvn[n] + index, *le;
+    list_init(&list);
+    if (!list_empty(head)) {
+        list_add(head, &list);
+        list_del_init(head);
+    }
+    while ((le = list_next(&list)) != &list) {
+        timer_t *timer = le2timer(le, timer_link);
+        list_del(le);
+        list_add_before(timer_vec(timer), le);
+    }
+    return index;
+}
+
+// add_timer - put the timer in the wheel, it expires timer->expires ticks from now
 void
 add_timer(timer_t *timer) {
     bool intr_flag;
@@ -112,68 +462,165 @@ add_timer(timer_t *timer) {
     {
         assert(timer->expires > 0 && timer->proc != NULL);
         assert(list_empty(&(timer->timer_link)));
-        list_entry_t *le = list_next(&timer_list);
-        while (le != &timer_list) {
-            timer_t *next = le2timer(le, timer_link);
-            if (timer->expires < next->expires) {
-                next->expires -= timer->expires;
-                break;
-            }
-            timer->expires -= next->expires;
-            le = list_next(le);
+        timer->expires += (unsigned int)ticks;
+        list_add_before(timer_vec(timer), &(timer->timer_link));
+        // the boot cpu runs the wheel, when idle it sleeps until the first timer due
+        if (mycpu() != cpus && cpus->tick_stopped) {
+            lapic_send_ipi(cpus->apicid, IRQ_OFFSET + IRQ_RESCHED);
         }
-        list_add_before(le, &(timer->timer_link));
     }
     local_intr_restore(intr_flag);
 }
 
+// del_timer - take the timer out of the wheel, if it has not expired yet
 void
 del_timer(timer_t *timer) {
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        if (!list_empty(&(timer->timer_link))) {
-            if (timer->expires != 0) {
-                list_entry_t *le = list_next(&(timer->timer_link));
-                if (le != &timer_list) {
-                    timer_t *next = le2timer(le, timer_link);
-                    next->expires += timer->expires;
-                }
-            }
-            list_del_init(&(timer->timer_link));
+        list_del_init(&(timer->timer_link));
+    }
+    local_intr_restore(intr_flag);
+}
+
+// run_timers - run the slot of each tick up to the ticks of the clock, cascading the
+//            - upper levels each time the one below wraps
+static void
+run_timers(void) {
+    list_entry_t list, *le;
+    while ((int)(timer_jiffies - (unsigned int)ticks) <= 0) {
+        int n, index = timer_jiffies & TVR_MASK;
+        for (n = 0; index == 0 && n < TVN_LEVELS; n ++) {
+            index = cascade(n, TVN_INDEX(timer_jiffies, n));
+        }
+        index = timer_jiffies & TVR_MASK;
+        timer_jiffies ++;
+
+        list_init(&list);
+        if (!list_empty(tv1 + index)) {
+            list_add(tv1 + index, &list);
+            list_del_init(tv1 + index);
+        }
+        while ((le = list_next(&list)) != &list) {
+            timer_t *timer = le2timer(le, timer_link);
+            list_del_init(le);
+            timer_wakeup(timer->proc);
+        }
+    }
+}
+
+// timer_next_expiry - the first tick with a slot of tv1 to run, at most the next wrap
+//                   - of tv1, where the upper levels are cascaded
+static unsigned int
+timer_next_expiry(void) {
+    unsigned int tick = timer_jiffies;
+    while ((tick & TVR_MASK) != 0 && list_empty(tv1 + (tick & TVR_MASK))) {
+        tick ++;
+    }
+    return tick;
+}
+
+// hrtimer_first - the first hrtimer due on the cpu, NULL if none
+static hrtimer_t *
+hrtimer_first(struct cpu *cpu) {
+    rb_node *node, *left;
+    if ((node = rb_node_root(cpu->hrtimers)) == NULL) {
+        return NULL;
+    }
+    while ((left = rb_node_left(cpu->hrtimers, node)) != NULL) {
+        node = left;
+    }
+    return rbn2hrtimer(node);
+}
+
+// add_hrtimer - queue the timer on this cpu, it expires at the TSC timer->expires
+void
+add_hrtimer(hrtimer_t *timer) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        struct cpu *cpu = mycpu();
+        assert(timer->proc != NULL && timer->cpu == NULL);
+        timer->cpu = cpu;
+        rb_insert(cpu->hrtimers, &(timer->hr_node));
+        if (hrtimer_first(cpu) == timer) {
+            timer_program(cpu->tick_stopped);
+        }
+    }
+    local_intr_restore(intr_flag);
+}
+
+// del_hrtimer - take the timer off its cpu, if it has not expired yet
+void
+del_hrtimer(hrtimer_t *timer) {
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        if (timer->cpu != NULL) {
+            rb_delete(timer->cpu->hrtimers, &(timer->hr_node));
+            timer->cpu = NULL;
         }
     }
     local_intr_restore(intr_flag);
 }
 
+// run_hrtimers - wake up the procs of the hrtimers due on this cpu
+static void
+run_hrtimers(void) {
+    struct cpu *cpu = mycpu();
+    uint64_t now = rdtsc();
+    hrtimer_t *timer;
+    while ((timer = hrtimer_first(cpu)) != NULL && timer->expires <= now) {
+        rb_delete(cpu->hrtimers, &(timer->hr_node));
+        timer->cpu = NULL;
+        timer_wakeup(timer->proc);
+    }
+}
+
+// timer_program - set up the next timer interrupt of this cpu with a oneshot clock
+//               - event device: the next tick if the cpu is busy; if it is idle, the
+//               - first timer due on the boot cpu, and none on the others, which are
+//               - woken up by an IPI; an hrtimer due earlier comes first either way
+void
+timer_program(bool idle) {
+    struct cpu *cpu = mycpu();
+    uint64_t deadline = 0;
+    hrtimer_t *timer;
+    if (!clock_oneshot()) {
+        return;
+    }
+    if (!idle) {
+        deadline = clock_tick_deadline(ticks + 1);
+    }
+    else if (cpu == cpus) {
+        deadline = clock_tick_deadline(timer_next_expiry());
+    }
+    if ((timer = hrtimer_first(cpu)) != NULL && (deadline == 0 || timer->expires < deadline)) {
+        deadline = timer->expires;
+    }
+    cpu->tick_stopped = idle;
+    clock_set_next_event(deadline);
+}
+
+// run_timer_list - called on each timer interrupt: run the timers due, and the proc_tick
+//                - of current once per tick; a oneshot interrupt may come for an hrtimer
+//                - between two ticks
 void
 run_timer_list(void) {
     bool intr_flag;
     local_intr_save(intr_flag);
     {
-        list_entry_t *le = list_next(&timer_list);
-        if (le != &timer_list) {
-            timer_t *timer = le2timer(le, timer_link);
-            assert(timer->expires != 0);
-            timer->expires --;
-            while (timer->expires == 0) {
-                le = list_next(le);
-                struct proc_struct *proc = timer->proc;
-                if (proc->wait_state != 0) {
-                    assert(proc->wait_state & WT_INTERRUPTED);
-                }
-                else {
-                    warn("process %d's wait_state == 0.\n", proc->pid);
-                }
-                wakeup_proc(proc);
-                del_timer(timer);
-                if (le == &timer_list) {
-                    break;
-                }
-                timer = le2timer(le, timer_link);
-            }
+        struct cpu *cpu = mycpu();
+        // the timer wheel is run by the boot cpu
+        if (cpu == cpus) {
+            run_timers();
+        }
+        run_hrtimers();
+        if (cpu->last_tick != ticks) {
+            cpu->last_tick = ticks;
+            sched_class_proc_tick(current);
         }
-        sched_class_proc_tick(current);
+        timer_program(0);
     }
     local_intr_restore(intr_flag);
 }
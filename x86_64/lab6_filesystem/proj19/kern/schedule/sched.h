@@ -3,13 +3,15 @@
 
 #include <defs.h>
 #include <list.h>
+#include <spinlock.h>
+#include <rb_tree.h>
 
 struct proc_struct;
 
 typedef struct {
-    unsigned int expires;
+    unsigned int expires;           // the ticks to wait, the tick it expires at once added
     struct proc_struct *proc;
-    list_entry_t timer_link;
+    list_entry_t timer_link;        // the entry in a slot of the timer wheel
 } timer_t;
 
 #define le2timer(le, member)            \
@@ -23,8 +25,39 @@ timer_init(timer_t *timer, struct proc_struct *proc, int expires) {
     return timer;
 }
 
+// hrtimer_t - a timer of TSC cycle resolution, queued on the cpu adding it and raising
+//           - its own timer interrupt there, with a oneshot clock event device
+typedef struct {
+    uint64_t expires;               // the TSC deadline
+    struct proc_struct *proc;
+    struct cpu *cpu;                // the cpu it is queued on, NULL if not queued
+    rb_node hr_node;                // the node in the hrtimers of the cpu
+} hrtimer_t;
+
+#define rbn2hrtimer(node)               \
+    to_struct((node), hrtimer_t, hr_node)
+
+static inline hrtimer_t *
+hrtimer_init(hrtimer_t *timer, struct proc_struct *proc, uint64_t expires) {
+    timer->expires = expires;
+    timer->proc = proc;
+    timer->cpu = NULL;
+    return timer;
+}
+
 struct run_queue;
 
+// sched_pi_t - the scheduling attributes a proc inherits from the top waiter of the
+//            - mutexes it holds (see mutex.c); a copy, changed only while the proc is
+//            - out of the run queues, so a queued proc keeps its place
+typedef struct {
+    bool boosted;                   // the fields below are valid
+    int policy;
+    int rt_priority;
+    int nice;
+    int prio;                       // the rank in the fair class, see proc_prio
+} sched_pi_t;
+
 // The introduction of scheduling classes is borrrowed from Linux, and makes the 
 // core scheduler quite extensible. These classes (the scheduler modules) encapsulate 
 // the scheduling policies. 
@@ -41,20 +74,33 @@ struct sched_class {
     struct proc_struct *(*pick_next)(struct run_queue *rq);
     // dealer of the time-tick
     void (*proc_tick)(struct run_queue *rq, struct proc_struct *proc);
-     /* for SMP support in the future
-      *  load_balance
-      *	 void (*load_balance)(struct rq* rq);
-      *  get some proc from this rq, used in load_balance,
-      *  return value is the num of gotten proc
-      *  int (*get_proc)(struct rq* rq, struct proc* procs_moved[]);
-      */
+    // (optional) place the proc waking up before it is put into rq, and this function
+    // must be called with rq_lock
+    void (*proc_wakeup)(struct run_queue *rq, struct proc_struct *proc);
+    // (optional) the running proc yields the cpu
+    void (*proc_yield)(struct run_queue *rq, struct proc_struct *proc);
+    // get at most max procs out of rq for load_balance, the procs which would run last
+    // go first; return the number of procs gotten, and this function must be called
+    // with rq_lock
+    int (*get_proc)(struct run_queue *rq, struct proc_struct *procs_moved[], int max);
+    // (optional) the rank of proc among the procs of the class, higher runs first; the
+    // priority inheritance of the mutexes compares the fair procs by it
+    int (*proc_prio)(struct proc_struct *proc);
 };
 
+// Each cpu has a run queue of its own, and picks the next proc from it. A cpu with an
+// empty run queue steals procs from the busiest run queue (load_balance in sched.c).
 struct run_queue {
     list_entry_t run_list;
     unsigned int proc_num;
     int max_time_slice;
     list_entry_t rq_link;
+    spinlock_t rq_lock;
+    rb_tree *cfs_tree;              // CFS: the queued procs by vruntime
+    rb_node *cfs_leftmost;          // CFS: the queued proc with the smallest vruntime
+    uint64_t min_vruntime;          // CFS: follows the smallest vruntime, never goes back
+    unsigned int load_weight;       // CFS: the sum of the weights of the queued procs
+    struct rt_prio_array *rt_array; // RT: the FIFO list of each priority and their bitmap
 };
 
 #define le2rq(le, member)           \
@@ -63,9 +109,17 @@ struct run_queue {
 void sched_init(void);
 void wakeup_proc(struct proc_struct *proc);
 void schedule(void);
+void sched_yield(void);
+void sched_set_nice(struct proc_struct *proc, int nice);
+void sched_set_scheduler(struct proc_struct *proc, int policy, int rt_priority);
+void sched_set_pi(struct proc_struct *proc, struct proc_struct *donor);
+bool sched_prio_before(struct proc_struct *proc1, struct proc_struct *proc2);
 void add_timer(timer_t *timer);
 void del_timer(timer_t *timer);
 void run_timer_list(void);
+void add_hrtimer(hrtimer_t *timer);
+void del_hrtimer(hrtimer_t *timer);
+void timer_program(bool idle);
 
 #endif /* !__KERN_SCHEDULE_SCHED_H__ */
 
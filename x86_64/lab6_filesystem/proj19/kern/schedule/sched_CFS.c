@@ -0,0 +1,210 @@
+#include <defs.h>
+#include <list.h>
+#include <proc.h>
+#include <assert.h>
+#include <rb_tree.h>
+#include <sched_CFS.h>
+
+/* *
+ * CFS - the completely fair scheduler. A proc is charged vruntime for the ticks it runs,
+ * weighted by its nice value: a tick of a nice 0 proc is CFS_VTICK, and a proc of weight
+ * w is charged CFS_VTICK * CFS_NICE_0_LOAD / w per tick, so the heavier procs get ahead
+ * slower. The queued procs are kept in a red-black tree by vruntime, and the leftmost one,
+ * which has run the least, runs next.
+ *
+ * Each proc runs for its share of CFS_LATENCY by weight, but not less than
+ * CFS_MIN_GRANULARITY ticks; after CFS_MIN_GRANULARITY ticks it is also preempted if the
+ * leftmost proc is more than CFS_WAKEUP_GRANULARITY behind it.
+ *
+ * The min_vruntime of a run queue follows the smallest vruntime in it and never goes
+ * back. A proc waking up is placed at most CFS_SLEEPER_CREDIT before it, so a sleeper
+ * runs soon but cannot bank the time it slept, and a new proc starts a
+ * CFS_MIN_GRANULARITY after it so that forking does not get ahead of the queued procs.
+ * The vruntime of a proc is relative to the min_vruntime of the run queue it was last
+ * on, and is moved over when the proc goes to the run queue of another cpu.
+ * */
+
+#define CFS_NICE_0_LOAD             1024
+#define CFS_VTICK                   1024                        // the vruntime of a nice 0 tick
+#define CFS_LATENCY                 8                           // ticks
+#define CFS_MIN_GRANULARITY         2                           // ticks
+#define CFS_WAKEUP_GRANULARITY      (CFS_VTICK)
+#define CFS_SLEEPER_CREDIT          (CFS_LATENCY / 2 * CFS_VTICK)
+
+#define rbn2proc(node)              \
+    to_struct((node), struct proc_struct, run_node)
+
+// the weights of nice -20 ~ 19, each nice level is about 10% of the cpu, from Linux
+static const unsigned int cfs_prio_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */   88761,  71755,  56483,  46273,  36291,
+    /* -15 */   29154,  23254,  18705,  14949,  11916,
+    /* -10 */    9548,   7620,   6100,   4904,   3906,
+    /*  -5 */    3121,   2501,   1991,   1586,   1277,
+    /*   0 */    1024,    820,    655,    526,    423,
+    /*   5 */     335,    272,    215,    172,    137,
+    /*  10 */     110,     87,     70,     56,     45,
+    /*  15 */      36,     29,     23,     18,     15,
+};
+
+static inline unsigned int
+cfs_weight(struct proc_struct *proc) {
+    return cfs_prio_to_weight[proc_nice(proc) - NICE_MIN];
+}
+
+// cfs_delta - the vruntime of proc for running ticks
+static inline uint64_t
+cfs_delta(int ticks, struct proc_struct *proc) {
+    return (uint64_t)ticks * CFS_VTICK * CFS_NICE_0_LOAD / cfs_weight(proc);
+}
+
+// vruntime_before - a vruntime is before b, the vruntimes may wrap around
+static inline bool
+vruntime_before(uint64_t a, uint64_t b) {
+    return (int64_t)(a - b) < 0;
+}
+
+static int
+cfs_compare(rb_node *node1, rb_node *node2) {
+    struct proc_struct *proc1 = rbn2proc(node1), *proc2 = rbn2proc(node2);
+    if (proc1->vruntime != proc2->vruntime) {
+        return vruntime_before(proc1->vruntime, proc2->vruntime) ? -1 : 1;
+    }
+    return (proc1->pid < proc2->pid) ? -1 : ((proc1->pid > proc2->pid) ? 1 : 0);
+}
+
+// cfs_vruntime - the vruntime of proc moved over to rq
+static inline uint64_t
+cfs_vruntime(struct run_queue *rq, struct proc_struct *proc) {
+    if (proc->rq != NULL && proc->rq != rq) {
+        return proc->vruntime - proc->rq->min_vruntime + rq->min_vruntime;
+    }
+    return proc->vruntime;
+}
+
+// cfs_slice - the share of CFS_LATENCY of proc queued on rq
+static int
+cfs_slice(struct run_queue *rq, struct proc_struct *proc) {
+    int slice = CFS_LATENCY * cfs_weight(proc) / rq->load_weight;
+    return (slice < CFS_MIN_GRANULARITY) ? CFS_MIN_GRANULARITY : slice;
+}
+
+static void
+CFS_init(struct run_queue *rq) {
+    list_init(&(rq->run_list));
+    if ((rq->cfs_tree = rb_tree_create(cfs_compare)) == NULL) {
+        panic("CFS_init: no memory for the tree of run queue.\n");
+    }
+    rq->cfs_leftmost = NULL;
+    rq->min_vruntime = 0;
+    rq->load_weight = 0;
+    rq->proc_num = 0;
+}
+
+static void
+CFS_enqueue(struct run_queue *rq, struct proc_struct *proc) {
+    proc->vruntime = cfs_vruntime(rq, proc);
+    proc->rq = rq;
+    rb_insert(rq->cfs_tree, &(proc->run_node));
+    if (rq->cfs_leftmost == NULL || cfs_compare(&(proc->run_node), rq->cfs_leftmost) < 0) {
+        rq->cfs_leftmost = &(proc->run_node);
+    }
+    rq->load_weight += cfs_weight(proc);
+    rq->proc_num ++;
+}
+
+static void
+CFS_dequeue(struct run_queue *rq, struct proc_struct *proc) {
+    assert(proc->rq == rq && rq->proc_num > 0);
+    if (rq->cfs_leftmost == &(proc->run_node)) {
+        rq->cfs_leftmost = rb_node_next(rq->cfs_tree, &(proc->run_node));
+    }
+    rb_delete(rq->cfs_tree, &(proc->run_node));
+    rq->load_weight -= cfs_weight(proc);
+    rq->proc_num --;
+}
+
+// CFS_pick_next - the leftmost proc runs next, it gets its slice and min_vruntime moves
+//               - up to it
+static struct proc_struct *
+CFS_pick_next(struct run_queue *rq) {
+    struct proc_struct *next = NULL;
+    if (rq->cfs_leftmost != NULL) {
+        next = rbn2proc(rq->cfs_leftmost);
+        if (vruntime_before(rq->min_vruntime, next->vruntime)) {
+            rq->min_vruntime = next->vruntime;
+        }
+        next->time_slice = cfs_slice(rq, next);
+        next->slice_ticks = 0;
+    }
+    return next;
+}
+
+static void
+CFS_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+    proc->vruntime += cfs_delta(1, proc);
+    proc->slice_ticks ++;
+    if (proc->time_slice > 0) {
+        proc->time_slice --;
+    }
+    if (proc->time_slice == 0) {
+        proc->need_resched = 1;
+    }
+    else if (proc->slice_ticks >= CFS_MIN_GRANULARITY && rq->cfs_leftmost != NULL) {
+        struct proc_struct *left = rbn2proc(rq->cfs_leftmost);
+        if (vruntime_before(left->vruntime + CFS_WAKEUP_GRANULARITY, proc->vruntime)) {
+            proc->need_resched = 1;
+        }
+    }
+}
+
+static void
+CFS_proc_wakeup(struct run_queue *rq, struct proc_struct *proc) {
+    uint64_t vruntime = rq->min_vruntime;
+    if (proc->runs == 0) {
+        vruntime += cfs_delta(CFS_MIN_GRANULARITY, proc);
+    }
+    else {
+        uint64_t own = cfs_vruntime(rq, proc);
+        vruntime -= CFS_SLEEPER_CREDIT;
+        if (vruntime_before(vruntime, own)) {
+            vruntime = own;
+        }
+    }
+    proc->vruntime = vruntime;
+    proc->rq = rq;
+}
+
+// CFS_proc_prio - the lower the nice, the higher the rank
+static int
+CFS_proc_prio(struct proc_struct *proc) {
+    return -proc_nice(proc);
+}
+
+// CFS_get_proc - get the procs with the largest vruntimes first
+static int
+CFS_get_proc(struct run_queue *rq, struct proc_struct *procs_moved[], int max) {
+    int n = 0;
+    rb_node *node, *right;
+    while (n < max && (node = rb_node_root(rq->cfs_tree)) != NULL) {
+        while ((right = rb_node_right(rq->cfs_tree, node)) != NULL) {
+            node = right;
+        }
+        struct proc_struct *proc = rbn2proc(node);
+        CFS_dequeue(rq, proc);
+        procs_moved[n ++] = proc;
+    }
+    return n;
+}
+
+struct sched_class CFS_sched_class = {
+    .name = "CFS_scheduler",
+    .init = CFS_init,
+    .enqueue = CFS_enqueue,
+    .dequeue = CFS_dequeue,
+    .pick_next = CFS_pick_next,
+    .proc_tick = CFS_proc_tick,
+    .proc_wakeup = CFS_proc_wakeup,
+    .get_proc = CFS_get_proc,
+    .proc_prio = CFS_proc_prio,
+};
+
@@ -18,14 +18,31 @@ MLFQ_init(struct run_queue *rq) {
     } while (le != list);
 }
 
+// MLFQ_level_prio - the rank of the procs on a level, the shorter the slice the higher
+static inline int
+MLFQ_level_prio(struct run_queue *rq) {
+    return -rq->max_time_slice;
+}
+
 static void
 MLFQ_enqueue(struct run_queue *rq, struct proc_struct *proc) {
     assert(list_empty(&(proc->run_link)));
     struct run_queue *nrq = rq;
     if (proc->rq != NULL && proc->time_slice == 0) {
-        nrq = le2rq(list_next(&(proc->rq->rq_link)), rq_link);
-        if (nrq == rq) {
-            nrq = proc->rq;
+        // proc->rq may be a level of the run queue of another cpu, find the same level
+        // in rq by its time slice, then go one level down
+        list_entry_t *list = &(rq->rq_link), *le = list;
+        while (nrq->max_time_slice < proc->rq->max_time_slice && (le = list_next(le)) != list) {
+            nrq = le2rq(le, rq_link);
+        }
+        if ((le = list_next(&(nrq->rq_link))) != list) {
+            nrq = le2rq(le, rq_link);
+        }
+    }
+    // a proc holding a mutex runs no lower than the level of its top waiter
+    if (proc->pi.boosted) {
+        while (nrq != rq && MLFQ_level_prio(nrq) < proc->pi.prio) {
+            nrq = le2rq(list_prev(&(nrq->rq_link)), rq_link);
         }
     }
     sched_class->enqueue(nrq, proc);
@@ -55,6 +72,29 @@ MLFQ_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
     sched_class->proc_tick(proc->rq, proc);
 }
 
+// MLFQ_get_proc - get procs from the lowest levels first
+static int
+MLFQ_get_proc(struct run_queue *rq, struct proc_struct *procs_moved[], int max) {
+    int n = 0;
+    list_entry_t *list = &(rq->rq_link), *le = list;
+    do {
+        le = list_prev(le);
+        n += sched_class->get_proc(le2rq(le, rq_link), procs_moved + n, max - n);
+    } while (le != list && n < max);
+    return n;
+}
+
+// MLFQ_proc_prio - the rank of the level of proc, or of the level it inherits; a new
+//                - proc goes in at the top level
+static int
+MLFQ_proc_prio(struct proc_struct *proc) {
+    int prio = (proc->rq != NULL) ? MLFQ_level_prio(proc->rq) : 0;
+    if (proc->pi.boosted && proc->pi.prio > prio) {
+        prio = proc->pi.prio;
+    }
+    return prio;
+}
+
 struct sched_class MLFQ_sched_class = {
     .name = "MLFQ_scheduler",
     .init = MLFQ_init,
@@ -62,5 +102,7 @@ struct sched_class MLFQ_sched_class = {
     .dequeue = MLFQ_dequeue,
     .pick_next = MLFQ_pick_next,
     .proc_tick = MLFQ_proc_tick,
+    .get_proc = MLFQ_get_proc,
+    .proc_prio = MLFQ_proc_prio,
 };
 
@@ -0,0 +1,149 @@
+#include <defs.h>
+#include <x86.h>
+#include <list.h>
+#include <proc.h>
+#include <slab.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched_RT.h>
+
+/* *
+ * RT - the real-time class, stacked above the fair class (see sched.c). Each priority has
+ * a FIFO list of its queued procs, and a bitmap has the bit of each non-empty list set,
+ * so the next proc is the head of the list of the first set bit, found with bsf over
+ * RT_BITMAP_WORDS words. Bit 0 is the highest priority, MAX_RT_PRIO - 1.
+ *
+ * A SCHED_FIFO proc runs until it blocks, yields or is preempted by a higher priority;
+ * a SCHED_RR proc also goes behind the procs of its priority every RT_RR_TIMESLICE
+ * ticks. A proc preempted with time_slice left goes back to the head of its list, one
+ * which has used up its slice, yields or wakes up goes to the tail.
+ * */
+
+#define RT_RR_TIMESLICE             10                          // ticks
+#define RT_BITMAP_WORDS             ((MAX_RT_PRIO + 63) / 64)
+
+struct rt_prio_array {
+    uint64_t bitmap[RT_BITMAP_WORDS];
+    list_entry_t queue[MAX_RT_PRIO];
+};
+
+static inline int
+rt_index(struct proc_struct *proc) {
+    return MAX_RT_PRIO - 1 - proc_rt_priority(proc);
+}
+
+// rt_first - the index of the highest priority with queued procs, or -1 if none
+static inline int
+rt_first(struct rt_prio_array *array) {
+    int i;
+    for (i = 0; i < RT_BITMAP_WORDS; i ++) {
+        if (array->bitmap[i] != 0) {
+            return i * 64 + bsfq(array->bitmap[i]);
+        }
+    }
+    return -1;
+}
+
+static void
+RT_init(struct run_queue *rq) {
+    struct rt_prio_array *array;
+    if ((array = kmalloc(sizeof(struct rt_prio_array))) == NULL) {
+        panic("RT_init: no memory for the priority array of run queue.\n");
+    }
+    int i;
+    for (i = 0; i < RT_BITMAP_WORDS; i ++) {
+        array->bitmap[i] = 0;
+    }
+    for (i = 0; i < MAX_RT_PRIO; i ++) {
+        list_init(array->queue + i);
+    }
+    list_init(&(rq->run_list));
+    rq->rt_array = array;
+    rq->proc_num = 0;
+}
+
+static void
+RT_enqueue(struct run_queue *rq, struct proc_struct *proc) {
+    assert(list_empty(&(proc->run_link)));
+    struct rt_prio_array *array = rq->rt_array;
+    int idx = rt_index(proc);
+    if (proc->time_slice == 0) {
+        proc->time_slice = RT_RR_TIMESLICE;
+        list_add_before(array->queue + idx, &(proc->run_link));
+    }
+    else {
+        list_add_after(array->queue + idx, &(proc->run_link));
+    }
+    array->bitmap[idx / 64] |= (1ULL << (idx % 64));
+    rq->proc_num ++;
+}
+
+static void
+RT_dequeue(struct run_queue *rq, struct proc_struct *proc) {
+    assert(!list_empty(&(proc->run_link)));
+    struct rt_prio_array *array = rq->rt_array;
+    int idx = rt_index(proc);
+    list_del_init(&(proc->run_link));
+    if (list_empty(array->queue + idx)) {
+        array->bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+    }
+    rq->proc_num --;
+}
+
+static struct proc_struct *
+RT_pick_next(struct run_queue *rq) {
+    int idx;
+    if ((idx = rt_first(rq->rt_array)) >= 0) {
+        return le2proc(list_next(rq->rt_array->queue + idx), run_link);
+    }
+    return NULL;
+}
+
+static void
+RT_proc_tick(struct run_queue *rq, struct proc_struct *proc) {
+    if (proc_policy(proc) == SCHED_RR && proc->time_slice > 0) {
+        if (-- proc->time_slice == 0) {
+            proc->need_resched = 1;
+        }
+    }
+}
+
+// RT_proc_wakeup - a proc waking up goes to the tail of its list with a new slice
+static void
+RT_proc_wakeup(struct run_queue *rq, struct proc_struct *proc) {
+    proc->time_slice = 0;
+}
+
+// RT_proc_yield - a proc yielding goes to the tail of its list with a new slice
+static void
+RT_proc_yield(struct run_queue *rq, struct proc_struct *proc) {
+    proc->time_slice = 0;
+}
+
+// RT_get_proc - get the procs of the lowest priorities first, from the tails
+static int
+RT_get_proc(struct run_queue *rq, struct proc_struct *procs_moved[], int max) {
+    int n = 0, idx;
+    for (idx = MAX_RT_PRIO - 1; idx >= 0 && n < max; idx --) {
+        list_entry_t *list = rq->rt_array->queue + idx, *le;
+        while (n < max && (le = list_prev(list)) != list) {
+            struct proc_struct *proc = le2proc(le, run_link);
+            RT_dequeue(rq, proc);
+            procs_moved[n ++] = proc;
+        }
+    }
+    return n;
+}
+
+struct sched_class RT_sched_class = {
+    .name = "RT_scheduler",
+    .init = RT_init,
+    .enqueue = RT_enqueue,
+    .dequeue = RT_dequeue,
+    .pick_next = RT_pick_next,
+    .proc_tick = RT_proc_tick,
+    .proc_wakeup = RT_proc_wakeup,
+    .proc_yield = RT_proc_yield,
+    .get_proc = RT_get_proc,
+};
+
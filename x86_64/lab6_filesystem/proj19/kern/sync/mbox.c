@@ -51,12 +51,17 @@ struct msg_mbox {
 #define MAX_MBOX_NUM                8192
 #define MBOX_P_PAGE                 (PGSIZE / sizeof(struct msg_mbox))
 #define MAX_MBOX_PAGES              ((MAX_MBOX_NUM + MBOX_P_PAGE - 1) / MBOX_P_PAGE)
-#define MAX_MSG_DATALEN             (512 - sizeof(struct msg_msg))
+#define MSG_CHUNK_SIZE              512
+#define MAX_MSG_DATALEN             (MSG_CHUNK_SIZE - sizeof(struct msg_msg))
 
 static struct msg_mbox *mbox_map[MAX_MBOX_PAGES];
 static list_entry_t free_mbox_list;
 static semaphore_t sem_mbox_map;
 
+// a message is split into chunks (msg_msg and msg_segs) of at most MSG_CHUNK_SIZE bytes,
+// the big chunks are allocated from msg_cachep, and the small ones from kmalloc
+static kmem_cache_t *msg_cachep;
+
 void
 mbox_init(void) {
     int i;
@@ -66,6 +71,9 @@ mbox_init(void) {
     sem_init(&sem_mbox_map, 1);
     list_init(&free_mbox_list);
     static_assert(MBOX_P_PAGE != 0);
+    if ((msg_cachep = kmem_cache_create("msg_msg", MSG_CHUNK_SIZE, 0, NULL)) == NULL) {
+        panic("mbox_init: cannot create msg_msg cache.\n");
+    }
 }
 
 static struct msg_mbox *
@@ -184,6 +192,15 @@ ipc_mbox_init(unsigned int max_slots) {
     return ret;
 }
 
+static void *
+alloc_msg_chunk(size_t size) {
+    if (size > MSG_CHUNK_SIZE / 2) {
+        return kmem_cache_alloc(msg_cachep);
+    }
+    return kmalloc(size);
+}
+
+// the chunks are freed by kfree, which finds the cache of obj from its page
 static void
 free_seg(struct msg_seg *seg) {
     if (seg->next != NULL) {
@@ -207,7 +224,7 @@ load_msg(const void *src, size_t len) {
         alen = MAX_MSG_DATALEN;
     }
     struct msg_msg *msg;
-    if ((msg = kmalloc(sizeof(struct msg_msg) + alen)) == NULL) {
+    if ((msg = alloc_msg_chunk(sizeof(struct msg_msg) + alen)) == NULL) {
         return NULL;
     }
 
@@ -221,7 +238,7 @@ load_msg(const void *src, size_t len) {
             alen = MAX_MSG_DATALEN;
         }
         struct msg_seg *seg;
-        if ((seg = kmalloc(sizeof(struct msg_seg) + alen)) == NULL) {
+        if ((seg = alloc_msg_chunk(sizeof(struct msg_seg) + alen)) == NULL) {
             goto failed;
         }
         *segp = seg, segp = &(seg->next);
@@ -0,0 +1,267 @@
+#include <defs.h>
+#include <list.h>
+#include <sync.h>
+#include <wait.h>
+#include <proc.h>
+#include <sched.h>
+#include <cpu.h>
+#include <clock.h>
+#include <mutex.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <assert.h>
+
+/* *
+ * mutex - a sleeping lock with an owner and priority inheritance.
+ *
+ * A proc blocking on a mutex lends the scheduling parameters it runs by to the owner
+ * (sched_set_pi), and on to the owner of the mutex that one sleeps on, and so on, so a
+ * low priority proc sleeping with a lock held (on the disk, on kswapd) is not kept off
+ * the cpu by the procs in between once it wakes up, while a high priority proc waits
+ * for the lock. An owner runs by the parameters of the top waiter of all the mutexes it
+ * holds, and gets its own back as it unlocks them; an unlock hands the mutex over to the
+ * top waiter, FIFO among equals.
+ *
+ * The owners, the waiters and the parameters inherited are all under pi_lock, one lock
+ * for all the mutexes, so a chain is walked under one lock; it is followed at most
+ * MUTEX_PI_DEPTH deep. Before the procs are set up a mutex is taken with no owner.
+ * */
+
+#define MUTEX_PI_DEPTH              16
+
+static spinlock_t pi_lock;
+
+#ifdef DEBUG_MUTEX_PI
+static bool mutex_pi_enabled = 1;   // cleared to measure an inversion without inheritance
+#else
+#define mutex_pi_enabled            1
+#endif
+
+void
+mutex_init(mutex_t *mutex) {
+    mutex->locked = 0;
+    mutex->owner = NULL;
+    list_init(&(mutex->held_link));
+    wait_queue_init(&(mutex->wait_queue));
+}
+
+static void
+mutex_set_owner(mutex_t *mutex, struct proc_struct *proc) {
+    mutex->locked = 1;
+    mutex->owner = proc;
+    if (proc != NULL) {
+        list_add(&(proc->pi_mutexes), &(mutex->held_link));
+    }
+}
+
+// mutex_pi_donor - the top waiter of the mutexes proc holds, NULL if none
+static struct proc_struct *
+mutex_pi_donor(struct proc_struct *proc) {
+    struct proc_struct *donor = NULL;
+    if (mutex_pi_enabled) {
+        list_entry_t *list = &(proc->pi_mutexes), *le = list;
+        while ((le = list_next(le)) != list) {
+            wait_t *wait = wait_queue_top(&(le2mutex(le, held_link)->wait_queue));
+            if (wait != NULL && (donor == NULL || sched_prio_before(wait->proc, donor))) {
+                donor = wait->proc;
+            }
+        }
+    }
+    return donor;
+}
+
+// mutex_pi_chain - let proc inherit from its top waiter, and go on along the mutexes
+//                - the owners sleep on; called with pi_lock held
+static void
+mutex_pi_chain(struct proc_struct *proc) {
+    int depth;
+    for (depth = 0; proc != NULL && depth < MUTEX_PI_DEPTH; depth ++) {
+        sched_set_pi(proc, mutex_pi_donor(proc));
+        if (proc->pi_blocked_on == NULL) {
+            break;
+        }
+        proc = proc->pi_blocked_on->owner;
+    }
+}
+
+void
+mutex_lock(mutex_t *mutex) {
+    bool intr_flag;
+    spin_lock_irqsave(&pi_lock, intr_flag);
+    if (!mutex->locked) {
+        mutex_set_owner(mutex, current);
+        spin_unlock_irqrestore(&pi_lock, intr_flag);
+        return ;
+    }
+    assert(current != NULL && mutex->owner != current);
+    wait_t __wait, *wait = &__wait;
+    wait_current_set(&(mutex->wait_queue), wait, WT_KMUTEX);
+    current->pi_blocked_on = mutex;
+    mutex_pi_chain(mutex->owner);
+    spin_unlock_irqrestore(&pi_lock, intr_flag);
+
+    schedule();
+
+    // mutex_unlock has handed the mutex over
+    assert(!wait_in_queue(wait) && wait->wakeup_flags == WT_KMUTEX && mutex->owner == current);
+}
+
+bool
+mutex_trylock(mutex_t *mutex) {
+    bool intr_flag, ret = 0;
+    spin_lock_irqsave(&pi_lock, intr_flag);
+    if (!mutex->locked) {
+        mutex_set_owner(mutex, current);
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&pi_lock, intr_flag);
+    return ret;
+}
+
+void
+mutex_unlock(mutex_t *mutex) {
+    bool intr_flag;
+    spin_lock_irqsave(&pi_lock, intr_flag);
+    {
+        assert(mutex->locked);
+        struct proc_struct *owner = mutex->owner;
+        if (owner != NULL) {
+            list_del_init(&(mutex->held_link));
+        }
+        wait_t *wait;
+        if ((wait = wait_queue_top(&(mutex->wait_queue))) == NULL) {
+            mutex->locked = 0, mutex->owner = NULL;
+        }
+        else {
+            struct proc_struct *proc = wait->proc;
+            assert(proc->wait_state == WT_KMUTEX && proc->pi_blocked_on == mutex);
+            wait_queue_del(&(mutex->wait_queue), wait);
+            proc->pi_blocked_on = NULL;
+            mutex_set_owner(mutex, proc);
+            // the waiters left lend to the new owner before it runs
+            mutex_pi_chain(proc);
+            wakeup_wait(&(mutex->wait_queue), wait, WT_KMUTEX, 0);
+        }
+        if (owner != NULL) {
+            mutex_pi_chain(owner);
+        }
+    }
+    spin_unlock_irqrestore(&pi_lock, intr_flag);
+}
+
+// mutex_adjust_pi - the parameters of proc have changed, pass them on to the owners of
+//                 - the mutex it sleeps on
+void
+mutex_adjust_pi(struct proc_struct *proc) {
+    bool intr_flag;
+    spin_lock_irqsave(&pi_lock, intr_flag);
+    if (proc->pi_blocked_on != NULL) {
+        mutex_pi_chain(proc->pi_blocked_on->owner);
+    }
+    spin_unlock_irqrestore(&pi_lock, intr_flag);
+}
+
+static mutex_t check_lock;
+
+#ifdef DEBUG_MUTEX_PI
+
+/* *
+ * check_mutex_inversion - a fair proc takes a mutex and sleeps with it, standing in for
+ * the disk; a SCHED_FIFO proc then waits for the mutex, while a lower SCHED_FIFO proc on
+ * each cpu keeps it busy for MUTEX_CHECK_HOG ticks. The latency of the waiter is the
+ * inversion: about MUTEX_CHECK_HOG ticks without inheritance, a tick or two with it.
+ *
+ * It depends on the timer and on how the cpus are scheduled, so it only prints what it
+ * measured, and is built in with make "DEFS+=-DDEBUG_MUTEX_PI".
+ * */
+
+#define MUTEX_CHECK_HOLD            2       // ticks the fair proc sleeps holding the mutex
+#define MUTEX_CHECK_HOG             20      // ticks the cpus are kept busy
+
+static volatile size_t check_latency;
+
+static int
+check_mutex_low(void *arg) {
+    mutex_lock(&check_lock);
+    do_sleep(MUTEX_CHECK_HOLD);
+    mutex_unlock(&check_lock);
+    assert(!current->pi.boosted && list_empty(&(current->pi_mutexes)));
+    return 0;
+}
+
+static int
+check_mutex_high(void *arg) {
+    sched_set_scheduler(current, SCHED_FIFO, 20);
+    do_sleep(1);
+    size_t start = ticks;
+    mutex_lock(&check_lock);
+    check_latency = ticks - start;
+    mutex_unlock(&check_lock);
+    return 0;
+}
+
+// check_mutex_hog - spin without the kernel lock as a proc in user mode would, giving
+//                 - way only to a higher priority
+static int
+check_mutex_hog(void *arg) {
+    sched_set_scheduler(current, SCHED_FIFO, 10);
+    do_sleep(1);
+    size_t until = ticks + MUTEX_CHECK_HOG;
+    while (ticks < until) {
+        size_t tick = ticks;
+        unlock_kernel();
+        while (ticks == tick) {
+            cpu_relax();
+        }
+        bool intr_flag;
+        local_intr_save(intr_flag);
+        {
+            lock_kernel();
+        }
+        local_intr_restore(intr_flag);
+        if (current->need_resched) {
+            schedule();
+        }
+    }
+    return 0;
+}
+
+static size_t
+check_mutex_inversion(bool pi) {
+    int pids[NCPU + 2], i, n = 0;
+    mutex_pi_enabled = pi;
+    pids[n ++] = kernel_thread(check_mutex_low, NULL, 0);
+    pids[n ++] = kernel_thread(check_mutex_high, NULL, 0);
+    for (i = 0; i < ncpu; i ++) {
+        pids[n ++] = kernel_thread(check_mutex_hog, NULL, 0);
+    }
+    for (i = 0; i < n; i ++) {
+        assert(pids[i] > 0 && do_wait(pids[i], NULL) == 0);
+    }
+    mutex_pi_enabled = 1;
+    assert(!mutex_locked(&check_lock));
+    return check_latency;
+}
+
+#endif /* DEBUG_MUTEX_PI */
+
+void
+check_mutex(void) {
+    mutex_init(&check_lock);
+    mutex_lock(&check_lock);
+    assert(check_lock.owner == current && !mutex_trylock(&check_lock));
+    assert(list_next(&(current->pi_mutexes)) == &(check_lock.held_link));
+    mutex_unlock(&check_lock);
+    assert(mutex_trylock(&check_lock));
+    mutex_unlock(&check_lock);
+    assert(!mutex_locked(&check_lock) && list_empty(&(current->pi_mutexes)));
+
+#ifdef DEBUG_MUTEX_PI
+    size_t before = check_mutex_inversion(0);
+    size_t after = check_mutex_inversion(1);
+    cprintf("mutex inversion: %d ticks without inheritance, %d ticks with it.\n", before, after);
+#endif
+
+    cprintf("check_mutex() succeeded!\n");
+}
+
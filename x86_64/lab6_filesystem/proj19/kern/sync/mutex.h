@@ -0,0 +1,33 @@
+#ifndef __KERN_SYNC_MUTEX_H__
+#define __KERN_SYNC_MUTEX_H__
+
+#include <defs.h>
+#include <list.h>
+#include <wait.h>
+
+struct proc_struct;
+
+typedef struct mutex {
+    bool locked;
+    struct proc_struct *owner;      // NULL if taken before the procs are set up
+    list_entry_t held_link;         // the entry in the pi_mutexes of the owner
+    wait_queue_t wait_queue;
+} mutex_t;
+
+#define le2mutex(le, member)            \
+    to_struct((le), mutex_t, member)
+
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+bool mutex_trylock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+void mutex_adjust_pi(struct proc_struct *proc);
+void check_mutex(void);
+
+static inline bool
+mutex_locked(mutex_t *mutex) {
+    return mutex->locked;
+}
+
+#endif /* !__KERN_SYNC_MUTEX_H__ */
+
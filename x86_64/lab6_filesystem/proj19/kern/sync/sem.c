@@ -55,15 +55,17 @@ sem_init(semaphore_t *sem, int value) {
     sem->valid = 1;
     set_sem_count(sem, 0);
     wait_queue_init(&(sem->wait_queue));
+    spinlock_init(&(sem->lock));
 }
 
 static __noinline void __up(semaphore_t *sem, uint32_t wait_state) {
     assert(sem->valid);
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&(sem->lock), intr_flag);
     {
+        // the waiter of the highest priority goes first, FIFO among equals
         wait_t *wait;
-        if ((wait = wait_queue_first(&(sem->wait_queue))) == NULL) {
+        if ((wait = wait_queue_top(&(sem->wait_queue))) == NULL) {
             sem->value ++;
         }
         else {
@@ -71,29 +73,29 @@ static __noinline void __up(semaphore_t *sem, uint32_t wait_state) {
             wakeup_wait(&(sem->wait_queue), wait, wait_state, 1);
         }
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&(sem->lock), intr_flag);
 }
 
 static __noinline uint32_t __down(semaphore_t *sem, uint32_t wait_state, timer_t *timer) {
     assert(sem->valid);
     bool intr_flag;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&(sem->lock), intr_flag);
     if (sem->value > 0) {
         sem->value --;
-        local_intr_restore(intr_flag);
+        spin_unlock_irqrestore(&(sem->lock), intr_flag);
         return 0;
     }
     wait_t __wait, *wait = &__wait;
     wait_current_set(&(sem->wait_queue), wait, wait_state);
     ipc_add_timer(timer);
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&(sem->lock), intr_flag);
 
     schedule();
 
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&(sem->lock), intr_flag);
     ipc_del_timer(timer);
     wait_current_del(&(sem->wait_queue), wait);
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&(sem->lock), intr_flag);
 
     if (wait->wakeup_flags != wait_state) {
         return wait->wakeup_flags;
@@ -115,11 +117,11 @@ down(semaphore_t *sem) {
 bool
 try_down(semaphore_t *sem) {
     bool intr_flag, ret = 0;
-    local_intr_save(intr_flag);
+    spin_lock_irqsave(&(sem->lock), intr_flag);
     if (sem->value > 0) {
         sem->value --, ret = 1;
     }
-    local_intr_restore(intr_flag);
+    spin_unlock_irqrestore(&(sem->lock), intr_flag);
     return ret;
 }
 
@@ -158,10 +160,19 @@ sem_queue_destroy(sem_queue_t *sem_queue) {
     kfree(sem_queue);
 }
 
+static kmem_cache_t *semu_cachep;
+
+void
+semu_init(void) {
+    if ((semu_cachep = kmem_cache_create("sem_undo", sizeof(sem_undo_t), 0, NULL)) == NULL) {
+        panic("semu_init: cannot create sem_undo cache.\n");
+    }
+}
+
 sem_undo_t *
 semu_create(semaphore_t *sem, int value) {
     sem_undo_t *semu;
-    if ((semu = kmalloc(sizeof(sem_undo_t))) != NULL) {
+    if ((semu = kmem_cache_alloc(semu_cachep)) != NULL) {
         if (sem == NULL && (sem = kmalloc(sizeof(semaphore_t))) != NULL) {
             sem_init(sem, value);
         }
@@ -170,7 +181,7 @@ semu_create(semaphore_t *sem, int value) {
             semu->sem = sem;
             return semu;
         }
-        kfree(semu);
+        kmem_cache_free(semu_cachep, semu);
     }
     return NULL;
 }
@@ -180,7 +191,7 @@ semu_destroy(sem_undo_t *semu) {
     if (sem_count_dec(semu->sem) == 0) {
         kfree(semu->sem);
     }
-    kfree(semu);
+    kmem_cache_free(semu_cachep, semu);
 }
 
 int
@@ -291,13 +302,13 @@ ipc_sem_free(sem_t sem_id) {
     int ret = -E_INVAL;
     if (semu != NULL) {
         bool intr_flag;
-        local_intr_save(intr_flag);
+        spin_lock_irqsave(&(semu->sem->lock), intr_flag);
         {
             semaphore_t *sem = semu->sem;
             sem->valid = 0, ret = 0;
             wakeup_queue(&(sem->wait_queue), WT_INTERRUPTED, 1);
         }
-        local_intr_restore(intr_flag);
+        spin_unlock_irqrestore(&(semu->sem->lock), intr_flag);
     }
     return ret;
 }
@@ -4,12 +4,14 @@
 #include <defs.h>
 #include <atomic.h>
 #include <wait.h>
+#include <spinlock.h>
 
 typedef struct {
     int value;
     bool valid;
     atomic_t count;
     wait_queue_t wait_queue;
+    spinlock_t lock;                // protects value and wait_queue
 } semaphore_t;
 
 // The sem_undo_t is used to permit semaphore manipulations that can be undone. If a process
@@ -37,6 +39,7 @@ void up(semaphore_t *sem);
 void down(semaphore_t *sem);
 bool try_down(semaphore_t *sem);
 
+void semu_init(void);
 sem_undo_t *semu_create(semaphore_t *sem, int value);
 void semu_destroy(sem_undo_t *semu);
 
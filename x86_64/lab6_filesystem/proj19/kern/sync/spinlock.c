@@ -0,0 +1,68 @@
+#include <defs.h>
+#include <x86.h>
+#include <cpu.h>
+#include <pmm.h>
+#include <assert.h>
+#include <spinlock.h>
+
+static spinlock_t kernel_lock;
+
+// ticket_take - take the next ticket of lock
+static inline uint16_t
+ticket_take(spinlock_t *lock) {
+    uint16_t ticket = 1;
+    asm volatile ("lock; xaddw %0, %1" : "+r" (ticket), "+m" (lock->next) :: "memory");
+    return ticket;
+}
+
+void
+spinlock_init(spinlock_t *lock) {
+    lock->owner = lock->next = 0;
+    lock->cpu = NULL;
+}
+
+void
+spin_lock(spinlock_t *lock) {
+    uint16_t ticket = ticket_take(lock);
+    while (lock->owner != ticket) {
+        cpu_relax();
+    }
+    lock->cpu = mycpu();
+}
+
+void
+spin_unlock(spinlock_t *lock) {
+    assert(spin_holding(lock));
+    lock->cpu = NULL;
+    barrier();
+    lock->owner ++;
+}
+
+// spin_holding - whether the lock is held by this cpu
+bool
+spin_holding(spinlock_t *lock) {
+    return lock->owner != lock->next && lock->cpu == mycpu();
+}
+
+// lock_kernel - take the kernel lock, the TLB shootdowns sent to this cpu meanwhile are
+//             - answered here, as the cpu sending them holds the lock and waits for them
+void
+lock_kernel(void) {
+    uint16_t ticket = ticket_take(&kernel_lock);
+    while (kernel_lock.owner != ticket) {
+        tlb_shootdown_ack();
+        cpu_relax();
+    }
+    kernel_lock.cpu = mycpu();
+}
+
+void
+unlock_kernel(void) {
+    spin_unlock(&kernel_lock);
+}
+
+bool
+kernel_locked(void) {
+    return spin_holding(&kernel_lock);
+}
+
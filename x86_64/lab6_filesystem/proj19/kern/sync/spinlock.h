@@ -0,0 +1,36 @@
+#ifndef __KERN_SYNC_SPINLOCK_H__
+#define __KERN_SYNC_SPINLOCK_H__
+
+#include <defs.h>
+
+struct cpu;
+
+/* *
+ * Ticket spinlock: a cpu takes the next ticket and spins until the owner field reaches
+ * it, so the cpus get the lock in the order they asked for it. A spinlock does not
+ * disable the interrupts, use spin_lock_irqsave (sync.h) if an interrupt handler on
+ * the same cpu may take it.
+ *
+ * The kernel lock: the parts of ucore written for one cpu (mm, fs, ipc, ...) rely on
+ * local_intr_save for mutual exclusion, so the kernel lock lets one cpu at a time run
+ * in the kernel. A cpu takes it on the way in from user mode, keeps it across switch_to
+ * (the next proc runs on with it), and drops it on the way back to user mode or before
+ * its idle proc halts. The cpus spinning for it still answer the TLB shootdowns.
+ * */
+typedef struct {
+    volatile uint16_t owner;        // the ticket being served
+    volatile uint16_t next;         // the next ticket to hand out
+    struct cpu *cpu;                // the cpu holding the lock
+} spinlock_t;
+
+void spinlock_init(spinlock_t *lock);
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+bool spin_holding(spinlock_t *lock);
+
+void lock_kernel(void);
+void unlock_kernel(void);
+bool kernel_locked(void);
+
+#endif /* !__KERN_SYNC_SPINLOCK_H__ */
+
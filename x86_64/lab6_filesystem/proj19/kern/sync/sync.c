@@ -1,8 +1,10 @@
 #include <sync.h>
 #include <mbox.h>
+#include <sem.h>
 
 void
 sync_init(void) {
+    semu_init();
     mbox_init();
 }
 
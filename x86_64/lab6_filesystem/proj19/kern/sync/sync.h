@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <atomic.h>
 #include <sched.h>
+#include <spinlock.h>
 
 static inline bool
 __intr_save(void) {
@@ -27,6 +28,9 @@ __intr_restore(bool flag) {
 #define local_intr_save(x)      do { x = __intr_save(); } while (0)
 #define local_intr_restore(x)   __intr_restore(x);
 
+#define spin_lock_irqsave(lock, x)          do { local_intr_save(x); spin_lock(lock); } while (0)
+#define spin_unlock_irqrestore(lock, x)     do { spin_unlock(lock); local_intr_restore(x); } while (0)
+
 void sync_init(void);
 
 #endif /* !__KERN_SYNC_SYNC_H__ */
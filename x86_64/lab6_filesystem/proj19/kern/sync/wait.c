@@ -67,6 +67,21 @@ wait_queue_last(wait_queue_t *queue) {
     return NULL;
 }
 
+// wait_queue_top - the waiter of the highest priority (sched_prio_before), the one that
+//                - has waited longest among equals; NULL if none
+wait_t *
+wait_queue_top(wait_queue_t *queue) {
+    wait_t *top, *wait;
+    if ((top = wait = wait_queue_first(queue)) != NULL) {
+        while ((wait = wait_queue_next(queue, wait)) != NULL) {
+            if (sched_prio_before(wait->proc, top->proc)) {
+                top = wait;
+            }
+        }
+    }
+    return top;
+}
+
 bool
 wait_queue_empty(wait_queue_t *queue) {
     return list_empty(&(queue->wait_head));
@@ -28,6 +28,7 @@ wait_t *wait_queue_next(wait_queue_t *queue, wait_t *wait);
 wait_t *wait_queue_prev(wait_queue_t *queue, wait_t *wait);
 wait_t *wait_queue_first(wait_queue_t *queue);
 wait_t *wait_queue_last(wait_queue_t *queue);
+wait_t *wait_queue_top(wait_queue_t *queue);
 
 bool wait_queue_empty(wait_queue_t *queue);
 bool wait_in_queue(wait_t *wait);
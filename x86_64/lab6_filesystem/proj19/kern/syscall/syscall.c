@@ -3,6 +3,7 @@
 #include <trap.h>
 #include <stdio.h>
 #include <pmm.h>
+#include <vmm.h>
 #include <clock.h>
 #include <error.h>
 #include <assert.h>
@@ -12,6 +13,7 @@
 #include <stat.h>
 #include <dirent.h>
 #include <sysfile.h>
+#include <uring.h>
 
 static uint64_t
 sys_exit(uint64_t arg[]) {
@@ -52,6 +54,23 @@ sys_clone(uint64_t arg[]) {
     return do_fork(clone_flags, stack, tf);
 }
 
+static uint64_t
+sys_vfork(uint64_t arg[]) {
+    struct trapframe *tf = current->tf;
+    uintptr_t stack = tf->tf_rsp;
+    return do_fork(CLONE_VM | CLONE_VFORK, stack, tf);
+}
+
+static uint64_t
+sys_spawn(uint64_t arg[]) {
+    const char *name = (const char *)arg[0];
+    int argc = (int)arg[1];
+    const char **argv = (const char **)arg[2];
+    const struct spawn_action *actions = (const struct spawn_action *)arg[3];
+    int nactions = (int)arg[4];
+    return do_spawn(name, argc, argv, actions, nactions);
+}
+
 static uint64_t
 sys_exit_thread(uint64_t arg[]) {
     int error_code = (int)arg[0];
@@ -69,12 +88,40 @@ sys_sleep(uint64_t arg[]) {
     return do_sleep(time);
 }
 
+static uint64_t
+sys_nanosleep(uint64_t arg[]) {
+    uint64_t ns = arg[0];
+    return do_nanosleep(ns);
+}
+
+static uint64_t
+sys_clock_gettime(uint64_t arg[]) {
+    int clock_id = (int)arg[0];
+    struct timespec *ts = (struct timespec *)arg[1];
+    return do_clock_gettime(clock_id, ts);
+}
+
 static uint64_t
 sys_kill(uint64_t arg[]) {
     int pid = (int)arg[0];
     return do_kill(pid, -E_KILLED);
 }
 
+static uint64_t
+sys_setpriority(uint64_t arg[]) {
+    int pid = (int)arg[0];
+    int nice = (int)arg[1];
+    return do_setpriority(pid, nice);
+}
+
+static uint64_t
+sys_sched_setscheduler(uint64_t arg[]) {
+    int pid = (int)arg[0];
+    int policy = (int)arg[1];
+    int rt_priority = (int)arg[2];
+    return do_sched_setscheduler(pid, policy, rt_priority);
+}
+
 static uint64_t
 sys_gettime(uint64_t arg[]) {
     return (int)ticks;
@@ -124,6 +171,9 @@ sys_putc(uint64_t arg[]) {
 static uint64_t
 sys_pgdir(uint64_t arg[]) {
     print_pgdir();
+    if (current->mm != NULL) {
+        cprintf("huge pages: %lu, page faults: %lu\n", nr_huge_pages(current->mm->pgdir), current->mm->nr_faults);
+    }
     return 0;
 }
 
@@ -239,6 +289,15 @@ sys_write(uint64_t arg[]) {
     return sysfile_write(fd, base, len);
 }
 
+static uint64_t
+sys_pread(uint64_t arg[]) {
+    int fd = (int)arg[0];
+    void *base = (void *)arg[1];
+    size_t len = (size_t)arg[2];
+    off_t pos = (off_t)arg[3];
+    return sysfile_pread(fd, base, len, pos);
+}
+
 static uint64_t
 sys_seek(uint64_t arg[]) {
     int fd = (int)arg[0];
@@ -326,17 +385,39 @@ sys_mkfifo(uint64_t arg[]) {
     return sysfile_mkfifo(name, open_flags);
 }
 
+static uint64_t
+sys_uring_setup(uint64_t arg[]) {
+    unsigned int entries = (unsigned int)arg[0];
+    uint32_t flags = (uint32_t)arg[1];
+    uintptr_t *ring_store = (uintptr_t *)arg[2];
+    return do_uring_setup(entries, flags, ring_store);
+}
+
+static uint64_t
+sys_uring_enter(uint64_t arg[]) {
+    unsigned int to_submit = (unsigned int)arg[0];
+    unsigned int min_complete = (unsigned int)arg[1];
+    uint32_t flags = (uint32_t)arg[2];
+    return do_uring_enter(to_submit, min_complete, flags);
+}
+
 static uint64_t (*syscalls[])(uint64_t arg[]) = {
     [SYS_exit]              sys_exit,
     [SYS_fork]              sys_fork,
     [SYS_wait]              sys_wait,
     [SYS_exec]              sys_exec,
     [SYS_clone]             sys_clone,
+    [SYS_vfork]             sys_vfork,
+    [SYS_spawn]             sys_spawn,
     [SYS_exit_thread]       sys_exit_thread,
     [SYS_yield]             sys_yield,
     [SYS_kill]              sys_kill,
+    [SYS_setpriority]       sys_setpriority,
+    [SYS_sched_setscheduler]    sys_sched_setscheduler,
     [SYS_sleep]             sys_sleep,
+    [SYS_nanosleep]         sys_nanosleep,
     [SYS_gettime]           sys_gettime,
+    [SYS_clock_gettime]     sys_clock_gettime,
     [SYS_getpid]            sys_getpid,
     [SYS_brk]               sys_brk,
     [SYS_mmap]              sys_mmap,
@@ -361,6 +442,7 @@ static uint64_t (*syscalls[])(uint64_t arg[]) = {
     [SYS_read]              sys_read,
     [SYS_write]             sys_write,
     [SYS_seek]              sys_seek,
+    [SYS_pread]             sys_pread,
     [SYS_fstat]             sys_fstat,
     [SYS_fsync]             sys_fsync,
     [SYS_chdir]             sys_chdir,
@@ -373,6 +455,8 @@ static uint64_t (*syscalls[])(uint64_t arg[]) = {
     [SYS_dup]               sys_dup,
     [SYS_pipe]              sys_pipe,
     [SYS_mkfifo]            sys_mkfifo,
+    [SYS_uring_setup]       sys_uring_setup,
+    [SYS_uring_enter]       sys_uring_enter,
 };
 
 #define NUM_SYSCALLS        ((sizeof(syscalls)) / (sizeof(syscalls[0])))
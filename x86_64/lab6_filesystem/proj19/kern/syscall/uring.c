@@ -0,0 +1,358 @@
+#include <defs.h>
+#include <x86.h>
+#include <mmu.h>
+#include <memlayout.h>
+#include <pmm.h>
+#include <vmm.h>
+#include <slab.h>
+#include <proc.h>
+#include <sched.h>
+#include <clock.h>
+#include <sync.h>
+#include <wait.h>
+#include <sem.h>
+#include <mbox.h>
+#include <sysfile.h>
+#include <unistd.h>
+#include <uringbuf.h>
+#include <uring.h>
+#include <string.h>
+#include <error.h>
+#include <assert.h>
+
+/* *
+ * uring - batch the system calls through a submission and a completion queue shared
+ * with the user, see libs/uringbuf.h.
+ *
+ * The pages of a ring are allocated by the kernel and mapped at URING into the mm,
+ * outside of the vmas like the vvar page, so the kernel reads the sqes and writes the
+ * cqes at their kernel addresses; the ring belongs to the mm and goes away with it.
+ *
+ * Without UR_SETUP_SQPOLL the sqes run in uring_enter, in the order they were queued.
+ * With it they run in a kernel thread of the thread group of the caller, which shares
+ * its mm, files and semaphores: it spins on sq_tail without the kernel lock while the
+ * ring is busy, and after UR_SQPOLL_IDLE ticks with nothing to do it sets
+ * UR_NEED_WAKEUP in the ring and sleeps until uring_enter wakes it up.
+ *
+ * The sqes run one by one, an op that blocks (a read of an empty pipe, a mbox_recv or
+ * a sem_wait) holds up those queued behind it.
+ * */
+
+#define UR_SQPOLL_IDLE              (HZ / 10)           // ticks polled before sleeping
+#define UR_SQPOLL_SLEEP             HZ                  // ticks between checks when asleep
+
+struct uring_ctx {
+    struct uring *ring;             // the kernel address of the ring
+    struct Page *pages;
+    size_t npages;
+    struct uring_sqe *sqes;
+    struct uring_cqe *cqes;
+    uint32_t entries, mask;
+    uint32_t sq_head, cq_tail;      // the kernel copies, the user may scribble on the ring
+    semaphore_t sem;                // one submitter at a time
+    bool sqpoll;                    // the sqes are run by the sq poll thread
+    wait_queue_t worker_wait;       // the sq poll thread sleeps here
+    wait_queue_t cq_wait;           // uring_enter waits here for the cqes
+};
+
+// uring_issue - run the op of sqe, as the system call would
+static int64_t
+uring_issue(struct uring_sqe *sqe) {
+    switch (sqe->opcode) {
+    case UR_OP_NOP:
+        return 0;
+    case UR_OP_READ:
+        return sysfile_read(sqe->fd, (void *)sqe->addr, sqe->len);
+    case UR_OP_WRITE:
+        return sysfile_write(sqe->fd, (void *)sqe->addr, sqe->len);
+    case UR_OP_PREAD:
+        return sysfile_pread(sqe->fd, (void *)sqe->addr, sqe->len, sqe->off);
+    case UR_OP_FSYNC:
+        return sysfile_fsync(sqe->fd);
+    case UR_OP_MBOX_SEND:
+        return ipc_mbox_send(sqe->fd, (struct mboxbuf *)sqe->addr, sqe->off);
+    case UR_OP_MBOX_RECV:
+        return ipc_mbox_recv(sqe->fd, (struct mboxbuf *)sqe->addr, sqe->off);
+    case UR_OP_SEM_POST:
+        return ipc_sem_post(sqe->fd);
+    case UR_OP_SEM_WAIT:
+        return ipc_sem_wait(sqe->fd, sqe->off);
+    }
+    return -E_INVAL;
+}
+
+// uring_ready - there are sqes to run, and room in the cq for them
+static inline bool
+uring_ready(struct uring_ctx *ctx) {
+    struct uring *ring = ctx->ring;
+    uint32_t tail = ring->sq_tail;
+    return tail != ctx->sq_head && tail - ctx->sq_head <= ctx->entries &&
+        ctx->cq_tail - ring->cq_head < ctx->entries;
+}
+
+// uring_submit - run at most max sqes, return the number run
+static int
+uring_submit(struct uring_ctx *ctx, unsigned int max) {
+    struct uring *ring = ctx->ring;
+    int submitted = 0;
+    down(&(ctx->sem));
+    while (submitted < max && uring_ready(ctx)) {
+        // read the sqe after the tail, and copy it, the user may write it meanwhile
+        barrier();
+        struct uring_sqe sqe = ctx->sqes[ctx->sq_head & ctx->mask];
+        ring->sq_head = ++ ctx->sq_head;
+
+        int64_t res = uring_issue(&sqe);
+
+        struct uring_cqe *cqe = ctx->cqes + (ctx->cq_tail & ctx->mask);
+        cqe->user_data = sqe.user_data, cqe->res = res;
+        barrier();
+        ring->cq_tail = ++ ctx->cq_tail;
+        submitted ++;
+    }
+    up(&(ctx->sem));
+
+    if (submitted != 0) {
+        bool intr_flag;
+        local_intr_save(intr_flag);
+        {
+            wakeup_queue(&(ctx->cq_wait), WT_URING, 1);
+        }
+        local_intr_restore(intr_flag);
+    }
+    return submitted;
+}
+
+// uring_poll - spin on the ring without the kernel lock, so that the other cpus may
+//            - enter the kernel, until there is work or the tick is over
+static void
+uring_poll(struct uring_ctx *ctx) {
+    size_t tick = ticks;
+    unlock_kernel();
+    while (!uring_ready(ctx) && ticks == tick) {
+        cpu_relax();
+    }
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    {
+        lock_kernel();
+    }
+    local_intr_restore(intr_flag);
+}
+
+// uring_sleep - sleep until uring_enter wakes us up, or UR_SQPOLL_SLEEP ticks pass
+static void
+uring_sleep(struct uring_ctx *ctx) {
+    struct uring *ring = ctx->ring;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    ring->flags |= UR_NEED_WAKEUP;
+    // the user stores sq_tail and then loads flags, we do it the other way round
+    mb();
+    if (!uring_ready(ctx)) {
+        wait_t __wait, *wait = &__wait;
+        timer_t __timer, *timer = timer_init(&__timer, current, UR_SQPOLL_SLEEP);
+        wait_current_set(&(ctx->worker_wait), wait, WT_URING);
+        add_timer(timer);
+        local_intr_restore(intr_flag);
+
+        schedule();
+
+        local_intr_save(intr_flag);
+        del_timer(timer);
+        wait_current_del(&(ctx->worker_wait), wait);
+    }
+    ring->flags &= ~UR_NEED_WAKEUP;
+    local_intr_restore(intr_flag);
+}
+
+// uring_worker - the sq poll thread; it quits with its thread group, or when it is the
+//              - last one left on the mm
+static int
+uring_worker(void *arg) {
+    struct uring_ctx *ctx = arg;
+    size_t busy = ticks;
+    while (!(current->flags & PF_EXITING) && mm_count(current->mm) > 1) {
+        if (uring_submit(ctx, ctx->entries) != 0) {
+            busy = ticks;
+        }
+        else if (ticks - busy < UR_SQPOLL_IDLE) {
+            uring_poll(ctx);
+        }
+        else {
+            uring_sleep(ctx);
+            busy = ticks;
+        }
+        if (current->need_resched) {
+            schedule();
+        }
+    }
+    return 0;
+}
+
+static void
+uring_put_pages(struct uring_ctx *ctx) {
+    size_t i;
+    for (i = 0; i < ctx->npages; i ++) {
+        set_page_ref(ctx->pages + i, 0);
+    }
+    free_pages(ctx->pages, ctx->npages);
+}
+
+static void
+uring_unmap(struct mm_struct *mm, struct uring_ctx *ctx) {
+    size_t i;
+    for (i = 0; i < ctx->npages; i ++) {
+        page_remove(mm->pgdir, URING + i * PGSIZE);
+    }
+}
+
+// do_uring_setup - set up a ring of entries sqes and cqes for the mm of current, and
+//                - store its user address in *ring_store
+int
+do_uring_setup(unsigned int entries, uint32_t flags, uintptr_t *ring_store) {
+    static_assert(sizeof(struct uring) <= UR_SQES_OFF);
+    static_assert(UR_RING_SIZE(UR_MAX_ENTRIES) <= URINGSIZE);
+    struct mm_struct *mm = current->mm;
+    if (entries == 0 || entries > UR_MAX_ENTRIES || (entries & (entries - 1)) != 0) {
+        return -E_INVAL;
+    }
+    if ((flags & ~UR_SETUP_SQPOLL) != 0) {
+        return -E_INVAL;
+    }
+    if (mm->uring != NULL) {
+        return -E_BUSY;
+    }
+
+    int ret = -E_NO_MEM;
+    struct uring_ctx *ctx;
+    if ((ctx = kmalloc(sizeof(struct uring_ctx))) == NULL) {
+        goto out;
+    }
+    ctx->npages = ROUNDUP(UR_RING_SIZE(entries), PGSIZE) / PGSIZE;
+    if ((ctx->pages = alloc_pages(ctx->npages)) == NULL) {
+        goto bad_cleanup_ctx;
+    }
+
+    size_t i;
+    struct uring *ring = ctx->ring = page2kva(ctx->pages);
+    memset(ring, 0, ctx->npages * PGSIZE);
+    ring->entries = entries;
+    ring->sqes_off = UR_SQES_OFF;
+    ring->cqes_off = UR_CQES_OFF(entries);
+    ctx->sqes = (struct uring_sqe *)((void *)ring + ring->sqes_off);
+    ctx->cqes = (struct uring_cqe *)((void *)ring + ring->cqes_off);
+    ctx->entries = entries, ctx->mask = entries - 1;
+    ctx->sq_head = ctx->cq_tail = 0;
+    sem_init(&(ctx->sem), 1);
+    ctx->sqpoll = ((flags & UR_SETUP_SQPOLL) != 0);
+    wait_queue_init(&(ctx->worker_wait));
+    wait_queue_init(&(ctx->cq_wait));
+
+    // the pages are held by ctx as well as by the mappings, exit_mmap only unmaps them
+    for (i = 0; i < ctx->npages; i ++) {
+        set_page_ref(ctx->pages + i, 1);
+    }
+
+    uintptr_t addr = URING;
+    lock_mm(mm);
+    {
+        ret = 0;
+        for (i = 0; ret == 0 && i < ctx->npages; i ++) {
+            ret = page_insert(mm->pgdir, ctx->pages + i, URING + i * PGSIZE, PTE_U | PTE_W);
+        }
+        if (ret == 0 && !copy_to_user(mm, ring_store, &addr, sizeof(uintptr_t))) {
+            ret = -E_INVAL;
+        }
+        if (ret != 0) {
+            uring_unmap(mm, ctx);
+        }
+        else {
+            mm->uring = ctx;
+        }
+    }
+    unlock_mm(mm);
+
+    if (ret != 0) {
+        goto bad_cleanup_pages;
+    }
+
+    if (ctx->sqpoll) {
+        int pid;
+        if ((ret = pid = kernel_thread(uring_worker, ctx, CLONE_THREAD | CLONE_FS | CLONE_SEM)) < 0) {
+            lock_mm(mm);
+            {
+                mm->uring = NULL;
+                uring_unmap(mm, ctx);
+            }
+            unlock_mm(mm);
+            goto bad_cleanup_pages;
+        }
+        set_proc_name(find_proc(pid), "uring");
+    }
+    return 0;
+
+bad_cleanup_pages:
+    uring_put_pages(ctx);
+bad_cleanup_ctx:
+    kfree(ctx);
+out:
+    return ret;
+}
+
+// do_uring_enter - run at most to_submit sqes, or wake the sq poll thread up; with
+//                - UR_ENTER_GETEVENTS wait until the cq has min_complete cqes
+int
+do_uring_enter(unsigned int to_submit, unsigned int min_complete, uint32_t flags) {
+    struct mm_struct *mm = current->mm;
+    struct uring_ctx *ctx;
+    if (mm == NULL || (ctx = mm->uring) == NULL) {
+        return -E_INVAL;
+    }
+    if (!ctx->sqpoll) {
+        // the sqes submitted are complete when we return
+        return uring_submit(ctx, to_submit);
+    }
+
+    struct uring *ring = ctx->ring;
+    if (min_complete > ctx->entries) {
+        min_complete = ctx->entries;
+    }
+
+    int ret = 0;
+    bool intr_flag;
+    local_intr_save(intr_flag);
+    if (flags & (UR_ENTER_SQ_WAKEUP | UR_ENTER_GETEVENTS)) {
+        wakeup_queue(&(ctx->worker_wait), WT_URING, 1);
+    }
+    if (flags & UR_ENTER_GETEVENTS) {
+        wait_t __wait, *wait = &__wait;
+        while (ctx->cq_tail - ring->cq_head < min_complete) {
+            wait_current_set(&(ctx->cq_wait), wait, WT_URING);
+            local_intr_restore(intr_flag);
+
+            schedule();
+
+            local_intr_save(intr_flag);
+            wait_current_del(&(ctx->cq_wait), wait);
+            if (wait->wakeup_flags != WT_URING) {
+                ret = -E_KILLED;
+                break;
+            }
+        }
+    }
+    local_intr_restore(intr_flag);
+    return ret;
+}
+
+// uring_destroy - free the ring of mm, once exit_mmap has unmapped it
+void
+uring_destroy(struct mm_struct *mm) {
+    struct uring_ctx *ctx;
+    if ((ctx = mm->uring) != NULL) {
+        mm->uring = NULL;
+        uring_put_pages(ctx);
+        kfree(ctx);
+    }
+}
+
@@ -0,0 +1,13 @@
+#ifndef __KERN_SYSCALL_URING_H__
+#define __KERN_SYSCALL_URING_H__
+
+#include <defs.h>
+
+struct mm_struct;
+
+int do_uring_setup(unsigned int entries, uint32_t flags, uintptr_t *ring_store);
+int do_uring_enter(unsigned int to_submit, unsigned int min_complete, uint32_t flags);
+void uring_destroy(struct mm_struct *mm);
+
+#endif /* !__KERN_SYSCALL_URING_H__ */
+
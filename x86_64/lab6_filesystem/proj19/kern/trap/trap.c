@@ -16,6 +16,9 @@
 #include <unistd.h>
 #include <syscall.h>
 #include <error.h>
+#include <cpu.h>
+#include <pmm.h>
+#include <lapic.h>
 
 #define TICK_NUM 30
 
@@ -25,15 +28,40 @@ static struct pseudodesc idt_pd = {
     sizeof(idt) - 1, (uintptr_t)idt
 };
 
+// syscall_init - enter the kernel at syscall_entry (trapentry.S) on SYSCALL, with
+//              - the interrupts, single steps and the direction flag off; SYSCALL
+//              - takes %cs and %ss from GD_KTEXT, SYSRET from GD_UDATA
+static void
+syscall_init(void) {
+    extern char syscall_entry[];
+    static_assert(offsetof(struct cpu, rsp0) == CPU_RSP0);
+    static_assert(offsetof(struct cpu, user_rsp) == CPU_USER_RSP);
+    wrmsr(MSR_STAR, ((uint64_t)(GD_UDATA - 8) << 48) | ((uint64_t)GD_KTEXT << 32));
+    wrmsr(MSR_LSTAR, (uintptr_t)syscall_entry);
+    wrmsr(MSR_SFMASK, FL_IF | FL_TF | FL_DF | FL_AC);
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
+// idt_init - all the gates are interrupt gates, so a cpu enters trap() with the
+//          - interrupts off and takes the kernel lock first; trap() turns them back on
+//          - for the exceptions and system calls
 void
 idt_init(void) {
     extern uintptr_t __vectors[];
     int i;
     for (i = 0; i < sizeof(idt) / sizeof(struct gatedesc); i ++) {
-        SETGATE(idt[i], 1, GD_KTEXT, __vectors[i], DPL_KERNEL);
+        SETGATE(idt[i], 0, GD_KTEXT, __vectors[i], DPL_KERNEL);
     }
-    SETGATE(idt[T_SYSCALL], 1, GD_KTEXT, __vectors[T_SYSCALL], DPL_USER);
+    SETGATE(idt[T_SYSCALL], 0, GD_KTEXT, __vectors[T_SYSCALL], DPL_USER);
     lidt(&idt_pd);
+    syscall_init();
+}
+
+// idt_init_ap - load the idt built by the boot cpu
+void
+idt_init_ap(void) {
+    lidt(&idt_pd);
+    syscall_init();
 }
 
 static const char *
@@ -67,7 +95,7 @@ trapname(int trapno) {
     if (trapno == T_SYSCALL) {
         return "System call";
     }
-    if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16) {
+    if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 32) {
         return "Hardware Interrupt";
     }
     return "(unknown trap)";
@@ -189,10 +217,14 @@ trap_dispatch(struct trapframe *tf) {
         syscall();
         break;
     case IRQ_OFFSET + IRQ_TIMER:
-        ticks ++;
+        clock_interrupt();
         assert(current != NULL);
         run_timer_list();
         break;
+    case IRQ_OFFSET + IRQ_RESCHED:
+        // the waker has set need_resched of current
+    case IRQ_OFFSET + IRQ_SPURIOUS:
+        break;
     case IRQ_OFFSET + IRQ_COM1:
     case IRQ_OFFSET + IRQ_KBD:
         c = cons_getc();
@@ -216,6 +248,27 @@ trap_dispatch(struct trapframe *tf) {
 
 void
 trap(struct trapframe *tf) {
+    // the cpu sending a TLB shootdown holds the kernel lock and waits for the answer
+    if (tf->tf_trapno == IRQ_OFFSET + IRQ_TLB) {
+        tlb_shootdown_ack();
+        lapic_eoi();
+        return;
+    }
+    if (tf->tf_trapno >= IRQ_OFFSET && tf->tf_trapno < IRQ_OFFSET + IRQ_SPURIOUS) {
+        lapic_eoi();
+    }
+
+    bool locked = 0;
+    if (!kernel_locked()) {
+        lock_kernel();
+        locked = 1;
+    }
+    if (tf->tf_trapno < IRQ_OFFSET || tf->tf_trapno == T_SYSCALL) {
+        if (tf->tf_rflags & FL_IF) {
+            intr_enable();
+        }
+    }
+
     // used for previous projects
     if (current == NULL) {
         trap_dispatch(tf);
@@ -235,7 +288,18 @@ trap(struct trapframe *tf) {
             if (current->need_resched) {
                 schedule();
             }
+            vvar_update(current);
         }
     }
+
+    // return with the interrupts off, the iretq or sysretq restores them; on the
+    // way to user mode the %gs base is swapped, and an interrupt must not come
+    // between that and the return
+    intr_disable();
+
+    // keep the kernel lock if the trap came from the kernel holding it
+    if (locked || !trap_in_kernel(tf)) {
+        unlock_kernel();
+    }
 }
 
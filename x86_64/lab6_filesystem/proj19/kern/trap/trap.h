@@ -36,6 +36,8 @@
 #define IRQ_IDE1                14
 #define IRQ_IDE2                15
 #define IRQ_ERROR               19
+#define IRQ_TLB                 20  // IPI: TLB shootdown
+#define IRQ_RESCHED             21  // IPI: reschedule
 #define IRQ_SPURIOUS            31
 
 /* registers as pushed by pushal */
@@ -80,6 +82,7 @@ struct trapframe {
 } __attribute__((packed));
 
 void idt_init(void);
+void idt_init_ap(void);
 void print_trapframe(struct trapframe *tf);
 void print_regs(struct pushregs *regs);
 bool trap_in_kernel(struct trapframe *tf);
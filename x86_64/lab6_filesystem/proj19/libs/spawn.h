@@ -0,0 +1,21 @@
+#ifndef __LIBS_SPAWN_H__
+#define __LIBS_SPAWN_H__
+
+#include <defs.h>
+
+/* file actions applied in order by the child of SYS_spawn, before it loads the new image */
+struct spawn_action {
+    int type;                           // SPAWN_OPEN, SPAWN_DUP2 or SPAWN_CLOSE
+    int fd;                             // the fd to open, duplicate from or close
+    int newfd;                          // the fd to duplicate to (SPAWN_DUP2)
+    uint32_t open_flags;                // the flags to open path with (SPAWN_OPEN)
+    const char *path;                   // the path to open (SPAWN_OPEN)
+};
+
+#define SPAWN_OPEN          1           // open path at fd
+#define SPAWN_DUP2          2           // duplicate fd at newfd
+#define SPAWN_CLOSE         3           // close fd
+
+#define SPAWN_MAX_ACTIONS   8
+
+#endif /* !__LIBS_SPAWN_H__ */
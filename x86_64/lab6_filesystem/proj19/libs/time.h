@@ -0,0 +1,19 @@
+#ifndef __LIBS_TIME_H__
+#define __LIBS_TIME_H__
+
+#include <defs.h>
+
+// clock ids of clock_gettime
+#define CLOCK_MONOTONIC             1           // the time since boot, on the TSC
+#define CLOCK_PROCESS_CPUTIME_ID    2           // the time run by the threads of the process
+#define CLOCK_THREAD_CPUTIME_ID     3           // the time run by the calling thread
+
+#define NSEC_PER_SEC                1000000000ULL
+
+struct timespec {
+    int64_t tv_sec;
+    int64_t tv_nsec;
+};
+
+#endif /* !__LIBS_TIME_H__ */
+
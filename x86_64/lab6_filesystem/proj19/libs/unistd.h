@@ -9,10 +9,16 @@
 #define SYS_wait            3
 #define SYS_exec            4
 #define SYS_clone           5
+#define SYS_vfork           6
+#define SYS_spawn           7
 #define SYS_exit_thread     9
 #define SYS_yield           10
 #define SYS_sleep           11
 #define SYS_kill            12
+#define SYS_setpriority     13
+#define SYS_sched_setscheduler  14
+#define SYS_nanosleep       15
+#define SYS_clock_gettime   16
 #define SYS_gettime         17
 #define SYS_getpid          18
 #define SYS_brk             19
@@ -38,6 +44,7 @@
 #define SYS_read            102
 #define SYS_write           103
 #define SYS_seek            104
+#define SYS_pread           105
 #define SYS_fstat           110
 #define SYS_fsync           111
 #define SYS_chdir           120
@@ -52,12 +59,21 @@
 #define SYS_dup             130
 #define SYS_pipe            140
 #define SYS_mkfifo          141
+#define SYS_uring_setup     150
+#define SYS_uring_enter     151
 
 /* SYS_fork flags */
 #define CLONE_VM            0x00000100  // set if VM shared between processes
 #define CLONE_THREAD        0x00000200  // thread group
 #define CLONE_SEM           0x00000400  // set if shared between processes
 #define CLONE_FS            0x00000800  // set if shared between processes
+#define CLONE_VFORK         0x00001000  // parent sleeps until the child execs or exits
+
+/* SYS_sched_setscheduler policies */
+#define SCHED_NORMAL        0           // the fair class, MLFQ or CFS
+#define SCHED_FIFO          1           // real-time, runs until it blocks or yields
+#define SCHED_RR            2           // real-time, round robin among the same priority
+#define MAX_RT_PRIO         100         // real-time priorities are 0 ~ MAX_RT_PRIO - 1, higher first
 
 /* SYS_mmap flags */
 #define MMAP_WRITE          0x00000100
@@ -0,0 +1,66 @@
+#ifndef __LIBS_URINGBUF_H__
+#define __LIBS_URINGBUF_H__
+
+#include <defs.h>
+
+/* *
+ * A uring is a submission queue (sq) and a completion queue (cq) in pages shared by the
+ * kernel and the user: the user fills sqes and moves sq_tail, the kernel runs them in
+ * order and posts a cqe for each, moving cq_tail; the heads follow the other way. The
+ * counters run free, the slot of counter n is n & (entries - 1).
+ * */
+
+#define UR_MAX_ENTRIES              256
+
+// the opcodes of a sqe
+#define UR_OP_NOP                   0
+#define UR_OP_READ                  1           // read(fd, addr, len)
+#define UR_OP_WRITE                 2           // write(fd, addr, len)
+#define UR_OP_PREAD                 3           // pread(fd, addr, len, off)
+#define UR_OP_FSYNC                 4           // fsync(fd)
+#define UR_OP_MBOX_SEND             5           // mbox_send_timeout(fd, addr, off)
+#define UR_OP_MBOX_RECV             6           // mbox_recv_timeout(fd, addr, off)
+#define UR_OP_SEM_POST              7           // sem_post(fd)
+#define UR_OP_SEM_WAIT              8           // sem_wait_timeout(fd, off)
+
+// flags of uring_setup
+#define UR_SETUP_SQPOLL             0x00000001  // a kernel thread polls the sq
+
+// flags of uring_enter
+#define UR_ENTER_GETEVENTS          0x00000001  // wait for min_complete cqes
+#define UR_ENTER_SQ_WAKEUP          0x00000002  // wake the sq poll thread up
+
+// flags of the ring
+#define UR_NEED_WAKEUP              0x00000001  // the sq poll thread sleeps, enter to wake it
+
+struct uring_sqe {
+    uint32_t opcode;
+    int fd;                         // the file, mbox id or sem id
+    uint64_t addr;                  // the buffer or the struct mboxbuf
+    uint64_t len;
+    uint64_t off;                   // the offset of pread, the timeout of mbox and sem ops
+    uint64_t user_data;             // passed on to the cqe
+};
+
+struct uring_cqe {
+    uint64_t user_data;
+    int64_t res;                    // the return value of the op
+};
+
+struct uring {
+    volatile uint32_t sq_head;      // the next sqe the kernel takes, written by the kernel
+    volatile uint32_t sq_tail;      // one past the last sqe submitted, written by the user
+    volatile uint32_t cq_head;      // the next cqe the user takes, written by the user
+    volatile uint32_t cq_tail;      // one past the last cqe posted, written by the kernel
+    volatile uint32_t flags;        // UR_NEED_WAKEUP, written by the kernel
+    uint32_t entries;               // of the sq and of the cq, a power of 2
+    uint32_t sqes_off;              // where the sqes begin in the ring
+    uint32_t cqes_off;              // where the cqes begin in the ring
+};
+
+#define UR_SQES_OFF                 64
+#define UR_CQES_OFF(entries)        (UR_SQES_OFF + (entries) * sizeof(struct uring_sqe))
+#define UR_RING_SIZE(entries)       (UR_CQES_OFF(entries) + (entries) * sizeof(struct uring_cqe))
+
+#endif /* !__LIBS_URINGBUF_H__ */
+
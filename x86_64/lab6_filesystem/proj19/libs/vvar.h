@@ -0,0 +1,30 @@
+#ifndef __LIBS_VVAR_H__
+#define __LIBS_VVAR_H__
+
+#include <defs.h>
+
+/* *
+ * The vvar page is mapped read only at VVAR_ADDR, just above the user space, into every
+ * user address space; the kernel brings it up to date each time it returns to user mode,
+ * so the user reads its pid, the time and its scheduling stats without a system call.
+ *
+ * The kernel makes seq odd while it writes the page and even again after it; a reader
+ * copies the page and retries until seq was the same even number before and after.
+ * */
+
+#define VVAR_ADDR                   0x0000100000000000          // USERTOP
+
+struct vvar {
+    volatile uint32_t seq;          // odd while the kernel writes the page
+    int pid;                        // the pid, 0 if the address space is shared by more procs
+    uint64_t ticks;                 // the ticks of the clock
+    uint64_t tsc_base;              // the TSC at time 0 of CLOCK_MONOTONIC
+    uint64_t tsc_freq;              // TSC cycles per second, 0 if not calibrated
+    int cpu;                        // the cpu the proc runs on
+    int runs;                       // the times the proc has been switched to
+    uint64_t runtime;               // the TSC cycles run, up to exec_start
+    uint64_t exec_start;            // the TSC when the proc was last switched to
+};
+
+#endif /* !__LIBS_VVAR_H__ */
+
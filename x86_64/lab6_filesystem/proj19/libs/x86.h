@@ -4,6 +4,7 @@
 #include <defs.h>
 
 #define barrier() __asm__ __volatile__ ("" ::: "memory")
+#define mb() __asm__ __volatile__ ("mfence" ::: "memory")
 
 /* Pseudo-descriptors used for LGDT, LLDT(not used) and LIDT instructions. */
 struct pseudodesc {
@@ -106,11 +107,73 @@ rcr3(void) {
     return cr3;
 }
 
+static __always_inline void
+lcr4(uintptr_t cr4) {
+    asm volatile ("mov %0, %%cr4" :: "r" (cr4) : "memory");
+}
+
+static __always_inline uintptr_t
+rcr4(void) {
+    uintptr_t cr4;
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4) :: "memory");
+    return cr4;
+}
+
 static __always_inline void
 invlpg(void *addr) {
     asm volatile ("invlpg (%0)" :: "r" (addr) : "memory");
 }
 
+static __always_inline void
+invpcid(uint64_t type, uint64_t pcid, uintptr_t addr) {
+    struct {
+        uint64_t pcid;
+        uintptr_t addr;
+    } desc = {pcid, addr};
+    asm volatile ("invpcid %0, %1" :: "m" (desc), "r" (type) : "memory");
+}
+
+static __always_inline uint64_t
+rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static __always_inline void
+cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (info), "c" (0));
+    if (eaxp) *eaxp = eax;
+    if (ebxp) *ebxp = ebx;
+    if (ecxp) *ecxp = ecx;
+    if (edxp) *edxp = edx;
+}
+
+static __always_inline uint64_t
+rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile ("rdmsr" : "=a" (lo), "=d" (hi) : "c" (msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static __always_inline void
+wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile ("wrmsr" :: "c" (msr), "a" ((uint32_t)val), "d" ((uint32_t)(val >> 32)) : "memory");
+}
+
+/* cpu_relax - hint the processor that this is a spin-wait loop */
+static __always_inline void
+cpu_relax(void) {
+    asm volatile ("pause" ::: "memory");
+}
+
+/* safe_halt - enable interrupts and halt, no interrupt can slip in between the two */
+static __always_inline void
+safe_halt(void) {
+    asm volatile ("sti; hlt" ::: "memory");
+}
+
 #ifdef __UCORE_64__
 
 #define do_div(n, base) ({                                          \
@@ -139,6 +202,14 @@ write_rflags(uint64_t rflags) {
     asm volatile ("pushq %0; popfq" :: "r" (rflags));
 }
 
+/* bsfq - return the index of the least significant set bit, x must not be 0 */
+static __always_inline uint64_t
+bsfq(uint64_t x) {
+    uint64_t ret;
+    asm ("bsfq %1, %0" : "=r" (ret) : "rm" (x));
+    return ret;
+}
+
 #else /* not __UCORE_64__ (only used for 32-bit libs) */
 
 #define do_div(n, base) ({                                          \
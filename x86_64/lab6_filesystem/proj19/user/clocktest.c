@@ -0,0 +1,67 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <error.h>
+
+/* clocktest - the monotonic clock goes forward at a resolution finer than a tick and
+ *           - agrees with the ticks and nanosleep, the cpu time clocks count only the
+ *           - time run */
+
+#define SPIN_TICKS                  10
+#define HZ                          100
+
+static uint64_t
+read_clock(int clock_id) {
+    struct timespec ts;
+    assert(clock_gettime(clock_id, &ts) == 0);
+    assert(ts.tv_nsec >= 0 && ts.tv_nsec < NSEC_PER_SEC);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int
+main(void) {
+    struct timespec ts;
+    uint64_t t0, t1, cpu0, cpu1;
+    int i;
+
+    // monotonic, and readable twice within a tick with different values
+    t0 = read_clock(CLOCK_MONOTONIC);
+    for (i = 0; i < 1000; i ++) {
+        t1 = read_clock(CLOCK_MONOTONIC);
+        assert(t1 >= t0);
+        t0 = t1;
+    }
+    while ((t1 = read_clock(CLOCK_MONOTONIC)) == t0) {
+        /* spin */
+    }
+    assert(t1 - t0 < NSEC_PER_SEC / HZ);
+    cprintf("clocktest: resolution at least %llu ns.\n", t1 - t0);
+
+    // agrees with the ticks, and the cpu time of a spinning thread follows
+    unsigned int tick = gettime_msec();
+    while (gettime_msec() == tick) {
+        /* wait for a tick to begin */
+    }
+    tick = gettime_msec();
+    t0 = read_clock(CLOCK_MONOTONIC), cpu0 = read_clock(CLOCK_THREAD_CPUTIME_ID);
+    while (gettime_msec() - tick < SPIN_TICKS) {
+        /* spin */
+    }
+    t1 = read_clock(CLOCK_MONOTONIC), cpu1 = read_clock(CLOCK_THREAD_CPUTIME_ID);
+    cprintf("clocktest: %d ticks in %llu us, %llu us of cpu time.\n",
+            SPIN_TICKS, (t1 - t0) / 1000, (cpu1 - cpu0) / 1000);
+    assert(t1 - t0 >= (SPIN_TICKS - 1) * NSEC_PER_SEC / HZ);
+    assert(t1 - t0 <= (SPIN_TICKS + 1) * NSEC_PER_SEC / HZ);
+    assert(cpu1 - cpu0 <= t1 - t0);
+
+    // nanosleep sleeps at least as long as asked, and not on the cpu
+    t0 = read_clock(CLOCK_MONOTONIC), cpu0 = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+    assert(nanosleep(2000000) == 0);
+    t1 = read_clock(CLOCK_MONOTONIC), cpu1 = read_clock(CLOCK_PROCESS_CPUTIME_ID);
+    assert(t1 - t0 >= 2000000);
+    assert(cpu1 - cpu0 < t1 - t0);
+
+    assert(clock_gettime(0, &ts) == -E_INVAL);
+    assert(clock_gettime(CLOCK_MONOTONIC, NULL) == -E_INVAL);
+    cprintf("clocktest pass.\n");
+    return 0;
+}
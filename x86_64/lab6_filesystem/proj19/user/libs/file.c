@@ -27,6 +27,11 @@ write(int fd, void *base, size_t len) {
     return sys_write(fd, base, len);
 }
 
+int
+pread(int fd, void *base, size_t len, off_t pos) {
+    return sys_pread(fd, base, len, pos);
+}
+
 int
 seek(int fd, off_t pos, int whence) {
     return sys_seek(fd, pos, whence);
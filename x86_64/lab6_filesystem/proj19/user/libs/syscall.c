@@ -8,16 +8,45 @@
 
 #define MAX_ARGS            6
 
+#define syscall_args(num, a) do {                           \
+        va_list ap;                                         \
+        va_start(ap, num);                                  \
+        int i;                                              \
+        for (i = 0; i < MAX_ARGS; i ++) {                   \
+            (a)[i] = va_arg(ap, uint64_t);                  \
+        }                                                   \
+        va_end(ap);                                         \
+    } while (0)
+
+// syscall - enter the kernel by SYSCALL, which takes %rcx and %r11 for the %rip and
+//         - %rflags to return to, so the fourth argument goes in %r10
 static inline uint64_t
 syscall(int num, ...) {
-    va_list ap;
-    va_start(ap, num);
     uint64_t a[MAX_ARGS];
-    int i;
-    for (i = 0; i < MAX_ARGS; i ++) {
-        a[i] = va_arg(ap, uint64_t);
-    }
-    va_end(ap);
+    syscall_args(num, a);
+
+    uint64_t ret;
+    asm volatile (
+        "movq 0x00(%%rbx), %%rdi;"
+        "movq 0x08(%%rbx), %%rsi;"
+        "movq 0x10(%%rbx), %%rdx;"
+        "movq 0x18(%%rbx), %%r10;"
+        "movq 0x20(%%rbx), %%r8;"
+        "movq 0x28(%%rbx), %%r9;"
+        "syscall"
+        : "=a" (ret)
+        : "a" (num),
+          "b" (a)
+        : "rdi", "rsi", "rdx", "rcx", "r8", "r9", "r10", "r11", "cc", "memory");
+    return ret;
+}
+
+// syscall_int - enter the kernel through the trap gate T_SYSCALL, the way kept for
+//             - compatibility
+uint64_t
+syscall_int(int num, ...) {
+    uint64_t a[MAX_ARGS];
+    syscall_args(num, a);
 
     uint64_t ret;
     asm volatile (
@@ -32,7 +61,7 @@ syscall(int num, ...) {
         : "i" (T_SYSCALL),
           "a" (num),
           "b" (a)
-        : "cc", "memory");
+        : "rdi", "rsi", "rdx", "rcx", "r8", "r9", "cc", "memory");
     return ret;
 }
 
@@ -56,6 +85,12 @@ sys_exec(const char *name, int argc, const char **argv) {
     return syscall(SYS_exec, name, argc, argv);
 }
 
+int
+sys_spawn(const char *name, int argc, const char **argv,
+        const struct spawn_action *actions, int nactions) {
+    return syscall(SYS_spawn, name, argc, argv, actions, nactions);
+}
+
 int
 sys_yield(void) {
     return syscall(SYS_yield);
@@ -66,16 +101,36 @@ sys_sleep(unsigned int time) {
     return syscall(SYS_sleep, time);
 }
 
+int
+sys_nanosleep(uint64_t ns) {
+    return syscall(SYS_nanosleep, ns);
+}
+
 int
 sys_kill(int pid) {
     return syscall(SYS_kill, pid);
 }
 
+int
+sys_setpriority(int pid, int nice) {
+    return syscall(SYS_setpriority, pid, nice);
+}
+
+int
+sys_sched_setscheduler(int pid, int policy, int rt_priority) {
+    return syscall(SYS_sched_setscheduler, pid, policy, rt_priority);
+}
+
 size_t
 sys_gettime(void) {
     return (size_t)syscall(SYS_gettime);
 }
 
+int
+sys_clock_gettime(int clock_id, struct timespec *ts) {
+    return syscall(SYS_clock_gettime, clock_id, ts);
+}
+
 int
 sys_getpid(void) {
     return syscall(SYS_getpid);
@@ -191,6 +246,11 @@ sys_write(int fd, void *base, size_t len) {
     return syscall(SYS_write, fd, base, len);
 }
 
+int
+sys_pread(int fd, void *base, size_t len, off_t pos) {
+    return syscall(SYS_pread, fd, base, len, pos);
+}
+
 int
 sys_seek(int fd, off_t pos, int whence) {
     return syscall(SYS_seek, fd, pos, whence);
@@ -256,3 +316,13 @@ sys_mkfifo(const char *name, uint32_t open_flags) {
     return syscall(SYS_mkfifo, name, open_flags);
 }
 
+int
+sys_uring_setup(unsigned int entries, uint32_t flags, uintptr_t *ring_store) {
+    return syscall(SYS_uring_setup, entries, flags, ring_store);
+}
+
+int
+sys_uring_enter(unsigned int to_submit, unsigned int min_complete, uint32_t flags) {
+    return syscall(SYS_uring_enter, to_submit, min_complete, flags);
+}
+
@@ -3,14 +3,28 @@
 
 #include <defs.h>
 
+uint64_t syscall_int(int num, ...);
+
 int sys_exit(int error_code);
 int sys_fork(void);
 int sys_wait(int pid, int *store);
 int sys_exec(const char *name, int argc, const char **argv);
+
+struct spawn_action;
+
+int sys_spawn(const char *name, int argc, const char **argv,
+        const struct spawn_action *actions, int nactions);
+
 int sys_yield(void);
 int sys_sleep(unsigned int time);
+int sys_nanosleep(uint64_t ns);
 int sys_kill(int pid);
+int sys_setpriority(int pid, int nice);
+int sys_sched_setscheduler(int pid, int policy, int rt_priority);
+struct timespec;
+
 size_t sys_gettime(void);
+int sys_clock_gettime(int clock_id, struct timespec *ts);
 int sys_getpid(void);
 int sys_brk(uintptr_t *brk_store);
 int sys_mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
@@ -42,6 +56,7 @@ int sys_open(const char *path, uint32_t open_flags);
 int sys_close(int fd);
 int sys_read(int fd, void *base, size_t len);
 int sys_write(int fd, void *base, size_t len);
+int sys_pread(int fd, void *base, size_t len, off_t pos);
 int sys_seek(int fd, off_t pos, int whence);
 int sys_fstat(int fd, struct stat *stat);
 int sys_fsync(int fd);
@@ -56,5 +71,8 @@ int sys_dup(int fd1, int fd2);
 int sys_pipe(int *fd_store);
 int sys_mkfifo(const char *name, uint32_t open_flags);
 
+int sys_uring_setup(unsigned int entries, uint32_t flags, uintptr_t *ring_store);
+int sys_uring_enter(unsigned int to_submit, unsigned int min_complete, uint32_t flags);
+
 #endif /* !__USER_LIBS_SYSCALL_H__ */
 
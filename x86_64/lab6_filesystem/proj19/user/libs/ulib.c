@@ -54,19 +54,57 @@ sleep(unsigned int time) {
     return sys_sleep(time);
 }
 
+int
+nanosleep(uint64_t ns) {
+    return sys_nanosleep(ns);
+}
+
 int
 kill(int pid) {
     return sys_kill(pid);
 }
 
+int
+setpriority(int pid, int nice) {
+    return sys_setpriority(pid, nice);
+}
+
+int
+sched_setscheduler(int pid, int policy, int rt_priority) {
+    return sys_sched_setscheduler(pid, policy, rt_priority);
+}
+
 unsigned int
 gettime_msec(void) {
-    return (unsigned int)sys_gettime();
+    return (unsigned int)vvar_ticks();
+}
+
+// clock_gettime - read the clock from the vvar page, ask the kernel if it cannot be
+int
+clock_gettime(int clock_id, struct timespec *ts) {
+    uint64_t ns;
+    if (vvar_clock_ns(clock_id, &ns) != 0) {
+        return sys_clock_gettime(clock_id, ts);
+    }
+    ts->tv_sec = ns / NSEC_PER_SEC;
+    ts->tv_nsec = ns % NSEC_PER_SEC;
+    return 0;
+}
+
+// gettime_nsec - the monotonic time in nanoseconds
+uint64_t
+gettime_nsec(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
 }
 
 int
 getpid(void) {
-    return sys_getpid();
+    int pid = vvar_getpid();
+    return (pid != 0) ? pid : sys_getpid();
 }
 
 //print_pgdir - print the PDT&PT
@@ -184,6 +222,15 @@ __exec(const char *name, const char **argv) {
     return sys_exec(name, argc, argv);
 }
 
+int
+__spawn(const char *name, const char **argv, const struct spawn_action *actions, int nactions) {
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc ++;
+    }
+    return sys_spawn(name, argc, argv, actions, nactions);
+}
+
 int __clone(uint32_t clone_flags, uintptr_t stack, int (*fn)(void *), void *arg);
 
 int
@@ -2,6 +2,7 @@
 #define __USER_LIBS_ULIB_H__
 
 #include <defs.h>
+#include <time.h>
 
 #include <defs.h>
 
@@ -29,14 +30,27 @@ int fprintf(int fd, const char *fmt, ...);
 
 void __noreturn exit(int error_code);
 int fork(void);
+int vfork(void);
 int forks(void);
 int wait(void);
 int waitpid(int pid, int *store);
 void yield(void);
 int sleep(unsigned int time);
+int nanosleep(uint64_t ns);
 int kill(int pid);
+int setpriority(int pid, int nice);
+int sched_setscheduler(int pid, int policy, int rt_priority);
 unsigned int gettime_msec(void);
+int clock_gettime(int clock_id, struct timespec *ts);
+uint64_t gettime_nsec(void);
 int getpid(void);
+
+struct vvar;
+
+void vvar_read(struct vvar *snap);
+int vvar_getpid(void);
+size_t vvar_ticks(void);
+int vvar_clock_ns(int clock_id, uint64_t *ns_store);
 void print_pgdir(void);
 int mmap(uintptr_t *addr_store, size_t len, uint32_t mmap_flags);
 int munmap(uintptr_t addr, size_t len);
@@ -72,5 +86,12 @@ int __exec(const char *name, const char **argv);
 #define exec(path, ...)                         __exec0(NULL, path, ##__VA_ARGS__)
 #define nexec(name, path, ...)                  __exec0(name, path, ##__VA_ARGS__)
 
+struct spawn_action;
+
+int __spawn(const char *name, const char **argv, const struct spawn_action *actions, int nactions);
+
+#define spawn(path, ...)                                                \
+    ({ const char *argv[] = {path, ##__VA_ARGS__, NULL}; __spawn(NULL, argv, NULL, 0); })
+
 #endif /* !__USER_LIBS_ULIB_H__ */
 
@@ -0,0 +1,88 @@
+#include <defs.h>
+#include <x86.h>
+#include <string.h>
+#include <syscall.h>
+#include <error.h>
+#include <uring.h>
+
+int
+uring_setup(uring_t *ur, unsigned int entries, uint32_t flags) {
+    int ret;
+    uintptr_t addr;
+    if ((ret = sys_uring_setup(entries, flags, &addr)) != 0) {
+        return ret;
+    }
+    struct uring *ring = (struct uring *)addr;
+    ur->ring = ring;
+    ur->sqes = (struct uring_sqe *)(addr + ring->sqes_off);
+    ur->cqes = (struct uring_cqe *)(addr + ring->cqes_off);
+    ur->mask = ring->entries - 1;
+    ur->sqe_tail = ring->sq_tail;
+    ur->flags = flags;
+    return 0;
+}
+
+// uring_get_sqe - a free sqe, cleared, to be filled and submitted; NULL if the sq is full
+struct uring_sqe *
+uring_get_sqe(uring_t *ur) {
+    struct uring *ring = ur->ring;
+    if (ur->sqe_tail - ring->sq_head > ur->mask) {
+        return NULL;
+    }
+    struct uring_sqe *sqe = ur->sqes + (ur->sqe_tail ++ & ur->mask);
+    memset(sqe, 0, sizeof(struct uring_sqe));
+    return sqe;
+}
+
+// uring_submit - hand the sqes got to the kernel: trap to run them, or with
+//              - UR_SETUP_SQPOLL only if the sq poll thread has gone to sleep
+int
+uring_submit(uring_t *ur) {
+    struct uring *ring = ur->ring;
+    unsigned int to_submit = ur->sqe_tail - ring->sq_tail;
+    // the sqes are filled before the tail moves
+    barrier();
+    ring->sq_tail = ur->sqe_tail;
+    if (ur->flags & UR_SETUP_SQPOLL) {
+        mb();
+        if (ring->flags & UR_NEED_WAKEUP) {
+            sys_uring_enter(0, 0, UR_ENTER_SQ_WAKEUP);
+        }
+        return to_submit;
+    }
+    return (to_submit != 0) ? sys_uring_enter(to_submit, 0, 0) : 0;
+}
+
+// uring_wait - wait until there are min_complete cqes to take
+int
+uring_wait(uring_t *ur, unsigned int min_complete) {
+    struct uring *ring = ur->ring;
+    if (ring->cq_tail - ring->cq_head >= min_complete) {
+        return 0;
+    }
+    if (!(ur->flags & UR_SETUP_SQPOLL)) {
+        // the sqes run in uring_submit, the cqes missing are not coming
+        return -E_INVAL;
+    }
+    return sys_uring_enter(0, min_complete, UR_ENTER_GETEVENTS);
+}
+
+// uring_peek_cqe - the first cqe not taken, or NULL if the cq is empty
+struct uring_cqe *
+uring_peek_cqe(uring_t *ur) {
+    struct uring *ring = ur->ring;
+    if (ring->cq_head == ring->cq_tail) {
+        return NULL;
+    }
+    // read the cqe after the tail
+    barrier();
+    return ur->cqes + (ring->cq_head & ur->mask);
+}
+
+// uring_cqe_seen - take the cqe of uring_peek_cqe off the cq
+void
+uring_cqe_seen(uring_t *ur) {
+    barrier();
+    ur->ring->cq_head ++;
+}
+
@@ -0,0 +1,24 @@
+#ifndef __USER_LIBS_URING_H__
+#define __USER_LIBS_URING_H__
+
+#include <defs.h>
+#include <uringbuf.h>
+
+typedef struct {
+    struct uring *ring;
+    struct uring_sqe *sqes;
+    struct uring_cqe *cqes;
+    uint32_t mask;
+    uint32_t sqe_tail;              // one past the last sqe got, submitted or not
+    uint32_t flags;                 // of uring_setup
+} uring_t;
+
+int uring_setup(uring_t *ur, unsigned int entries, uint32_t flags);
+struct uring_sqe *uring_get_sqe(uring_t *ur);
+int uring_submit(uring_t *ur);
+int uring_wait(uring_t *ur, unsigned int min_complete);
+struct uring_cqe *uring_peek_cqe(uring_t *ur);
+void uring_cqe_seen(uring_t *ur);
+
+#endif /* !__USER_LIBS_URING_H__ */
+
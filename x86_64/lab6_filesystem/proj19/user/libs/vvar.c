@@ -0,0 +1,82 @@
+#include <defs.h>
+#include <x86.h>
+#include <vvar.h>
+#include <time.h>
+#include <ulib.h>
+
+/* *
+ * vvar - read the vvar page the kernel maps at VVAR_ADDR (see libs/vvar.h), so that
+ * getpid, gettime_msec and clock_gettime take a few loads and an rdtsc, not a trap.
+ * */
+
+static const volatile struct vvar *const vvar = (const struct vvar *)VVAR_ADDR;
+
+// vvar_read - a consistent copy of the vvar page: retry while the kernel is writing it
+void
+vvar_read(struct vvar *snap) {
+    uint32_t seq;
+    do {
+        while ((seq = vvar->seq) & 1) {
+            cpu_relax();
+        }
+        barrier();
+        *snap = *(const struct vvar *)vvar;
+        barrier();
+    } while (vvar->seq != seq);
+}
+
+// vvar_cycles2ns - TSC cycles to nanoseconds, as the kernel counts them
+static uint64_t
+vvar_cycles2ns(const struct vvar *snap, uint64_t cycles) {
+    uint64_t freq = snap->tsc_freq;
+    return cycles / freq * NSEC_PER_SEC + cycles % freq * NSEC_PER_SEC / freq;
+}
+
+// vvar_getpid - the pid of the caller, 0 if it shares its address space
+//             - with other procs and the page cannot tell them apart
+int
+vvar_getpid(void) {
+    struct vvar snap;
+    vvar_read(&snap);
+    return snap.pid;
+}
+
+// vvar_ticks - the ticks of the clock, as of the last entry to the kernel or tick
+size_t
+vvar_ticks(void) {
+    struct vvar snap;
+    vvar_read(&snap);
+    return snap.ticks;
+}
+
+// vvar_clock_ns - read the clock clock_id in nanoseconds into *ns_store; return -1 if it
+//               - cannot be read from the page and the kernel has to be asked instead;
+//               - the TSCs of the cpus may be a little apart, so unlike the kernel clock
+//               - two reads on different cpus may see CLOCK_MONOTONIC step back a little
+int
+vvar_clock_ns(int clock_id, uint64_t *ns_store) {
+    struct vvar snap;
+    vvar_read(&snap);
+    if (snap.tsc_freq == 0) {
+        return -1;
+    }
+    uint64_t now = rdtsc();
+    switch (clock_id) {
+    case CLOCK_MONOTONIC:
+        *ns_store = (now > snap.tsc_base) ? vvar_cycles2ns(&snap, now - snap.tsc_base) : 0;
+        return 0;
+    case CLOCK_PROCESS_CPUTIME_ID:
+    case CLOCK_THREAD_CPUTIME_ID:
+        // the stats are of a single proc, which is then the whole process
+        if (snap.pid == 0) {
+            return -1;
+        }
+        if (now > snap.exec_start) {
+            snap.runtime += now - snap.exec_start;
+        }
+        *ns_store = vvar_cycles2ns(&snap, snap.runtime);
+        return 0;
+    }
+    return -1;
+}
+
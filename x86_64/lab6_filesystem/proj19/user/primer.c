@@ -97,7 +97,7 @@ main(void) {
 
     cprintf("sharemem init ok.\n");
 
-    unsigned int time = gettime_msec();
+    uint64_t time = gettime_nsec();
 
     if ((pid = fork()) == 0) {
         primeproc();
@@ -111,7 +111,8 @@ main(void) {
         }
     }
 
-    cprintf("use %d msecs.\n", gettime_msec() - time);
+    time = (gettime_nsec() - time) / 1000;
+    cprintf("use %llu.%03llu msecs.\n", time / 1000, time % 1000);
     cprintf("primer pass.\n");
     return 0;
 }
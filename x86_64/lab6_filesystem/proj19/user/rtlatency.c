@@ -0,0 +1,73 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <thread.h>
+#include <x86.h>
+#include <unistd.h>
+
+/* rtlatency - the wakeup-to-run latency of a waiter blocked in sem_wait, posted by a
+ *           - waker thread while spinners keep the cpus busy; the waiter runs as
+ *           - SCHED_NORMAL first and then as SCHED_FIFO, the latencies are TSC cycles */
+
+#define NSPIN                       4
+#define ROUNDS                      50
+
+static sem_t sem;
+static volatile uint64_t posted;
+
+static int
+waker(void *arg) {
+    int i;
+    sched_setscheduler(0, SCHED_NORMAL, 0);
+    for (i = 0; i < ROUNDS; i ++) {
+        sleep(1);
+        posted = rdtsc();
+        sem_post(sem);
+    }
+    return 0;
+}
+
+static void
+measure(const char *name) {
+    thread_t tid;
+    uint64_t latency, sum = 0, max = 0;
+    int i, code;
+    assert(thread(waker, NULL, &tid) == 0);
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(sem_wait(sem) == 0);
+        latency = rdtsc() - posted;
+        sum += latency;
+        if (max < latency) {
+            max = latency;
+        }
+    }
+    assert(thread_wait(&tid, &code) == 0 && code == 0);
+    cprintf("%s: wakeup to run %llu cycles on average, %llu at most.\n", name, sum / ROUNDS, max);
+}
+
+int
+main(void) {
+    int i, pids[NSPIN];
+    assert((sem = sem_init(0)) > 0);
+
+    for (i = 0; i < NSPIN; i ++) {
+        if ((pids[i] = fork()) == 0) {
+            while (1);
+        }
+        assert(pids[i] > 0);
+    }
+
+    measure("SCHED_NORMAL");
+    assert(sched_setscheduler(0, SCHED_FIFO, 50) == 0);
+    measure("SCHED_FIFO 50");
+    assert(sched_setscheduler(0, SCHED_NORMAL, 0) == 0);
+
+    assert(sched_setscheduler(0, SCHED_RR, MAX_RT_PRIO) != 0);
+    assert(sched_setscheduler(0, SCHED_NORMAL, 1) != 0);
+
+    for (i = 0; i < NSPIN; i ++) {
+        assert(kill(pids[i]) == 0 && waitpid(pids[i], NULL) == 0);
+    }
+    sem_free(sem);
+    cprintf("rtlatency pass.\n");
+    return 0;
+}
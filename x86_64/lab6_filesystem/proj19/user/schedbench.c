@@ -0,0 +1,84 @@
+#include <ulib.h>
+#include <stdio.h>
+
+/* schedbench - spinners of different nice values, a yielder and a sleeper run side by
+ *            - side for DURATION ticks; the share of the loops of each spinner shows the
+ *            - fairness, how late the sleep(1)s of the sleeper wake up the latency.
+ *            - Build the kernel with 'make SCHED=CFS' or 'make SCHED=MLFQ' to compare. */
+
+#define DURATION                    300                 // ticks
+#define NSPIN                       4
+#define SPIN_BATCH                  1024                // loops between two gettime calls
+
+static const int spin_nice[NSPIN] = {0, 0, 5, -5};
+
+static unsigned int deadline;
+
+// spinner - return the loops run before the deadline, in SPIN_BATCH
+static int
+spinner(int nice) {
+    volatile int i;
+    int batches = 0;
+    setpriority(0, nice);
+    while (gettime_msec() < deadline) {
+        for (i = 0; i < SPIN_BATCH; i ++) {
+            /* spin */
+        }
+        batches ++;
+    }
+    return batches;
+}
+
+static int
+yielder(void) {
+    int yields = 0;
+    while (gettime_msec() < deadline) {
+        yield(), yields ++;
+    }
+    cprintf("yielder: %d yields.\n", yields);
+    return 0;
+}
+
+static int
+sleeper(void) {
+    int sleeps = 0, late, max_late = 0, sum_late = 0;
+    while (gettime_msec() < deadline) {
+        unsigned int start = gettime_msec();
+        sleep(1);
+        late = gettime_msec() - start - 1;
+        sum_late += late, sleeps ++;
+        if (max_late < late) {
+            max_late = late;
+        }
+    }
+    cprintf("sleeper: %d sleeps, %d.%02d ticks late on average, %d at most.\n",
+            sleeps, sum_late / sleeps, sum_late * 100 / sleeps % 100, max_late);
+    return 0;
+}
+
+int
+main(void) {
+    int i, pid, pids[NSPIN + 2], loops[NSPIN], total = 0;
+    deadline = gettime_msec() + DURATION;
+
+    for (i = 0; i < NSPIN + 2; i ++) {
+        if ((pid = fork()) == 0) {
+            exit((i < NSPIN) ? spinner(spin_nice[i]) : ((i == NSPIN) ? yielder() : sleeper()));
+        }
+        assert(pid > 0);
+        pids[i] = pid;
+    }
+
+    for (i = 0; i < NSPIN + 2; i ++) {
+        int code;
+        assert(waitpid(pids[i], &code) == 0);
+        if (i < NSPIN) {
+            loops[i] = code, total += code;
+        }
+    }
+    for (i = 0; i < NSPIN; i ++) {
+        cprintf("spinner nice %3d: %d%% of the loops.\n", spin_nice[i], loops[i] * 100 / total);
+    }
+    cprintf("schedbench pass.\n");
+    return 0;
+}
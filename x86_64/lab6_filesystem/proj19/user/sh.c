@@ -1,11 +1,11 @@
 #include <ulib.h>
 #include <stdio.h>
 #include <string.h>
-#include <malloc.h>
 #include <dir.h>
 #include <file.h>
 #include <error.h>
 #include <unistd.h>
+#include <spawn.h>
 
 #define printf(...)                     fprintf(1, __VA_ARGS__)
 #define putc(c)                         printf("%c", c)
@@ -13,8 +13,7 @@
 #define BUFSIZE                         4096
 #define WHITESPACE                      " \t\r\n"
 #define SYMBOLS                         "<|>&;"
-
-static char *shcwd = NULL;
+#define MAXPIPE                         16
 
 int
 gettoken(char **p1, char **p2) {
@@ -114,105 +113,129 @@ testfile(const char *name) {
     return 0;
 }
 
+// spawncmd - spawn argv[0] (or /bin/argv[0]) with the file actions, return the pid
 int
-runcmd(char *cmd) {
+spawncmd(int argc, const char **argv, struct spawn_action *actions, int nactions) {
     static char argv0[BUFSIZE];
+    int ret;
+    if ((ret = testfile(argv[0])) != 0) {
+        if (ret != -E_NOENT) {
+            return ret;
+        }
+        snprintf(argv0, sizeof(argv0), "/bin/%s", argv[0]);
+        argv[0] = argv0;
+    }
+    argv[argc] = NULL;
+    return __spawn(NULL, argv, actions, nactions);
+}
+
+// waitcmds - wait the spawned commands, return ret or the first non-zero exit code
+int
+waitcmds(int *pids, int npids, int ret) {
+    int i, code;
+    for (i = 0; i < npids; i ++) {
+        if (waitpid(pids[i], &code) == 0 && ret == 0) {
+            ret = code;
+        }
+    }
+    return ret;
+}
+
+int
+runcmd(char *cmd) {
     const char *argv[EXEC_MAX_ARG_NUM + 1];
+    struct spawn_action actions[SPAWN_MAX_ACTIONS];
+    int pids[MAXPIPE + 1], npids = 0;
     char *t;
-    int argc, token, ret, p[2];
+    int argc, nactions, token, ret, infd = -1, p[2];
 again:
-    argc = 0;
+    argc = nactions = 0;
+    if (infd >= 0) {
+        actions[nactions ++] = (struct spawn_action){SPAWN_DUP2, infd, 0, 0, NULL};
+    }
     while (1) {
         switch (token = gettoken(&cmd, &t)) {
         case 'w':
             if (argc == EXEC_MAX_ARG_NUM) {
                 printf("sh error: too many arguments\n");
-                return -1;
+                ret = -1;
+                goto failed;
             }
             argv[argc ++] = t;
             break;
         case '<':
+        case '>':
             if (gettoken(&cmd, &t) != 'w') {
-                printf("sh error: syntax error: < not followed by word\n");
-                return -1;
+                printf("sh error: syntax error: %c not followed by word\n", token);
+                ret = -1;
+                goto failed;
             }
-            if ((ret = reopen(0, t, O_RDONLY)) != 0) {
-                return ret;
+            if (nactions == SPAWN_MAX_ACTIONS) {
+                printf("sh error: too many redirections\n");
+                ret = -1;
+                goto failed;
             }
-            break;
-        case '>':
-            if (gettoken(&cmd, &t) != 'w') {
-                printf("sh error: syntax error: > not followed by word\n");
-                return -1;
+            if (token == '<') {
+                actions[nactions ++] = (struct spawn_action){SPAWN_OPEN, 0, 0, O_RDONLY, t};
             }
-            if ((ret = reopen(1, t, O_RDWR | O_TRUNC | O_CREAT)) != 0) {
-                return ret;
+            else {
+                actions[nactions ++] = (struct spawn_action){SPAWN_OPEN, 1, 0, O_RDWR | O_TRUNC | O_CREAT, t};
             }
             break;
         case '|':
+            if (argc == 0 || npids == MAXPIPE || nactions == SPAWN_MAX_ACTIONS) {
+                printf("sh error: bad pipe\n");
+                ret = -1;
+                goto failed;
+            }
             if ((ret = pipe(p)) != 0) {
-                return ret;
+                goto failed;
             }
-            if ((ret = fork()) == 0) {
-                close(0);
-                if ((ret = dup2(p[0], 0)) < 0) {
-                    return ret;
-                }
-                close(p[0]), close(p[1]);
-                goto again;
+            actions[nactions ++] = (struct spawn_action){SPAWN_DUP2, p[1], 1, 0, NULL};
+            ret = spawncmd(argc, argv, actions, nactions);
+            close(p[1]);
+            if (infd >= 0) {
+                close(infd);
             }
-            else {
-                if (ret < 0) {
-                    return ret;
-                }
-                close(1);
-                if ((ret = dup2(p[1], 1)) < 0) {
-                    return ret;
-                }
-                close(p[0]), close(p[1]);
-                goto runit;
+            infd = p[0];
+            if (ret < 0) {
+                goto failed;
             }
-            break;
+            pids[npids ++] = ret;
+            goto again;
         case 0:
-            goto runit;
         case ';':
-            if ((ret = fork()) == 0) {
-                goto runit;
+            ret = 0;
+            if (argc == 0) {
+                ;
             }
-            else {
-                if (ret < 0) {
-                    return ret;
-                }
-                waitpid(ret, NULL);
-                goto again;
+            else if (strcmp(argv[0], "cd") == 0) {
+                ret = (argc != 2) ? -1 : chdir(argv[1]);
             }
-            break;
+            else if ((ret = spawncmd(argc, argv, actions, nactions)) >= 0) {
+                pids[npids ++] = ret, ret = 0;
+            }
+            if (infd >= 0) {
+                close(infd), infd = -1;
+            }
+            ret = waitcmds(pids, npids, ret);
+            npids = 0;
+            if (token == 0) {
+                return ret;
+            }
+            goto again;
         default:
             printf("sh error: bad return %d from gettoken\n", token);
-            return -1;
+            ret = -1;
+            goto failed;
         }
     }
 
-runit:
-    if (argc == 0) {
-        return 0;
-    }
-    else if (strcmp(argv[0], "cd") == 0) {
-        if (argc != 2) {
-            return -1;
-        }
-        strcpy(shcwd, argv[1]);
-        return 0;
+failed:
+    if (infd >= 0) {
+        close(infd);
     }
-    if ((ret = testfile(argv[0])) != 0) {
-        if (ret != -E_NOENT) {
-            return ret;
-        }
-        snprintf(argv0, sizeof(argv0), "/bin/%s", argv[0]);
-        argv[0] = argv0;
-    }
-    argv[argc] = NULL;
-    return __exec(NULL, argv);
+    return waitcmds(pids, npids, ret);
 }
 
 int
@@ -228,25 +251,11 @@ main(int argc, char **argv) {
         usage();
         return -1;
     }
-    shcwd = shmem_malloc(BUFSIZE);
-    assert(shcwd != NULL);
 
     char *buffer;
     while ((buffer = readline((interactive) ? "$ " : NULL)) != NULL) {
-        shcwd[0] = '\0';
-        int pid;
-        if ((pid = fork()) == 0) {
-            ret = runcmd(buffer);
-            exit(ret);
-        }
-        assert(pid >= 0);
-        if (waitpid(pid, &ret) == 0) {
-            if (ret == 0 && shcwd[0] != '\0') {
-                ret = chdir(shcwd);
-            }
-            if (ret != 0) {
-                printf("error: %d - %e\n", ret, ret);
-            }
+        if ((ret = runcmd(buffer)) != 0) {
+            printf("error: %d - %e\n", ret, ret);
         }
     }
     return 0;
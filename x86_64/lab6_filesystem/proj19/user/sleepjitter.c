@@ -0,0 +1,45 @@
+#include <ulib.h>
+#include <stdio.h>
+
+/* sleepjitter - how late sleep(1) and nanosleep wake up, on an otherwise idle system,
+ *             - measured on the monotonic clock and reported with the jitter (the
+ *             - spread between the earliest and the latest wakeup) */
+
+#define ROUNDS                      50
+#define HZ                          100
+
+// report - sleep ROUNDS times with fn(arg), which should take us microseconds
+static void
+report(const char *name, int (*fn)(uint64_t), uint64_t arg, uint64_t us) {
+    uint64_t start, late, sum = 0, min = (uint64_t)-1, max = 0;
+    int i;
+    for (i = 0; i < ROUNDS; i ++) {
+        start = gettime_nsec();
+        assert(fn(arg) == 0);
+        late = (gettime_nsec() - start) / 1000;
+        late = (late > us) ? late - us : 0;
+        sum += late;
+        if (min > late) {
+            min = late;
+        }
+        if (max < late) {
+            max = late;
+        }
+    }
+    cprintf("%s: %llu us late on average, %llu ~ %llu, jitter %llu us.\n",
+            name, sum / ROUNDS, min, max, max - min);
+}
+
+static int
+sleep_ticks(uint64_t ticks) {
+    return sleep((unsigned int)ticks);
+}
+
+int
+main(void) {
+    report("sleep(1)", sleep_ticks, 1, 1000000 / HZ);
+    report("nanosleep(100us)", nanosleep, 100000, 100);
+    report("nanosleep(1ms)", nanosleep, 1000000, 1000);
+    cprintf("sleepjitter pass.\n");
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include <ulib.h>
+#include <stdio.h>
+
+/* smptest - run forktree, matrix and threadwork side by side and wait for them all;
+ *         - with 'make qemu CPUS=4' the three spread over the cpus */
+
+static const char *progs[] = {"bin/forktree", "bin/matrix", "bin/threadwork"};
+
+#define NPROGS                      (sizeof(progs) / sizeof(progs[0]))
+
+int
+main(void) {
+    int i, pids[NPROGS], code;
+    unsigned int start = gettime_msec();
+    for (i = 0; i < NPROGS; i ++) {
+        const char *argv[] = {progs[i], NULL};
+        pids[i] = __spawn(NULL, argv, NULL, 0);
+        assert(pids[i] > 0);
+    }
+    for (i = 0; i < NPROGS; i ++) {
+        assert(waitpid(pids[i], &code) == 0 && code == 0);
+    }
+    cprintf("smptest: %d programs in %d ms.\n", NPROGS, gettime_msec() - start);
+    cprintf("smptest pass.\n");
+    return 0;
+}
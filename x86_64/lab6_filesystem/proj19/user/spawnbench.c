@@ -0,0 +1,93 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <string.h>
+#include <file.h>
+#include <dir.h>
+#include <unistd.h>
+#include <spawn.h>
+
+/* spawnbench - time the process creation of fork+exec, vfork+exec and spawn, each waited */
+
+#define ROUNDS                      64
+#define HEAP_SIZE                   (4 << 20)
+
+static const char *argv[] = {"bin/spawnbench", "child", NULL};
+
+static void
+bench_fork(void) {
+    int i, pid, code;
+    unsigned int start = gettime_msec();
+    for (i = 0; i < ROUNDS; i ++) {
+        if ((pid = fork()) == 0) {
+            __exec(NULL, argv);
+            exit(-1);
+        }
+        assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+    }
+    cprintf("fork+exec+wait: %d rounds, %d ms\n", ROUNDS, gettime_msec() - start);
+}
+
+static void
+bench_vfork(void) {
+    int i, pid, code;
+    unsigned int start = gettime_msec();
+    for (i = 0; i < ROUNDS; i ++) {
+        if ((pid = vfork()) == 0) {
+            __exec(NULL, argv);
+            exit(-1);
+        }
+        assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+    }
+    cprintf("vfork+exec+wait: %d rounds, %d ms\n", ROUNDS, gettime_msec() - start);
+}
+
+static void
+bench_spawn(void) {
+    int i, pid, code;
+    unsigned int start = gettime_msec();
+    for (i = 0; i < ROUNDS; i ++) {
+        // no file actions: the plain command case of sh
+        pid = __spawn(NULL, argv, NULL, 0);
+        assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+    }
+    cprintf("spawn+wait: %d rounds, %d ms\n", ROUNDS, gettime_msec() - start);
+}
+
+static void
+check_spawn_actions(void) {
+    const char *path = "spawnbench.out";
+    struct spawn_action actions[] = {
+        {SPAWN_OPEN, 1, 0, O_RDWR | O_TRUNC | O_CREAT, path},
+    };
+    const char *echo[] = {"bin/echo", "spawn", NULL};
+    int pid, code, fd;
+    char buf[16];
+    pid = __spawn(NULL, echo, actions, sizeof(actions) / sizeof(actions[0]));
+    assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+
+    assert((fd = open(path, O_RDONLY)) >= 0);
+    memset(buf, 0, sizeof(buf));
+    assert(read(fd, buf, sizeof(buf) - 1) > 0 && strncmp(buf, "spawn", 5) == 0);
+    close(fd);
+    assert(unlink(path) == 0);
+}
+
+int
+main(int argc, char **argv) {
+    if (argc > 1) {
+        return 0;
+    }
+
+    uintptr_t addr = 0;
+    assert(mmap(&addr, HEAP_SIZE, MMAP_WRITE) == 0);
+    memset((void *)addr, 0x5a, HEAP_SIZE);
+    cprintf("spawnbench: %d KB of heap in parent.\n", HEAP_SIZE / 1024);
+
+    bench_fork();
+    bench_vfork();
+    bench_spawn();
+    check_spawn_actions();
+
+    cprintf("spawnbench pass.\n");
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <unistd.h>
+
+/* syscallbench - the round trip of getpid and yield, entering the kernel by SYSCALL
+ *              - and by int $T_SYSCALL */
+
+#define ROUNDS                      100000
+
+static int
+trap_getpid(void) {
+    return syscall_int(SYS_getpid);
+}
+
+static int
+trap_yield(void) {
+    return syscall_int(SYS_yield);
+}
+
+// round_trip - the nanoseconds fn takes, on average over ROUNDS calls
+static uint64_t
+round_trip(int (*fn)(void), int expected) {
+    int i;
+    uint64_t start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(fn() == expected);
+    }
+    return (gettime_nsec() - start) / ROUNDS;
+}
+
+int
+main(void) {
+    int pid = getpid();
+    cprintf("getpid: %llu ns by syscall, %llu ns by int $0x80.\n",
+            round_trip(sys_getpid, pid), round_trip(trap_getpid, pid));
+    cprintf("yield: %llu ns by syscall, %llu ns by int $0x80.\n",
+            round_trip(sys_yield, 0), round_trip(trap_yield, 0));
+    cprintf("syscallbench pass.\n");
+    return 0;
+}
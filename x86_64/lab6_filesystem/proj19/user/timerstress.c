@@ -0,0 +1,65 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <thread.h>
+#include <x86.h>
+
+/* timerstress - the time the tick handler takes away from a spinner, with no sleepers
+ *             - and then with NSLEEP threads asleep on timers spread over the levels of
+ *             - the timer wheel; the spinner reads the TSC in a tight loop and takes a
+ *             - gap of more than GAP_CYCLES between two reads for a tick */
+
+#define NSLEEP                      2000
+#define DURATION                    200                 // ticks
+#define GAP_CYCLES                  2000
+
+static thread_t tids[NSLEEP];
+
+static int
+sleeper(void *arg) {
+    unsigned int i = (unsigned int)(long)arg;
+    sleep(DURATION * 2 + (i * 7919) % 30000);
+    return 0;
+}
+
+// measure - spin for DURATION ticks, report the gaps of the ticks in TSC cycles
+static void
+measure(const char *name) {
+    uint64_t now, last, gap, sum = 0, max = 0;
+    int gaps = 0;
+    unsigned int deadline = gettime_msec() + DURATION;
+    last = rdtsc();
+    while (gettime_msec() < deadline) {
+        now = rdtsc();
+        if ((gap = now - last) > GAP_CYCLES) {
+            sum += gap, gaps ++;
+            if (max < gap) {
+                max = gap;
+            }
+        }
+        last = now;
+    }
+    assert(gaps != 0);
+    cprintf("%s: %d ticks, %llu cycles on average, %llu at most.\n", name, gaps, sum / gaps, max);
+}
+
+int
+main(void) {
+    int i, code;
+    measure("no sleepers");
+
+    for (i = 0; i < NSLEEP; i ++) {
+        assert(thread(sleeper, (void *)(long)i, tids + i) == 0);
+    }
+    // let them all get to sleep
+    sleep(10);
+    measure("2000 sleepers");
+
+    for (i = 0; i < NSLEEP; i ++) {
+        assert(thread_kill(tids + i) == 0);
+    }
+    for (i = 0; i < NSLEEP; i ++) {
+        assert(thread_wait(tids + i, &code) == 0);
+    }
+    cprintf("timerstress pass.\n");
+    return 0;
+}
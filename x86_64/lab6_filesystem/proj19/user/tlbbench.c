@@ -0,0 +1,86 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <string.h>
+#include <file.h>
+#include <dir.h>
+#include <unistd.h>
+
+/* tlbbench - time the TLB sensitive workloads: fork, pipe and file copy */
+
+#define FORK_ROUNDS                 256
+#define PIPE_BYTES                  (4 << 20)
+#define FILE_BLOCKS                 256
+
+static char buf[4096];
+
+static void
+bench_fork(void) {
+    int i, pid;
+    unsigned int start = gettime_msec();
+    for (i = 0; i < FORK_ROUNDS; i ++) {
+        if ((pid = fork()) == 0) {
+            exit(0);
+        }
+        assert(pid > 0 && waitpid(pid, NULL) == 0);
+    }
+    cprintf("fork+exit+wait: %d rounds, %d ms\n", FORK_ROUNDS, gettime_msec() - start);
+}
+
+static void
+bench_pipe(void) {
+    int fd[2], pid;
+    assert(pipe(fd) == 0);
+    unsigned int start = gettime_msec();
+    if ((pid = fork()) == 0) {
+        close(fd[0]);
+        size_t left = PIPE_BYTES;
+        while (left > 0) {
+            int ret = write(fd[1], buf, (left < sizeof(buf)) ? left : sizeof(buf));
+            assert(ret > 0);
+            left -= ret;
+        }
+        exit(0);
+    }
+    assert(pid > 0);
+    close(fd[1]);
+    size_t total = 0;
+    int ret;
+    while ((ret = read(fd[0], buf, sizeof(buf))) > 0) {
+        total += ret;
+    }
+    assert(total == PIPE_BYTES && waitpid(pid, NULL) == 0);
+    close(fd[0]);
+    cprintf("pipe: %d KB, %d ms\n", PIPE_BYTES / 1024, gettime_msec() - start);
+}
+
+static void
+bench_file(void) {
+    const char *src = "tlbbench.src", *dst = "tlbbench.dst";
+    int i, fd0, fd1, ret;
+    memset(buf, 'x', sizeof(buf));
+    assert((fd0 = open(src, O_CREAT | O_TRUNC | O_RDWR)) >= 0);
+    for (i = 0; i < FILE_BLOCKS; i ++) {
+        assert(write(fd0, buf, sizeof(buf)) == sizeof(buf));
+    }
+    assert(seek(fd0, 0, LSEEK_SET) == 0);
+
+    unsigned int start = gettime_msec();
+    assert((fd1 = open(dst, O_CREAT | O_TRUNC | O_WRONLY)) >= 0);
+    while ((ret = read(fd0, buf, sizeof(buf))) > 0) {
+        assert(write(fd1, buf, ret) == ret);
+    }
+    assert(ret == 0 && fsync(fd1) == 0);
+    cprintf("file copy: %d KB, %d ms\n", FILE_BLOCKS * sizeof(buf) / 1024, gettime_msec() - start);
+
+    close(fd0), close(fd1);
+    assert(unlink(src) == 0 && unlink(dst) == 0);
+}
+
+int
+main(void) {
+    bench_fork();
+    bench_pipe();
+    bench_file();
+    cprintf("tlbbench pass.\n");
+    return 0;
+}
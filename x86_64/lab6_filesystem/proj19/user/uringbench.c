@@ -0,0 +1,218 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <string.h>
+#include <file.h>
+#include <dir.h>
+#include <unistd.h>
+#include <error.h>
+#include <mboxbuf.h>
+#include <uring.h>
+
+/* uringbench - time small writes, preads, mbox messages and sem posts and waits one
+ *            - system call at a time against batches through a uring, with the sqes
+ *            - run by uring_enter and by the sq poll thread, checking the results */
+
+#define ROUNDS                      4096
+#define BATCH                       32
+#define CHUNK                       64
+
+static const char *path = "uringbench.tmp";
+static char buf[ROUNDS / BATCH][BATCH][CHUNK];
+static char data[BATCH][CHUNK];
+static struct mboxbuf mbufs[BATCH];
+
+static uring_t ur;
+
+// fill - the bytes of chunk i of the file
+static void
+fill(char *chunk, int i) {
+    memset(chunk, 'a' + i % 26, CHUNK);
+}
+
+// ring_run - submit the sqes queued, take the n cqes and check each res against want
+static void
+ring_run(int n, int64_t want) {
+    assert(uring_submit(&ur) == n);
+    assert(uring_wait(&ur, n) == 0);
+    int i;
+    for (i = 0; i < n; i ++) {
+        struct uring_cqe *cqe = uring_peek_cqe(&ur);
+        assert(cqe != NULL && cqe->user_data == i && cqe->res == want);
+        uring_cqe_seen(&ur);
+    }
+    assert(uring_peek_cqe(&ur) == NULL);
+}
+
+static struct uring_sqe *
+ring_sqe(uint32_t opcode, int fd, void *addr, size_t len, uint64_t off, int i) {
+    struct uring_sqe *sqe = uring_get_sqe(&ur);
+    assert(sqe != NULL);
+    sqe->opcode = opcode, sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr, sqe->len = len, sqe->off = off;
+    sqe->user_data = i;
+    return sqe;
+}
+
+static void
+report(const char *what, uint64_t sys_ns, uint64_t ring_ns) {
+    cprintf("  %s: %llu ns by syscall, %llu ns by uring.\n",
+            what, sys_ns / ROUNDS, ring_ns / ROUNDS);
+}
+
+static void
+bench_file(void) {
+    int i, j, fd;
+    uint64_t start, sys_ns, ring_ns;
+    for (i = 0; i < ROUNDS / BATCH; i ++) {
+        for (j = 0; j < BATCH; j ++) {
+            fill(buf[i][j], i * BATCH + j);
+        }
+    }
+
+    assert((fd = open(path, O_CREAT | O_TRUNC | O_RDWR)) >= 0);
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(write(fd, buf[i / BATCH][i % BATCH], CHUNK) == CHUNK);
+    }
+    sys_ns = gettime_nsec() - start;
+
+    // the same file again through the ring, the writes go in the order queued
+    assert(seek(fd, 0, LSEEK_SET) == 0);
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS / BATCH; i ++) {
+        for (j = 0; j < BATCH; j ++) {
+            ring_sqe(UR_OP_WRITE, fd, buf[i][j], CHUNK, 0, j);
+        }
+        ring_run(BATCH, CHUNK);
+    }
+    ring_ns = gettime_nsec() - start;
+    report("write", sys_ns, ring_ns);
+
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(pread(fd, data[0], CHUNK, (off_t)i * CHUNK) == CHUNK);
+        assert(data[0][0] == 'a' + i % 26 && data[0][CHUNK - 1] == 'a' + i % 26);
+    }
+    sys_ns = gettime_nsec() - start;
+
+    // backwards, a pread does not care where the file is
+    start = gettime_nsec();
+    for (i = ROUNDS / BATCH - 1; i >= 0; i --) {
+        for (j = 0; j < BATCH; j ++) {
+            ring_sqe(UR_OP_PREAD, fd, data[j], CHUNK, (off_t)(i * BATCH + j) * CHUNK, j);
+        }
+        ring_run(BATCH, CHUNK);
+        for (j = 0; j < BATCH; j ++) {
+            assert(memcmp(data[j], buf[i][j], CHUNK) == 0);
+        }
+    }
+    ring_ns = gettime_nsec() - start;
+    report("pread", sys_ns, ring_ns);
+
+    // reads past the end complete with 0, the fsync with 0
+    ring_sqe(UR_OP_PREAD, fd, data[0], CHUNK, (off_t)ROUNDS * CHUNK, 0);
+    ring_sqe(UR_OP_FSYNC, fd, NULL, 0, 0, 1);
+    ring_run(2, 0);
+
+    close(fd);
+    assert(unlink(path) == 0);
+}
+
+static void
+bench_ipc(void) {
+    int i, j, id;
+    sem_t sem;
+    uint64_t start, sys_ns, ring_ns;
+    assert((id = mbox_init(BATCH)) >= 0 && (sem = sem_init(0)) > 0);
+
+    for (j = 0; j < BATCH; j ++) {
+        mbufs[j].data = data[j], mbufs[j].size = mbufs[j].len = CHUNK;
+    }
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(mbox_send(id, &mbufs[0]) == 0 && mbox_recv(id, &mbufs[0]) == 0);
+    }
+    sys_ns = gettime_nsec() - start;
+
+    // a batch of sends and then a batch of recvs, so that no recv blocks the ring
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS / BATCH; i ++) {
+        for (j = 0; j < BATCH; j ++) {
+            ring_sqe(UR_OP_MBOX_SEND, id, &mbufs[j], 0, 0, j);
+        }
+        ring_run(BATCH, 0);
+        for (j = 0; j < BATCH; j ++) {
+            ring_sqe(UR_OP_MBOX_RECV, id, &mbufs[j], 0, 0, j);
+        }
+        ring_run(BATCH, 0);
+    }
+    ring_ns = gettime_nsec() - start;
+    report("mbox send+recv", sys_ns, ring_ns);
+    // sent by the sq poll thread, if there is one
+    for (j = 0; j < BATCH; j ++) {
+        assert(mbufs[j].len == CHUNK);
+        assert((ur.flags & UR_SETUP_SQPOLL) ? mbufs[j].from != getpid() : mbufs[j].from == getpid());
+    }
+
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        assert(sem_post(sem) == 0 && sem_wait(sem) == 0);
+    }
+    sys_ns = gettime_nsec() - start;
+
+    start = gettime_nsec();
+    for (i = 0; i < ROUNDS / BATCH; i ++) {
+        for (j = 0; j < BATCH / 2; j ++) {
+            ring_sqe(UR_OP_SEM_POST, sem, NULL, 0, 0, j);
+        }
+        for (; j < BATCH; j ++) {
+            ring_sqe(UR_OP_SEM_WAIT, sem, NULL, 0, 0, j);
+        }
+        ring_run(BATCH, 0);
+    }
+    ring_ns = gettime_nsec() - start;
+    report("sem post/wait", sys_ns, ring_ns);
+
+    // a wait that times out holds the ring up for its ticks, then fails
+    ring_sqe(UR_OP_SEM_WAIT, sem, NULL, 0, 1, 0);
+    ring_run(1, -E_TIMEOUT);
+}
+
+static void
+bench(uint32_t flags) {
+    cprintf("uringbench: %s, %d ops, %d per batch\n",
+            (flags & UR_SETUP_SQPOLL) ? "sqpoll" : "uring_enter", ROUNDS, BATCH);
+    assert(uring_setup(&ur, 3, flags) == -E_INVAL);
+    assert(uring_setup(&ur, BATCH, flags) == 0);
+    assert(uring_setup(&ur, BATCH, flags) == -E_BUSY);
+
+    // a bad op completes with an error, the ops after it still run
+    ring_sqe(~0, 0, NULL, 0, 0, 0);
+    ring_sqe(UR_OP_NOP, 0, NULL, 0, 0, 1);
+    assert(uring_submit(&ur) == 2 && uring_wait(&ur, 2) == 0);
+    assert(uring_peek_cqe(&ur)->res == -E_INVAL);
+    uring_cqe_seen(&ur);
+    assert(uring_peek_cqe(&ur)->res == 0);
+    uring_cqe_seen(&ur);
+
+    bench_file();
+    bench_ipc();
+}
+
+int
+main(void) {
+    int pid, code;
+    // one ring per address space, so each mode gets a fork of its own
+    if ((pid = fork()) == 0) {
+        bench(0);
+        exit(0);
+    }
+    assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+    if ((pid = fork()) == 0) {
+        bench(UR_SETUP_SQPOLL);
+        exit(0);
+    }
+    assert(pid > 0 && waitpid(pid, &code) == 0 && code == 0);
+    cprintf("uringbench pass.\n");
+    return 0;
+}
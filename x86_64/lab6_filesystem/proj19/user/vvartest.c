@@ -0,0 +1,92 @@
+#include <ulib.h>
+#include <stdio.h>
+#include <syscall.h>
+#include <thread.h>
+#include <error.h>
+#include <vvar.h>
+
+/* vvartest - getpid, gettime_msec and clock_gettime read from the vvar page agree with
+ *          - the system calls, in a fork and with a thread sharing the address space;
+ *          - the page is read only, and a read costs nanoseconds against a trap */
+
+#define ROUNDS                      100000
+
+static volatile int thread_done;
+
+static int
+sharer(void *arg) {
+    // two procs on one address space, the page cannot tell whose pid it is
+    assert(vvar_getpid() == 0 && getpid() == sys_getpid());
+    while (!thread_done) {
+        yield();
+    }
+    return 0;
+}
+
+static int
+vvar_ticks_int(void) {
+    return (int)gettime_msec();
+}
+
+static int
+sys_ticks_int(void) {
+    return (int)sys_gettime();
+}
+
+// round_trip - the nanoseconds fn takes, on average over ROUNDS calls
+static uint64_t
+round_trip(int (*fn)(void)) {
+    int i;
+    uint64_t start = gettime_nsec();
+    for (i = 0; i < ROUNDS; i ++) {
+        fn();
+    }
+    return (gettime_nsec() - start) / ROUNDS;
+}
+
+int
+main(void) {
+    int pid, code;
+    struct timespec ts;
+    uint64_t ns, last;
+
+    assert(vvar_getpid() == sys_getpid() && getpid() == sys_getpid());
+    assert(sys_gettime() - gettime_msec() <= 1);
+
+    // CLOCK_MONOTONIC from the page goes along with the kernel clock
+    assert(sys_clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+    ns = ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+    assert(vvar_clock_ns(CLOCK_MONOTONIC, &last) == 0 && last >= ns);
+    assert(sleep(2) == 0);
+    assert(vvar_clock_ns(CLOCK_MONOTONIC, &ns) == 0 && ns - last >= 2 * NSEC_PER_SEC / 100);
+    assert(vvar_clock_ns(CLOCK_THREAD_CPUTIME_ID, &ns) == 0 && ns != 0);
+
+    if ((pid = fork()) == 0) {
+        assert(vvar_getpid() == sys_getpid());
+        exit(getpid());
+    }
+    assert(pid > 0 && waitpid(pid, &code) == 0 && code == pid);
+
+    if ((pid = fork()) == 0) {
+        *(volatile int *)VVAR_ADDR = 0;
+        exit(0);
+    }
+    assert(pid > 0 && waitpid(pid, &code) == 0 && code == -E_KILLED);
+
+    thread_t tid;
+    assert(thread(sharer, NULL, &tid) == 0);
+    assert(getpid() == sys_getpid());
+    thread_done = 1;
+    assert(thread_wait(&tid, &code) == 0 && code == 0);
+    // alone again after the next trip through the kernel
+    yield();
+    assert(vvar_getpid() == sys_getpid());
+
+    cprintf("getpid: %llu ns by vvar, %llu ns by syscall.\n",
+            round_trip(getpid), round_trip(sys_getpid));
+    cprintf("gettime_msec: %llu ns by vvar, %llu ns by syscall.\n",
+            round_trip(vvar_ticks_int), round_trip(sys_ticks_int));
+    cprintf("vvartest pass.\n");
+    return 0;
+}
+